@@ -0,0 +1,148 @@
+#include "FluidBVH.h"
+#include "FluidJobs.h"
+#include <algorithm>
+#include <atomic>
+
+// Upper levels are split into jobs down to this depth (2^depth subtrees)
+static const int ParallelDepth = 4;
+
+struct FluidBVH::Allocator {
+	std::atomic<int> next;
+};
+
+void FluidBVH::build(const std::vector<float>& vertexData, const std::vector<int>& indexData) {
+	vertices = &vertexData;
+	indices = &indexData;
+
+	const int count = static_cast<int>(indexData.size() / 3);
+	triangles.resize(count);
+	std::vector<float> centroids(2 * static_cast<size_t>(count));
+	for (int t = 0; t < count; ++t) {
+		triangles[t] = t;
+		float cy = 0.0f, cz = 0.0f;
+		for (int k = 0; k < 3; ++k) {
+			const int v = indexData[3 * t + k];
+			cy += vertexData[3 * v + 1];
+			cz += vertexData[3 * v + 2];
+		}
+		centroids[2 * t] = cy / 3.0f;
+		centroids[2 * t + 1] = cz / 3.0f;
+	}
+
+	// Median splits leave every leaf with more than LeafSize / 2 triangles, which bounds the node count
+	nodes.resize(std::max(1, 4 * count / LeafSize + 2));
+	Allocator allocator;
+	allocator.next = 1;
+	if (count > 0)
+		buildNode(0, 0, count, centroids, 0, allocator);
+	else
+		nodes[0] = { 1.0f, -1.0f, 1.0f, -1.0f, 0, 0 };
+	nodes.resize(allocator.next.load());
+}
+
+void FluidBVH::buildNode(int nodeIndex, int begin, int end, const std::vector<float>& centroids, int depth, Allocator& allocator) {
+	const std::vector<float>& v = *vertices;
+	const std::vector<int>& idx = *indices;
+
+	Node node = { 1e30f, -1e30f, 1e30f, -1e30f, begin, end - begin };
+	float cMinY = 1e30f, cMaxY = -1e30f, cMinZ = 1e30f, cMaxZ = -1e30f;
+	for (int i = begin; i < end; ++i) {
+		const int t = triangles[i];
+		for (int k = 0; k < 3; ++k) {
+			const int vi = idx[3 * t + k];
+			node.minY = std::min(node.minY, v[3 * vi + 1]);
+			node.maxY = std::max(node.maxY, v[3 * vi + 1]);
+			node.minZ = std::min(node.minZ, v[3 * vi + 2]);
+			node.maxZ = std::max(node.maxZ, v[3 * vi + 2]);
+		}
+		cMinY = std::min(cMinY, centroids[2 * t]);
+		cMaxY = std::max(cMaxY, centroids[2 * t]);
+		cMinZ = std::min(cMinZ, centroids[2 * t + 1]);
+		cMaxZ = std::max(cMaxZ, centroids[2 * t + 1]);
+	}
+
+	if (end - begin <= LeafSize) {
+		nodes[nodeIndex] = node;
+		return;
+	}
+
+	const int axis = (cMaxY - cMinY) >= (cMaxZ - cMinZ) ? 0 : 1;
+	const int mid = begin + (end - begin) / 2;
+	std::nth_element(triangles.begin() + begin, triangles.begin() + mid, triangles.begin() + end,
+		[&](int a, int b) { return centroids[2 * a + axis] < centroids[2 * b + axis]; });
+
+	const int left = allocator.next.fetch_add(2);
+	node.first = left;
+	node.count = 0;
+	nodes[nodeIndex] = node;
+
+	if (depth < ParallelDepth && end - begin > 65536) {
+		FluidJobs& jobs = FluidJobs::shared();
+		FluidJobs::Counter counter;
+		jobs.run(counter, [&]() { buildNode(left, begin, mid, centroids, depth + 1, allocator); });
+		buildNode(left + 1, mid, end, centroids, depth + 1, allocator);
+		jobs.wait(counter);
+	}
+	else {
+		buildNode(left, begin, mid, centroids, depth + 1, allocator);
+		buildNode(left + 1, mid, end, centroids, depth + 1, allocator);
+	}
+}
+
+bool FluidBVH::intersectTriangle(int triangle, float y, float z, float& x) const {
+	const std::vector<float>& v = *vertices;
+	const std::vector<int>& idx = *indices;
+	const float* a = &v[3 * idx[3 * triangle]];
+	const float* b = &v[3 * idx[3 * triangle + 1]];
+	const float* c = &v[3 * idx[3 * triangle + 2]];
+
+	const double area = (static_cast<double>(b[1]) - a[1]) * (static_cast<double>(c[2]) - a[2])
+		- (static_cast<double>(b[2]) - a[2]) * (static_cast<double>(c[1]) - a[1]);
+	if (area == 0.0)
+		return false; // Edge-on to the ray
+
+	// Edge functions of the triangle projected onto the yz plane. Ties on an edge go to one side
+	// only (top-left style) so a ray through a shared edge is counted exactly once.
+	auto edge = [y, z](const float* p, const float* q) {
+		double e = (static_cast<double>(q[1]) - p[1]) * (static_cast<double>(z) - p[2])
+			- (static_cast<double>(q[2]) - p[2]) * (static_cast<double>(y) - p[1]);
+		if (e == 0.0)
+			e = (q[1] > p[1] || (q[1] == p[1] && q[2] < p[2])) ? 1e-300 : -1e-300;
+		return e;
+	};
+	const double w0 = edge(b, c);
+	const double w1 = edge(c, a);
+	const double w2 = edge(a, b);
+	if (!((w0 > 0 && w1 > 0 && w2 > 0) || (w0 < 0 && w1 < 0 && w2 < 0)))
+		return false;
+
+	const double sum = w0 + w1 + w2;
+	x = static_cast<float>((w0 * a[0] + w1 * b[0] + w2 * c[0]) / sum);
+	return true;
+}
+
+void FluidBVH::intersectAxisRay(float y, float z, std::vector<float>& hits) const {
+	hits.clear();
+	if (triangles.empty())
+		return;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (y < node.minY || y > node.maxY || z < node.minZ || z > node.maxZ)
+			continue;
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; ++i) {
+				float x;
+				if (intersectTriangle(triangles[i], y, z, x))
+					hits.push_back(x);
+			}
+		}
+		else {
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+}
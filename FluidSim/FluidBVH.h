@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Bounding volume hierarchy over a triangle mesh, specialised for x-aligned rays.
+ *
+ * Voxelization only ever casts rays along +x, so nodes are bounded in y and z only and a query
+ * is a point-in-rectangle descent. Built by median splits on triangle centroids; the upper levels
+ * are built as jobs on the shared pool so multi-million triangle meshes build in seconds.
+ */
+class FluidBVH {
+public:
+	/**
+	 * @brief Builds the hierarchy. The vertex and index arrays must outlive the BVH.
+	 * @param vertices Packed xyz vertex positions.
+	 * @param indices Three vertex indices per triangle.
+	 */
+	void build(const std::vector<float>& vertices, const std::vector<int>& indices);
+
+	/**
+	 * @brief Finds every triangle crossed by the line through (y, z) parallel to x.
+	 * @param y, z Line position.
+	 * @param hits Cleared, then filled with the x coordinate of each crossing (unsorted).
+	 */
+	void intersectAxisRay(float y, float z, std::vector<float>& hits) const;
+
+	size_t triangleCount() const { return triangles.size(); }
+
+private:
+	struct Node {
+		float minY, maxY, minZ, maxZ;
+		int first; // Internal: index of the left child (right = first + 1). Leaf: first triangle slot.
+		int count; // Triangles in a leaf, 0 for internal nodes
+	};
+
+	static const int LeafSize = 8;
+
+	const std::vector<float>* vertices = nullptr;
+	const std::vector<int>* indices = nullptr;
+	std::vector<Node> nodes;
+	std::vector<int> triangles; // Triangle ids, reordered so each leaf is contiguous
+
+	struct Allocator;
+	void buildNode(int nodeIndex, int begin, int end, const std::vector<float>& centroids, int depth, Allocator& allocator);
+	bool intersectTriangle(int triangle, float y, float z, float& x) const;
+};
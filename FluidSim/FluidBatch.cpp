@@ -0,0 +1,221 @@
+// Headless runner for compute nodes: executes SimulationConfigs rows, many at a time, and records each
+// run in SavedSimulations. Not part of the GUI project; build it from this file, FluidRunner.cpp,
+// FluidSweep.cpp, the solver sources, FluidDatabase.cpp and SQLite, e.g.
+//
+//   g++ -std=c++14 -O2 -pthread FluidBatch.cpp FluidRunner.cpp FluidSweep.cpp FluidSolver.cpp ... FluidDatabase.cpp -lsqlite3
+//
+// Usage: FluidBatch <database> <configIDs>... [options]
+#include "FluidSweep.h"
+#include "FluidVersion.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void printUsage() {
+	printf(
+		"FluidSim batch runner, version %s\n"
+		"Usage: FluidBatch <database> <configIDs>... [options]\n"
+		"  ConfigIDs and seeds are lists of numbers and ranges, e.g. 1-200 or 3,7,9-12\n"
+		"  --seeds <list>          Run every config once per seed (default: the config's own seed)\n"
+		"  --threads <n>           Cores to use (default: all)\n"
+		"  --threads-per-run <n>   Threads given to each run; runs fill the cores side by side (default: 8)\n"
+		"  --memory <MB>           Memory the concurrent runs may use together (default: 80%% of RAM)\n"
+		"  --ensemble <n>          Step up to n lattice Boltzmann runs of one config together (default: 1)\n"
+		"  --rerun                 Also run (ConfigID, seed) pairs that SavedSimulations already has\n"
+		"  --no-reuse              Simulate even when an earlier run had identical inputs (same config hash)\n"
+		"  --checkpoint-every <n>  Write a checkpoint (and its SimulationCheckpoints row) every n steps\n"
+		"  --resume                Continue unfinished runs from their latest checkpoint instead of starting over\n"
+		"  --output <dir>          Directory for result files (default: working directory)\n"
+		"  --store-results         Also store each result file in the database (SimulationFrames)\n"
+		"  --user <name>           SavedSimulations.User\n"
+		"  --notes <text>          SavedSimulations.Notes\n"
+		"  --progress <n>          Print progress every n steps\n"
+		"  --metrics <n>           Log kinetic energy, speed, solver iterations and forces to SimulationMetrics every n steps\n"
+		"  --dataset <dir>         Export (state, next state) training pairs to shards in dir\n"
+		"  --dataset-every <n>     Steps between exported frames (default: 1)\n"
+		"  --dataset-patch <n>     Export random n-cell patches instead of whole frames\n"
+		"  --dataset-patches <n>   Patches per frame (default: 1)\n"
+		"  --dataset-shard <n>     Samples per shard file (default: 1024)\n",
+		FLUIDSIM_VERSION_STRING);
+}
+
+// Parses a whole argument as a non-negative integer
+static bool parseCount(const char* text, long long& value) {
+	char* end = nullptr;
+	value = std::strtoll(text, &end, 10);
+	return end != text && *end == '\0' && value >= 0;
+}
+
+// Parses "3,7,9-12" into its numbers
+static bool parseList(const char* text, long long limit, std::vector<long long>& values) {
+	std::string list(text);
+	size_t at = 0;
+	while (at <= list.size()) {
+		size_t comma = list.find(',', at);
+		if (comma == std::string::npos)
+			comma = list.size();
+		const std::string item = list.substr(at, comma - at);
+		const size_t dash = item.find('-', 1);
+		long long lo, hi;
+		if (!parseCount(item.substr(0, dash).c_str(), lo))
+			return false;
+		hi = lo;
+		if (dash != std::string::npos && !parseCount(item.substr(dash + 1).c_str(), hi))
+			return false;
+		if (hi < lo || hi > limit || hi - lo > 1000000)
+			return false;
+		for (long long v = lo; v <= hi; ++v)
+			values.push_back(v);
+		at = comma + 1;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		printUsage();
+		return 2;
+	}
+
+	FluidSweep::Options options;
+	std::vector<long long> configIDs, seeds;
+	for (int i = 2; i < argc; ++i) {
+		const char* arg = argv[i];
+		long long value = 0;
+		if (std::strncmp(arg, "--", 2) != 0) {
+			const size_t before = configIDs.size();
+			if (!parseList(arg, 0x7fffffff, configIDs) || std::find(configIDs.begin() + before, configIDs.end(), 0LL) != configIDs.end()) {
+				fprintf(stderr, "Not a ConfigID list: %s\n", arg);
+				return 2;
+			}
+			continue;
+		}
+		if (std::strcmp(arg, "--rerun") == 0) {
+			options.skipRecorded = false;
+			continue;
+		}
+		if (std::strcmp(arg, "--no-reuse") == 0) {
+			options.run.reuseResults = false;
+			continue;
+		}
+		if (std::strcmp(arg, "--resume") == 0) {
+			options.run.resume = true;
+			continue;
+		}
+		if (std::strcmp(arg, "--store-results") == 0) {
+			options.run.storeResult = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s needs a value\n", arg);
+			return 2;
+		}
+		const char* next = argv[++i];
+		if (std::strcmp(arg, "--output") == 0) {
+			options.run.outputDirectory = next;
+		}
+		else if (std::strcmp(arg, "--user") == 0) {
+			options.run.user = next;
+		}
+		else if (std::strcmp(arg, "--notes") == 0) {
+			options.run.notes = next;
+		}
+		else if (std::strcmp(arg, "--seeds") == 0 && parseList(next, 0x7fffffff, seeds)) {
+			// Every config runs once per seed
+		}
+		else if (std::strcmp(arg, "--threads") == 0 && parseCount(next, value) && value > 0 && value <= 4096) {
+			options.threads = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--threads-per-run") == 0 && parseCount(next, value) && value > 0 && value <= 4096) {
+			options.threadsPerRun = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--memory") == 0 && parseCount(next, value) && value > 0 && value < (1LL << 40)) {
+			options.memoryBudget = static_cast<uint64_t>(value) << 20;
+		}
+		else if (std::strcmp(arg, "--ensemble") == 0 && parseCount(next, value) && value > 0 && value <= FluidLBM::MaxLanes) {
+			options.ensembleSize = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--dataset") == 0) {
+			options.run.exportDataset = true;
+			options.run.dataset.directory = next;
+		}
+		else if (std::strcmp(arg, "--dataset-every") == 0 && parseCount(next, value) && value > 0 && value <= 0x7fffffff) {
+			options.run.dataset.interval = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--dataset-patch") == 0 && parseCount(next, value) && value <= 4096) {
+			options.run.dataset.patch = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--dataset-patches") == 0 && parseCount(next, value) && value > 0 && value <= 4096) {
+			options.run.dataset.patchesPerFrame = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--dataset-shard") == 0 && parseCount(next, value) && value > 0 && value <= (1 << 24)) {
+			options.run.dataset.samplesPerShard = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--progress") == 0 && parseCount(next, value) && value <= 0x7fffffff) {
+			options.run.progressInterval = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--metrics") == 0 && parseCount(next, value) && value <= 0x7fffffff) {
+			options.run.metricsInterval = static_cast<int>(value);
+		}
+		else if (std::strcmp(arg, "--checkpoint-every") == 0 && parseCount(next, value) && value <= 0x7fffffff) {
+			options.run.checkpointInterval = static_cast<int>(value);
+		}
+		else {
+			fprintf(stderr, "Bad option: %s %s\n", arg, next);
+			printUsage();
+			return 2;
+		}
+	}
+	if (configIDs.empty()) {
+		fprintf(stderr, "No ConfigID given\n");
+		return 2;
+	}
+
+	FluidDatabase database(argv[1]);
+	if (!database.open()) {
+		fprintf(stderr, "Could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	FluidSweep sweep(database);
+	for (long long configID : configIDs) {
+		if (seeds.empty())
+			sweep.add(static_cast<int>(configID));
+		for (long long seed : seeds)
+			sweep.add(static_cast<int>(configID), static_cast<unsigned>(seed));
+	}
+
+	// Every job is attempted; the exit code reports whether any failed
+	std::vector<FluidSweep::Outcome> outcomes;
+	const bool succeeded = sweep.run(options, outcomes, [](const FluidSweep::Outcome& outcome) {
+		const FluidSweep::Job& job = outcome.job;
+		if (outcome.skipped) {
+			printf("config %d, seed %u: already recorded, skipped\n", job.configID, job.seed);
+		}
+		else if (!outcome.succeeded) {
+			fprintf(stderr, "config %d: %s\n", job.configID, outcome.error.c_str());
+		}
+		else if (outcome.result.reused) {
+			printf("config %d, seed %u: identical inputs already ran -> SimulationID %d, %s\n", job.configID, outcome.result.seed,
+				outcome.result.simulationID, outcome.result.resultFilePath.c_str());
+		}
+		else {
+			const FluidRunner::Result& result = outcome.result;
+			printf("config %d, seed %u: %llu steps, %.4f s simulated in %.2f s, %llu particles -> SimulationID %d, %s\n",
+				job.configID, result.seed, static_cast<unsigned long long>(result.steps), result.simulatedTime, result.duration,
+				static_cast<unsigned long long>(result.particleCount), result.simulationID, result.resultFilePath.c_str());
+			if (result.resumedStep > 0)
+				printf("config %d, seed %u: resumed from step %llu\n", job.configID, result.seed, static_cast<unsigned long long>(result.resumedStep));
+			if (result.datasetSamples > 0)
+				printf("config %d, seed %u: %llu training samples exported\n", job.configID, result.seed, static_cast<unsigned long long>(result.datasetSamples));
+		}
+		fflush(stdout);
+	});
+	const FluidDatabase::ResultCacheStats reuse = database.getResultCacheStats();
+	if (reuse.hits + reuse.misses > 0)
+		printf("result cache: %llu hits, %llu misses, %llu stale rows passed over\n", reuse.hits, reuse.misses, reuse.stale);
+	return succeeded ? 0 : 1;
+}
@@ -0,0 +1,356 @@
+#include "FluidBoundary.h"
+#include "FluidJson.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+// Axis a side is normal to, and the two tangential axes in x, y, z order
+static int sideAxis(FluidBoundary::Side side) { return static_cast<int>(side) / 2; }
+static bool sideIsUpper(FluidBoundary::Side side) { return static_cast<int>(side) % 2 == 1; }
+static void tangentAxes(int axis, int& u, int& v) {
+	u = axis == 0 ? 1 : 0;
+	v = axis == 2 ? 1 : 2;
+}
+
+FluidBoundary::FluidBoundary()
+	: preparedSize{ 0, 0, 0 }, cellSize(0.0f), outletCount(0), drainsParticles(false) {
+}
+
+bool FluidBoundary::parseSide(const std::string& text, Side& side) {
+	static const char* names[] = { "x-", "x+", "y-", "y+", "z-", "z+" };
+	for (int i = 0; i < 6; ++i) {
+		if (text == names[i]) {
+			side = static_cast<Side>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FluidBoundary::load(const std::string& inflowJSON, const std::string& outflowJSON, std::string* error) {
+	FluidJson inflowDoc, outflowDoc;
+	if (!FluidJson::parse(inflowJSON, inflowDoc, error) || !FluidJson::parse(outflowJSON, outflowDoc, error))
+		return false;
+	return load(inflowDoc, outflowDoc, error);
+}
+
+bool FluidBoundary::load(const FluidJson& inflowDoc, const FluidJson& outflowDoc, std::string* error) {
+	inflows.clear();
+	outflows.clear();
+	preparedSize[0] = 0;
+
+	auto forEachObject = [](const FluidJson& doc, auto fn) {
+		if (doc.isObject())
+			return fn(doc);
+		for (size_t i = 0; i < doc.size() && doc.isArray(); ++i) {
+			if (!fn(doc[i]))
+				return false;
+		}
+		return doc.isNull() || doc.isArray();
+	};
+
+	bool ok = forEachObject(inflowDoc, [&](const FluidJson& item) {
+		Inflow inflow = {};
+		if (!item.isObject() || !parseSide(item.getString("side", ""), inflow.side)) {
+			if (error) *error = "Inflow needs a \"side\" of x-, x+, y-, y+, z- or z+";
+			return false;
+		}
+		const std::string profile = item.getString("profile", "uniform");
+		if (profile != "uniform" && profile != "parabolic") {
+			if (error) *error = "Unknown inflow profile: " + profile;
+			return false;
+		}
+		inflow.profile = profile == "parabolic" ? Profile::Parabolic : Profile::Uniform;
+		const FluidJson& velocity = item.get("velocity");
+		for (int d = 0; d < 3; ++d)
+			inflow.velocity[d] = static_cast<float>(velocity[d].asNumber(0.0));
+		inflow.emissionRate = static_cast<float>(std::max(0.0, item.getNumber("emissionRate", 0.0)));
+		inflow.material_id = static_cast<int>(item.getNumber("materialID", -1.0));
+		inflow.phase_id = static_cast<int>(item.getNumber("phaseID", 0.0));
+		const FluidJson& region = item.get("region");
+		inflow.hasRegion = region.isArray() && region.size() == 4;
+		for (int i = 0; i < 4 && inflow.hasRegion; ++i)
+			inflow.region[i] = static_cast<float>(region[i].asNumber(0.0));
+		inflows.push_back(inflow);
+		return true;
+	});
+	if (!ok) {
+		if (error && error->empty()) *error = "InflowParamsJSON must be an object or an array of objects";
+		return false;
+	}
+
+	ok = forEachObject(outflowDoc, [&](const FluidJson& item) {
+		Outflow outflow = {};
+		if (!item.isObject() || !parseSide(item.getString("side", ""), outflow.side)) {
+			if (error) *error = "Outflow needs a \"side\" of x-, x+, y-, y+, z- or z+";
+			return false;
+		}
+		const std::string type = item.getString("type", "open");
+		if (type != "open" && type != "sink") {
+			if (error) *error = "Unknown outflow type: " + type;
+			return false;
+		}
+		outflow.type = type == "sink" ? OutflowType::Sink : OutflowType::Open;
+		outflows.push_back(outflow);
+		return true;
+	});
+	if (!ok) {
+		if (error && error->empty()) *error = "OutflowParamsJSON must be an object or an array of objects";
+		return false;
+	}
+	return true;
+}
+
+void FluidBoundary::addInflow(const Inflow& inflow) {
+	inflows.push_back(inflow);
+	preparedSize[0] = 0;
+}
+
+void FluidBoundary::addOutflow(const Outflow& outflow) {
+	outflows.push_back(outflow);
+	preparedSize[0] = 0;
+}
+
+bool FluidBoundary::isPreparedFor(const FluidGrid& grid) const {
+	return preparedSize[0] == grid.getWidth() && preparedSize[1] == grid.getHeight()
+		&& preparedSize[2] == grid.getDepth() && cellSize == grid.getCellSize();
+}
+
+void FluidBoundary::inflowExtent(const Inflow& inflow, float lo[2], float hi[2]) const {
+	int u, v;
+	tangentAxes(sideAxis(inflow.side), u, v);
+	lo[0] = inflow.hasRegion ? inflow.region[0] : 0.0f;
+	hi[0] = inflow.hasRegion ? inflow.region[1] : preparedSize[u] * cellSize;
+	lo[1] = inflow.hasRegion ? inflow.region[2] : 0.0f;
+	hi[1] = inflow.hasRegion ? inflow.region[3] : preparedSize[v] * cellSize;
+}
+
+float FluidBoundary::profileScale(const Inflow& inflow, float u, float v) const {
+	float lo[2], hi[2];
+	inflowExtent(inflow, lo, hi);
+	if (u < lo[0] || u > hi[0] || (preparedSize[2] > 1 && (v < lo[1] || v > hi[1])))
+		return -1.0f; // Outside the inflow region
+	if (inflow.profile == Profile::Uniform)
+		return 1.0f;
+
+	// Parabolic: 1 at the centre of the region, 0 at its edges (product of both tangential axes in 3D)
+	auto bump = [](float x, float a, float b) {
+		float t = (b > a) ? (2.0f * (x - a) / (b - a) - 1.0f) : 0.0f;
+		return std::max(0.0f, 1.0f - t * t);
+	};
+	float scale = bump(u, lo[0], hi[0]);
+	if (preparedSize[2] > 1)
+		scale *= bump(v, lo[1], hi[1]);
+	return scale;
+}
+
+void FluidBoundary::prepare(const FluidGrid& grid, unsigned seed) {
+	const int size[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int dims = grid.getDimensions();
+	const float dx = grid.getCellSize();
+	for (int d = 0; d < 3; ++d)
+		preparedSize[d] = size[d];
+	cellSize = dx;
+	rng.seed(seed);
+	emissionCarry.assign(inflows.size(), 0.0f);
+	faceVelocities.clear();
+	cellKinds.assign(grid.getCellCount(), Interior);
+	outletCount = 0;
+	drainsParticles = false;
+
+	// Visits every cell of the boundary layer on a side
+	auto forEachLayerCell = [&](Side side, auto fn) {
+		const int axis = sideAxis(side);
+		const int layer = sideIsUpper(side) ? size[axis] - 1 : 0;
+		for (int z = 0; z < size[2]; ++z) {
+			for (int y = 0; y < size[1]; ++y) {
+				for (int x = 0; x < size[0]; ++x) {
+					const int coord[3] = { x, y, z };
+					if (coord[axis] == layer)
+						fn(grid.index(x, y, z), coord);
+				}
+			}
+		}
+	};
+
+	for (const Outflow& outflow : outflows) {
+		if (sideAxis(outflow.side) >= dims)
+			continue;
+		forEachLayerCell(outflow.side, [&](int cell, const int*) {
+			if (!grid.isSolid(cell)) {
+				cellKinds[cell] = outflow.type == OutflowType::Open ? Outlet : Sink;
+				outletCount += outflow.type == OutflowType::Open ? 1 : 0;
+				drainsParticles = true;
+			}
+		});
+	}
+
+	for (const Inflow& inflow : inflows) {
+		const int axis = sideAxis(inflow.side);
+		if (axis >= dims)
+			continue;
+		int u, v;
+		tangentAxes(axis, u, v);
+		const bool upper = sideIsUpper(inflow.side);
+		forEachLayerCell(inflow.side, [&](int cell, const int* coord) {
+			if (grid.isSolid(cell))
+				return;
+			float scale = profileScale(inflow, (coord[u] + 0.5f) * dx, (coord[v] + 0.5f) * dx);
+			if (scale < 0.0f)
+				return;
+			if (upper)
+				cellKinds[cell] = Inlet;
+			// The driven face is the cell's lower face along the axis: the wall face on a "-" side,
+			// the face between the inlet layer and the interior on a "+" side
+			faceVelocities.push_back({ cell, axis, scale * inflow.velocity[axis] });
+		});
+	}
+}
+
+void FluidBoundary::applyFaceVelocities(FluidGrid& grid, int axis) const {
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	for (const FaceVelocity& face : faceVelocities) {
+		if (axis < 0 || face.axis == axis)
+			cells[face.cell].velocity[face.axis] = face.value;
+	}
+}
+
+std::string FluidBoundary::saveEmissionState() const {
+	std::ostringstream out;
+	out.precision(9); // Round-trips every float
+	out << emissionCarry.size();
+	for (float carry : emissionCarry)
+		out << ' ' << carry;
+	out << ' ' << rng;
+	return out.str();
+}
+
+bool FluidBoundary::restoreEmissionState(const std::string& state) {
+	std::istringstream in(state);
+	size_t count = 0;
+	if (!(in >> count) || count != inflows.size())
+		return false;
+	std::vector<float> carry(count);
+	for (float& value : carry)
+		in >> value;
+	std::mt19937 generator;
+	if (!(in >> generator))
+		return false;
+	emissionCarry.swap(carry);
+	rng = generator;
+	return true;
+}
+
+size_t FluidBoundary::emitParticles(float dt, std::vector<FluidParticle>& particles, float spacing) {
+	const int dims = preparedSize[2] > 1 ? 3 : 2;
+	size_t emitted = 0;
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	FluidParticle& target = particles.back();
+
+	for (size_t k = 0; k < inflows.size(); ++k) {
+		const Inflow& inflow = inflows[k];
+		const int axis = sideAxis(inflow.side);
+		if (inflow.emissionRate <= 0.0f || axis >= dims)
+			continue;
+		int u, v;
+		tangentAxes(axis, u, v);
+		float lo[2], hi[2];
+		inflowExtent(inflow, lo, hi);
+
+		emissionCarry[k] += inflow.emissionRate * dt;
+		int count = static_cast<int>(emissionCarry[k]);
+		emissionCarry[k] -= count;
+
+		// New particles start within half a cell inside the driven face
+		const float faceCoord = sideIsUpper(inflow.side) ? (preparedSize[axis] - 1) * cellSize : 0.0f;
+		const float inward = sideIsUpper(inflow.side) ? -0.5f * cellSize : 0.5f * cellSize;
+		auto emit = [&](const float pos[3]) {
+			float scale = std::max(0.0f, profileScale(inflow, pos[u], pos[v]));
+			FluidParticle::Particle p = { pos[0], pos[1], pos[2],
+				scale * inflow.velocity[0], scale * inflow.velocity[1], scale * inflow.velocity[2],
+				inflow.material_id, inflow.phase_id };
+			target.append(p);
+			++emitted;
+		};
+
+		if (spacing <= 0.0f) {
+			for (int i = 0; i < count; ++i) {
+				float pos[3] = { 0.0f, 0.0f, 0.0f };
+				pos[axis] = faceCoord + unit(rng) * inward;
+				pos[u] = lo[0] + unit(rng) * (hi[0] - lo[0]);
+				pos[v] = dims == 3 || v < 2 ? lo[1] + unit(rng) * (hi[1] - lo[1]) : 0.0f;
+				emit(pos);
+			}
+			continue;
+		}
+
+		// One layer of sites half a spacing inside the face, centred across the inflow
+		const int sites[2] = { std::max(1, static_cast<int>((hi[0] - lo[0]) / spacing)),
+			dims == 3 ? std::max(1, static_cast<int>((hi[1] - lo[1]) / spacing)) : 1 };
+		const float first[2] = { 0.5f * (lo[0] + hi[0] - (sites[0] - 1) * spacing),
+			dims == 3 ? 0.5f * (lo[1] + hi[1] - (sites[1] - 1) * spacing) : 0.0f };
+		const float layer = faceCoord + (inward > 0.0f ? 0.5f : -0.5f) * spacing;
+		const float spacingSquared = spacing * spacing;
+		std::vector<uint8_t> taken(static_cast<size_t>(sites[0]) * sites[1], 0);
+		for (const FluidParticle& block : particles) {
+			for (const FluidParticle::Particle& p : block.getParticles()) {
+				const float pos[3] = { p.x, p.y, p.z };
+				const float normal = pos[axis] - layer;
+				if (std::abs(normal) >= spacing)
+					continue;
+				// Only the sites within one spacing of the particle can be too close to it
+				const int s0 = std::max(0, static_cast<int>(std::ceil((pos[u] - first[0]) / spacing - 1.0f)));
+				const int e0 = std::min(sites[0] - 1, static_cast<int>(std::floor((pos[u] - first[0]) / spacing + 1.0f)));
+				const int s1 = dims == 3 ? std::max(0, static_cast<int>(std::ceil((pos[v] - first[1]) / spacing - 1.0f))) : 0;
+				const int e1 = dims == 3 ? std::min(sites[1] - 1, static_cast<int>(std::floor((pos[v] - first[1]) / spacing + 1.0f))) : 0;
+				for (int b = s1; b <= e1; ++b) {
+					const float dv = dims == 3 ? pos[v] - (first[1] + b * spacing) : 0.0f;
+					for (int a = s0; a <= e0; ++a) {
+						const float du = pos[u] - (first[0] + a * spacing);
+						if (normal * normal + du * du + dv * dv < spacingSquared)
+							taken[static_cast<size_t>(b) * sites[0] + a] = 1;
+					}
+				}
+			}
+		}
+
+		// Free sites are filled in order from a random one, so the layer fills evenly over the steps
+		const int total = sites[0] * sites[1];
+		const int start = std::min(static_cast<int>(unit(rng) * total), total - 1);
+		int placed = 0;
+		for (int n = 0; n < total && placed < count; ++n) {
+			const int site = (start + n) % total;
+			if (taken[site])
+				continue;
+			float pos[3] = { 0.0f, 0.0f, 0.0f };
+			pos[axis] = layer;
+			pos[u] = first[0] + (site % sites[0]) * spacing;
+			if (dims == 3)
+				pos[v] = first[1] + (site / sites[0]) * spacing;
+			emit(pos);
+			++placed;
+		}
+		emissionCarry[k] = std::min(emissionCarry[k] + (count - placed), static_cast<float>(total));
+	}
+	return emitted;
+}
+
+size_t FluidBoundary::removeParticles(const FluidGrid& grid, std::vector<FluidParticle>& particles) const {
+	if (!drainsParticles)
+		return 0;
+
+	const float inv = 1.0f / grid.getCellSize();
+	const int dims = grid.getDimensions();
+	size_t removed = 0;
+	for (FluidParticle& block : particles) {
+		auto drained = [&](const FluidParticle::Particle& p) {
+			int ci = std::min(std::max(static_cast<int>(p.x * inv), 0), grid.getWidth() - 1);
+			int cj = std::min(std::max(static_cast<int>(p.y * inv), 0), grid.getHeight() - 1);
+			int ck = dims == 3 ? std::min(std::max(static_cast<int>(p.z * inv), 0), grid.getDepth() - 1) : 0;
+			uint8_t kind = cellKinds[grid.index(ci, cj, ck)];
+			return kind == Outlet || kind == Sink;
+		};
+		removed += block.removeIf(drained);
+	}
+	return removed;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "FluidGrid.h"
+#include "FluidParticle.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+class FluidJson;
+
+/**
+ * @brief Inflow/outflow boundary engine for open wind-tunnel runs.
+ *
+ * InflowParamsJSON and OutflowParamsJSON are parsed once into typed descriptors. Each column holds
+ * one object or an array of objects:
+ *
+ *   Inflow:  { "side": "x-", "velocity": [2.0, 0, 0], "profile": "uniform" | "parabolic",
+ *              "emissionRate": 5000, "materialID": 1, "phaseID": 0, "region": [u0, u1, v0, v1] }
+ *   Outflow: { "side": "x+", "type": "open" | "sink" }
+ *
+ * prepare() bakes the descriptors into flat face and cell index lists for a grid, so the per-step
+ * stage only does bulk array writes: prescribed face velocities, particle emission, and particle
+ * removal. "open" outflows are pressure outlets (p = 0) that also drain particles; "sink" outflows
+ * drain particles through an otherwise closed wall. Inflows drive the normal velocity of the
+ * boundary faces: on a "-" side the wall face itself, on a "+" side the last cell layer becomes
+ * the inlet and the faces between it and the interior are driven. Emitted particles carry the full
+ * velocity vector.
+ */
+class FluidBoundary {
+public:
+	enum class Side { XMinus, XPlus, YMinus, YPlus, ZMinus, ZPlus };
+	enum class Profile { Uniform, Parabolic };
+	enum class OutflowType { Open, Sink };
+
+	// Per-cell role used by the pressure solve and particle removal
+	enum CellKind : uint8_t { Interior = 0, Outlet = 1, Inlet = 2, Sink = 3 };
+
+	struct Inflow {
+		Side side;
+		Profile profile;
+		float velocity[3];  ///< Peak velocity (world units per second).
+		float emissionRate; ///< Particles emitted per second, 0 for a velocity-only inflow.
+		int material_id;
+		int phase_id;
+		bool hasRegion;
+		float region[4];    ///< Tangential extent [u0, u1, v0, v1] in world units (u, v in x, y, z order).
+	};
+
+	struct Outflow {
+		Side side;
+		OutflowType type;
+	};
+
+	// A prescribed normal velocity on the lower face of a cell along an axis
+	struct FaceVelocity {
+		int cell;
+		int axis;
+		float value;
+	};
+
+	FluidBoundary();
+
+	/**
+	 * @brief Parses the InflowParamsJSON and OutflowParamsJSON columns, replacing any descriptors.
+	 * @param inflowJSON Inflow package (may be empty).
+	 * @param outflowJSON Outflow package (may be empty).
+	 * @param error Optional: receives the reason on failure.
+	 * @return True if both packages were valid.
+	 */
+	bool load(const std::string& inflowJSON, const std::string& outflowJSON, std::string* error = nullptr);
+	// The same from already parsed packages (e.g. FluidDatabase::parseJson)
+	bool load(const FluidJson& inflowDoc, const FluidJson& outflowDoc, std::string* error = nullptr);
+
+	void addInflow(const Inflow& inflow);
+	void addOutflow(const Outflow& outflow);
+	const std::vector<Inflow>& getInflows() const { return inflows; }
+	const std::vector<Outflow>& getOutflows() const { return outflows; }
+	bool empty() const { return inflows.empty() && outflows.empty(); }
+
+	/**
+	 * @brief Bakes the descriptors into index lists for the grid. Must be called again if the grid
+	 * is resized or descriptors change (the solver does this automatically).
+	 * @param grid Grid the boundaries apply to.
+	 * @param seed Seed for emission positions.
+	 */
+	void prepare(const FluidGrid& grid, unsigned seed);
+	bool isPreparedFor(const FluidGrid& grid) const;
+
+	// Writes the prescribed inflow velocities into their faces, of one axis or (axis < 0) all of them
+	void applyFaceVelocities(FluidGrid& grid, int axis = -1) const;
+
+	/**
+	 * @brief Emits this step's inflow particles.
+	 * @param dt Timestep.
+	 * @param particles Blocks to keep clear of; the new particles are appended to the last one.
+	 * @param spacing 0 to scatter particles at random within half a cell of the face. Otherwise (SPH,
+	 * whose pressure explodes on overlapping particles) they are placed on a lattice of this spacing,
+	 * skipping sites closer than it to any particle; emission the sites cannot take is carried over
+	 * up to one layer's worth.
+	 * @return Number of particles emitted.
+	 */
+	size_t emitParticles(float dt, std::vector<FluidParticle>& particles, float spacing = 0.0f);
+
+	/**
+	 * @brief Removes particles that have entered an outlet or sink cell.
+	 * Blocks that lose particles become flat size() x 1 x 1 rows (see FluidParticle::removeIf).
+	 * @return Number of particles removed.
+	 */
+	size_t removeParticles(const FluidGrid& grid, std::vector<FluidParticle>& particles) const;
+
+	// Emission progress (fractional particles carried per inflow and the generator state), for checkpoints.
+	// Restore it after prepare(), which resets it.
+	std::string saveEmissionState() const;
+	bool restoreEmissionState(const std::string& state);
+
+	const std::vector<FaceVelocity>& getFaceVelocities() const { return faceVelocities; }
+	const std::vector<uint8_t>& getCellKinds() const { return cellKinds; }
+	bool hasOutlet() const { return outletCount > 0; }
+
+private:
+	std::vector<Inflow> inflows;
+	std::vector<Outflow> outflows;
+
+	// Baked state
+	int preparedSize[3];
+	float cellSize;
+	std::vector<FaceVelocity> faceVelocities;
+	std::vector<uint8_t> cellKinds;
+	std::vector<float> emissionCarry; // Fractional particles carried between steps, per inflow
+	int outletCount;
+	bool drainsParticles;
+	std::mt19937 rng;
+
+	static bool parseSide(const std::string& text, Side& side);
+	float profileScale(const Inflow& inflow, float u, float v) const;
+	void inflowExtent(const Inflow& inflow, float lo[2], float hi[2]) const;
+};
@@ -0,0 +1,360 @@
+// Self-checks for properties the simulator promises but a run does not show: seeded runs that are
+// bitwise identical on any thread count, checkpoints that restore exactly, SPH inflows that stay
+// bounded, and a database writer that accounts for every record posted to it. Not part of the GUI
+// project; build it like FluidBatch, from this file, the solver sources, FluidDatabase.cpp and SQLite, e.g.
+//
+//   g++ -std=c++14 -O2 -pthread FluidCheck.cpp FluidSolver.cpp ... FluidDatabase.cpp -lsqlite3
+//
+// Usage: FluidCheck [checks...]
+// Runs every check, or the named ones, and exits with the number that failed.
+#include "FluidDatabaseWriter.h"
+#include "FluidJobs.h"
+#include "FluidSolver.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Thread counts every determinism check compares
+static const int ThreadCounts[] = { 1, 4 };
+static const float CheckTimestep = 0.005f;
+
+// A small scene on its own grid and particles: a block of water under gravity, with an inflow
+struct Scene {
+	FluidGrid grid;
+	std::vector<FluidParticle> particles;
+	std::unique_ptr<FluidSolver> solver;
+
+	Scene(FluidSolver::Method method, int nx, int ny, int nz, const char* inflowJSON, const char* outflowJSON) {
+		grid.resize(nx, ny, nz, 1.0f / nx);
+		solver = std::make_unique<FluidSolver>(grid, particles);
+		solver->setMethod(method);
+		solver->setMaterial(1, { 1000.0f, 1.0e-3f });
+		solver->setSeed(7);
+		solver->getBoundary().load(inflowJSON, outflowJSON);
+	}
+
+	// Fills [0, 0.4] x [0, 0.5] (x [0, 0.5] in 3D) with a lattice of particles, two per cell along each axis
+	void fill() {
+		const int dims = grid.getDimensions();
+		const int n[3] = { static_cast<int>(0.8f * grid.getWidth()), grid.getHeight(), dims == 3 ? grid.getDepth() : 1 };
+		particles.emplace_back(n[0], n[1], n[2]);
+		FluidParticle& block = particles.back();
+		const float spacing = 0.5f * grid.getCellSize();
+		for (int z = 0; z < n[2]; ++z) {
+			for (int y = 0; y < n[1]; ++y) {
+				for (int x = 0; x < n[0]; ++x) {
+					block.setPosition(x, y, z, (x + 0.5f) * spacing, (y + 0.5f) * spacing, dims == 3 ? (z + 0.5f) * spacing : 0.0f);
+					block.setMaterialID(x, y, z, 1);
+				}
+			}
+		}
+		solver->setParticlesPerCell(static_cast<float>(1 << dims));
+	}
+
+	void step(int count) {
+		for (int s = 0; s < count; ++s)
+			solver->step(CheckTimestep);
+	}
+
+	// FNV-1a over the particles and grid cells, which hold the whole evolving state
+	uint64_t digest() const {
+		uint64_t hash = 1469598103934665603ull;
+		auto add = [&hash](const void* data, size_t bytes) {
+			const unsigned char* at = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < bytes; ++i)
+				hash = (hash ^ at[i]) * 1099511628211ull;
+		};
+		for (const FluidParticle& block : particles)
+			add(block.getParticles().data(), block.size() * sizeof(FluidParticle::Particle));
+		const std::vector<FluidGrid::Cell>& cells = const_cast<FluidGrid&>(grid).getCells();
+		add(cells.data(), cells.size() * sizeof(FluidGrid::Cell));
+		return hash;
+	}
+};
+
+struct SceneSpec {
+	const char* name;
+	FluidSolver::Method method;
+	int size[3];
+	const char* inflow;
+	const char* outflow;
+	bool fill;
+};
+
+static const SceneSpec Scenes[] = {
+	{ "FLIP 2D", FluidSolver::Method::FlipPic, { 48, 32, 1 }, "{\"side\": \"x-\", \"velocity\": [1, 0, 0], \"emissionRate\": 400, \"materialID\": 1}", "{\"side\": \"x+\"}", true },
+	{ "FLIP 3D", FluidSolver::Method::FlipPic, { 16, 16, 16 }, "", "", true },
+	{ "DFSPH 2D", FluidSolver::Method::SphDivergenceFree, { 32, 32, 1 }, "", "", true },
+	{ "WCSPH 2D", FluidSolver::Method::SphWeaklyCompressible, { 32, 32, 1 }, "", "", true },
+	{ "LBM 2D", FluidSolver::Method::LatticeBoltzmann, { 64, 32, 1 }, "{\"side\": \"x-\", \"velocity\": [0.5, 0, 0]}", "{\"side\": \"x+\"}", false },
+};
+
+static std::unique_ptr<Scene> makeScene(const SceneSpec& spec) {
+	std::unique_ptr<Scene> scene = std::make_unique<Scene>(spec.method, spec.size[0], spec.size[1], spec.size[2], spec.inflow, spec.outflow);
+	if (spec.fill)
+		scene->fill();
+	return scene;
+}
+
+// The same seeded scene reaches the same bits on every thread count
+static bool checkThreadDeterminism() {
+	bool ok = true;
+	for (const SceneSpec& spec : Scenes) {
+		uint64_t reference = 0;
+		for (int threads : ThreadCounts) {
+			FluidJobs pool(threads);
+			FluidJobs::Scope scope(pool);
+			std::unique_ptr<Scene> scene = makeScene(spec);
+			scene->step(20);
+			const uint64_t digest = scene->digest();
+			if (threads == ThreadCounts[0]) {
+				reference = digest;
+			}
+			else if (digest != reference) {
+				printf("  %s: %d threads end in a different state than %d\n", spec.name, threads, ThreadCounts[0]);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+// Checkpoint, step on; restore the checkpoint into a fresh solver, step as far: the states must match
+// bit for bit, and the restored run must not depend on the thread count either
+static bool checkRestore() {
+	bool ok = true;
+	for (const SceneSpec& spec : Scenes) {
+		const std::string path = "fluidcheck_restore.ckp";
+		uint64_t reference = 0;
+		for (int threads : ThreadCounts) {
+			FluidJobs pool(threads);
+			FluidJobs::Scope scope(pool);
+			std::unique_ptr<Scene> original = makeScene(spec);
+			original->step(10);
+			original->solver->writeCheckpoint(path);
+			std::string error;
+			if (!original->solver->finishCheckpoint(&error)) {
+				printf("  %s: cannot write the checkpoint: %s\n", spec.name, error.c_str());
+				ok = false;
+				break;
+			}
+			original->step(10);
+
+			Scene restored(spec.method, 1, 1, 1, "", "");
+			if (!restored.solver->restoreCheckpoint(path, &error)) {
+				printf("  %s: cannot restore the checkpoint: %s\n", spec.name, error.c_str());
+				ok = false;
+				break;
+			}
+			restored.step(10);
+			const uint64_t digest = restored.digest();
+			if (digest != original->digest()) {
+				printf("  %s, %d threads: the restored run differs from the original\n", spec.name, threads);
+				ok = false;
+			}
+			if (threads == ThreadCounts[0]) {
+				reference = digest;
+			}
+			else if (digest != reference) {
+				printf("  %s: the restored run on %d threads differs from %d\n", spec.name, threads, ThreadCounts[0]);
+				ok = false;
+			}
+		}
+		std::remove(path.c_str());
+	}
+	return ok;
+}
+
+// Water poured in through an inflow on the SPH methods: overlapping new particles would blow the
+// pressure up, so the fastest particle must stay near what gravity and the inflow can explain
+static bool checkSphInflow() {
+	const float limit = 8.0f; // m/s: the inflow is 1 m/s, and a 1 m fall reaches 4.4 m/s
+	const FluidSolver::Method methods[] = { FluidSolver::Method::SphDivergenceFree, FluidSolver::Method::SphWeaklyCompressible };
+	const char* const names[] = { "DFSPH", "WCSPH" };
+	bool ok = true;
+	for (int m = 0; m < 2; ++m) {
+		Scene scene(methods[m], 32, 32, 1, "{\"side\": \"x-\", \"velocity\": [1, 0, 0], \"emissionRate\": 2000, \"materialID\": 1}",
+			"{\"side\": \"x+\"}");
+		scene.solver->setParticlesPerCell(4.0f);
+		float fastest = 0.0f;
+		size_t count = 0;
+		for (int s = 0; s < 200 && fastest <= limit; ++s) {
+			scene.step(1);
+			count = 0;
+			for (const FluidParticle& block : scene.particles) {
+				for (const FluidParticle::Particle& p : block.getParticles())
+					fastest = std::max(fastest, std::sqrt(p.vx * p.vx + p.vy * p.vy + p.vz * p.vz));
+				count += block.size();
+			}
+		}
+		if (fastest > limit || count == 0) {
+			printf("  %s: %zu particles, fastest at %.1f m/s\n", names[m], count, fastest);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// Producers post metric samples while another thread flushes and the writer is stopped under them:
+// the queue stays within its limit, and every accepted record is written or counted as failed and
+// lands as exactly one row, even when another connection holds the lock past the busy timeout
+static bool checkWriter() {
+	const std::string path = "fluidcheck_writer.db";
+	const char* const suffixes[] = { "", "-wal", "-shm" };
+	for (const char* suffix : suffixes)
+		std::remove((path + suffix).c_str());
+	FluidDatabase database(path);
+	if (!database.open()) {
+		printf("  cannot create %s: %s\n", path.c_str(), database.lastError());
+		return false;
+	}
+	// open() creates the metrics table; the run it refers to need not exist
+	const int simulationID = 1;
+
+	struct Case {
+		const char* name;
+		size_t maxPending;
+		bool blockWhenFull;
+	};
+	const Case cases[] = { { "unbounded", 1 << 20, false }, { "dropping", 64, false }, { "blocking", 64, true } };
+	const int producers = 4, samples = 5000, flushes = 20;
+	bool ok = true;
+	for (int c = 0; c < 3; ++c) {
+		FluidDatabaseWriter::Options options;
+		options.flushIntervalMilliseconds = 5;
+		options.maxBatch = 32;
+		options.maxPending = cases[c].maxPending;
+		options.blockWhenFull = cases[c].blockWhenFull;
+		FluidDatabaseWriter writer;
+		std::string error;
+		if (!writer.start(path, options, &error)) {
+			printf("  %s: cannot start the writer: %s\n", cases[c].name, error.c_str());
+			return false;
+		}
+
+		// Each case logs its own step range, so its rows can be counted
+		const long long firstStep = static_cast<long long>(c) * producers * samples;
+		std::atomic<uint64_t> accepted(0);
+		std::vector<std::thread> threads;
+		for (int p = 0; p < producers; ++p) {
+			threads.emplace_back([&, p]() {
+				for (int i = 0; i < samples; ++i) {
+					FluidDatabase::MetricSample sample;
+					sample.simulationID = simulationID;
+					sample.step = firstStep + static_cast<long long>(p) * samples + i;
+					if (writer.post(sample))
+						++accepted;
+				}
+			});
+		}
+		// The queue never holds more than maxPending records
+		std::atomic<bool> posting(true);
+		uint64_t mostPending = 0;
+		std::thread monitor([&]() {
+			while (posting)
+				mostPending = std::max<uint64_t>(mostPending, writer.getStats().pending);
+		});
+		for (int f = 0; f < flushes; ++f)
+			writer.flush();
+		writer.stop(); // Races the producers still posting
+		for (std::thread& thread : threads)
+			thread.join();
+		posting = false;
+		monitor.join();
+		if (mostPending > options.maxPending) {
+			printf("  %s: %llu records pending, over the limit of %zu\n", cases[c].name,
+				static_cast<unsigned long long>(mostPending), options.maxPending);
+			ok = false;
+		}
+
+		const FluidDatabaseWriter::Stats stats = writer.getStats();
+		FluidDatabase::MetricSeries series;
+		database.loadMetrics(simulationID, firstStep, firstStep + producers * samples - 1, series);
+		if (stats.posted != accepted || stats.written + stats.failed != stats.posted || stats.pending != 0
+			|| series.size() != stats.written) {
+			printf("  %s: %llu accepted, %llu posted, %llu written, %llu failed, %llu pending, %zu rows\n", cases[c].name,
+				static_cast<unsigned long long>(accepted.load()), static_cast<unsigned long long>(stats.posted),
+				static_cast<unsigned long long>(stats.written), static_cast<unsigned long long>(stats.failed),
+				static_cast<unsigned long long>(stats.pending), series.size());
+			ok = false;
+		}
+	}
+
+	// Another connection holding the write lock past the busy timeout: the batch waits it out and lands
+	{
+		FluidDatabaseWriter writer;
+		std::string error;
+		writer.start(path, FluidDatabaseWriter::Options(), &error);
+		FluidDatabase::Transaction holder(database);
+		FluidDatabase::MetricSample sample;
+		sample.simulationID = simulationID;
+		sample.step = -1;
+		database.saveMetric(sample); // Takes the write lock
+		const int busy = 50;
+		for (int i = 0; i < busy; ++i) {
+			sample.step = -2 - i;
+			writer.post(sample);
+		}
+		std::thread release([&holder]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(6000));
+			holder.commit();
+		});
+		const bool flushed = writer.flush();
+		release.join();
+		writer.stop();
+		const FluidDatabaseWriter::Stats stats = writer.getStats();
+		FluidDatabase::MetricSeries series;
+		database.loadMetrics(simulationID, -1 - busy, -2, series);
+		if (!flushed || stats.written != static_cast<uint64_t>(busy) || series.size() != static_cast<size_t>(busy)) {
+			printf("  busy: %llu of %d written after the lock was released, %zu rows\n",
+				static_cast<unsigned long long>(stats.written), busy, series.size());
+			ok = false;
+		}
+	}
+
+	database.close();
+	for (const char* suffix : suffixes)
+		std::remove((path + suffix).c_str());
+	return ok;
+}
+
+struct Check {
+	const char* name;
+	bool (*run)();
+};
+
+static const Check Checks[] = {
+	{ "determinism", checkThreadDeterminism },
+	{ "restore", checkRestore },
+	{ "sph-inflow", checkSphInflow },
+	{ "writer", checkWriter },
+};
+
+int main(int argc, char** argv) {
+	int failed = 0, ran = 0;
+	for (const Check& check : Checks) {
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; ++i)
+			selected = selected || std::strcmp(argv[i], check.name) == 0;
+		if (!selected)
+			continue;
+		++ran;
+		printf("%s\n", check.name);
+		const bool ok = check.run();
+		printf("%s: %s\n", check.name, ok ? "ok" : "FAILED");
+		failed += ok ? 0 : 1;
+	}
+	if (ran == 0) {
+		fprintf(stderr, "Usage: FluidCheck [checks...]\n");
+		return 2;
+	}
+	return failed;
+}
@@ -0,0 +1,433 @@
+#include "FluidCheckpoint.h"
+#include "FluidParallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FLUID_CRC_SSE42
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+const uint32_t FluidCheckpoint::FormatVersion;
+const uint32_t FluidCheckpoint::ChunkSize;
+
+static const char Magic[8] = { 'F', 'L', 'U', 'I', 'D', 'C', 'K', 'P' };
+static const size_t HeaderBytes = 40;
+static const size_t SectionBytes = 24;
+static const uint64_t PayloadAlignment = 64;
+static const size_t CopyBlock = 1 << 20; // Large sections are copied out of the mapping in parallel blocks
+
+// CRC-32C (Castagnoli), slicing-by-8
+struct CrcTables {
+	uint32_t table[8][256];
+	CrcTables() {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78u : 0u);
+			table[0][i] = crc;
+		}
+		for (int k = 1; k < 8; ++k) {
+			for (int i = 0; i < 256; ++i)
+				table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+		}
+	}
+};
+
+static uint32_t crc32cTables(const uint8_t* data, size_t bytes, uint32_t crc) {
+	static const CrcTables tables;
+	const uint32_t (*t)[256] = tables.table;
+	crc = ~crc;
+	for (; bytes >= 8; bytes -= 8, data += 8) {
+		uint32_t lo, hi;
+		std::memcpy(&lo, data, 4);
+		std::memcpy(&hi, data + 4, 4);
+		lo ^= crc;
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+			^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for (; bytes > 0; --bytes, ++data)
+		crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+#ifdef FLUID_CRC_SSE42
+// The SSE4.2 crc32 instruction computes CRC-32C directly, several times faster than the tables
+static bool hasCrcInstruction() {
+	unsigned regs[4] = {};
+#ifdef _MSC_VER
+	__cpuid(reinterpret_cast<int*>(regs), 1);
+#else
+	__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+	return (regs[2] & (1u << 20)) != 0;
+}
+
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t crc32cInstruction(const uint8_t* data, size_t bytes, uint32_t crc) {
+	uint64_t wide = ~crc;
+	for (; bytes >= 8; bytes -= 8, data += 8) {
+		uint64_t word;
+		std::memcpy(&word, data, 8);
+		wide = _mm_crc32_u64(wide, word);
+	}
+	uint32_t narrow = static_cast<uint32_t>(wide);
+	for (; bytes > 0; --bytes, ++data)
+		narrow = _mm_crc32_u8(narrow, *data);
+	return ~narrow;
+}
+#endif
+
+static uint32_t crc32c(const uint8_t* data, size_t bytes, uint32_t crc = 0) {
+#ifdef FLUID_CRC_SSE42
+	static const bool instruction = hasCrcInstruction();
+	if (instruction)
+		return crc32cInstruction(data, bytes, crc);
+#endif
+	return crc32cTables(data, bytes, crc);
+}
+
+static void put32(uint8_t* at, uint32_t value) { std::memcpy(at, &value, 4); }
+static void put64(uint8_t* at, uint64_t value) { std::memcpy(at, &value, 8); }
+static uint32_t get32(const uint8_t* at) { uint32_t value; std::memcpy(&value, at, 4); return value; }
+static uint64_t get64(const uint8_t* at) { uint64_t value; std::memcpy(&value, at, 8); return value; }
+
+static uint64_t chunksOf(uint64_t bytes) {
+	return (bytes + FluidCheckpoint::ChunkSize - 1) / FluidCheckpoint::ChunkSize;
+}
+
+static uint64_t alignUp(uint64_t offset) {
+	return (offset + PayloadAlignment - 1) / PayloadAlignment * PayloadAlignment;
+}
+
+static std::string tagName(uint32_t tag) {
+	std::string name;
+	for (int i = 0; i < 4; ++i)
+		name += static_cast<char>((tag >> (8 * i)) & 0xff);
+	return name;
+}
+
+// Forces the file's data to disk, so a crash after the rename cannot leave a renamed but empty file
+static bool syncFile(FILE* file) {
+	if (std::fflush(file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+#ifndef _WIN32
+// Makes a rename in the directory holding path durable (MOVEFILE_WRITE_THROUGH does this on Windows)
+static bool syncDirectory(const std::string& path) {
+	const size_t slash = path.find_last_of('/');
+	const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+	const int descriptor = ::open(directory.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+	const bool ok = fsync(descriptor) == 0;
+	::close(descriptor);
+	return ok;
+}
+#endif
+
+static bool fail(std::string* error, const std::string& reason) {
+	if (error)
+		*error = reason;
+	return false;
+}
+
+FluidCheckpoint::FluidCheckpoint()
+	: fileSize(0), tableChecksum(0), view(nullptr), viewSize(0), fileHandle(nullptr), mappingHandle(nullptr) {
+}
+
+FluidCheckpoint::~FluidCheckpoint() {
+	close();
+}
+
+void FluidCheckpoint::addSection(uint32_t tag, const void* data, size_t bytes) {
+	if (bytes > 0)
+		std::memcpy(beginSection(tag, bytes), data, bytes);
+	else
+		beginSection(tag, 0);
+}
+
+uint8_t* FluidCheckpoint::beginSection(uint32_t tag, size_t bytes) {
+	Section* target = nullptr;
+	for (Section& section : sections) {
+		if (section.tag == tag)
+			target = &section;
+	}
+	if (!target) {
+		sections.push_back({ tag, std::vector<uint8_t>(), nullptr, 0 });
+		target = &sections.back();
+	}
+	target->data.resize(bytes);
+	target->size = bytes;
+	return target->data.data();
+}
+
+bool FluidCheckpoint::save(const std::string& path, std::string* error) {
+	// Lay out the tables, then each section's payload on its own aligned offset
+	uint64_t chunkCount = 0;
+	for (const Section& section : sections)
+		chunkCount += chunksOf(section.size);
+	const uint64_t tableBytes = SectionBytes * sections.size() + 4 * chunkCount;
+	std::vector<uint8_t> head(HeaderBytes + tableBytes, 0);
+	uint8_t* sectionTable = head.data() + HeaderBytes;
+	uint8_t* chunkTable = sectionTable + SectionBytes * sections.size();
+
+	uint64_t offset = alignUp(head.size());
+	uint32_t chunk = 0;
+	std::vector<uint64_t> offsets;
+	for (size_t s = 0; s < sections.size(); ++s) {
+		const Section& section = sections[s];
+		uint8_t* entry = sectionTable + SectionBytes * s;
+		put32(entry, section.tag);
+		put32(entry + 4, chunk);
+		put64(entry + 8, offset);
+		put64(entry + 16, section.size);
+		for (uint64_t at = 0; at < section.size; at += ChunkSize, ++chunk) {
+			const size_t length = static_cast<size_t>(std::min<uint64_t>(ChunkSize, section.size - at));
+			put32(chunkTable + 4 * chunk, crc32c(section.data.data() + at, length));
+		}
+		offsets.push_back(offset);
+		offset = alignUp(offset + section.size);
+	}
+	fileSize = offset;
+	tableChecksum = crc32c(sectionTable, static_cast<size_t>(tableBytes));
+
+	std::memcpy(head.data(), Magic, sizeof(Magic));
+	put32(head.data() + 8, FormatVersion);
+	put32(head.data() + 12, static_cast<uint32_t>(sections.size()));
+	put32(head.data() + 16, static_cast<uint32_t>(chunkCount));
+	put32(head.data() + 20, ChunkSize);
+	put64(head.data() + 24, fileSize);
+	put32(head.data() + 32, tableChecksum);
+
+	const std::string temporary = path + ".tmp";
+	FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (!file)
+		return fail(error, "Cannot create " + temporary);
+	static const uint8_t padding[PayloadAlignment] = {};
+	bool ok = std::fwrite(head.data(), 1, head.size(), file) == head.size();
+	uint64_t written = head.size();
+	for (size_t s = 0; s < sections.size() && ok; ++s) {
+		const size_t pad = static_cast<size_t>(offsets[s] - written);
+		ok = std::fwrite(padding, 1, pad, file) == pad
+			&& std::fwrite(sections[s].data.data(), 1, sections[s].data.size(), file) == sections[s].data.size();
+		written = offsets[s] + sections[s].size;
+	}
+	if (ok) {
+		const size_t pad = static_cast<size_t>(fileSize - written);
+		ok = std::fwrite(padding, 1, pad, file) == pad;
+	}
+	ok = ok && syncFile(file);
+	ok = std::fclose(file) == 0 && ok;
+	if (!ok) {
+		std::remove(temporary.c_str());
+		return fail(error, "Cannot write " + temporary);
+	}
+
+#ifdef _WIN32
+	ok = MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+	if (!ok) {
+		std::remove(temporary.c_str());
+		return fail(error, "Cannot replace " + path);
+	}
+#ifndef _WIN32
+	if (!syncDirectory(path))
+		return fail(error, "Cannot sync the directory of " + path);
+#endif
+	return true;
+}
+
+bool FluidCheckpoint::load(const std::string& path, std::string* error) {
+	close();
+	sections.clear();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return fail(error, "Cannot open " + path);
+	fileHandle = file;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart < static_cast<LONGLONG>(HeaderBytes)) {
+		close();
+		return fail(error, path + " is not a checkpoint");
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		close();
+		return fail(error, "Cannot map " + path);
+	}
+	mappingHandle = mapping;
+	view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	viewSize = static_cast<uint64_t>(size.QuadPart);
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return fail(error, "Cannot open " + path);
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(HeaderBytes)) {
+		::close(fd);
+		return fail(error, path + " is not a checkpoint");
+	}
+	void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapped != MAP_FAILED) {
+		madvise(mapped, static_cast<size_t>(info.st_size), MADV_WILLNEED);
+		view = static_cast<const uint8_t*>(mapped);
+		viewSize = static_cast<uint64_t>(info.st_size);
+	}
+#endif
+	if (!view) {
+		close();
+		return fail(error, "Cannot map " + path);
+	}
+
+	// Header and tables
+	if (std::memcmp(view, Magic, sizeof(Magic)) != 0) {
+		close();
+		return fail(error, path + " is not a checkpoint");
+	}
+	const uint32_t version = get32(view + 8);
+	const uint32_t sectionCount = get32(view + 12);
+	const uint32_t chunkCount = get32(view + 16);
+	const uint32_t chunkSize = get32(view + 20);
+	fileSize = get64(view + 24);
+	tableChecksum = get32(view + 32);
+	if (version == 0 || version > FormatVersion) {
+		close();
+		return fail(error, path + " has unsupported format version " + std::to_string(version));
+	}
+	const uint64_t tableBytes = static_cast<uint64_t>(SectionBytes) * sectionCount + 4ull * chunkCount;
+	if (chunkSize != ChunkSize || fileSize != viewSize || HeaderBytes + tableBytes > viewSize) {
+		close();
+		return fail(error, path + " is truncated or damaged");
+	}
+	const uint8_t* sectionTable = view + HeaderBytes;
+	const uint8_t* chunkTable = sectionTable + SectionBytes * sectionCount;
+	if (crc32c(sectionTable, static_cast<size_t>(tableBytes)) != tableChecksum) {
+		close();
+		return fail(error, path + " has a damaged section table");
+	}
+
+	// Every chunk of every section, flattened so they can be verified in parallel
+	struct Chunk {
+		const uint8_t* data;
+		size_t bytes;
+		uint32_t checksum;
+		uint32_t tag;
+	};
+	std::vector<Chunk> chunks;
+	chunks.reserve(chunkCount);
+	for (uint32_t s = 0; s < sectionCount; ++s) {
+		const uint8_t* entry = sectionTable + SectionBytes * s;
+		const uint32_t tag = get32(entry);
+		const uint32_t firstChunk = get32(entry + 4);
+		const uint64_t offset = get64(entry + 8);
+		const uint64_t size = get64(entry + 16);
+		if (offset > viewSize || size > viewSize - offset || firstChunk + chunksOf(size) > chunkCount) {
+			close();
+			return fail(error, path + " has a section outside the file");
+		}
+		Section section = { tag, std::vector<uint8_t>(), view + offset, size };
+		sections.push_back(std::move(section));
+		for (uint64_t at = 0, c = firstChunk; at < size; at += ChunkSize, ++c) {
+			Chunk chunk = { view + offset + at, static_cast<size_t>(std::min<uint64_t>(ChunkSize, size - at)), get32(chunkTable + 4 * c), tag };
+			chunks.push_back(chunk);
+		}
+	}
+
+	std::atomic<int> damaged(-1);
+	parallelFor(0, static_cast<int>(chunks.size()), [&](int c) {
+		if (crc32c(chunks[c].data, chunks[c].bytes) != chunks[c].checksum)
+			damaged.store(c);
+	});
+	if (damaged.load() >= 0) {
+		const uint32_t tag = chunks[damaged.load()].tag;
+		close();
+		sections.clear();
+		return fail(error, path + " failed its checksum in section " + tagName(tag));
+	}
+	return true;
+}
+
+void FluidCheckpoint::close() {
+	// Sections of a loaded file point into the mapping
+	if (view) {
+		std::vector<Section> kept;
+		for (Section& section : sections) {
+			if (!section.mapped)
+				kept.push_back(std::move(section));
+		}
+		sections.swap(kept);
+	}
+#ifdef _WIN32
+	if (view)
+		UnmapViewOfFile(view);
+	if (mappingHandle)
+		CloseHandle(static_cast<HANDLE>(mappingHandle));
+	if (fileHandle)
+		CloseHandle(static_cast<HANDLE>(fileHandle));
+#else
+	if (view)
+		munmap(const_cast<uint8_t*>(view), static_cast<size_t>(viewSize));
+#endif
+	view = nullptr;
+	viewSize = 0;
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+}
+
+const FluidCheckpoint::Section* FluidCheckpoint::findSection(uint32_t tag) const {
+	for (const Section& section : sections) {
+		if (section.tag == tag)
+			return &section;
+	}
+	return nullptr;
+}
+
+const void* FluidCheckpoint::getSection(uint32_t tag, size_t& bytes) const {
+	const Section* section = findSection(tag);
+	if (!section) {
+		bytes = 0;
+		return nullptr;
+	}
+	bytes = static_cast<size_t>(section->size);
+	return section->mapped ? section->mapped : section->data.data();
+}
+
+void FluidCheckpoint::copyOut(const void* from, void* to, size_t bytes) {
+	const int blocks = static_cast<int>((bytes + CopyBlock - 1) / CopyBlock);
+	parallelFor(0, blocks, [&](int b) {
+		const size_t at = static_cast<size_t>(b) * CopyBlock;
+		std::memcpy(static_cast<uint8_t*>(to) + at, static_cast<const uint8_t*>(from) + at, std::min(CopyBlock, bytes - at));
+	});
+}
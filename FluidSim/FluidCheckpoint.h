@@ -0,0 +1,105 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Versioned binary checkpoint file: a set of tagged sections with per-chunk checksums.
+ *
+ * Layout (little-endian):
+ *
+ *   Header   "FLUIDCKP", format version, section count, chunk count, chunk size, file size, table checksum
+ *   Sections tag, first chunk, offset, size           (one entry per section)
+ *   Chunks   CRC-32C of every chunk of every section  (sections split into chunkSize pieces)
+ *   Payload  section data, each starting on a 64-byte boundary
+ *
+ * The table checksum covers the section and chunk tables, so a torn or truncated write is detected
+ * before any payload is trusted. Files are written to a temporary name, synced to disk and renamed into
+ * place (the directory is synced too), so an interrupted write or a power loss never replaces a good
+ * checkpoint.
+ *
+ * Writing: addSection() copies data into the checkpoint (the snapshot), after which the source may
+ * change freely; save() can then run on another thread. Reading: load() maps the file into memory and
+ * verifies every chunk in parallel; getSection() returns pointers into the mapping, valid until close().
+ */
+class FluidCheckpoint {
+public:
+	static const uint32_t FormatVersion = 1;
+	static const uint32_t ChunkSize = 4u << 20;
+
+	// Packs four characters into a section tag
+	static constexpr uint32_t tag(char a, char b, char c, char d) {
+		return static_cast<uint32_t>(static_cast<uint8_t>(a)) | static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8
+			| static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24;
+	}
+
+	FluidCheckpoint();
+	~FluidCheckpoint();
+	FluidCheckpoint(const FluidCheckpoint&) = delete;
+	FluidCheckpoint& operator=(const FluidCheckpoint&) = delete;
+
+	// Copies a section into the snapshot, replacing any section with the same tag
+	void addSection(uint32_t tag, const void* data, size_t bytes);
+	template <typename T>
+	void addSection(uint32_t tag, const std::vector<T>& data) { addSection(tag, data.data(), data.size() * sizeof(T)); }
+	// Sizes a section and returns its buffer for the caller to fill, saving a copy when the data is scattered
+	uint8_t* beginSection(uint32_t tag, size_t bytes);
+
+	/**
+	 * @brief Writes the snapshot to path (through path + ".tmp", synced and renamed when complete).
+	 * @param path Destination file.
+	 * @param error Optional: receives the reason on failure.
+	 * @return True if the file was written.
+	 */
+	bool save(const std::string& path, std::string* error = nullptr);
+
+	/**
+	 * @brief Maps a checkpoint file and verifies its tables and chunk checksums.
+	 * @param path Checkpoint file.
+	 * @param error Optional: receives the reason on failure.
+	 * @return True if the file is intact and of a known format version.
+	 */
+	bool load(const std::string& path, std::string* error = nullptr);
+	void close();
+
+	bool hasSection(uint32_t tag) const { return findSection(tag) != nullptr; }
+	// Section data and its size in bytes, or null if the checkpoint has no such section
+	const void* getSection(uint32_t tag, size_t& bytes) const;
+	// Copies a section into a vector of T; false if it is missing or not a whole number of Ts
+	template <typename T>
+	bool readSection(uint32_t tag, std::vector<T>& out) const {
+		size_t bytes = 0;
+		const void* data = getSection(tag, bytes);
+		if (!data || bytes % sizeof(T) != 0)
+			return false;
+		out.resize(bytes / sizeof(T));
+		copyOut(data, out.data(), bytes);
+		return true;
+	}
+
+	// Size and table checksum of the last file saved or loaded, for recording it elsewhere
+	uint64_t getFileSize() const { return fileSize; }
+	uint32_t getChecksum() const { return tableChecksum; }
+
+private:
+	struct Section {
+		uint32_t tag;
+		std::vector<uint8_t> data;  // Snapshot copy when writing
+		const uint8_t* mapped;      // Into the file mapping when reading
+		uint64_t size;
+	};
+
+	std::vector<Section> sections;
+	uint64_t fileSize;
+	uint32_t tableChecksum;
+
+	// File mapping of a loaded checkpoint
+	const uint8_t* view;
+	uint64_t viewSize;
+	void* fileHandle;
+	void* mappingHandle;
+
+	const Section* findSection(uint32_t tag) const;
+	static void copyOut(const void* from, void* to, size_t bytes);
+};
@@ -1,156 +1,246 @@
 #include "FluidDatabase.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Prepared statements kept per connection unless setStatementCacheCapacity() says otherwise
+static const size_t DefaultStatementCapacity = 64;
+// Idle read connections kept unless setReaderPoolSize() says otherwise
+static const size_t DefaultReaderPoolSize = 4;
+// Parsed JSON documents kept per connection unless setJsonCacheCapacity() says otherwise
+static const size_t DefaultJsonCapacity = 256;
+// How long a statement waits for a lock held by another connection before failing with SQLITE_BUSY
+static const int BusyTimeoutMilliseconds = 5000;
+// SQLite's own default: commits checkpoint once the log holds this many pages
+static const int AutoCheckpointPages = 1000;
+
+const size_t FluidDatabase::FrameChunkBytes;
 
 FluidDatabase::FluidDatabase(const std::string& dbPath)
-    : path(dbPath), db(nullptr) {}
+    : path(dbPath), db(nullptr), statementCapacity(DefaultStatementCapacity), statementStats(), transactionDepth(0),
+      jsonCapacity(DefaultJsonCapacity), jsonStats(), resultStats(),
+      readers(std::make_shared<ReaderPool>()), checkpointerStopping(false) {
+    readers->capacity = DefaultReaderPoolSize;
+}
 
 FluidDatabase::~FluidDatabase() {
+    stopCheckpointer();
     close();
 }
 
 bool FluidDatabase::open() {
     if (sqlite3_open(path.c_str(), &db) == SQLITE_OK) {
+        sqlite3_busy_timeout(db, BusyTimeoutMilliseconds);
+        // In-memory and read-only databases stay in their journal mode; that is not an error
+        sqlite3_exec(db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", nullptr, nullptr, nullptr);
+        return upgradeSchema();
+    }
+    db = nullptr;
+    return false;
+}
+
+bool FluidDatabase::openReadOnly() {
+    if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK) {
+        sqlite3_busy_timeout(db, BusyTimeoutMilliseconds);
         return true;
     }
+    sqlite3_close(db);
     db = nullptr;
     return false;
 }
 
 void FluidDatabase::close() {
-    if (validateDB()) {
+    // A connection that never opened has nothing to close
+    if (db && validateDB()) {
+        // Unfinalized statements and open BLOB handles would keep the connection open
+        for (sqlite3_blob* blob : frameBlobs)
+            sqlite3_blob_close(blob);
+        frameBlobs.clear();
+        for (CachedStatement& entry : statements)
+            sqlite3_finalize(entry.stmt);
+        statements.clear();
+        statementIndex.clear();
+        transactionDepth = 0;
         sqlite3_close(db);
         db = nullptr;
     }
 }
 
-bool FluidDatabase::saveSimulationParameters(const std::map<std::string, std::string>& parameters) {
-    if (!validateDB()) return false;
-
-    bool hasPK = parameters.count("ConfigID") && !parameters.at("ConfigID").empty();
-    const char* sql = nullptr;
-    sqlite3_stmt* stmt = nullptr;
-    int bindIdx = 1;
+FluidDatabase::Transaction::Transaction(FluidDatabase& database)
+    : database(database), active(false) {
+    if (!database.validateDB()) return;
+    savepoint = "fluid_tx" + std::to_string(database.transactionDepth);
+    active = database.execute("SAVEPOINT " + savepoint + ";");
+    if (active) ++database.transactionDepth;
+}
 
-    if (hasPK) {
-        sql =
-            "INSERT INTO SimulationConfigs "
-            "(ConfigID, Name, GridSize, ParticleCount, InflowParamsJSON, OutflowParamsJSON, "
-            "Timestep, MethodOfComputation, FluidID, Description, IsStandard, OtherParamsJSON) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-    }
-    else {
-        sql =
-            "INSERT INTO SimulationConfigs "
-            "(Name, GridSize, ParticleCount, InflowParamsJSON, OutflowParamsJSON, "
-            "Timestep, MethodOfComputation, FluidID, Description, IsStandard, OtherParamsJSON) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-    }
+FluidDatabase::Transaction::~Transaction() {
+    rollback();
+}
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        printf("SQLite error: %s\n", sqlite3_errmsg(db));
+bool FluidDatabase::Transaction::commit() {
+    if (!active) return false;
+    // Releasing the outermost savepoint commits; it fails if the database is locked by another connection
+    if (!database.execute("RELEASE " + savepoint + ";")) {
+        rollback();
         return false;
     }
-
-    if (hasPK) {
-        sqlite3_bind_int(stmt, bindIdx++, std::stoi(parameters.at("ConfigID")));
-    }
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("Name").c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("GridSize").c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, bindIdx++, std::stoi(parameters.at("ParticleCount")));
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("InflowParamsJSON").c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("OutflowParamsJSON").c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(stmt, bindIdx++, std::stod(parameters.at("Timestep")));
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("MethodOfComputation").c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, bindIdx++, std::stoi(parameters.at("FluidID")));
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("Description").c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, bindIdx++, std::stoi(parameters.at("IsStandard")));
-    sqlite3_bind_text(stmt, bindIdx++, parameters.at("OtherParamsJSON").c_str(), -1, SQLITE_TRANSIENT);
-
-    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
-
-    sqlite3_finalize(stmt);
-    return success;
+    active = false;
+    --database.transactionDepth;
+    return true;
 }
 
-bool FluidDatabase::loadSimulationParameters(const int configID, std::map<std::string, std::string>& parameters) {
-     if (!validateDB()) return false;
-
-     const char* sql =
-          "SELECT ConfigID, Name, GridSize, ParticleCount, InflowParamsJSON, OutflowParamsJSON, "
-          "Timestep, MethodOfComputation, FluidID, Description, IsStandard, OtherParamsJSON "
-          "FROM SimulationConfigs WHERE ConfigID = ?;";
-
-     sqlite3_stmt* stmt = nullptr;
-     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-         printf("SQLite error: %s\n", sqlite3_errmsg(db));
-         return false;
-     }
+void FluidDatabase::Transaction::rollback() {
+    if (!active) return;
+    active = false;
+    // Closing the connection already rolled back
+    if (!database.db) return;
+    database.execute("ROLLBACK TO " + savepoint + ";");
+    database.execute("RELEASE " + savepoint + ";");
+    --database.transactionDepth;
+}
 
-     if (sqlite3_bind_int(stmt, 1, configID) != SQLITE_OK) {
-          sqlite3_finalize(stmt);
-          return false;
-     }
+// Reads a text column into out, reusing its storage; NULL reads as empty
+static void readText(sqlite3_stmt* stmt, int column, std::string& out) {
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    if (text)
+        out.assign(reinterpret_cast<const char*>(text), static_cast<size_t>(sqlite3_column_bytes(stmt, column)));
+    else
+        out.clear();
+}
 
-     bool found = false;
-     if (sqlite3_step(stmt) == SQLITE_ROW) {
-          parameters["ConfigID"] = std::to_string(sqlite3_column_int(stmt, 0));
+// Column order of every SimulationConfigs SELECT and INSERT below
+#define CONFIG_COLUMNS \
+    "ConfigID, Name, GridSize, ParticleCount, InflowParamsJSON, OutflowParamsJSON, " \
+    "Timestep, MethodOfComputation, FluidID, Description, IsStandard, OtherParamsJSON"
+
+static void readSimulationConfig(sqlite3_stmt* stmt, FluidDatabase::SimulationConfig& config) {
+    config.configID = sqlite3_column_int(stmt, 0);
+    readText(stmt, 1, config.name);
+    readText(stmt, 2, config.gridSize);
+    config.particleCount = sqlite3_column_int(stmt, 3);
+    readText(stmt, 4, config.inflowParamsJSON);
+    readText(stmt, 5, config.outflowParamsJSON);
+    config.timestep = sqlite3_column_double(stmt, 6);
+    readText(stmt, 7, config.methodOfComputation);
+    config.fluidID = sqlite3_column_int(stmt, 8);
+    readText(stmt, 9, config.description);
+    config.isStandard = sqlite3_column_int(stmt, 10) != 0;
+    readText(stmt, 11, config.otherParamsJSON);
+}
 
-          const unsigned char* nameText = sqlite3_column_text(stmt, 1);
-          parameters["Name"] = nameText ? reinterpret_cast<const char*>(nameText) : "";
+static std::map<std::string, std::string> toMap(const FluidDatabase::SimulationConfig& config) {
+    std::map<std::string, std::string> row;
+    row["ConfigID"] = std::to_string(config.configID);
+    row["Name"] = config.name;
+    row["GridSize"] = config.gridSize;
+    row["ParticleCount"] = std::to_string(config.particleCount);
+    row["InflowParamsJSON"] = config.inflowParamsJSON;
+    row["OutflowParamsJSON"] = config.outflowParamsJSON;
+    row["Timestep"] = std::to_string(config.timestep);
+    row["MethodOfComputation"] = config.methodOfComputation;
+    row["FluidID"] = std::to_string(config.fluidID);
+    row["Description"] = config.description;
+    row["IsStandard"] = std::to_string(config.isStandard ? 1 : 0);
+    row["OtherParamsJSON"] = config.otherParamsJSON;
+    return row;
+}
 
-          const unsigned char* gridSizeText = sqlite3_column_text(stmt, 2);
-          parameters["GridSize"] = gridSizeText ? reinterpret_cast<const char*>(gridSizeText) : "";
+bool FluidDatabase::saveSimulationParameters(const std::map<std::string, std::string>& parameters) {
+    SimulationConfig config;
+    if (parameters.count("ConfigID") && !parameters.at("ConfigID").empty())
+        config.configID = std::stoi(parameters.at("ConfigID"));
+    config.name = parameters.at("Name");
+    config.gridSize = parameters.at("GridSize");
+    config.particleCount = std::stoi(parameters.at("ParticleCount"));
+    config.inflowParamsJSON = parameters.at("InflowParamsJSON");
+    config.outflowParamsJSON = parameters.at("OutflowParamsJSON");
+    config.timestep = std::stod(parameters.at("Timestep"));
+    config.methodOfComputation = parameters.at("MethodOfComputation");
+    config.fluidID = std::stoi(parameters.at("FluidID"));
+    config.description = parameters.at("Description");
+    config.isStandard = std::stoi(parameters.at("IsStandard")) != 0;
+    config.otherParamsJSON = parameters.at("OtherParamsJSON");
+    return saveSimulationParameters(config);
+}
 
-          parameters["ParticleCount"] = std::to_string(sqlite3_column_int(stmt, 3));
+bool FluidDatabase::saveSimulationParameters(const SimulationConfig& config) {
+    if (!validateDB()) return false;
 
-          const unsigned char* inflowText = sqlite3_column_text(stmt, 4);
-          parameters["InflowParamsJSON"] = inflowText ? reinterpret_cast<const char*>(inflowText) : "";
+    // A NULL ConfigID is assigned by the database
+    const char* sql = "INSERT INTO SimulationConfigs (" CONFIG_COLUMNS ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
 
-          const unsigned char* outflowText = sqlite3_column_text(stmt, 5);
-          parameters["OutflowParamsJSON"] = outflowText ? reinterpret_cast<const char*>(outflowText) : "";
+    int bindIdx = 1;
+    if (config.configID > 0)
+        sqlite3_bind_int(stmt, bindIdx++, config.configID);
+    else
+        sqlite3_bind_null(stmt, bindIdx++);
+    sqlite3_bind_text(stmt, bindIdx++, config.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, config.gridSize.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, bindIdx++, config.particleCount);
+    sqlite3_bind_text(stmt, bindIdx++, config.inflowParamsJSON.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, config.outflowParamsJSON.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, bindIdx++, config.timestep);
+    sqlite3_bind_text(stmt, bindIdx++, config.methodOfComputation.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, bindIdx++, config.fluidID);
+    sqlite3_bind_text(stmt, bindIdx++, config.description.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, bindIdx++, config.isStandard ? 1 : 0);
+    sqlite3_bind_text(stmt, bindIdx++, config.otherParamsJSON.c_str(), -1, SQLITE_STATIC);
 
-          parameters["Timestep"] = std::to_string(sqlite3_column_double(stmt, 6));
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
 
-          const unsigned char* methodText = sqlite3_column_text(stmt, 7);
-          parameters["MethodOfComputation"] = methodText ? reinterpret_cast<const char*>(methodText) : "";
+    releaseStatement(stmt);
+    return success;
+}
 
-          parameters["FluidID"] = std::to_string(sqlite3_column_int(stmt, 8));
+bool FluidDatabase::loadSimulationParameters(const int configID, std::map<std::string, std::string>& parameters) {
+    SimulationConfig config;
+    if (!loadSimulationParameters(configID, config)) return false;
+    for (auto& column : toMap(config))
+        parameters[column.first] = std::move(column.second);
+    return true;
+}
 
-          const unsigned char* descText = sqlite3_column_text(stmt, 9);
-          parameters["Description"] = descText ? reinterpret_cast<const char*>(descText) : "";
+bool FluidDatabase::loadSimulationParameters(const int configID, SimulationConfig& config) {
+    if (!validateDB()) return false;
 
-          parameters["IsStandard"] = std::to_string(sqlite3_column_int(stmt, 10));
+    const char* sql = "SELECT " CONFIG_COLUMNS " FROM SimulationConfigs WHERE ConfigID = ?;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, configID);
 
-          const unsigned char* otherParamsText = sqlite3_column_text(stmt, 11);
-          parameters["OtherParamsJSON"] = otherParamsText ? reinterpret_cast<const char*>(otherParamsText) : "";
-          found = true;
-     }
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        readSimulationConfig(stmt, config);
+        found = true;
+    }
 
-     sqlite3_finalize(stmt);
-     return found;
+    releaseStatement(stmt);
+    return found;
 }
 
 bool FluidDatabase::loadAllSimulationParameters(std::vector<std::map<std::string, std::string>>& records) {
+    std::vector<SimulationConfig> configs;
+    if (!loadAllSimulationParameters(configs)) return false;
+    for (const SimulationConfig& config : configs)
+        records.push_back(toMap(config));
+    return true;
+}
+
+bool FluidDatabase::loadAllSimulationParameters(std::vector<SimulationConfig>& records) {
     if (!validateDB()) return false;
-    const char* sql = "SELECT * FROM SimulationConfigs;";
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+    const char* sql = "SELECT " CONFIG_COLUMNS " FROM SimulationConfigs;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
-        std::map<std::string, std::string> row;
-        row["ConfigID"] = std::to_string(sqlite3_column_int(stmt, 0));
-        row["Name"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        row["GridSize"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        row["ParticleCount"] = std::to_string(sqlite3_column_int(stmt, 3));
-        row["InflowParamsJSON"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        row["OutflowParamsJSON"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        row["Timestep"] = std::to_string(sqlite3_column_double(stmt, 6));
-        row["MethodOfComputation"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
-        row["FluidID"] = std::to_string(sqlite3_column_int(stmt, 8));
-        row["Description"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 9));
-        row["IsStandard"] = std::to_string(sqlite3_column_int(stmt, 10));
-        row["OtherParamsJSON"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 11));
-        records.push_back(row);
+        records.emplace_back();
+        readSimulationConfig(stmt, records.back());
     }
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return true;
 }
 
@@ -185,9 +275,8 @@ bool FluidDatabase::updateSimulationParameters(const int configID, std::map<std:
 
     sql += " WHERE ConfigID = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-        return false;
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
 
     // Bind only the non-empty values
     int bindIdx = 1;
@@ -209,115 +298,118 @@ bool FluidDatabase::updateSimulationParameters(const int configID, std::map<std:
 
     bool success = (sqlite3_step(stmt) == SQLITE_DONE);
 
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return success;
 }
 
+#define LIQUID_COLUMNS "LiquidID, Name, Density, Viscosity, Color, Description, OtherPhysicalPropertiesJSON"
+
+static void readLiquidType(sqlite3_stmt* stmt, FluidDatabase::LiquidType& liquid) {
+    liquid.liquidID = sqlite3_column_int(stmt, 0);
+    readText(stmt, 1, liquid.name);
+    liquid.density = sqlite3_column_double(stmt, 2);
+    liquid.viscosity = sqlite3_column_double(stmt, 3);
+    readText(stmt, 4, liquid.color);
+    readText(stmt, 5, liquid.description);
+    readText(stmt, 6, liquid.otherPhysicalPropertiesJSON);
+}
+
+static std::map<std::string, std::string> toMap(const FluidDatabase::LiquidType& liquid) {
+    std::map<std::string, std::string> row;
+    row["LiquidID"] = std::to_string(liquid.liquidID);
+    row["Name"] = liquid.name;
+    row["Density"] = std::to_string(liquid.density);
+    row["Viscosity"] = std::to_string(liquid.viscosity);
+    row["Color"] = liquid.color;
+    row["Description"] = liquid.description;
+    row["OtherPhysicalPropertiesJSON"] = liquid.otherPhysicalPropertiesJSON;
+    return row;
+}
+
 bool FluidDatabase::saveLiquidType(const std::string& liquidID, const std::string& name, double density, double viscosity,
     const std::string& color, const std::string& description,
     const std::string& otherPhysicalPropertiesJSON) {
-    if (!validateDB()) return false;
-
-    bool hasPK = !liquidID.empty();
-    const char* sql = nullptr;
-    sqlite3_stmt* stmt = nullptr;
-    int bindIdx = 1;
+    LiquidType liquid;
+    if (!liquidID.empty())
+        liquid.liquidID = std::stoi(liquidID);
+    liquid.name = name;
+    liquid.density = density;
+    liquid.viscosity = viscosity;
+    liquid.color = color;
+    liquid.description = description;
+    liquid.otherPhysicalPropertiesJSON = otherPhysicalPropertiesJSON;
+    return saveLiquidType(liquid);
+}
 
-    if (hasPK) {
-        sql =
-            "INSERT INTO TypesOfLiquids "
-            "(LiquidID, Name, Density, Viscosity, Color, Description, OtherPhysicalPropertiesJSON) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?);";
-    }
-    else {
-        sql =
-            "INSERT INTO TypesOfLiquids "
-            "(Name, Density, Viscosity, Color, Description, OtherPhysicalPropertiesJSON) "
-            "VALUES (?, ?, ?, ?, ?, ?);";
-    }
+bool FluidDatabase::saveLiquidType(const LiquidType& liquid) {
+    if (!validateDB()) return false;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        printf("SQLite error: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
+    const char* sql = "INSERT INTO TypesOfLiquids (" LIQUID_COLUMNS ") VALUES (?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
 
-    if (hasPK) {
-        sqlite3_bind_int(stmt, bindIdx++, std::stoi(liquidID));
-    }
-    sqlite3_bind_text(stmt, bindIdx++, name.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(stmt, bindIdx++, density);
-    sqlite3_bind_double(stmt, bindIdx++, viscosity);
-    sqlite3_bind_text(stmt, bindIdx++, color.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, description.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, otherPhysicalPropertiesJSON.c_str(), -1, SQLITE_TRANSIENT);
+    int bindIdx = 1;
+    if (liquid.liquidID > 0)
+        sqlite3_bind_int(stmt, bindIdx++, liquid.liquidID);
+    else
+        sqlite3_bind_null(stmt, bindIdx++);
+    sqlite3_bind_text(stmt, bindIdx++, liquid.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, bindIdx++, liquid.density);
+    sqlite3_bind_double(stmt, bindIdx++, liquid.viscosity);
+    sqlite3_bind_text(stmt, bindIdx++, liquid.color.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, liquid.description.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, liquid.otherPhysicalPropertiesJSON.c_str(), -1, SQLITE_STATIC);
 
     bool success = (sqlite3_step(stmt) == SQLITE_DONE);
 
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return success;
 }
 
 bool FluidDatabase::loadLiquidType(int liquidID, std::map<std::string, std::string>& liquidData) {
-     if (!validateDB()) return false;
-
-     const char* sql =
-          "SELECT LiquidID, Name, Density, Viscosity, Color, Description, OtherPhysicalPropertiesJSON "
-          "FROM TypesOfLiquids WHERE LiquidID = ?;";
-
-     sqlite3_stmt* stmt = nullptr;
-     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-         printf("SQLite error: %s\n", sqlite3_errmsg(db));
-         return false;
-     }
-
-     if (sqlite3_bind_int(stmt, 1, liquidID) != SQLITE_OK) {
-          sqlite3_finalize(stmt);
-          return false;
-     }
-
-     bool found = false;
-     if (sqlite3_step(stmt) == SQLITE_ROW) {
-          liquidData["LiquidID"] = std::to_string(sqlite3_column_int(stmt, 0));
-
-          const unsigned char* nameText = sqlite3_column_text(stmt, 1);
-          liquidData["Name"] = nameText ? reinterpret_cast<const char*>(nameText) : "";
-
-          liquidData["Density"] = std::to_string(sqlite3_column_double(stmt, 2));
-          liquidData["Viscosity"] = std::to_string(sqlite3_column_double(stmt, 3));
-
-          const unsigned char* colorText = sqlite3_column_text(stmt, 4);
-          liquidData["Color"] = colorText ? reinterpret_cast<const char*>(colorText) : "";
+    LiquidType liquid;
+    if (!loadLiquidType(liquidID, liquid)) return false;
+    for (auto& column : toMap(liquid))
+        liquidData[column.first] = std::move(column.second);
+    return true;
+}
 
-          const unsigned char* descText = sqlite3_column_text(stmt, 5);
-          liquidData["Description"] = descText ? reinterpret_cast<const char*>(descText) : "";
+bool FluidDatabase::loadLiquidType(int liquidID, LiquidType& liquid) {
+    if (!validateDB()) return false;
 
-          const unsigned char* otherPropsText = sqlite3_column_text(stmt, 6);
-          liquidData["OtherPhysicalPropertiesJSON"] = otherPropsText ? reinterpret_cast<const char*>(otherPropsText) : "";
+    const char* sql = "SELECT " LIQUID_COLUMNS " FROM TypesOfLiquids WHERE LiquidID = ?;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, liquidID);
 
-          found = true;
-     }
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        readLiquidType(stmt, liquid);
+        found = true;
+    }
 
-     sqlite3_finalize(stmt);
-     return found;
+    releaseStatement(stmt);
+    return found;
 }
 
 bool FluidDatabase::loadAllLiquidTypes(std::vector<std::map<std::string, std::string>>& records) {
+    std::vector<LiquidType> liquids;
+    if (!loadAllLiquidTypes(liquids)) return false;
+    for (const LiquidType& liquid : liquids)
+        records.push_back(toMap(liquid));
+    return true;
+}
+
+bool FluidDatabase::loadAllLiquidTypes(std::vector<LiquidType>& records) {
     if (!validateDB()) return false;
-    const char* sql = "SELECT * FROM TypesOfLiquids;";
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+    const char* sql = "SELECT " LIQUID_COLUMNS " FROM TypesOfLiquids;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
-        std::map<std::string, std::string> row;
-        row["LiquidID"] = std::to_string(sqlite3_column_int(stmt, 0));
-        row["Name"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        row["Density"] = std::to_string(sqlite3_column_double(stmt, 2));
-        row["Viscosity"] = std::to_string(sqlite3_column_double(stmt, 3));
-        row["Color"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        row["Description"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        row["OtherPhysicalPropertiesJSON"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
-        records.push_back(row);
+        records.emplace_back();
+        readLiquidType(stmt, records.back());
     }
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return true;
 }
 
@@ -350,9 +442,8 @@ bool FluidDatabase::updateLiquidType(int liquidID, std::map<std::string, std::st
 
     sql += " WHERE LiquidID = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-        return false;
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
 
     int bindIdx = 1;
     for (size_t i = 0; i < columnsToUpdate.size(); ++i) {
@@ -369,131 +460,184 @@ bool FluidDatabase::updateLiquidType(int liquidID, std::map<std::string, std::st
 
     bool success = (sqlite3_step(stmt) == SQLITE_DONE);
 
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return success;
 }
 
+#define SIMULATION_COLUMNS \
+    "SimulationID, ConfigID, DateTime, ResultFilePath, Duration, Notes, User, Seed, Version, OtherMetadataJSON, ConfigHash"
+
+static void readSavedSimulation(sqlite3_stmt* stmt, FluidDatabase::SavedSimulation& record) {
+    record.simulationID = sqlite3_column_int(stmt, 0);
+    record.configID = sqlite3_column_int(stmt, 1);
+    readText(stmt, 2, record.dateTime);
+    readText(stmt, 3, record.resultFilePath);
+    record.duration = sqlite3_column_double(stmt, 4);
+    readText(stmt, 5, record.notes);
+    readText(stmt, 6, record.user);
+    record.seed = sqlite3_column_int(stmt, 7);
+    readText(stmt, 8, record.version);
+    readText(stmt, 9, record.otherMetadataJSON);
+    readText(stmt, 10, record.configHash);
+}
+
+static std::map<std::string, std::string> toMap(const FluidDatabase::SavedSimulation& record) {
+    std::map<std::string, std::string> row;
+    row["SimulationID"] = std::to_string(record.simulationID);
+    row["ConfigID"] = std::to_string(record.configID);
+    row["DateTime"] = record.dateTime;
+    row["ResultFilePath"] = record.resultFilePath;
+    row["Duration"] = std::to_string(record.duration);
+    row["Notes"] = record.notes;
+    row["User"] = record.user;
+    row["Seed"] = std::to_string(record.seed);
+    row["Version"] = record.version;
+    row["OtherMetadataJSON"] = record.otherMetadataJSON;
+    row["ConfigHash"] = record.configHash;
+    return row;
+}
+
+// Binds every column of a SavedSimulations INSERT; the strings must outlive the step
+static void bindSavedSimulation(sqlite3_stmt* stmt, const FluidDatabase::SavedSimulation& record) {
+    int bindIdx = 1;
+    if (record.simulationID > 0)
+        sqlite3_bind_int(stmt, bindIdx++, record.simulationID);
+    else
+        sqlite3_bind_null(stmt, bindIdx++);
+    sqlite3_bind_int(stmt, bindIdx++, record.configID);
+    sqlite3_bind_text(stmt, bindIdx++, record.dateTime.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, record.resultFilePath.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, bindIdx++, record.duration);
+    sqlite3_bind_text(stmt, bindIdx++, record.notes.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, record.user.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, bindIdx++, record.seed);
+    sqlite3_bind_text(stmt, bindIdx++, record.version.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, bindIdx++, record.otherMetadataJSON.c_str(), -1, SQLITE_STATIC);
+    // NULL rather than '' keeps unhashed rows out of the ConfigHash index's lookups
+    if (record.configHash.empty())
+        sqlite3_bind_null(stmt, bindIdx++);
+    else
+        sqlite3_bind_text(stmt, bindIdx++, record.configHash.c_str(), -1, SQLITE_STATIC);
+}
+
+// A NULL SimulationID is assigned by the database, so one statement serves every row
+static const char* const InsertSimulationSql =
+    "INSERT INTO SavedSimulations (" SIMULATION_COLUMNS ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+// Numbered in SIMULATION_COLUMNS order, so bindSavedSimulation fills it too
+static const char* const UpdateSimulationSql =
+    "UPDATE SavedSimulations SET ConfigID = ?2, DateTime = ?3, ResultFilePath = ?4, Duration = ?5, Notes = ?6, "
+    "User = ?7, Seed = ?8, Version = ?9, OtherMetadataJSON = ?10, ConfigHash = ?11 WHERE SimulationID = ?1;";
+
 bool FluidDatabase::saveSimulation(const int simulationID, const int configID, const std::string& dateTime,
     const std::string& resultFilePath, double duration,
     const std::string& notes, const std::string& user,
     int seed, const std::string& version,
     const std::string& otherMetadataJSON) {
-    if (!validateDB()) return false;
-
-    bool hasPK = simulationID > 0;
-    const char* sql = nullptr;
-    sqlite3_stmt* stmt = nullptr;
-    int bindIdx = 1;
-
-    if (hasPK) {
-        sql =
-            "INSERT INTO SavedSimulations "
-            "(SimulationID, ConfigID, DateTime, ResultFilePath, Duration, Notes, User, Seed, Version, OtherMetadataJSON) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-    }
-    else {
-        sql =
-            "INSERT INTO SavedSimulations "
-            "(ConfigID, DateTime, ResultFilePath, Duration, Notes, User, Seed, Version, OtherMetadataJSON) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);";
-    }
+    SavedSimulation record;
+    record.simulationID = simulationID;
+    record.configID = configID;
+    record.dateTime = dateTime;
+    record.resultFilePath = resultFilePath;
+    record.duration = duration;
+    record.notes = notes;
+    record.user = user;
+    record.seed = seed;
+    record.version = version;
+    record.otherMetadataJSON = otherMetadataJSON;
+    return saveSimulation(record);
+}
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        printf("SQLite error: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
+bool FluidDatabase::saveSimulation(const SavedSimulation& record) {
+    if (!validateDB()) return false;
 
-    if (hasPK) {
-        sqlite3_bind_int(stmt, bindIdx++, simulationID);
-    }
-    sqlite3_bind_int(stmt, bindIdx++, configID);
-    sqlite3_bind_text(stmt, bindIdx++, dateTime.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, resultFilePath.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_double(stmt, bindIdx++, duration);
-    sqlite3_bind_text(stmt, bindIdx++, notes.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, user.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, bindIdx++, seed);
-    sqlite3_bind_text(stmt, bindIdx++, version.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, bindIdx++, otherMetadataJSON.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_stmt* stmt = prepare(InsertSimulationSql);
+    if (!stmt) return false;
+    bindSavedSimulation(stmt, record);
 
     bool success = (sqlite3_step(stmt) == SQLITE_DONE);
 
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return success;
 }
 
-bool FluidDatabase::loadSimulation(int simulationID, std::map<std::string, std::string>& simulationData) {
-     if (!validateDB()) return false;
-
-     const char* sql =
-          "SELECT SimulationID, ConfigID, DateTime, ResultFilePath, Duration, Notes, User, Seed, Version, OtherMetadataJSON "
-          "FROM SavedSimulations WHERE SimulationID = ?;";
-
-     sqlite3_stmt* stmt = nullptr;
-     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-         printf("SQLite error: %s\n", sqlite3_errmsg(db));
-         return false;
-     }
-
-     if (sqlite3_bind_int(stmt, 1, simulationID) != SQLITE_OK) {
-          sqlite3_finalize(stmt);
-          return false;
-     }
-
-     bool found = false;
-     if (sqlite3_step(stmt) == SQLITE_ROW) {
-          simulationData["SimulationID"] = std::to_string(sqlite3_column_int(stmt, 0));
-          simulationData["ConfigID"] = std::to_string(sqlite3_column_int(stmt, 1));
-
-          const unsigned char* dateTimeText = sqlite3_column_text(stmt, 2);
-          simulationData["DateTime"] = dateTimeText ? reinterpret_cast<const char*>(dateTimeText) : "";
+bool FluidDatabase::saveSimulations(const SavedSimulation* records, size_t count, std::string* error) {
+    if (!validateDB()) return false;
+    if (count == 0) return true;
 
-          const unsigned char* resultFilePathText = sqlite3_column_text(stmt, 3);
-          simulationData["ResultFilePath"] = resultFilePathText ? reinterpret_cast<const char*>(resultFilePathText) : "";
+    Transaction transaction(*this);
+    if (!transaction.isActive()) {
+        if (error) *error = std::string("Could not begin a transaction: ") + sqlite3_errmsg(db);
+        return false;
+    }
 
-          simulationData["Duration"] = std::to_string(sqlite3_column_double(stmt, 4));
+    sqlite3_stmt* stmt = prepare(InsertSimulationSql);
+    if (!stmt) {
+        if (error) *error = sqlite3_errmsg(db);
+        return false;
+    }
 
-          const unsigned char* notesText = sqlite3_column_text(stmt, 5);
-          simulationData["Notes"] = notesText ? reinterpret_cast<const char*>(notesText) : "";
+    for (size_t i = 0; i < count; ++i) {
+        bindSavedSimulation(stmt, records[i]);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            if (error) *error = "Row " + std::to_string(i) + ": " + sqlite3_errmsg(db);
+            releaseStatement(stmt);
+            return false; // The transaction rolls back every row
+        }
+        sqlite3_reset(stmt);
+    }
+    releaseStatement(stmt);
 
-          const unsigned char* userText = sqlite3_column_text(stmt, 6);
-          simulationData["User"] = userText ? reinterpret_cast<const char*>(userText) : "";
+    if (!transaction.commit()) {
+        if (error) *error = "Could not commit the transaction (the database may be locked)";
+        return false;
+    }
+    return true;
+}
 
-          simulationData["Seed"] = std::to_string(sqlite3_column_int(stmt, 7));
+bool FluidDatabase::loadSimulation(int simulationID, std::map<std::string, std::string>& simulationData) {
+    SavedSimulation record;
+    if (!loadSimulation(simulationID, record)) return false;
+    for (auto& column : toMap(record))
+        simulationData[column.first] = std::move(column.second);
+    return true;
+}
 
-          const unsigned char* versionText = sqlite3_column_text(stmt, 8);
-          simulationData["Version"] = versionText ? reinterpret_cast<const char*>(versionText) : "";
+bool FluidDatabase::loadSimulation(int simulationID, SavedSimulation& record) {
+    if (!validateDB()) return false;
 
-          const unsigned char* otherMetaText = sqlite3_column_text(stmt, 9);
-          simulationData["OtherMetadataJSON"] = otherMetaText ? reinterpret_cast<const char*>(otherMetaText) : "";
+    const char* sql = "SELECT " SIMULATION_COLUMNS " FROM SavedSimulations WHERE SimulationID = ?;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, simulationID);
 
-          found = true;
-     }
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        readSavedSimulation(stmt, record);
+        found = true;
+    }
 
-     sqlite3_finalize(stmt);
-     return found;
+    releaseStatement(stmt);
+    return found;
 }
 
 bool FluidDatabase::loadAllSimulations(std::vector<std::map<std::string, std::string>>& records) {
+    std::vector<SavedSimulation> simulations;
+    if (!loadAllSimulations(simulations)) return false;
+    for (const SavedSimulation& record : simulations)
+        records.push_back(toMap(record));
+    return true;
+}
+
+bool FluidDatabase::loadAllSimulations(std::vector<SavedSimulation>& records) {
     if (!validateDB()) return false;
-    const char* sql = "SELECT * FROM SavedSimulations;";
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+    const char* sql = "SELECT " SIMULATION_COLUMNS " FROM SavedSimulations;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
-        std::map<std::string, std::string> row;
-        row["SimulationID"] = std::to_string(sqlite3_column_int(stmt, 0));
-        row["ConfigID"] = std::to_string(sqlite3_column_int(stmt, 1));
-        row["DateTime"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        row["ResultFilePath"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        row["Duration"] = std::to_string(sqlite3_column_double(stmt, 4));
-        row["Notes"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        row["User"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
-        row["Seed"] = std::to_string(sqlite3_column_int(stmt, 7));
-        row["Version"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 8));
-        row["OtherMetadataJSON"] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 9));
-        records.push_back(row);
+        records.emplace_back();
+        readSavedSimulation(stmt, records.back());
     }
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return true;
 }
 
@@ -503,7 +647,7 @@ bool FluidDatabase::updateSimulation(int simulationID, std::map<std::string, std
     // List of all possible columns (excluding PK)
     const char* allColumns[] = {
         "ConfigID", "DateTime", "ResultFilePath", "Duration", "Notes",
-        "User", "Seed", "Version", "OtherMetadataJSON"
+        "User", "Seed", "Version", "OtherMetadataJSON", "ConfigHash"
     };
     std::string sql = "UPDATE SavedSimulations SET ";
     std::vector<std::string> columnsToUpdate;
@@ -527,9 +671,8 @@ bool FluidDatabase::updateSimulation(int simulationID, std::map<std::string, std
 
     sql += " WHERE SimulationID = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-        return false;
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
 
     int bindIdx = 1;
     for (size_t i = 0; i < columnsToUpdate.size(); ++i) {
@@ -549,17 +692,590 @@ bool FluidDatabase::updateSimulation(int simulationID, std::map<std::string, std
 
     bool success = (sqlite3_step(stmt) == SQLITE_DONE);
 
-    sqlite3_finalize(stmt);
+    releaseStatement(stmt);
     return success;
 }
 
-bool FluidDatabase::queryTable(
+bool FluidDatabase::updateSimulation(const SavedSimulation& record) {
+    if (!validateDB() || record.simulationID <= 0) return false;
+
+    sqlite3_stmt* stmt = prepare(UpdateSimulationSql);
+    if (!stmt) return false;
+    bindSavedSimulation(stmt, record);
+
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE) && sqlite3_changes(db) == 1;
+
+    releaseStatement(stmt);
+    return success;
+}
+
+bool FluidDatabase::findResult(const std::string& configHash, SavedSimulation& record) {
+    if (!validateDB()) return false;
+    if (configHash.empty()) {
+        ++resultStats.misses;
+        return false;
+    }
+
+    const char* sql = "SELECT " SIMULATION_COLUMNS " FROM SavedSimulations WHERE ConfigHash = ? ORDER BY SimulationID DESC;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_text(stmt, 1, configHash.c_str(), -1, SQLITE_STATIC);
+
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+        readSavedSimulation(stmt, record);
+        FILE* file = record.resultFilePath.empty() ? nullptr : std::fopen(record.resultFilePath.c_str(), "rb");
+        if (file) {
+            std::fclose(file);
+            found = true;
+        }
+        std::vector<Frame> frames;
+        if (!found && loadFrames(record.simulationID, frames)) {
+            for (const Frame& frame : frames) {
+                if (frame.format == "checkpoint")
+                    found = true;
+            }
+        }
+        if (!found)
+            ++resultStats.stale;
+    }
+    releaseStatement(stmt);
+
+    if (found)
+        ++resultStats.hits;
+    else
+        ++resultStats.misses;
+    return found;
+}
+
+bool FluidDatabase::findUnfinishedSimulation(int configID, long long seed, SavedSimulation& record) {
+    if (!validateDB()) return false;
+
+    const char* sql =
+        "SELECT " SIMULATION_COLUMNS " FROM SavedSimulations "
+        "WHERE ConfigID = ?1 AND (ResultFilePath IS NULL OR ResultFilePath = '') AND (?2 < 0 OR Seed = ?2) "
+        "ORDER BY SimulationID DESC LIMIT 1;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, configID);
+    sqlite3_bind_int64(stmt, 2, seed);
+
+    const bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found)
+        readSavedSimulation(stmt, record);
+    releaseStatement(stmt);
+    return found;
+}
+
+bool FluidDatabase::saveCheckpoint(int simulationID, long long step, double simulatedTime, const std::string& filePath,
+    long long fileSize, long long checksum, int formatVersion, const std::string& dateTime) {
+    Checkpoint checkpoint;
+    checkpoint.simulationID = simulationID;
+    checkpoint.step = step;
+    checkpoint.simulatedTime = simulatedTime;
+    checkpoint.filePath = filePath;
+    checkpoint.fileSize = fileSize;
+    checkpoint.checksum = checksum;
+    checkpoint.formatVersion = formatVersion;
+    checkpoint.dateTime = dateTime;
+    return saveCheckpoint(checkpoint);
+}
+
+bool FluidDatabase::saveCheckpoint(const Checkpoint& checkpoint) {
+    if (!validateDB()) return false;
+
+    const char* sql =
+        "INSERT INTO SimulationCheckpoints "
+        "(SimulationID, Step, SimulatedTime, FilePath, FileSize, Checksum, FormatVersion, DateTime) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+
+    int bindIdx = 1;
+    sqlite3_bind_int(stmt, bindIdx++, checkpoint.simulationID);
+    sqlite3_bind_int64(stmt, bindIdx++, checkpoint.step);
+    sqlite3_bind_double(stmt, bindIdx++, checkpoint.simulatedTime);
+    sqlite3_bind_text(stmt, bindIdx++, checkpoint.filePath.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, bindIdx++, checkpoint.fileSize);
+    sqlite3_bind_int64(stmt, bindIdx++, checkpoint.checksum);
+    sqlite3_bind_int(stmt, bindIdx++, checkpoint.formatVersion);
+    sqlite3_bind_text(stmt, bindIdx++, checkpoint.dateTime.c_str(), -1, SQLITE_STATIC);
+
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
+
+    releaseStatement(stmt);
+    return success;
+}
+
+// Reads the current row of a SimulationCheckpoints SELECT into a column map
+static std::map<std::string, std::string> readCheckpointRow(sqlite3_stmt* stmt) {
+    std::map<std::string, std::string> row;
+    row["CheckpointID"] = std::to_string(sqlite3_column_int(stmt, 0));
+    row["SimulationID"] = std::to_string(sqlite3_column_int(stmt, 1));
+    row["Step"] = std::to_string(sqlite3_column_int64(stmt, 2));
+    row["SimulatedTime"] = std::to_string(sqlite3_column_double(stmt, 3));
+
+    const unsigned char* filePathText = sqlite3_column_text(stmt, 4);
+    row["FilePath"] = filePathText ? reinterpret_cast<const char*>(filePathText) : "";
+
+    row["FileSize"] = std::to_string(sqlite3_column_int64(stmt, 5));
+    row["Checksum"] = std::to_string(sqlite3_column_int64(stmt, 6));
+    row["FormatVersion"] = std::to_string(sqlite3_column_int(stmt, 7));
+
+    const unsigned char* dateTimeText = sqlite3_column_text(stmt, 8);
+    row["DateTime"] = dateTimeText ? reinterpret_cast<const char*>(dateTimeText) : "";
+    return row;
+}
+
+bool FluidDatabase::loadCheckpoints(int simulationID, std::vector<std::map<std::string, std::string>>& records) {
+    if (!validateDB()) return false;
+
+    const char* sql =
+        "SELECT CheckpointID, SimulationID, Step, SimulatedTime, FilePath, FileSize, Checksum, FormatVersion, DateTime "
+        "FROM SimulationCheckpoints WHERE SimulationID = ? ORDER BY Step, CheckpointID;";
+
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, simulationID);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        records.push_back(readCheckpointRow(stmt));
+
+    releaseStatement(stmt);
+    return true;
+}
+
+bool FluidDatabase::loadCheckpoints(int simulationID, std::vector<Checkpoint>& records) {
+    if (!validateDB()) return false;
+
+    const char* sql =
+        "SELECT CheckpointID, SimulationID, Step, SimulatedTime, FilePath, FileSize, Checksum, FormatVersion, DateTime "
+        "FROM SimulationCheckpoints WHERE SimulationID = ? ORDER BY Step, CheckpointID;";
+
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, simulationID);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Checkpoint record;
+        record.checkpointID = sqlite3_column_int(stmt, 0);
+        record.simulationID = sqlite3_column_int(stmt, 1);
+        record.step = sqlite3_column_int64(stmt, 2);
+        record.simulatedTime = sqlite3_column_double(stmt, 3);
+        readText(stmt, 4, record.filePath);
+        record.fileSize = sqlite3_column_int64(stmt, 5);
+        record.checksum = sqlite3_column_int64(stmt, 6);
+        record.formatVersion = sqlite3_column_int(stmt, 7);
+        readText(stmt, 8, record.dateTime);
+        records.push_back(record);
+    }
+
+    releaseStatement(stmt);
+    return true;
+}
+
+bool FluidDatabase::loadLatestCheckpoint(int simulationID, std::map<std::string, std::string>& checkpointData) {
+    if (!validateDB()) return false;
+
+    const char* sql =
+        "SELECT CheckpointID, SimulationID, Step, SimulatedTime, FilePath, FileSize, Checksum, FormatVersion, DateTime "
+        "FROM SimulationCheckpoints WHERE SimulationID = ? ORDER BY Step DESC, CheckpointID DESC LIMIT 1;";
+
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, simulationID);
+
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        checkpointData = readCheckpointRow(stmt);
+        found = true;
+    }
+
+    releaseStatement(stmt);
+    return found;
+}
+
+// Replaces a sample logged again for the same step, e.g. by a run resumed from a checkpoint
+static const char* const InsertMetricSql =
+    "INSERT OR REPLACE INTO SimulationMetrics "
+    "(SimulationID, Step, SimulatedTime, KineticEnergy, MaxVelocity, PressureIterations, ViscosityIterations, "
+    "Drag, Lift, StepSeconds) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+static void bindMetricSample(sqlite3_stmt* stmt, const FluidDatabase::MetricSample& sample) {
+    int bindIdx = 1;
+    sqlite3_bind_int(stmt, bindIdx++, sample.simulationID);
+    sqlite3_bind_int64(stmt, bindIdx++, sample.step);
+    sqlite3_bind_double(stmt, bindIdx++, sample.simulatedTime);
+    sqlite3_bind_double(stmt, bindIdx++, sample.kineticEnergy);
+    sqlite3_bind_double(stmt, bindIdx++, sample.maxVelocity);
+    sqlite3_bind_int(stmt, bindIdx++, sample.pressureIterations);
+    sqlite3_bind_int(stmt, bindIdx++, sample.viscosityIterations);
+    sqlite3_bind_double(stmt, bindIdx++, sample.drag);
+    sqlite3_bind_double(stmt, bindIdx++, sample.lift);
+    sqlite3_bind_double(stmt, bindIdx++, sample.stepSeconds);
+}
+
+bool FluidDatabase::saveMetric(const MetricSample& sample) {
+    if (!validateDB()) return false;
+    sqlite3_stmt* stmt = prepare(InsertMetricSql);
+    if (!stmt) return false;
+    bindMetricSample(stmt, sample);
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
+    releaseStatement(stmt);
+    return success;
+}
+
+bool FluidDatabase::saveMetrics(const MetricSample* samples, size_t count, std::string* error) {
+    if (!validateDB()) return false;
+    if (count == 0) return true;
+
+    Transaction transaction(*this);
+    if (!transaction.isActive()) {
+        if (error) *error = std::string("Could not begin a transaction: ") + sqlite3_errmsg(db);
+        return false;
+    }
+    sqlite3_stmt* stmt = prepare(InsertMetricSql);
+    if (!stmt) {
+        if (error) *error = sqlite3_errmsg(db);
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        bindMetricSample(stmt, samples[i]);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            if (error) *error = "Sample " + std::to_string(i) + ": " + sqlite3_errmsg(db);
+            releaseStatement(stmt);
+            return false; // The transaction rolls back every sample
+        }
+        sqlite3_reset(stmt);
+    }
+    releaseStatement(stmt);
+
+    if (!transaction.commit()) {
+        if (error) *error = "Could not commit the transaction (the database may be locked)";
+        return false;
+    }
+    return true;
+}
+
+void FluidDatabase::MetricSeries::clear() {
+    step.clear();
+    simulatedTime.clear();
+    kineticEnergy.clear();
+    maxVelocity.clear();
+    pressureIterations.clear();
+    viscosityIterations.clear();
+    drag.clear();
+    lift.clear();
+    stepSeconds.clear();
+}
+
+bool FluidDatabase::loadMetrics(int simulationID, long long firstStep, long long lastStep, MetricSeries& series) {
+    if (!validateDB()) return false;
+
+    // A range of the primary key: the rows are read in order from one stretch of the table
+    const char* sql =
+        "SELECT Step, SimulatedTime, KineticEnergy, MaxVelocity, PressureIterations, ViscosityIterations, "
+        "Drag, Lift, StepSeconds FROM SimulationMetrics "
+        "WHERE SimulationID = ? AND Step BETWEEN ? AND ? ORDER BY Step;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, simulationID);
+    sqlite3_bind_int64(stmt, 2, firstStep);
+    sqlite3_bind_int64(stmt, 3, lastStep);
+
+    series.clear();
+    series.simulationID = simulationID;
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        series.step.push_back(sqlite3_column_int64(stmt, 0));
+        series.simulatedTime.push_back(sqlite3_column_double(stmt, 1));
+        series.kineticEnergy.push_back(sqlite3_column_double(stmt, 2));
+        series.maxVelocity.push_back(sqlite3_column_double(stmt, 3));
+        series.pressureIterations.push_back(sqlite3_column_int(stmt, 4));
+        series.viscosityIterations.push_back(sqlite3_column_int(stmt, 5));
+        series.drag.push_back(sqlite3_column_double(stmt, 6));
+        series.lift.push_back(sqlite3_column_double(stmt, 7));
+        series.stepSeconds.push_back(sqlite3_column_double(stmt, 8));
+    }
+
+    releaseStatement(stmt);
+    return result == SQLITE_DONE;
+}
+
+bool FluidDatabase::loadMetrics(const std::vector<int>& simulationIDs, long long firstStep, long long lastStep,
+    std::vector<MetricSeries>& series) {
+    if (!validateDB()) return false;
+
+    // One read transaction: a consistent snapshot, and the lock is taken once rather than per run
+    Transaction transaction(*this);
+    series.resize(simulationIDs.size());
+    for (size_t i = 0; i < simulationIDs.size(); ++i) {
+        if (!loadMetrics(simulationIDs[i], firstStep, lastStep, series[i]))
+            return false;
+    }
+    transaction.commit();
+    return true;
+}
+
+FluidDatabase::FrameStream::FrameStream(FrameStream&& other)
+    : database(other.database), blob(other.blob), bytes(other.bytes) {
+    other.blob = nullptr;
+}
+
+FluidDatabase::FrameStream& FluidDatabase::FrameStream::operator=(FrameStream&& other) {
+    if (this != &other) {
+        close();
+        database = other.database;
+        blob = other.blob;
+        bytes = other.bytes;
+        other.blob = nullptr;
+    }
+    return *this;
+}
+
+FluidDatabase::FrameStream::~FrameStream() {
+    close();
+}
+
+void FluidDatabase::FrameStream::close() {
+    // The connection may have been closed under the stream, closing its handle
+    if (blob && database && database->frameBlobs.erase(blob))
+        sqlite3_blob_close(blob);
+    blob = nullptr;
+}
+
+bool FluidDatabase::FrameStream::read(long long offset, void* out, size_t count) {
+    if (!blob || offset < 0 || offset > bytes || count > static_cast<unsigned long long>(bytes - offset))
+        return false;
+    // Payloads are below 2 GiB (see createFrame), so the range fits the int API
+    if (sqlite3_blob_read(blob, out, static_cast<int>(count), static_cast<int>(offset)) != SQLITE_OK) {
+        printf("SQLite error: %s\n", sqlite3_errmsg(database->db));
+        return false;
+    }
+    return true;
+}
+
+bool FluidDatabase::FrameStream::write(long long offset, const void* data, size_t count) {
+    if (!blob || offset < 0 || offset > bytes || count > static_cast<unsigned long long>(bytes - offset))
+        return false;
+    if (sqlite3_blob_write(blob, data, static_cast<int>(count), static_cast<int>(offset)) != SQLITE_OK) {
+        printf("SQLite error: %s\n", sqlite3_errmsg(database->db));
+        return false;
+    }
+    return true;
+}
+
+bool FluidDatabase::createFrame(Frame& frame, std::string* error) {
+    if (!validateDB()) return false;
+    // The BLOB API addresses payloads with int offsets, and SQLite caps values at SQLITE_LIMIT_LENGTH
+    const long long largest = std::min<long long>(0x7fffffff, sqlite3_limit(db, SQLITE_LIMIT_LENGTH, -1));
+    if (frame.size < 0 || frame.size > largest) {
+        if (error) *error = "Frames hold at most " + std::to_string(largest) + " bytes";
+        return false;
+    }
+
+    // Data is the last column, so reading the others never walks the payload's overflow pages
+    const char* sql =
+        "INSERT INTO SimulationFrames (FrameID, SimulationID, Step, SimulatedTime, Format, Size, Data) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) {
+        if (error) *error = sqlite3_errmsg(db);
+        return false;
+    }
+    int bindIdx = 1;
+    if (frame.frameID > 0)
+        sqlite3_bind_int64(stmt, bindIdx++, frame.frameID);
+    else
+        sqlite3_bind_null(stmt, bindIdx++);
+    sqlite3_bind_int(stmt, bindIdx++, frame.simulationID);
+    sqlite3_bind_int64(stmt, bindIdx++, frame.step);
+    sqlite3_bind_double(stmt, bindIdx++, frame.simulatedTime);
+    sqlite3_bind_text(stmt, bindIdx++, frame.format.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, bindIdx++, frame.size);
+    // Reserves the payload without materializing it
+    sqlite3_bind_zeroblob64(stmt, bindIdx++, static_cast<sqlite3_uint64>(frame.size));
+
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
+    if (success)
+        frame.frameID = sqlite3_last_insert_rowid(db);
+    else if (error)
+        *error = sqlite3_errmsg(db);
+    releaseStatement(stmt);
+    return success;
+}
+
+bool FluidDatabase::saveFrame(Frame& frame, const void* data, std::string* error) {
+    if (!validateDB()) return false;
+
+    Transaction transaction(*this);
+    if (!transaction.isActive()) {
+        if (error) *error = std::string("Could not begin a transaction: ") + sqlite3_errmsg(db);
+        return false;
+    }
+    if (!createFrame(frame, error))
+        return false;
+    {
+        // Closed before the commit, which fails while a write handle is open
+        FrameStream stream = openFrame(frame.frameID, true);
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (long long offset = 0; offset < frame.size; offset += FrameChunkBytes) {
+            const size_t count = static_cast<size_t>(std::min<long long>(FrameChunkBytes, frame.size - offset));
+            if (!stream.write(offset, bytes + offset, count)) {
+                if (error) *error = std::string("Could not write the frame: ") + sqlite3_errmsg(db);
+                return false;
+            }
+        }
+    }
+    if (!transaction.commit()) {
+        if (error) *error = "Could not commit the transaction (the database may be locked)";
+        return false;
+    }
+    return true;
+}
+
+FluidDatabase::FrameStream FluidDatabase::openFrame(long long frameID, bool writable) {
+    FrameStream stream;
+    if (!validateDB()) return stream;
+    sqlite3_blob* blob = nullptr;
+    if (sqlite3_blob_open(db, "main", "SimulationFrames", "Data", frameID, writable ? 1 : 0, &blob) != SQLITE_OK) {
+        printf("SQLite error: %s\n", sqlite3_errmsg(db));
+        sqlite3_blob_close(blob);
+        return stream;
+    }
+    frameBlobs.insert(blob);
+    stream.database = this;
+    stream.blob = blob;
+    stream.bytes = sqlite3_blob_bytes(blob);
+    return stream;
+}
+
+bool FluidDatabase::readFrame(long long frameID, long long offset, void* out, size_t count) {
+    FrameStream stream = openFrame(frameID);
+    return stream.read(offset, out, count);
+}
+
+bool FluidDatabase::loadFrames(int simulationID, std::vector<Frame>& frames) {
+    if (!validateDB()) return false;
+
+    const char* sql =
+        "SELECT FrameID, SimulationID, Step, SimulatedTime, Format, Size FROM SimulationFrames "
+        "WHERE SimulationID = ? ORDER BY Step, FrameID;";
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    sqlite3_bind_int(stmt, 1, simulationID);
+
+    frames.clear();
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        Frame frame;
+        frame.frameID = sqlite3_column_int64(stmt, 0);
+        frame.simulationID = sqlite3_column_int(stmt, 1);
+        frame.step = sqlite3_column_int64(stmt, 2);
+        frame.simulatedTime = sqlite3_column_double(stmt, 3);
+        readText(stmt, 4, frame.format);
+        frame.size = sqlite3_column_int64(stmt, 5);
+        frames.push_back(frame);
+    }
+
+    releaseStatement(stmt);
+    return result == SQLITE_DONE;
+}
+
+FluidDatabase::Cursor::Cursor(Cursor&& other)
+    : database(other.database), stmt(other.stmt), error(other.error) {
+    other.stmt = nullptr;
+}
+
+FluidDatabase::Cursor& FluidDatabase::Cursor::operator=(Cursor&& other) {
+    if (this != &other) {
+        release();
+        database = other.database;
+        stmt = other.stmt;
+        error = other.error;
+        other.stmt = nullptr;
+    }
+    return *this;
+}
+
+FluidDatabase::Cursor::~Cursor() {
+    release();
+}
+
+void FluidDatabase::Cursor::release() {
+    // The connection may have been closed under the cursor, finalizing its statement
+    if (stmt && database && database->db)
+        database->releaseStatement(stmt);
+    stmt = nullptr;
+}
+
+bool FluidDatabase::Cursor::next() {
+    if (!stmt) return false;
+    int result = sqlite3_step(stmt);
+    if (result == SQLITE_ROW) return true;
+    if (result != SQLITE_DONE) {
+        printf("SQLite error: %s\n", sqlite3_errmsg(database->db));
+        error = true;
+    }
+    // Done: give the statement back now rather than when the cursor goes
+    release();
+    return false;
+}
+
+const char* FluidDatabase::Cursor::text(int column) const {
+    const unsigned char* value = sqlite3_column_text(stmt, column);
+    return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+// The expression a JsonPredicate compiles to and addJsonIndex() indexes. The path is inlined (quoted)
+// rather than bound because SQLite only matches an expression index against an identical expression.
+// Invalid JSON yields NULL instead of failing the statement.
+static bool jsonExpression(const std::string& column, const std::string& path, std::string& sql) {
+    if (column.empty() || path.empty() || path[0] != '$' || path.find('\0') != std::string::npos)
+        return false;
+    std::string quoted = "'";
+    for (char c : path) {
+        if (c == '\'') quoted += '\'';
+        quoted += c;
+    }
+    quoted += "'";
+    sql = "CASE WHEN json_valid(" + column + ") THEN json_extract(" + column + ", " + quoted + ") END";
+    return true;
+}
+
+// Binds a predicate value the way json_extract returns it: integer, real, 1/0 for booleans, else text
+static void bindJsonValue(sqlite3_stmt* stmt, int index, const std::string& value) {
+    if (value == "true" || value == "false") {
+        sqlite3_bind_int(stmt, index, value == "true" ? 1 : 0);
+        return;
+    }
+    if (!value.empty()) {
+        char* end = nullptr;
+        const long long integer = std::strtoll(value.c_str(), &end, 10);
+        if (*end == '\0') {
+            sqlite3_bind_int64(stmt, index, integer);
+            return;
+        }
+        const double real = std::strtod(value.c_str(), &end);
+        if (*end == '\0') {
+            sqlite3_bind_double(stmt, index, real);
+            return;
+        }
+    }
+    sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+FluidDatabase::Cursor FluidDatabase::openCursor(
     const std::string& tableName,
     const std::vector<std::string>& columns,
     const std::map<std::string, std::string>& filters,
-    std::vector<std::map<std::string, std::string>>& results)
+    const QueryOptions& options)
 {
-    if (!validateDB()) return false;
+    Cursor cursor;
+    cursor.database = this;
+    cursor.error = true;
+    if (!validateDB()) return cursor;
 
     // Build SELECT statement
     std::string sql = "SELECT ";
@@ -569,46 +1285,369 @@ bool FluidDatabase::queryTable(
     }
     sql += " FROM " + tableName;
 
-    // Build WHERE clause
-    std::vector<std::string> filterKeys;
+    // Build WHERE clause: the filters, the JSON predicates, then the keyset bound
+    static const char* const comparisons[] = { " = ?", " <> ?", " < ?", " <= ?", " > ?", " >= ?", " IS NOT NULL" };
+    std::vector<const std::string*> values;
+    std::vector<const std::string*> jsonValues;
+    bool hasWhere = false;
     for (const auto& kv : filters) {
-        if (!kv.second.empty())
-            filterKeys.push_back(kv.first);
-    }
-    if (!filterKeys.empty()) {
-        sql += " WHERE ";
-        for (size_t i = 0; i < filterKeys.size(); ++i) {
-            if (i > 0) sql += " AND ";
-            sql += filterKeys[i] + " = ?";
+        if (kv.second.empty()) continue;
+        sql += hasWhere ? " AND " : " WHERE ";
+        sql += kv.first + " = ?";
+        values.push_back(&kv.second);
+        hasWhere = true;
+    }
+    for (const JsonPredicate& predicate : options.json) {
+        std::string expression;
+        if (!jsonExpression(predicate.column, predicate.path, expression)) {
+            printf("SQLite error: invalid JSON path '%s' on %s\n", predicate.path.c_str(), predicate.column.c_str());
+            return cursor;
         }
+        sql += hasWhere ? " AND " : " WHERE ";
+        sql += expression + comparisons[static_cast<int>(predicate.comparison)];
+        if (predicate.comparison != JsonPredicate::Comparison::Present)
+            jsonValues.push_back(&predicate.value);
+        hasWhere = true;
+    }
+    const bool keyset = options.hasAfter && !options.orderBy.empty();
+    if (keyset) {
+        sql += hasWhere ? " AND " : " WHERE ";
+        sql += options.orderBy + (options.descending ? " < ?" : " > ?");
     }
+    if (!options.orderBy.empty())
+        sql += " ORDER BY " + options.orderBy + (options.descending ? " DESC" : "");
+    // Limits are bound, so every page of a scan shares one cached statement
+    const bool paged = options.limit >= 0 || options.offset > 0;
+    if (paged)
+        sql += " LIMIT ? OFFSET ?";
     sql += ";";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        printf("SQLite error: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
+    cursor.stmt = prepare(sql);
+    if (!cursor.stmt) return cursor;
 
-    // Bind filter values
     int bindIdx = 1;
-    for (const auto& key : filterKeys) {
-        sqlite3_bind_text(stmt, bindIdx++, filters.at(key).c_str(), -1, SQLITE_TRANSIENT);
+    for (const std::string* value : values)
+        sqlite3_bind_text(cursor.stmt, bindIdx++, value->c_str(), -1, SQLITE_TRANSIENT);
+    for (const std::string* value : jsonValues)
+        bindJsonValue(cursor.stmt, bindIdx++, *value);
+    if (keyset)
+        sqlite3_bind_text(cursor.stmt, bindIdx++, options.after.c_str(), -1, SQLITE_TRANSIENT);
+    if (paged) {
+        sqlite3_bind_int64(cursor.stmt, bindIdx++, options.limit);
+        sqlite3_bind_int64(cursor.stmt, bindIdx++, options.offset);
     }
+    cursor.error = false;
+    return cursor;
+}
 
-    // Fetch results
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+bool FluidDatabase::forEachRow(
+    const std::string& tableName,
+    const std::vector<std::string>& columns,
+    const std::map<std::string, std::string>& filters,
+    const QueryOptions& options,
+    const std::function<bool(const Cursor&)>& visit)
+{
+    Cursor cursor = openCursor(tableName, columns, filters, options);
+    while (cursor.next()) {
+        if (!visit(cursor)) return true;
+    }
+    return !cursor.failed();
+}
+
+bool FluidDatabase::queryTable(
+    const std::string& tableName,
+    const std::vector<std::string>& columns,
+    const std::map<std::string, std::string>& filters,
+    std::vector<std::map<std::string, std::string>>& results)
+{
+    return queryTable(tableName, columns, filters, std::vector<JsonPredicate>(), results);
+}
+
+bool FluidDatabase::queryTable(
+    const std::string& tableName,
+    const std::vector<std::string>& columns,
+    const std::map<std::string, std::string>& filters,
+    const std::vector<JsonPredicate>& predicates,
+    std::vector<std::map<std::string, std::string>>& results)
+{
+    QueryOptions options;
+    options.json = predicates;
+    Cursor cursor = openCursor(tableName, columns, filters, options);
+    while (cursor.next()) {
         std::map<std::string, std::string> row;
         for (size_t i = 0; i < columns.size(); ++i) {
-            const unsigned char* text = sqlite3_column_text(stmt, static_cast<int>(i));
-            row[columns[i]] = text ? reinterpret_cast<const char*>(text) : "";
+            const char* text = cursor.text(static_cast<int>(i));
+            row[columns[i]].assign(text, cursor.textSize(static_cast<int>(i)));
         }
         results.push_back(row);
     }
+    return !cursor.failed();
+}
+
+bool FluidDatabase::addJsonIndex(const std::string& tableName, const std::string& column, const std::string& path,
+    const std::string& generatedColumn, std::string* error) {
+    if (!validateDB()) return false;
+    std::string expression;
+    if (!jsonExpression(column, path, expression)) {
+        if (error) *error = "Invalid JSON path '" + path + "'";
+        return false;
+    }
+
+    if (!generatedColumn.empty()) {
+        // ALTER TABLE has no IF NOT EXISTS for columns; generated columns only show in table_xinfo
+        sqlite3_stmt* stmt = prepare("SELECT 1 FROM pragma_table_xinfo(?) WHERE name = ?;");
+        if (!stmt) {
+            if (error) *error = sqlite3_errmsg(db);
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, tableName.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, generatedColumn.c_str(), -1, SQLITE_STATIC);
+        const bool exists = (sqlite3_step(stmt) == SQLITE_ROW);
+        releaseStatement(stmt);
+        if (!exists && !execute("ALTER TABLE " + tableName + " ADD COLUMN " + generatedColumn +
+            " GENERATED ALWAYS AS (" + expression + ") VIRTUAL;")) {
+            if (error) *error = std::string("Could not add the generated column: ") + sqlite3_errmsg(db);
+            return false;
+        }
+    }
+
+    // idx_<table>_<column>_<path with anything but letters and digits as '_'>
+    std::string indexName = "idx_" + tableName + "_" + column + "_";
+    for (size_t i = 1; i < path.size(); ++i)
+        indexName += std::isalnum(static_cast<unsigned char>(path[i])) ? path[i] : '_';
+    if (!execute("CREATE INDEX IF NOT EXISTS " + indexName + " ON " + tableName + " (" + expression + ");")) {
+        if (error) *error = std::string("Could not create the index: ") + sqlite3_errmsg(db);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const FluidJson> FluidDatabase::parseJson(const std::string& table, const std::string& column, long long rowid,
+    const std::string& text, std::string* error) {
+    const std::string key = table + '\n' + column + '\n' + std::to_string(rowid);
+    auto found = jsonIndex.find(key);
+    if (found != jsonIndex.end()) {
+        if (found->second->text == text) {
+            jsonDocuments.splice(jsonDocuments.begin(), jsonDocuments, found->second);
+            ++jsonStats.hits;
+            return found->second->document;
+        }
+        // The row changed since it was parsed
+        jsonDocuments.erase(found->second);
+        jsonIndex.erase(found);
+    }
+
+    ++jsonStats.misses;
+    auto document = std::make_shared<FluidJson>();
+    if (!FluidJson::parse(text, *document, error))
+        return nullptr;
+    if (jsonCapacity > 0) {
+        jsonDocuments.push_front(CachedJson{ key, text, document });
+        jsonIndex[key] = jsonDocuments.begin();
+        while (jsonDocuments.size() > jsonCapacity) {
+            jsonIndex.erase(jsonDocuments.back().key);
+            jsonDocuments.pop_back();
+            ++jsonStats.evictions;
+        }
+    }
+    return document;
+}
+
+FluidDatabase::JsonCacheStats FluidDatabase::getJsonCacheStats() const {
+    JsonCacheStats stats = jsonStats;
+    stats.cached = jsonDocuments.size();
+    return stats;
+}
+
+void FluidDatabase::setJsonCacheCapacity(size_t capacity) {
+    jsonCapacity = capacity;
+    while (jsonDocuments.size() > jsonCapacity) {
+        jsonIndex.erase(jsonDocuments.back().key);
+        jsonDocuments.pop_back();
+        ++jsonStats.evictions;
+    }
+}
+
+bool FluidDatabase::isWriteAheadLog() const {
+    if (!db) return false;
+    sqlite3_stmt* stmt = nullptr;
+    bool wal = false;
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char* mode = sqlite3_column_text(stmt, 0);
+        wal = mode && sqlite3_stricmp(reinterpret_cast<const char*>(mode), "wal") == 0;
+    }
     sqlite3_finalize(stmt);
+    return wal;
+}
+
+std::shared_ptr<FluidDatabase> FluidDatabase::acquireReader() {
+    std::unique_ptr<FluidDatabase> reader;
+    {
+        std::lock_guard<std::mutex> lock(readers->mutex);
+        if (!readers->idle.empty()) {
+            reader = std::move(readers->idle.back());
+            readers->idle.pop_back();
+        }
+    }
+    if (!reader) {
+        reader = std::make_unique<FluidDatabase>(path);
+        if (!reader->openReadOnly()) return nullptr;
+    }
+
+    // Back to the pool when the caller is done, unless the pool is full or this connection is gone
+    std::weak_ptr<ReaderPool> pool = readers;
+    return std::shared_ptr<FluidDatabase>(reader.release(), [pool](FluidDatabase* connection) {
+        if (std::shared_ptr<ReaderPool> owner = pool.lock()) {
+            std::lock_guard<std::mutex> lock(owner->mutex);
+            if (owner->idle.size() < owner->capacity) {
+                owner->idle.emplace_back(connection);
+                return;
+            }
+        }
+        delete connection;
+    });
+}
+
+void FluidDatabase::setReaderPoolSize(size_t size) {
+    std::vector<std::unique_ptr<FluidDatabase>> closing;
+    std::lock_guard<std::mutex> lock(readers->mutex);
+    readers->capacity = size;
+    while (readers->idle.size() > size) {
+        closing.push_back(std::move(readers->idle.back()));
+        readers->idle.pop_back();
+    }
+}
+
+// Opens a connection for checkpoints. A connection only finds the log once it has read the database,
+// and checkpoints on one that has not are no-ops, so it reads the schema first.
+static sqlite3* openCheckpointConnection(const std::string& path) {
+    sqlite3* connection = nullptr;
+    if (sqlite3_open_v2(path.c_str(), &connection, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK
+        || sqlite3_exec(connection, "SELECT count(*) FROM sqlite_master;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        sqlite3_close(connection);
+        return nullptr;
+    }
+    return connection;
+}
+
+bool FluidDatabase::checkpoint(bool truncate) {
+    sqlite3* connection = openCheckpointConnection(path);
+    bool success = false;
+    if (connection) {
+        // Truncating waits for readers through the busy handler
+        sqlite3_busy_timeout(connection, BusyTimeoutMilliseconds);
+        success = sqlite3_wal_checkpoint_v2(connection, nullptr,
+            truncate ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr) == SQLITE_OK;
+        if (!success) printf("SQLite error: %s\n", sqlite3_errmsg(connection));
+    }
+    sqlite3_close(connection);
+    return success;
+}
+
+bool FluidDatabase::startCheckpointer(unsigned intervalMilliseconds) {
+    if (checkpointer.joinable()) return true;
+    if (!validateDB() || !isWriteAheadLog()) return false;
+
+    sqlite3* connection = openCheckpointConnection(path);
+    if (!connection) return false;
+    sqlite3_wal_autocheckpoint(db, 0);
+    checkpointerStopping = false;
+    checkpointer = std::thread([this, connection, intervalMilliseconds]() {
+        std::unique_lock<std::mutex> lock(checkpointMutex);
+        while (!checkpointWake.wait_for(lock, std::chrono::milliseconds(intervalMilliseconds), [this]() { return checkpointerStopping; })) {
+            lock.unlock();
+            // Passive: copies the frames no reader still needs, without taking locks others wait on
+            sqlite3_wal_checkpoint_v2(connection, nullptr, SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+            lock.lock();
+        }
+        sqlite3_close(connection);
+    });
     return true;
 }
 
+void FluidDatabase::stopCheckpointer() {
+    if (!checkpointer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(checkpointMutex);
+        checkpointerStopping = true;
+        checkpointWake.notify_one();
+    }
+    checkpointer.join();
+    if (db) sqlite3_wal_autocheckpoint(db, AutoCheckpointPages);
+}
+
+bool FluidDatabase::execute(const std::string& sql) {
+    sqlite3_stmt* stmt = prepare(sql);
+    if (!stmt) return false;
+    bool success = (sqlite3_step(stmt) == SQLITE_DONE);
+    releaseStatement(stmt);
+    return success;
+}
+
+FluidDatabase::StatementCacheStats FluidDatabase::getStatementCacheStats() const {
+    StatementCacheStats stats = statementStats;
+    stats.cached = statements.size();
+    return stats;
+}
+
+void FluidDatabase::setStatementCacheCapacity(size_t capacity) {
+    statementCapacity = capacity;
+    trimStatements(capacity);
+}
+
+sqlite3_stmt* FluidDatabase::prepare(const std::string& sql) {
+    auto found = statementIndex.find(sql);
+    if (found != statementIndex.end() && !found->second->inUse) {
+        // Move to the front; the statement was reset and cleared when it was released
+        statements.splice(statements.begin(), statements, found->second);
+        found->second->inUse = true;
+        ++statementStats.hits;
+        return found->second->stmt;
+    }
+
+    ++statementStats.misses;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v3(db, sql.c_str(), static_cast<int>(sql.size()) + 1,
+        statementCapacity > 0 ? SQLITE_PREPARE_PERSISTENT : 0, &stmt, nullptr) != SQLITE_OK) {
+        printf("SQLite error: %s\n", sqlite3_errmsg(db));
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+    // A statement whose SQL is already handed out (a nested query) stays uncached
+    if (statementCapacity == 0 || found != statementIndex.end())
+        return stmt;
+
+    statements.push_front(CachedStatement{ sql, stmt, true });
+    statementIndex[sql] = statements.begin();
+    trimStatements(statementCapacity);
+    return stmt;
+}
+
+void FluidDatabase::releaseStatement(sqlite3_stmt* stmt) {
+    if (!stmt) return;
+    for (CachedStatement& entry : statements) {
+        if (entry.stmt == stmt) {
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+            entry.inUse = false;
+            return;
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+void FluidDatabase::trimStatements(size_t capacity) {
+    auto it = statements.end();
+    while (statements.size() > capacity && it != statements.begin()) {
+        --it;
+        if (it->inUse) continue;
+        sqlite3_finalize(it->stmt);
+        statementIndex.erase(it->sql);
+        it = statements.erase(it);
+        ++statementStats.evictions;
+    }
+}
+
 bool FluidDatabase::validateDB() {
     try {
         if (!db) {
@@ -621,4 +1660,75 @@ bool FluidDatabase::validateDB() {
         return false;
     }
     
-}
\ No newline at end of file
+}
+
+bool FluidDatabase::upgradeSchema() {
+    // Same definitions as in schema.sql
+    const char* sql =
+        "CREATE TABLE IF NOT EXISTS SimulationCheckpoints ("
+        "CheckpointID INTEGER PRIMARY KEY, "
+        "SimulationID INTEGER NOT NULL, "
+        "Step INTEGER, "
+        "SimulatedTime REAL, "
+        "FilePath TEXT NOT NULL, "
+        "FileSize INTEGER, "
+        "Checksum INTEGER, "
+        "FormatVersion INTEGER, "
+        "DateTime TEXT, "
+        "FOREIGN KEY (SimulationID) REFERENCES SavedSimulations(SimulationID));"
+        "CREATE TABLE IF NOT EXISTS SimulationMetrics ("
+        "SimulationID INTEGER NOT NULL, "
+        "Step INTEGER NOT NULL, "
+        "SimulatedTime REAL, "
+        "KineticEnergy REAL, "
+        "MaxVelocity REAL, "
+        "PressureIterations INTEGER, "
+        "ViscosityIterations INTEGER, "
+        "Drag REAL, "
+        "Lift REAL, "
+        "StepSeconds REAL, "
+        "PRIMARY KEY (SimulationID, Step), "
+        "FOREIGN KEY (SimulationID) REFERENCES SavedSimulations(SimulationID)) WITHOUT ROWID;"
+        "CREATE TABLE IF NOT EXISTS SimulationFrames ("
+        "FrameID INTEGER PRIMARY KEY, "
+        "SimulationID INTEGER NOT NULL, "
+        "Step INTEGER, "
+        "SimulatedTime REAL, "
+        "Format TEXT, "
+        "Size INTEGER, "
+        "Data BLOB, "
+        "FOREIGN KEY (SimulationID) REFERENCES SavedSimulations(SimulationID));"
+        "CREATE INDEX IF NOT EXISTS idx_SimulationFrames_SimulationID ON SimulationFrames (SimulationID, Step);";
+
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        printf("SQLite error: %s\n", errMsg ? errMsg : sqlite3_errmsg(db));
+        sqlite3_free(errMsg);
+        return false;
+    }
+
+    // Columns added to existing tables; ALTER TABLE has no IF NOT EXISTS for them
+    sqlite3_stmt* stmt = nullptr;
+    int columns = 0;
+    bool hasConfigHash = false;
+    if (sqlite3_prepare_v2(db, "SELECT name FROM pragma_table_info('SavedSimulations');", -1, &stmt, nullptr) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* name = sqlite3_column_text(stmt, 0);
+            ++columns;
+            hasConfigHash = hasConfigHash || (name && sqlite3_stricmp(reinterpret_cast<const char*>(name), "ConfigHash") == 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (columns == 0)
+        return true; // No SavedSimulations table to upgrade
+    const char* upgrade = hasConfigHash
+        ? "CREATE INDEX IF NOT EXISTS idx_SavedSimulations_ConfigHash ON SavedSimulations (ConfigHash);"
+        : "ALTER TABLE SavedSimulations ADD COLUMN ConfigHash TEXT;"
+          "CREATE INDEX IF NOT EXISTS idx_SavedSimulations_ConfigHash ON SavedSimulations (ConfigHash);";
+    if (sqlite3_exec(db, upgrade, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        printf("SQLite error: %s\n", errMsg ? errMsg : sqlite3_errmsg(db));
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
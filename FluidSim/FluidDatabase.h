@@ -1,8 +1,17 @@
 #pragma once
 #include "sqlite3.h"
+#include "FluidJson.h"
 #include <string>
 #include <map>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 /**
@@ -29,15 +38,283 @@ public:
 
     /**
      * @brief Opens the database connection.
+     *
+     * File databases are switched to write-ahead logging (WAL), so readers on other connections keep
+     * reading the last committed state while this connection writes, and a commit appends to the log
+     * instead of rewriting pages. Commits sync the log only at checkpoints (synchronous = NORMAL): a
+     * power loss can drop the last commits but never corrupts the database.
      * @return True if the connection was successful, false otherwise.
      */
     bool open();
 
+    /**
+     * @brief Opens the database as a read-only connection (no schema upgrade, writes fail).
+     * @return True if the connection was successful, false otherwise.
+     */
+    bool openReadOnly();
+
     /**
      * @brief Closes the database connection.
      */
     void close();
 
+    /**
+     * @brief Path of the database file, for opening further connections to it.
+     */
+    const std::string& getPath() const { return path; }
+
+    /**
+     * @brief True if the database is in WAL mode, so readers and the writer do not block each other.
+     */
+    bool isWriteAheadLog() const;
+
+    // --- Read connections ---
+
+    /**
+     * @brief Hands out a read-only connection to the same file from a pool.
+     *
+     * A connection is not shared between threads: each thread that reads takes its own and drops the
+     * pointer when done, which returns it to the pool for the next reader. Under WAL, reads through it
+     * run concurrently with each other and with writes through this connection.
+     * @return The connection, or null if it could not be opened.
+     */
+    std::shared_ptr<FluidDatabase> acquireReader();
+
+    /**
+     * @brief Sets how many idle read connections the pool keeps (default 4); more may be handed out.
+     */
+    void setReaderPoolSize(size_t size);
+
+    // --- WAL checkpoints ---
+
+    /**
+     * @brief Copies the log back into the database file, from a connection of its own.
+     * @param truncate Wait for readers and writers, then truncate the log to zero bytes; otherwise copy
+     * what can be copied without waiting.
+     * @return False if the checkpoint failed or (when truncating) could not complete.
+     */
+    bool checkpoint(bool truncate = false);
+
+    /**
+     * @brief Runs passive checkpoints on a background thread, and stops this connection's commits from
+     * checkpointing themselves, so writers never pay for them.
+     * @param intervalMilliseconds Time between checkpoints.
+     * @return False if the database is not in WAL mode.
+     */
+    bool startCheckpointer(unsigned intervalMilliseconds = 1000);
+
+    /**
+     * @brief Stops the background checkpoints and lets commits checkpoint again.
+     */
+    void stopCheckpointer();
+
+    /**
+     * @brief Counters of the prepared statement cache.
+     *
+     * Every method prepares its SQL through a per-connection cache keyed by the SQL text, so a statement
+     * is parsed once and then reset and rebound on each call. The least recently used statements are
+     * finalized once more than the capacity are cached.
+     */
+    struct StatementCacheStats {
+        unsigned long long hits;      ///< Statements reused from the cache.
+        unsigned long long misses;    ///< Statements prepared (cached or not).
+        unsigned long long evictions; ///< Cached statements finalized to make room.
+        size_t cached;                ///< Statements currently cached.
+    };
+
+    StatementCacheStats getStatementCacheStats() const;
+
+    /**
+     * @brief Sets how many prepared statements are kept; 0 disables the cache.
+     * @param capacity Maximum number of cached statements (default 64).
+     */
+    void setStatementCacheCapacity(size_t capacity);
+
+    // --- Parsed JSON ---
+
+    /**
+     * @brief Counters of the parsed-JSON cache (see parseJson()).
+     */
+    struct JsonCacheStats {
+        unsigned long long hits;      ///< Documents reused without parsing.
+        unsigned long long misses;    ///< Documents parsed (new rows, or rows whose text changed).
+        unsigned long long evictions; ///< Documents dropped to make room.
+        size_t cached;                ///< Documents currently cached.
+    };
+
+    /**
+     * @brief Parses a *JSON column value, reusing the document parsed for the same row when its text is
+     * unchanged.
+     *
+     * Documents are cached per connection by (table, column, rowid) together with the text they were
+     * parsed from; the text is the row's version, so an edited row is parsed again and nothing goes
+     * stale, even when another connection made the edit. Repeated loads of one config (a seed sweep,
+     * a resumed batch) then parse each package once.
+     * @param table Table the value was read from, e.g. "SimulationConfigs".
+     * @param column Column the value was read from, e.g. "OtherParamsJSON".
+     * @param rowid Primary key of the row.
+     * @param text The column value as just loaded.
+     * @param error Optional: receives the parse error.
+     * @return The shared document (null for empty text), or nullptr if the text is not valid JSON.
+     */
+    std::shared_ptr<const FluidJson> parseJson(const std::string& table, const std::string& column, long long rowid,
+        const std::string& text, std::string* error = nullptr);
+
+    JsonCacheStats getJsonCacheStats() const;
+
+    /**
+     * @brief Sets how many parsed documents are kept; 0 disables the cache.
+     * @param capacity Maximum number of cached documents (default 256).
+     */
+    void setJsonCacheCapacity(size_t capacity);
+
+    // --- Transactions ---
+
+    /**
+     * @brief Scoped transaction: everything done through the connection while it is active commits together.
+     *
+     * Runs in autocommit mode fsync once per statement; inside a transaction they share one commit. Each
+     * transaction is a savepoint, so they nest: an inner one that rolls back undoes only its own changes.
+     * One that is neither committed nor rolled back when it goes out of scope rolls back. Transactions of
+     * a connection must end in the reverse order they began.
+     */
+    class Transaction {
+    public:
+        explicit Transaction(FluidDatabase& database);
+        ~Transaction();
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        /**
+         * @brief Commits the changes (or, when nested, keeps them for the enclosing transaction).
+         * @return False if the savepoint could not be released; the transaction has then rolled back.
+         */
+        bool commit();
+
+        /**
+         * @brief Undoes the changes made since the transaction began.
+         */
+        void rollback();
+
+        /**
+         * @brief True from a successful begin until commit() or rollback().
+         */
+        bool isActive() const { return active; }
+
+    private:
+        FluidDatabase& database;
+        std::string savepoint;
+        bool active;
+    };
+
+    // --- Typed rows ---
+    // The typed methods read columns straight into native types. The map-based methods are kept for
+    // callers that handle rows generically; they convert to and from these structs.
+
+    /**
+     * @brief One TypesOfLiquids row.
+     */
+    struct LiquidType {
+        int liquidID;                  ///< 0 to let the database assign it.
+        std::string name;
+        double density;
+        double viscosity;
+        std::string color;
+        std::string description;
+        std::string otherPhysicalPropertiesJSON;
+
+        LiquidType() : liquidID(0), density(0.0), viscosity(0.0) {}
+    };
+
+    /**
+     * @brief One SimulationConfigs row.
+     */
+    struct SimulationConfig {
+        int configID;                  ///< 0 to let the database assign it.
+        std::string name;
+        std::string gridSize;
+        int particleCount;
+        std::string inflowParamsJSON;
+        std::string outflowParamsJSON;
+        double timestep;
+        std::string methodOfComputation;
+        int fluidID;
+        std::string description;
+        bool isStandard;
+        std::string otherParamsJSON;
+
+        SimulationConfig() : configID(0), particleCount(0), timestep(0.0), fluidID(0), isStandard(false) {}
+    };
+
+    /**
+     * @brief One SavedSimulations row.
+     */
+    struct SavedSimulation {
+        int simulationID;              ///< 0 to let the database assign it.
+        int configID;
+        std::string dateTime;
+        std::string resultFilePath;
+        double duration;
+        std::string notes;
+        std::string user;
+        int seed;
+        std::string version;
+        std::string otherMetadataJSON;
+        std::string configHash;        ///< Content hash of the inputs (see FluidRunner::getConfigHash); empty for none.
+
+        SavedSimulation() : simulationID(0), configID(0), duration(0.0), seed(0) {}
+    };
+
+    /**
+     * @brief One SimulationCheckpoints row.
+     */
+    struct Checkpoint {
+        int checkpointID;              ///< Assigned by the database.
+        int simulationID;
+        long long step;
+        double simulatedTime;
+        std::string filePath;
+        long long fileSize;
+        long long checksum;
+        int formatVersion;
+        std::string dateTime;
+
+        Checkpoint() : checkpointID(0), simulationID(0), step(0), simulatedTime(0.0), fileSize(0), checksum(0), formatVersion(0) {}
+    };
+
+    /**
+     * @brief One SimulationMetrics row: whole-domain quantities after one solver step.
+     */
+    struct MetricSample {
+        int simulationID;
+        long long step;
+        double simulatedTime;
+        double kineticEnergy;
+        double maxVelocity;
+        int pressureIterations;
+        int viscosityIterations;
+        double drag;
+        double lift;
+        double stepSeconds;            ///< Wall-clock time of the step.
+
+        MetricSample() : simulationID(0), step(0), simulatedTime(0.0), kineticEnergy(0.0), maxVelocity(0.0),
+            pressureIterations(0), viscosityIterations(0), drag(0.0), lift(0.0), stepSeconds(0.0) {}
+    };
+
+    /**
+     * @brief One SimulationFrames row without its payload, which is read and written through a FrameStream.
+     */
+    struct Frame {
+        long long frameID;             ///< Assigned by the database.
+        int simulationID;
+        long long step;
+        double simulatedTime;
+        std::string format;            ///< What the payload holds, e.g. "checkpoint".
+        long long size;                ///< Payload bytes, fixed when the frame is created.
+
+        Frame() : frameID(0), simulationID(0), step(0), simulatedTime(0.0), size(0) {}
+    };
+
     // --- SimulationConfigs table ---
 
     /**
@@ -48,6 +325,7 @@ public:
      * @return True if the operation was successful, false otherwise.
      */
     bool saveSimulationParameters(const std::map<std::string, std::string>& parameters);
+    bool saveSimulationParameters(const SimulationConfig& config);
 
     /**
      * @brief Loads simulation parameters from the SimulationConfigs table.
@@ -56,6 +334,7 @@ public:
      * @return True if the configuration was found and loaded, false otherwise.
      */
     bool loadSimulationParameters(const int ConfigID, std::map<std::string, std::string>& parameters);
+    bool loadSimulationParameters(const int ConfigID, SimulationConfig& config);
 
     /**
      * @brief Loads all simulation configurations from the SimulationConfigs table.
@@ -63,6 +342,7 @@ public:
      * @return True if the operation was successful, false otherwise.
      */
     bool loadAllSimulationParameters(std::vector<std::map<std::string, std::string>>& records);
+    bool loadAllSimulationParameters(std::vector<SimulationConfig>& records);
 
     /**
      * @brief Updates simulation parameters in the SimulationConfigs table.
@@ -89,6 +369,7 @@ public:
     bool saveLiquidType(const std::string& liquidID, const std::string& name, double density, double viscosity,
         const std::string& color, const std::string& description,
         const std::string& otherPhysicalPropertiesJSON);
+    bool saveLiquidType(const LiquidType& liquid);
 
     /**
      * @brief Loads a liquid type from the TypesOfLiquids table.
@@ -97,6 +378,7 @@ public:
      * @return True if the liquid was found and loaded, false otherwise.
      */
     bool loadLiquidType(int liquidID, std::map<std::string, std::string>& liquidData);
+    bool loadLiquidType(int liquidID, LiquidType& liquid);
 
     /**
      * @brief Loads all liquid types from the TypesOfLiquids table.
@@ -104,6 +386,7 @@ public:
      * @return True if the operation was successful, false otherwise.
 	 */
     bool loadAllLiquidTypes(std::vector<std::map<std::string, std::string>>& records);
+    bool loadAllLiquidTypes(std::vector<LiquidType>& records);
 
     /**
      * @brief Updates a liquid type in the TypesOfLiquids table.
@@ -135,6 +418,20 @@ public:
         const std::string& notes, const std::string& user,
         int seed, const std::string& version,
         const std::string& otherMetadataJSON);
+    bool saveSimulation(const SavedSimulation& record);
+
+    /**
+     * @brief Inserts many SavedSimulations rows in one transaction, reusing one prepared statement.
+     * Either every row is inserted or, if one fails, none are.
+     * @param records Rows to insert.
+     * @param count Number of rows.
+     * @param error Optional: receives the reason on failure, with the index of the failing row.
+     * @return True if every row was inserted.
+     */
+    bool saveSimulations(const SavedSimulation* records, size_t count, std::string* error = nullptr);
+    bool saveSimulations(const std::vector<SavedSimulation>& records, std::string* error = nullptr) {
+        return saveSimulations(records.data(), records.size(), error);
+    }
 
     /**
      * @brief Loads a simulation result from the SavedSimulations table.
@@ -143,6 +440,7 @@ public:
      * @return True if the simulation was found and loaded, false otherwise.
      */
     bool loadSimulation(int simulationID, std::map<std::string, std::string>& simulationData);
+    bool loadSimulation(int simulationID, SavedSimulation& record);
 
     /**
      * @brief Loads all simulation results from the SavedSimulations table.
@@ -150,6 +448,7 @@ public:
      * @return True if the operation was successful, false otherwise.
 	 */
     bool loadAllSimulations(std::vector<std::map<std::string, std::string>>& records);
+    bool loadAllSimulations(std::vector<SavedSimulation>& records);
 
     /**
      * @brief Updates a simulation result in the SavedSimulations table.
@@ -158,6 +457,212 @@ public:
      * @return True if the update was successful, false otherwise.
      */
     bool updateSimulation(int simulationID, std::map<std::string, std::string>& simulationData);
+    // Rewrites every column of the row record.simulationID names (empty values included)
+    bool updateSimulation(const SavedSimulation& record);
+
+    /**
+     * @brief Counters of findResult().
+     */
+    struct ResultCacheStats {
+        unsigned long long hits;   ///< Lookups that found a usable earlier result.
+        unsigned long long misses; ///< Lookups that found none.
+        unsigned long long stale;  ///< Rows passed over because their result file is gone and not stored in SimulationFrames.
+    };
+
+    /**
+     * @brief Finds the newest run recorded with the given ConfigHash whose result still exists, as a file
+     * or as a "checkpoint" frame in SimulationFrames.
+     *
+     * SavedSimulations is content-addressed through the indexed ConfigHash column: rows with the same
+     * hash were computed from the same inputs, so a match can be returned instead of running again.
+     * @param configHash Hash of the inputs; empty never matches.
+     * @param record Receives the row on success.
+     * @return True on a hit.
+     */
+    bool findResult(const std::string& configHash, SavedSimulation& record);
+    ResultCacheStats getResultCacheStats() const { return resultStats; }
+
+    /**
+     * @brief Finds the newest run of a config that never finished (empty ResultFilePath), to resume it
+     * from its checkpoints.
+     * @param configID Config the run belongs to.
+     * @param seed Only runs with this seed, or runs of any seed if negative.
+     * @param record Receives the row on success.
+     * @return True if there is such a run.
+     */
+    bool findUnfinishedSimulation(int configID, long long seed, SavedSimulation& record);
+
+    // --- SimulationCheckpoints table ---
+
+    /**
+     * @brief Records a checkpoint file against its SavedSimulations row.
+     * @param simulationID The simulation the checkpoint belongs to.
+     * @param step Solver step the checkpoint was taken at.
+     * @param simulatedTime Simulated time at that step.
+     * @param filePath Path to the checkpoint file.
+     * @param fileSize Size of the file in bytes.
+     * @param checksum Checksum of the file's section tables, to match the record to the file.
+     * @param formatVersion Checkpoint format version.
+     * @param dateTime Date and time the checkpoint was written.
+     * @return True if the operation was successful, false otherwise.
+     */
+    bool saveCheckpoint(int simulationID, long long step, double simulatedTime, const std::string& filePath,
+        long long fileSize, long long checksum, int formatVersion, const std::string& dateTime);
+    bool saveCheckpoint(const Checkpoint& checkpoint);
+
+    /**
+     * @brief Loads all checkpoints of a simulation, oldest step first.
+     * @param simulationID The simulation whose checkpoints to load.
+     * @param records Vector to be filled with maps of checkpoint column names and values.
+     * @return True if the operation was successful, false otherwise.
+     */
+    bool loadCheckpoints(int simulationID, std::vector<std::map<std::string, std::string>>& records);
+    bool loadCheckpoints(int simulationID, std::vector<Checkpoint>& records);
+
+    /**
+     * @brief Loads the checkpoint with the highest step of a simulation, the one to resume from.
+     * @param simulationID The simulation whose checkpoint to load.
+     * @param checkpointData Map to be filled with checkpoint column names and values.
+     * @return True if the simulation has a checkpoint, false otherwise.
+     */
+    bool loadLatestCheckpoint(int simulationID, std::map<std::string, std::string>& checkpointData);
+
+    // --- SimulationMetrics table ---
+    // A WITHOUT ROWID table clustered on (SimulationID, Step): the samples of one run are stored
+    // together in step order, so a range of them is one contiguous read of the primary key.
+
+    /**
+     * @brief Stores one metric sample, replacing any sample of the same run and step.
+     * @return True if the operation was successful, false otherwise.
+     */
+    bool saveMetric(const MetricSample& sample);
+
+    /**
+     * @brief Stores many metric samples in one transaction, reusing one prepared statement; either all are
+     * stored or none. Samples replace those of the same run and step (a resumed run re-logs its steps).
+     * @param error Optional: receives the reason on failure.
+     */
+    bool saveMetrics(const MetricSample* samples, size_t count, std::string* error = nullptr);
+    bool saveMetrics(const std::vector<MetricSample>& samples, std::string* error = nullptr) {
+        return saveMetrics(samples.data(), samples.size(), error);
+    }
+
+    /**
+     * @brief Metric samples of one run as one array per column, in step order, ready for plotting.
+     */
+    struct MetricSeries {
+        int simulationID;
+        std::vector<long long> step;
+        std::vector<double> simulatedTime;
+        std::vector<double> kineticEnergy;
+        std::vector<double> maxVelocity;
+        std::vector<int> pressureIterations;
+        std::vector<int> viscosityIterations;
+        std::vector<double> drag;
+        std::vector<double> lift;
+        std::vector<double> stepSeconds;
+
+        MetricSeries() : simulationID(0) {}
+        size_t size() const { return step.size(); }
+        void clear();
+    };
+
+    /**
+     * @brief Loads the samples of a run with firstStep <= Step <= lastStep.
+     * @param series Replaced with the samples.
+     * @return True if the query ran (the series may be empty).
+     */
+    bool loadMetrics(int simulationID, long long firstStep, long long lastStep, MetricSeries& series);
+
+    /**
+     * @brief Loads the same step range of many runs, from one consistent snapshot, e.g. to compare
+     * convergence curves.
+     * @param series Receives one series per simulation ID, in the same order.
+     */
+    bool loadMetrics(const std::vector<int>& simulationIDs, long long firstStep, long long lastStep, std::vector<MetricSeries>& series);
+
+    // --- SimulationFrames table ---
+    // Result payloads stored in the database next to their run, instead of (or as well as) the file
+    // ResultFilePath names. Payloads are streamed with SQLite's incremental BLOB I/O, so neither
+    // side ever holds a whole frame in memory or in a bound parameter.
+
+    /**
+     * @brief Incremental access to the payload of one frame; move-only.
+     *
+     * The payload's size is fixed when the frame is created: writes fill it in place and cannot grow
+     * it. Reads and writes take a byte range, so a viewer can fetch one slice of one frame. A payload
+     * is a chain of overflow pages: the first access deep into it walks the chain, later ones reuse
+     * the positions found, so keep one stream open to read many slices. A writable stream must be
+     * destroyed (or closed) before the transaction it was opened in commits.
+     */
+    class FrameStream {
+    public:
+        FrameStream() : database(nullptr), blob(nullptr), bytes(0) {}
+        FrameStream(FrameStream&& other);
+        FrameStream& operator=(FrameStream&& other);
+        ~FrameStream();
+        FrameStream(const FrameStream&) = delete;
+        FrameStream& operator=(const FrameStream&) = delete;
+
+        bool isOpen() const { return blob != nullptr; }
+        long long size() const { return bytes; }
+
+        /**
+         * @brief Copies bytes [offset, offset + count) of the payload into out.
+         * @return False if the range is outside the payload or the read failed.
+         */
+        bool read(long long offset, void* out, size_t count);
+
+        /**
+         * @brief Overwrites bytes [offset, offset + count) of the payload (writable streams only).
+         * @return False if the range is outside the payload or the write failed.
+         */
+        bool write(long long offset, const void* data, size_t count);
+
+        void close();
+
+    private:
+        friend class FluidDatabase;
+        FluidDatabase* database;
+        sqlite3_blob* blob;
+        long long bytes;
+    };
+
+    /**
+     * @brief Inserts a frame whose payload is frame.size zero bytes, to be filled through openFrame().
+     * @param frame Row to insert; frame.frameID receives its primary key.
+     * @param error Optional: receives the reason on failure.
+     * @return True if the row was inserted.
+     */
+    bool createFrame(Frame& frame, std::string* error = nullptr);
+
+    /**
+     * @brief Stores a frame with its payload in one transaction, written in chunks of FrameChunkBytes.
+     * @param frame Row to insert; frame.size is the payload size and frame.frameID receives its primary key.
+     * @param data frame.size bytes.
+     * @param error Optional: receives the reason on failure.
+     */
+    bool saveFrame(Frame& frame, const void* data, std::string* error = nullptr);
+
+    /**
+     * @brief Opens the payload of a frame for reading, or for writing as well.
+     * @return The stream; isOpen() is false if the frame does not exist.
+     */
+    FrameStream openFrame(long long frameID, bool writable = false);
+
+    /**
+     * @brief Reads bytes [offset, offset + count) of a frame's payload, without copying the rest; for
+     * several slices of one frame, read them through one openFrame() stream instead.
+     */
+    bool readFrame(long long frameID, long long offset, void* out, size_t count);
+
+    /**
+     * @brief Loads the frames of a run (without their payloads), in step order.
+     */
+    bool loadFrames(int simulationID, std::vector<Frame>& frames);
+
+    // Bytes written per sqlite3_blob_write by saveFrame()
+    static const size_t FrameChunkBytes = 1 << 20;
 
     /**
      * @brief Checks if the database is open.
@@ -165,8 +670,136 @@ public:
 	 */
     const char* lastError() const { return db ? sqlite3_errmsg(db) : "No DB connection"; }
 
+    /**
+     * @brief True if the last call failed because another connection held the lock past the busy timeout.
+     */
+    bool lastErrorIsBusy() const {
+        const int code = db ? sqlite3_errcode(db) : SQLITE_OK;
+        return code == SQLITE_BUSY || code == SQLITE_LOCKED;
+    }
+
+    /**
+     * @brief Primary key of the row most recently inserted through this connection.
+     * @return The rowid, or 0 if nothing has been inserted.
+     */
+    long long lastInsertID() const { return db ? sqlite3_last_insert_rowid(db) : 0; }
+
 	// --- General Query Methods ---
 
+    /**
+     * @brief A condition on a value inside a *JSON column, evaluated by SQLite's JSON functions.
+     *
+     * Text that is not valid JSON (or empty) has no values, so it never matches. A predicate is
+     * compiled to the same expression addJsonIndex() indexes, so an indexed path is a search rather
+     * than a scan.
+     */
+    struct JsonPredicate {
+        enum class Comparison { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, Present };
+
+        std::string column;    ///< JSON column, e.g. "OtherParamsJSON".
+        std::string path;      ///< JSON path starting with '$', e.g. "$.steps" or "$.obstacles[0].type".
+        Comparison comparison;
+        std::string value;     ///< Compared as a number if it is one, as 1/0 for true/false, else as text; unused by Present.
+
+        JsonPredicate() : comparison(Comparison::Equal) {}
+        JsonPredicate(const std::string& column, const std::string& path, Comparison comparison, const std::string& value = std::string())
+            : column(column), path(path), comparison(comparison), value(value) {}
+    };
+
+    /**
+     * @brief Paging and ordering for cursor queries.
+     *
+     * Keyset pagination: order by a unique column (usually the primary key), remember its value in the
+     * last row of a page and pass it as after for the next page. Unlike a growing offset, each page
+     * then costs the same however deep it is.
+     */
+    struct QueryOptions {
+        std::string orderBy;  ///< Column to order by; empty for table order.
+        bool descending;      ///< Order from the highest orderBy value.
+        std::string after;    ///< If hasAfter: only rows whose orderBy value comes after this one.
+        bool hasAfter;
+        long long limit;      ///< Maximum rows, or -1 for all.
+        long long offset;     ///< Rows to skip first.
+        std::vector<JsonPredicate> json; ///< Conditions inside JSON columns, ANDed with the filters.
+
+        QueryOptions() : descending(false), hasAfter(false), limit(-1), offset(0) {}
+    };
+
+    /**
+     * @brief Rows of a query, read one at a time.
+     *
+     * Column values are read from the current row in place: text() stays valid until the next call to
+     * next() or the cursor is destroyed, so a scan runs in constant memory however many rows it visits.
+     * A cursor keeps its statement (and a read of the database) until it is destroyed.
+     */
+    class Cursor {
+    public:
+        Cursor() : database(nullptr), stmt(nullptr), error(false) {}
+        Cursor(Cursor&& other);
+        Cursor& operator=(Cursor&& other);
+        ~Cursor();
+        Cursor(const Cursor&) = delete;
+        Cursor& operator=(const Cursor&) = delete;
+
+        /**
+         * @brief Moves to the next row (the first, on the first call).
+         * @return False after the last row or on an error (see failed()).
+         */
+        bool next();
+
+        /**
+         * @brief True if the query could not be prepared or a step failed.
+         */
+        bool failed() const { return error; }
+
+        int columnCount() const { return stmt ? sqlite3_column_count(stmt) : 0; }
+        const char* columnName(int column) const { return sqlite3_column_name(stmt, column); }
+        bool isNull(int column) const { return sqlite3_column_type(stmt, column) == SQLITE_NULL; }
+        long long integer(int column) const { return sqlite3_column_int64(stmt, column); }
+        double real(int column) const { return sqlite3_column_double(stmt, column); }
+
+        /**
+         * @brief Text of a column of the current row, "" for NULL; valid until next().
+         */
+        const char* text(int column) const;
+        // Bytes of text(column), without the terminator; call after text()
+        size_t textSize(int column) const { return static_cast<size_t>(sqlite3_column_bytes(stmt, column)); }
+
+    private:
+        friend class FluidDatabase;
+        FluidDatabase* database;
+        sqlite3_stmt* stmt;
+        bool error;
+
+        void release();
+    };
+
+    /**
+     * @brief Starts a query whose rows are read through a cursor instead of collected.
+     * @param tableName Name of the table to query.
+     * @param columns List of column names to retrieve.
+     * @param filters Map of column names and their filter values; empty values are ignored.
+     * @param options Ordering, keyset and LIMIT/OFFSET paging.
+     * @return The cursor; failed() is true if the query does not compile.
+     */
+    Cursor openCursor(
+        const std::string& tableName,
+        const std::vector<std::string>& columns,
+        const std::map<std::string, std::string>& filters,
+        const QueryOptions& options = QueryOptions());
+
+    /**
+     * @brief Runs a query and calls visit for each row, in constant memory.
+     * @param visit Receives the cursor on each row; return false to stop early.
+     * @return True if the query ran to the end or visit stopped it, false on an error.
+     */
+    bool forEachRow(
+        const std::string& tableName,
+        const std::vector<std::string>& columns,
+        const std::map<std::string, std::string>& filters,
+        const QueryOptions& options,
+        const std::function<bool(const Cursor&)>& visit);
+
     /**
      * @brief Queries a table in the database.
      * @param tableName Name of the table to query.
@@ -181,13 +814,110 @@ public:
         const std::map<std::string, std::string>& filters,
         std::vector<std::map<std::string, std::string>>& results);
 
+    /**
+     * @brief queryTable() with conditions on values inside JSON columns, filtered by SQLite rather than
+     * by loading and parsing every row.
+     * @param predicates JSON-path conditions, ANDed with the filters.
+     */
+    bool queryTable(
+        const std::string& tableName,
+        const std::vector<std::string>& columns,
+        const std::map<std::string, std::string>& filters,
+        const std::vector<JsonPredicate>& predicates,
+        std::vector<std::map<std::string, std::string>>& results);
+
+    /**
+     * @brief Indexes a path inside a JSON column, so predicates on it search the index.
+     *
+     * The index is on the predicate expression itself, so it serves every JsonPredicate with the same
+     * column and path. Optionally the value is also exposed as a VIRTUAL generated column, computed on
+     * read and costing no storage, to select or order by name.
+     * @param tableName Table holding the column.
+     * @param column JSON column.
+     * @param path JSON path starting with '$'.
+     * @param generatedColumn Name of the generated column to add, or empty for none.
+     * @param error Optional: receives the reason on failure.
+     * @return True if the index (and column) exist afterwards.
+     */
+    bool addJsonIndex(const std::string& tableName, const std::string& column, const std::string& path,
+        const std::string& generatedColumn = std::string(), std::string* error = nullptr);
+
 private:
     std::string path; ///< Path to the SQLite database file.
     sqlite3* db;      ///< SQLite database connection handle.
 
+    // Prepared statement cache: most recently used first
+    struct CachedStatement {
+        std::string sql;
+        sqlite3_stmt* stmt;
+        bool inUse; ///< Handed out by prepare() and not yet released.
+    };
+    std::list<CachedStatement> statements;
+    std::unordered_map<std::string, std::list<CachedStatement>::iterator> statementIndex;
+    size_t statementCapacity;
+    StatementCacheStats statementStats;
+    int transactionDepth; ///< Savepoints currently open.
+    std::unordered_set<sqlite3_blob*> frameBlobs; ///< Open FrameStream handles, closed by close().
+
+    // Parsed JSON cache: most recently used first, keyed by table, column and rowid
+    struct CachedJson {
+        std::string key;
+        std::string text; ///< Value the document was parsed from.
+        std::shared_ptr<const FluidJson> document;
+    };
+    std::list<CachedJson> jsonDocuments;
+    std::unordered_map<std::string, std::list<CachedJson>::iterator> jsonIndex;
+    size_t jsonCapacity;
+    JsonCacheStats jsonStats;
+    ResultCacheStats resultStats;
+
+    // Idle read connections; shared with the handed-out pointers, which return them here
+    struct ReaderPool {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<FluidDatabase>> idle;
+        size_t capacity;
+    };
+    std::shared_ptr<ReaderPool> readers;
+
+    // Background checkpoints
+    std::thread checkpointer;
+    std::mutex checkpointMutex;
+    std::condition_variable checkpointWake;
+    bool checkpointerStopping;
+
+    /**
+     * @brief Runs a statement that returns no rows, through the statement cache.
+     * @return True if it completed.
+     */
+    bool execute(const std::string& sql);
+
+    /**
+     * @brief Returns a prepared statement for sql, reused from the cache when possible, with no bindings.
+     * Pair every successful call with releaseStatement().
+     * @param sql Statement text; also the cache key.
+     * @return The statement, or nullptr if it does not compile (the error is printed).
+     */
+    sqlite3_stmt* prepare(const std::string& sql);
+
+    /**
+     * @brief Resets a statement from prepare() and returns it to the cache (or finalizes it if it is not cached).
+     */
+    void releaseStatement(sqlite3_stmt* stmt);
+
+    /**
+     * @brief Finalizes the cached statements beyond capacity, oldest first; statements in use are kept.
+     */
+    void trimStatements(size_t capacity);
+
     /**
      * @brief Validates that DB exists
      * @return True if DB exists, false otherwise and throws runtime error.
      */
     bool validateDB();
+
+    /**
+     * @brief Creates tables added after the original schema, for databases created before them.
+     * @return True if the schema is up to date.
+     */
+    bool upgradeSchema();
 };
\ No newline at end of file
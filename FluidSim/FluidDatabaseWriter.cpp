@@ -0,0 +1,279 @@
+#include "FluidDatabaseWriter.h"
+#include <chrono>
+#include <vector>
+
+// Times a batch is written again after another connection held the lock past the busy timeout
+static const int BusyRetries = 3;
+
+static long long writeRecord(FluidDatabase& database, const FluidDatabase::SavedSimulation& record) {
+	return database.saveSimulation(record) ? database.lastInsertID() : 0;
+}
+
+static long long writeRecord(FluidDatabase& database, const FluidDatabase::Checkpoint& record) {
+	return database.saveCheckpoint(record) ? database.lastInsertID() : 0;
+}
+
+static long long writeRecord(FluidDatabase& database, const FluidDatabase::MetricSample& record) {
+	return database.saveMetric(record) ? 1 : 0;
+}
+
+template <typename Record>
+struct FluidDatabaseWriter::RecordNode : FluidDatabaseWriter::Node {
+	Record record;
+	explicit RecordNode(const Record& value) : Node(true), record(value) {}
+	long long write(FluidDatabase& database) override { return writeRecord(database, record); }
+};
+
+// Resolves a node's future, if it has one
+static void finish(std::unique_ptr<std::promise<long long>>& promise, long long rowid) {
+	if (promise)
+		promise->set_value(rowid);
+}
+
+FluidDatabaseWriter::FluidDatabaseWriter()
+	: running(false), head(&stub), tail(&stub), pending(0), posted(0), written(0), failed(0), dropped(0), batches(0),
+	stopping(false), flushRequested(false) {
+}
+
+FluidDatabaseWriter::~FluidDatabaseWriter() {
+	stop();
+}
+
+bool FluidDatabaseWriter::start(const std::string& path, const Options& writerOptions, std::string* error) {
+	if (running) {
+		if (error) *error = "The writer is already running";
+		return false;
+	}
+	if (writerOptions.maxBatch == 0 || writerOptions.maxPending == 0) {
+		if (error) *error = "maxBatch and maxPending must be positive";
+		return false;
+	}
+	options = writerOptions;
+	database = std::make_unique<FluidDatabase>(path);
+	if (!database->open()) {
+		if (error) *error = "Cannot open " + path + ": " + database->lastError();
+		database.reset();
+		return false;
+	}
+	posted = written = failed = dropped = batches = 0;
+	stopping = false;
+	flushRequested = false;
+	running = true;
+	writer = std::thread(&FluidDatabaseWriter::writerLoop, this);
+	return true;
+}
+
+void FluidDatabaseWriter::stop() {
+	if (!running)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		wake.notify_one();
+		drained.notify_all();
+	}
+	writer.join();
+	running = false;
+	// Nothing can be pushed once stopping is set; this only frees what the writer never reached
+	while (Node* node = pop()) {
+		finish(node->promise, 0);
+		if (node->isRecord) {
+			--pending;
+			++dropped;
+		}
+		delete node;
+	}
+	database.reset();
+}
+
+bool FluidDatabaseWriter::enqueue(Node* node) {
+	{
+		// The slot is reserved and the node pushed under the lock stop() sets stopping with, so the count
+		// never overshoots maxPending and no record lands after the final drain
+		std::unique_lock<std::mutex> lock(mutex);
+		if (options.blockWhenFull)
+			drained.wait(lock, [this]() { return pending.load() < options.maxPending || stopping || !running; });
+		if (running && !stopping) {
+			if (pending.load() < options.maxPending) {
+				push(node);
+				++posted;
+				if (++pending == options.maxBatch)
+					wake.notify_one();
+				return true;
+			}
+			++dropped;
+		}
+	}
+	finish(node->promise, 0);
+	delete node;
+	return false;
+}
+
+bool FluidDatabaseWriter::post(const FluidDatabase::SavedSimulation& record) {
+	return enqueue(new RecordNode<FluidDatabase::SavedSimulation>(record));
+}
+
+bool FluidDatabaseWriter::post(const FluidDatabase::Checkpoint& record) {
+	return enqueue(new RecordNode<FluidDatabase::Checkpoint>(record));
+}
+
+bool FluidDatabaseWriter::post(const FluidDatabase::MetricSample& record) {
+	return enqueue(new RecordNode<FluidDatabase::MetricSample>(record));
+}
+
+std::future<long long> FluidDatabaseWriter::submit(const FluidDatabase::SavedSimulation& record) {
+	Node* node = new RecordNode<FluidDatabase::SavedSimulation>(record);
+	node->promise = std::make_unique<std::promise<long long>>();
+	std::future<long long> result = node->promise->get_future();
+	enqueue(node);
+	return result;
+}
+
+std::future<long long> FluidDatabaseWriter::submit(const FluidDatabase::Checkpoint& record) {
+	Node* node = new RecordNode<FluidDatabase::Checkpoint>(record);
+	node->promise = std::make_unique<std::promise<long long>>();
+	std::future<long long> result = node->promise->get_future();
+	enqueue(node);
+	return result;
+}
+
+std::future<long long> FluidDatabaseWriter::submit(const FluidDatabase::MetricSample& record) {
+	Node* node = new RecordNode<FluidDatabase::MetricSample>(record);
+	node->promise = std::make_unique<std::promise<long long>>();
+	std::future<long long> result = node->promise->get_future();
+	enqueue(node);
+	return result;
+}
+
+bool FluidDatabaseWriter::flush() {
+	// A barrier: resolves once every node pushed before it has been written
+	std::future<long long> done;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running || stopping)
+			return false;
+		Node* barrier = new Node();
+		barrier->promise = std::make_unique<std::promise<long long>>();
+		done = barrier->promise->get_future();
+		push(barrier);
+		flushRequested = true;
+		wake.notify_one();
+	}
+	return done.get() != 0;
+}
+
+FluidDatabaseWriter::Stats FluidDatabaseWriter::getStats() const {
+	Stats stats;
+	stats.posted = posted;
+	stats.written = written;
+	stats.failed = failed;
+	stats.dropped = dropped;
+	stats.batches = batches;
+	stats.pending = pending;
+	return stats;
+}
+
+void FluidDatabaseWriter::push(Node* node) {
+	node->next.store(nullptr, std::memory_order_relaxed);
+	Node* previous = head.exchange(node, std::memory_order_acq_rel);
+	previous->next.store(node, std::memory_order_release);
+}
+
+FluidDatabaseWriter::Node* FluidDatabaseWriter::pop() {
+	Node* first = tail;
+	Node* next = first->next.load(std::memory_order_acquire);
+	if (first == &stub) {
+		if (!next)
+			return nullptr;
+		tail = next;
+		first = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next) {
+		tail = next;
+		return first;
+	}
+	// first is the last node: a producer may be between its exchange and its link
+	if (first != head.load(std::memory_order_acquire))
+		return nullptr;
+	push(&stub);
+	next = first->next.load(std::memory_order_acquire);
+	if (next) {
+		tail = next;
+		return first;
+	}
+	return nullptr;
+}
+
+void FluidDatabaseWriter::writerLoop() {
+	for (;;) {
+		bool last;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait_for(lock, std::chrono::milliseconds(options.flushIntervalMilliseconds), [this]() {
+				return stopping || flushRequested || pending.load() >= options.maxBatch;
+			});
+			last = stopping;
+			flushRequested = false;
+		}
+		while (writeBatch() > 0) {
+		}
+		if (last)
+			break;
+	}
+}
+
+size_t FluidDatabaseWriter::writeBatch() {
+	std::vector<Node*> batch;
+	size_t records = 0;
+	while (records < options.maxBatch) {
+		Node* node = pop();
+		if (!node)
+			break;
+		batch.push_back(node);
+		if (node->isRecord)
+			++records;
+	}
+	if (batch.empty())
+		return 0;
+	if (records > 0) {
+		pending -= records;
+		if (options.blockWhenFull) {
+			std::lock_guard<std::mutex> lock(mutex);
+			drained.notify_all();
+		}
+	}
+
+	// Rows rejected on their own (e.g. a constraint) fail alone; a busy database rolls the batch back
+	// and writes it again, and a commit that still fails fails the batch
+	std::vector<long long> rowids(batch.size(), 0);
+	bool committed = true;
+	for (int attempt = 0; records > 0; ++attempt) {
+		FluidDatabase::Transaction transaction(*database);
+		bool busy = false;
+		for (size_t i = 0; i < batch.size() && !busy; ++i) {
+			rowids[i] = batch[i]->write(*database);
+			busy = rowids[i] == 0 && database->lastErrorIsBusy();
+		}
+		// Releasing the savepoint only fails while another connection holds the lock
+		committed = !busy && transaction.commit();
+		if (committed) {
+			++batches;
+			break;
+		}
+		if (attempt == BusyRetries)
+			break;
+	}
+	if (records == 0)
+		rowids.assign(batch.size(), 1);
+
+	for (size_t i = 0; i < batch.size(); ++i) {
+		Node* node = batch[i];
+		const long long rowid = committed ? rowids[i] : 0;
+		if (node->isRecord)
+			++(rowid != 0 ? written : failed);
+		finish(node->promise, rowid);
+		delete node;
+	}
+	return batch.size();
+}
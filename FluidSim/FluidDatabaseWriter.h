@@ -0,0 +1,126 @@
+#pragma once
+#include "FluidDatabase.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * @brief Writes records to the database on a background thread, so the caller never waits on SQLite.
+ *
+ * Records are pushed onto a multi-producer queue: posting one allocates a node and, under a short
+ * lock that reserves its slot, swaps a pointer; the writer pops without the lock. A writer thread with
+ * its own connection drains the queue every flush interval (or as soon as a batch's worth is
+ * pending), writing up to maxBatch records per transaction, so a thousand rows cost one commit
+ * instead of a thousand.
+ *
+ * Back-pressure: once maxPending records are waiting, posting either fails and counts the record as
+ * dropped (the default, for callers that must not stall) or blocks until the writer catches up.
+ * Callers that need to know a record landed use the submit* methods, whose futures resolve after the
+ * record's transaction commits.
+ */
+class FluidDatabaseWriter {
+public:
+	struct Options {
+		unsigned flushIntervalMilliseconds; // Longest a record waits before its batch is written
+		size_t maxBatch;                    // Records per transaction
+		size_t maxPending;                  // Records queued before posting pushes back
+		bool blockWhenFull;                 // Wait for room instead of dropping
+
+		Options() : flushIntervalMilliseconds(100), maxBatch(4096), maxPending(1 << 20), blockWhenFull(false) {}
+	};
+
+	struct Stats {
+		uint64_t posted;   // Accepted onto the queue
+		uint64_t written;  // Committed
+		uint64_t failed;   // Rejected by the database, or lost with a failed commit
+		uint64_t dropped;  // Refused because the queue was full
+		uint64_t batches;  // Transactions committed
+		uint64_t pending;  // Waiting in the queue
+	};
+
+	FluidDatabaseWriter();
+	~FluidDatabaseWriter();
+	FluidDatabaseWriter(const FluidDatabaseWriter&) = delete;
+	FluidDatabaseWriter& operator=(const FluidDatabaseWriter&) = delete;
+
+	/**
+	 * @brief Opens a connection of its own to the database file and starts the writer thread.
+	 * @param path Database file, e.g. FluidDatabase::getPath() of the application's connection.
+	 * @param options Batching and back-pressure.
+	 * @param error Optional: receives the reason on failure.
+	 */
+	bool start(const std::string& path, const Options& options = Options(), std::string* error = nullptr);
+
+	/**
+	 * @brief Writes everything still queued, then stops the writer thread and closes its connection.
+	 */
+	void stop();
+
+	bool isRunning() const { return running; }
+
+	// Fire and forget: false if the writer is not running or the record was dropped
+	bool post(const FluidDatabase::SavedSimulation& record);
+	bool post(const FluidDatabase::Checkpoint& record);
+	bool post(const FluidDatabase::MetricSample& record);
+
+	/**
+	 * @brief Queues a record and returns a future for its outcome.
+	 * @return Resolves to the rowid of the inserted row once its transaction commits, or 0 if the record
+	 * was dropped, rejected or its commit failed. SimulationMetrics has no rowid, so a metric sample
+	 * resolves to 1 once written.
+	 */
+	std::future<long long> submit(const FluidDatabase::SavedSimulation& record);
+	std::future<long long> submit(const FluidDatabase::Checkpoint& record);
+	std::future<long long> submit(const FluidDatabase::MetricSample& record);
+
+	/**
+	 * @brief Waits until every record posted before the call has been written.
+	 * @return False if the writer is not running or the last batch failed to commit.
+	 */
+	bool flush();
+
+	Stats getStats() const;
+
+private:
+	// Queue node; the base class is the queue's stub and flush() barrier
+	struct Node {
+		std::atomic<Node*> next;
+		std::unique_ptr<std::promise<long long>> promise;
+		bool isRecord; // False for the stub and barriers
+		explicit Node(bool isRecord = false) : next(nullptr), isRecord(isRecord) {}
+		virtual ~Node() {}
+		// Returns the rowid written, 0 on failure; the barrier writes nothing and reports 1
+		virtual long long write(FluidDatabase&) { return 1; }
+	};
+	template <typename Record> struct RecordNode;
+
+	Options options;
+	std::unique_ptr<FluidDatabase> database;
+	std::thread writer;
+	std::atomic<bool> running;
+
+	// Vyukov MPSC queue: producers exchange head, the writer alone follows tail
+	std::atomic<Node*> head;
+	Node* tail;
+	Node stub;
+
+	std::atomic<uint64_t> pending;
+	std::atomic<uint64_t> posted, written, failed, dropped, batches;
+
+	std::mutex mutex;                 // Guards pushes against stop() and the pending limit, and sleeping
+	std::condition_variable wake;     // Writer: a batch is ready, or stop
+	std::condition_variable drained;  // Producers: room in the queue
+	bool stopping;
+	bool flushRequested;
+
+	bool enqueue(Node* node);
+	void push(Node* node);
+	Node* pop();
+	void writerLoop();
+	size_t writeBatch();
+};
@@ -0,0 +1,257 @@
+#include "FluidDataset.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+const uint32_t FluidDataset::FormatVersion;
+const int FluidDataset::MaxChannels;
+
+static const char Magic[8] = { 'F', 'L', 'U', 'I', 'D', 'S', 'E', 'T' };
+static const size_t HeaderBytes = 128;
+static const size_t IndexEntryBytes = 32;
+static const uint64_t DataAlignment = 4096;
+
+static void put32(uint8_t* at, uint32_t value) { std::memcpy(at, &value, 4); }
+static void put64(uint8_t* at, uint64_t value) { std::memcpy(at, &value, 8); }
+
+static bool fail(std::string* error, const std::string& reason) {
+	if (error)
+		*error = reason;
+	return false;
+}
+
+FluidDataset::FluidDataset()
+	: size{ 0, 0, 0 }, extent{ 0, 0, 0 }, frameCells(0), sampleBytes(0), dataOffset(0), capturing(-1), running(false), stopping(false),
+	shard(nullptr), shardSamples(0), stats() {
+}
+
+FluidDataset::~FluidDataset() {
+	finish();
+}
+
+bool FluidDataset::open(const Options& exportOptions, const FluidGrid& grid, std::string* error) {
+	if (running)
+		return fail(error, "A dataset export is already running");
+	options = exportOptions;
+	const int dims = grid.getDimensions();
+	if (options.channels.empty()) {
+		options.channels = { FluidNet::Channel::VelocityX, FluidNet::Channel::VelocityY };
+		if (dims == 3)
+			options.channels.push_back(FluidNet::Channel::VelocityZ);
+		options.channels.insert(options.channels.end(), { FluidNet::Channel::Pressure, FluidNet::Channel::Solid, FluidNet::Channel::Liquid });
+	}
+	size[0] = grid.getWidth();
+	size[1] = grid.getHeight();
+	size[2] = grid.getDepth();
+	const int smallest = dims == 3 ? std::min(size[0], std::min(size[1], size[2])) : std::min(size[0], size[1]);
+	if (static_cast<int>(options.channels.size()) > MaxChannels)
+		return fail(error, "A dataset holds at most " + std::to_string(MaxChannels) + " channels");
+	if (options.interval < 1 || options.gap < 1 || options.patchesPerFrame < 1 || options.samplesPerShard < 1)
+		return fail(error, "Dataset interval, gap, patch count and shard size must be positive");
+	if (options.patch < 0 || options.patch > smallest)
+		return fail(error, "Dataset patches must fit in the grid (at most " + std::to_string(smallest) + " cells)");
+	if (options.samplesPerShard > (1 << 24))
+		return fail(error, "Dataset shards hold at most 16M samples");
+
+	for (int d = 0; d < 3; ++d)
+		extent[d] = options.patch > 0 && (d < 2 || dims == 3) ? options.patch : size[d];
+	const size_t channels = options.channels.size();
+	frameCells = static_cast<size_t>(grid.getCellCount());
+	sampleBytes = 2 * channels * static_cast<size_t>(extent[0]) * extent[1] * extent[2] * sizeof(float);
+	dataOffset = (HeaderBytes + IndexEntryBytes * options.samplesPerShard + DataAlignment - 1) / DataAlignment * DataAlignment;
+
+	for (Frame& frame : frames)
+		frame.data.resize(2 * channels * frameCells);
+	freeFrames = { 0, 1 };
+	queued.clear();
+	capturing = -1;
+	random.seed(options.seed);
+	stats = Stats();
+	shardPaths.clear();
+	writeError.clear();
+	index.assign(IndexEntryBytes * options.samplesPerShard, 0);
+	sample.resize(sampleBytes / sizeof(float));
+	stopping = false;
+	running = true;
+	writer = std::thread(&FluidDataset::writerLoop, this);
+	return true;
+}
+
+void FluidDataset::capture(const FluidGrid& grid, float* out) const {
+	for (size_t c = 0; c < options.channels.size(); ++c)
+		FluidNet::readChannel(grid, options.channels[c], options.dt, out + c * frameCells);
+}
+
+void FluidDataset::observe(const FluidGrid& grid, uint64_t step, double simulatedTime) {
+	if (!running)
+		return;
+	const size_t half = options.channels.size() * frameCells;
+	if (capturing >= 0 && step >= frames[capturing].nextStep) {
+		capture(grid, frames[capturing].data.data() + half);
+		std::lock_guard<std::mutex> lock(mutex);
+		queued.push_back(capturing);
+		capturing = -1;
+		wake.notify_one();
+	}
+	if (capturing >= 0 || step % options.interval != 0)
+		return;
+
+	int free = -1;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (freeFrames.empty()) {
+			++stats.dropped;
+			return;
+		}
+		free = freeFrames.back();
+		freeFrames.pop_back();
+		++stats.frames;
+	}
+	Frame& frame = frames[free];
+	capture(grid, frame.data.data());
+	frame.step = step;
+	frame.simulatedTime = simulatedTime;
+	frame.nextStep = step + options.gap;
+	capturing = free;
+}
+
+bool FluidDataset::finish(std::string* error) {
+	if (!running)
+		return writeError.empty() || fail(error, writeError);
+	{
+		// A frame still waiting for its next state is dropped
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		wake.notify_one();
+	}
+	writer.join();
+	running = false;
+	capturing = -1;
+	return writeError.empty() || fail(error, writeError);
+}
+
+FluidDataset::Stats FluidDataset::getStats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void FluidDataset::writerLoop() {
+	for (;;) {
+		int next;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return !queued.empty() || stopping; });
+			if (queued.empty())
+				break;
+			next = queued.front();
+			queued.pop_front();
+		}
+		// After a write error the frames are only released
+		const bool ok = writeError.empty() && writeFrame(frames[next]);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!ok && writeError.empty())
+			writeError = "Cannot write " + shardPath;
+		freeFrames.push_back(next);
+	}
+	if (shard && !closeShard() && writeError.empty())
+		writeError = "Cannot complete " + shardPath;
+}
+
+bool FluidDataset::writeFrame(const Frame& frame) {
+	const size_t channels = options.channels.size();
+	const int patches = options.patch > 0 ? options.patchesPerFrame : 1;
+	for (int p = 0; p < patches; ++p) {
+		int origin[3] = { 0, 0, 0 };
+		for (int d = 0; d < 3; ++d) {
+			if (extent[d] < size[d])
+				origin[d] = std::uniform_int_distribution<int>(0, size[d] - extent[d])(random);
+		}
+
+		// Rows of the window, state half then next-state half
+		float* out = sample.data();
+		for (size_t plane = 0; plane < 2 * channels; ++plane) {
+			const float* in = frame.data.data() + plane * frameCells;
+			for (int z = 0; z < extent[2]; ++z) {
+				for (int y = 0; y < extent[1]; ++y, out += extent[0]) {
+					const float* row = in + (static_cast<size_t>(origin[2] + z) * size[1] + origin[1] + y) * size[0] + origin[0];
+					std::copy(row, row + extent[0], out);
+				}
+			}
+		}
+
+		if (!shard && !openShard())
+			return false;
+		if (std::fwrite(sample.data(), 1, sampleBytes, shard) != sampleBytes)
+			return false;
+		uint8_t* entry = index.data() + IndexEntryBytes * shardSamples;
+		put64(entry, frame.step);
+		std::memcpy(entry + 8, &frame.simulatedTime, 8);
+		for (int d = 0; d < 3; ++d)
+			put32(entry + 16 + 4 * d, static_cast<uint32_t>(origin[d]));
+		++shardSamples;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++stats.samples;
+		}
+		if (shardSamples == static_cast<uint32_t>(options.samplesPerShard) && !closeShard())
+			return false;
+	}
+	return true;
+}
+
+bool FluidDataset::openShard() {
+	char name[32];
+	std::snprintf(name, sizeof(name), "_%05llu.fset", static_cast<unsigned long long>(shardPaths.size()));
+	shardPath = options.directory;
+	if (!shardPath.empty() && shardPath.back() != '/' && shardPath.back() != '\\')
+		shardPath += '/';
+	shardPath += options.prefix + name;
+	shard = std::fopen((shardPath + ".tmp").c_str(), "wb");
+	if (!shard)
+		return false;
+	// Header and index are filled in when the shard is complete
+	std::vector<uint8_t> zeros(static_cast<size_t>(dataOffset), 0);
+	shardSamples = 0;
+	return std::fwrite(zeros.data(), 1, zeros.size(), shard) == zeros.size();
+}
+
+bool FluidDataset::closeShard() {
+	uint8_t head[HeaderBytes] = {};
+	std::memcpy(head, Magic, sizeof(Magic));
+	put32(head + 8, FormatVersion);
+	put32(head + 12, static_cast<uint32_t>(options.channels.size()));
+	for (int d = 0; d < 3; ++d)
+		put32(head + 16 + 4 * d, static_cast<uint32_t>(extent[d]));
+	put32(head + 28, static_cast<uint32_t>(options.samplesPerShard));
+	put32(head + 32, shardSamples);
+	put64(head + 40, sampleBytes);
+	put64(head + 48, HeaderBytes);
+	put64(head + 56, dataOffset);
+	for (int c = 0; c < MaxChannels; ++c)
+		put32(head + 64 + 4 * c, c < static_cast<int>(options.channels.size()) ? static_cast<uint32_t>(options.channels[c]) : 0xffffffffu);
+
+	bool ok = std::fseek(shard, 0, SEEK_SET) == 0 && std::fwrite(head, 1, HeaderBytes, shard) == HeaderBytes
+		&& std::fwrite(index.data(), 1, IndexEntryBytes * shardSamples, shard) == IndexEntryBytes * shardSamples;
+	ok = std::fclose(shard) == 0 && ok;
+	shard = nullptr;
+	const std::string temporary = shardPath + ".tmp";
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temporary.c_str(), shardPath.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	ok = ok && std::rename(temporary.c_str(), shardPath.c_str()) == 0;
+#endif
+	if (!ok) {
+		std::remove(temporary.c_str());
+		return false;
+	}
+	shardPaths.push_back(shardPath);
+	std::lock_guard<std::mutex> lock(mutex);
+	++stats.shards;
+	return true;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include "FluidGrid.h"
+#include "FluidNet.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Exports (state, next state) training pairs from a running simulation into sharded files.
+ *
+ * Every interval steps the chosen grid channels are captured, and captured again gap steps later; the
+ * two captures form one frame. A frame becomes one sample (the whole grid) or patchesPerFrame samples
+ * (random patch x patch [x patch] windows, the same window in both halves). Samples are appended to
+ * shards of samplesPerShard samples each.
+ *
+ * Capturing copies the channels into one of two frame buffers on the caller's thread; a background
+ * thread cuts the patches and writes them. If both buffers are still in use the frame is dropped
+ * (and counted) instead of waiting, so the solver never stalls on the disk.
+ *
+ * Shard layout (little-endian), built for numpy.memmap and random access:
+ *
+ *   0    "FLUIDSET" | version u32 | channelCount u32 | extent u32[3] (x, y, z) | capacity u32
+ *        | sampleCount u32 | reserved u32 | sampleBytes u64 | indexOffset u64 | dataOffset u64
+ *   64   channel u32[16] (FluidNet::Channel ids, unused entries 0xffffffff)
+ *   128  index: sampleCount x (step u64, simulatedTime f64, origin i32[3], reserved u32)
+ *   dataOffset (4096-aligned): sampleCount x float32[2][channelCount][z][y][x]
+ *
+ * The index has room for capacity entries, so every shard has the same data offset, and sample i
+ * starts at dataOffset + i * sampleBytes. Shards are written as name.tmp and renamed when complete.
+ */
+class FluidDataset {
+public:
+	static const uint32_t FormatVersion = 1;
+	static const int MaxChannels = 16;
+
+	struct Options {
+		std::string directory;                 // Where shards go; empty for the working directory
+		std::string prefix;                    // Shards are <prefix>_<number>.fset
+		std::vector<FluidNet::Channel> channels;
+		int interval;                          // Steps between frames
+		int gap;                               // Steps from a state to its next state; frames never overlap, so a gap above interval spaces them further
+		int patch;                             // Patch width in cells, 0 for whole frames
+		int patchesPerFrame;
+		int samplesPerShard;
+		unsigned seed;                         // Patch placement
+		float dt;                              // Timestep the PressureRhs channel is formed with
+
+		Options() : prefix("dataset"), interval(1), gap(1), patch(0), patchesPerFrame(1), samplesPerShard(1024), seed(0), dt(0.0f) {}
+	};
+
+	struct Stats {
+		uint64_t samples; // Written to shards
+		uint64_t frames;  // Captured
+		uint64_t dropped; // Frames skipped because the writer was behind
+		uint64_t shards;
+	};
+
+	FluidDataset();
+	~FluidDataset();
+	FluidDataset(const FluidDataset&) = delete;
+	FluidDataset& operator=(const FluidDataset&) = delete;
+
+	/**
+	 * @brief Starts an export for grids of the given size and starts the writer thread.
+	 * @param options What to capture and where to write it; channels default to the velocities,
+	 * pressure and the solid and liquid masks.
+	 * @param grid Grid the frames are taken from (its size is fixed from here on).
+	 * @param error Optional: receives the reason on failure.
+	 * @return False if the options do not fit the grid.
+	 */
+	bool open(const Options& options, const FluidGrid& grid, std::string* error = nullptr);
+
+	/**
+	 * @brief Call once before the first step and after every step.
+	 * @param grid State after the step.
+	 * @param step Steps taken so far.
+	 * @param simulatedTime Time simulated so far.
+	 */
+	void observe(const FluidGrid& grid, uint64_t step, double simulatedTime);
+
+	/**
+	 * @brief Writes what is queued, completes the last shard and stops the writer thread.
+	 * @param error Optional: receives the first write error.
+	 * @return True if every shard was written.
+	 */
+	bool finish(std::string* error = nullptr);
+
+	bool isOpen() const { return running; }
+	Stats getStats() const;
+	// Completed shards; read after finish()
+	const std::vector<std::string>& getShardPaths() const { return shardPaths; }
+
+private:
+	struct Frame {
+		std::vector<float> data; // [2][channel][cell]
+		uint64_t step;
+		double simulatedTime;
+		uint64_t nextStep;       // Step the second half is captured at
+	};
+
+	Options options;
+	int size[3];
+	int extent[3];
+	size_t frameCells;
+	size_t sampleBytes;
+	uint64_t dataOffset;
+
+	// Frames owned by the caller (free, or waiting for their next state) or queued for the writer
+	Frame frames[2];
+	std::vector<int> freeFrames;
+	int capturing;               // Frame waiting for its next state, or -1
+	std::deque<int> queued;
+	std::thread writer;
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	bool running;
+	bool stopping;
+
+	// Writer state
+	std::mt19937 random;
+	FILE* shard;
+	std::string shardPath;
+	uint32_t shardSamples;
+	std::vector<uint8_t> index;
+	std::vector<float> sample;
+	std::vector<std::string> shardPaths;
+	std::string writeError;
+	Stats stats;
+
+	void capture(const FluidGrid& grid, float* out) const;
+	void writerLoop();
+	bool writeFrame(const Frame& frame);
+	bool openShard();
+	bool closeShard();
+};
@@ -0,0 +1,154 @@
+#include "FluidGeometry.h"
+#include "FluidParallel.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+FluidGeometry::FluidGeometry(int subsamples)
+	: subsamples(std::max(1, subsamples)) {
+}
+
+void FluidGeometry::addSphere(float cx, float cy, float cz, float radius) {
+	spheres.push_back({ cx, cy, cz, radius });
+}
+
+void FluidGeometry::addBox(float minX, float minY, float minZ, float maxX, float maxY, float maxZ) {
+	boxes.push_back({ { minX, minY, minZ }, { maxX, maxY, maxZ } });
+}
+
+void FluidGeometry::addMesh(std::vector<float> vertices, std::vector<int> indices) {
+	std::unique_ptr<Mesh> mesh(new Mesh());
+	mesh->vertices = std::move(vertices);
+	mesh->indices = std::move(indices);
+	mesh->bvh.build(mesh->vertices, mesh->indices);
+	meshes.push_back(std::move(mesh));
+}
+
+void FluidGeometry::insideIntervals(float y, float z, std::vector<float>& intervals, std::vector<float>& scratch) const {
+	intervals.clear();
+	for (const Sphere& s : spheres) {
+		float dy = y - s.cy, dz = z - s.cz;
+		float h = s.radius * s.radius - dy * dy - dz * dz;
+		if (h > 0.0f) {
+			h = std::sqrt(h);
+			intervals.push_back(s.cx - h);
+			intervals.push_back(s.cx + h);
+		}
+	}
+	for (const Box& b : boxes) {
+		if (y >= b.min[1] && y <= b.max[1] && z >= b.min[2] && z <= b.max[2]) {
+			intervals.push_back(b.min[0]);
+			intervals.push_back(b.max[0]);
+		}
+	}
+	for (const std::unique_ptr<Mesh>& mesh : meshes) {
+		// Crossings alternate entering and leaving a closed mesh
+		mesh->bvh.intersectAxisRay(y, z, scratch);
+		std::sort(scratch.begin(), scratch.end());
+		for (size_t i = 0; i + 1 < scratch.size(); i += 2) {
+			intervals.push_back(scratch[i]);
+			intervals.push_back(scratch[i + 1]);
+		}
+	}
+
+	// Merge overlapping intervals from different obstacles
+	const size_t count = intervals.size() / 2;
+	if (count < 2)
+		return;
+	std::vector<std::pair<float, float>> spans(count);
+	for (size_t i = 0; i < count; ++i)
+		spans[i] = { intervals[2 * i], intervals[2 * i + 1] };
+	std::sort(spans.begin(), spans.end());
+	intervals.clear();
+	for (const std::pair<float, float>& span : spans) {
+		if (!intervals.empty() && span.first <= intervals.back())
+			intervals.back() = std::max(intervals.back(), span.second);
+		else {
+			intervals.push_back(span.first);
+			intervals.push_back(span.second);
+		}
+	}
+}
+
+void FluidGeometry::rasterize(FluidGrid& grid) const {
+	const int nx = grid.getWidth(), ny = grid.getHeight(), nz = grid.getDepth();
+	const int n = grid.getCellCount();
+	const int dims = grid.getDimensions();
+	const float dx = grid.getCellSize();
+	const int subY = subsamples;
+	const int subZ = dims == 3 ? subsamples : 1;
+	const float sampleWeight = 1.0f / (subY * subZ);
+	// Rays sit a hair off the face planes so they never run exactly along mesh edges
+	const float jitter = 1e-4f * dx;
+
+	std::vector<float> volume(n, 0.0f);
+	std::vector<float>& fractions = grid.getFaceFractions();
+	fractions.assign(3 * static_cast<size_t>(n), 1.0f);
+
+	parallelFor(0, ny * nz, [&](int row) {
+		const int j = row % ny;
+		const int k = row / ny;
+		const int rowStart = grid.index(0, j, k);
+		std::vector<float> intervals, scratch;
+
+		for (int sz = 0; sz < subZ; ++sz) {
+			const float z = dims == 3 ? (k + static_cast<float>(sz) / subZ) * dx + jitter : 0.5f * dx;
+			for (int sy = 0; sy < subY; ++sy) {
+				const float y = (j + static_cast<float>(sy) / subY) * dx + jitter;
+				insideIntervals(y, z, intervals, scratch);
+
+				for (size_t s = 0; s + 1 < intervals.size(); s += 2) {
+					const float x0 = std::max(intervals[s] / dx, 0.0f);
+					const float x1 = std::min(intervals[s + 1] / dx, static_cast<float>(nx));
+					if (x1 <= x0)
+						continue;
+					const int first = static_cast<int>(x0);
+					const int last = std::min(static_cast<int>(std::ceil(x1)), nx);
+					for (int i = first; i < last; ++i) {
+						// Coverage of cell i along x by [x0, x1]
+						const float covered = std::min(x1, i + 1.0f) - std::max(x0, static_cast<float>(i));
+						const int c = rowStart + i;
+						volume[c] += covered * sampleWeight;
+						if (sy == 0)
+							fractions[3 * c + 1] -= covered / subZ;
+						if (sz == 0 && dims == 3)
+							fractions[3 * c + 2] -= covered / subY;
+						if (static_cast<float>(i) >= x0 && static_cast<float>(i) < x1)
+							fractions[3 * c + 0] -= sampleWeight;
+					}
+				}
+			}
+		}
+	});
+
+	// Pack the occupancy bits one 64-cell word at a time so no two threads share a word
+	std::vector<uint64_t>& mask = grid.getSolidMask();
+	const int words = (n + 63) / 64;
+	mask.assign(words, 0);
+	parallelFor(0, words, [&](int w) {
+		uint64_t bits = 0;
+		const int end = std::min(n, (w + 1) * 64);
+		for (int c = w * 64; c < end; ++c) {
+			if (volume[c] >= 0.5f)
+				bits |= uint64_t(1) << (c & 63);
+		}
+		mask[w] = bits;
+	});
+
+	// Faces touching a solid cell are closed; the rest keep their measured open fraction
+	const int stride[3] = { 1, nx, nx * ny };
+	parallelFor(0, nz, [&](int k) {
+		for (int j = 0; j < ny; ++j) {
+			for (int i = 0; i < nx; ++i) {
+				const int c = grid.index(i, j, k);
+				const int coord[3] = { i, j, k };
+				for (int d = 0; d < 3; ++d) {
+					float& f = fractions[3 * c + d];
+					f = std::min(std::max(f, 0.0f), 1.0f);
+					if (d >= dims || grid.isSolid(c) || (coord[d] > 0 && grid.isSolid(c - stride[d])))
+						f = d >= dims ? 1.0f : 0.0f;
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "FluidGrid.h"
+#include "FluidBVH.h"
+#include <vector>
+#include <memory>
+
+/**
+ * @brief Solid obstacles for the virtual wind tunnel, voxelized into the grid's solid layer.
+ *
+ * Obstacles are analytic primitives or closed triangle meshes. Rasterization casts rays along x
+ * through sub-rows of every cell row (in parallel over rows) and turns the inside intervals into
+ * cell volume fractions and per-face open fractions. Cells at least half solid are marked solid;
+ * their faces are closed.
+ */
+class FluidGeometry {
+public:
+	/**
+	 * @brief Constructs an empty geometry.
+	 * @param subsamples Sub-rows per cell along y and z used when measuring fractions.
+	 */
+	FluidGeometry(int subsamples = 4);
+
+	void addSphere(float cx, float cy, float cz, float radius);
+	void addBox(float minX, float minY, float minZ, float maxX, float maxY, float maxZ);
+
+	/**
+	 * @brief Adds a closed triangle mesh. Its BVH is built immediately.
+	 * @param vertices Packed xyz vertex positions, in the grid's world units.
+	 * @param indices Three vertex indices per triangle.
+	 */
+	void addMesh(std::vector<float> vertices, std::vector<int> indices);
+
+	/**
+	 * @brief Voxelizes all obstacles into the grid's solid mask and face fractions.
+	 * 2D grids are sliced through the middle of their single cell layer.
+	 * @param grid Grid whose solid layer is replaced.
+	 */
+	void rasterize(FluidGrid& grid) const;
+
+private:
+	struct Sphere { float cx, cy, cz, radius; };
+	struct Box { float min[3], max[3]; };
+	struct Mesh {
+		std::vector<float> vertices;
+		std::vector<int> indices;
+		FluidBVH bvh;
+	};
+
+	int subsamples;
+	std::vector<Sphere> spheres;
+	std::vector<Box> boxes;
+	std::vector<std::unique_ptr<Mesh>> meshes; // Heap-allocated so the BVH's array references stay valid
+
+	// Appends the x intervals inside any obstacle along the line (y, z), merged and sorted
+	void insideIntervals(float y, float z, std::vector<float>& intervals, std::vector<float>& scratch) const;
+};
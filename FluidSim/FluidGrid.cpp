@@ -8,7 +8,28 @@ static bool keyLess(const std::tuple<int, int, int>& a, const std::tuple<int, in
 }
 
 FluidGrid::FluidGrid(int order)
-	: order(order), root(std::make_shared<Node>(true)), width(0), height(0), depth(0) {
+	: order(order), root(std::make_shared<Node>(true)), width(0), height(0), depth(0), cellSize(1.0f) {
+}
+
+FluidGrid::FluidGrid(int nx, int ny, int nz, float cellSize, int order)
+	: FluidGrid(order) {
+	resize(nx, ny, nz, cellSize);
+}
+
+void FluidGrid::resize(int nx, int ny, int nz, float size) {
+	assert(nx > 0 && ny > 0 && nz > 0 && size > 0.0f);
+	width = nx;
+	height = ny;
+	depth = nz;
+	cellSize = size;
+	Cell empty = { { 0.0f, 0.0f, 0.0f }, 0.0f, -1 };
+	cells.assign(static_cast<size_t>(nx) * ny * nz, empty);
+	clearSolids();
+}
+
+void FluidGrid::clearSolids() {
+	solidMask.clear();
+	faceFractions.clear();
 }
 
 FluidGrid::Cell* FluidGrid::find(int x, int y, int z) {
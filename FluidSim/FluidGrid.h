@@ -2,19 +2,44 @@
 #include <vector>
 #include <memory>
 #include <tuple>
+#include <cstdint>
 
 class FluidGrid {
 public:
 	struct Cell {
-		float velocity[3]; // x, y, z (z=0 for 2D)
+		float velocity[3]; // x, y, z (z=0 for 2D), stored on the cell's lower face along each axis (MAC layout)
 		float pressure;
-		int   material_id;
+		int   material_id; // -1 for empty cells
 	};
 
 	FluidGrid(int order = 16);
+	FluidGrid(int nx, int ny, int nz, float cellSize, int order = 16);
 	Cell* find(int x, int y, int z = 0);
 	void insert(int x, int y, int z, const Cell& cell);
 
+	// Dense storage used by the solver, laid out x-fastest
+	void resize(int nx, int ny, int nz, float cellSize);
+	Cell& at(int x, int y, int z = 0) { return cells[index(x, y, z)]; }
+	const Cell& at(int x, int y, int z = 0) const { return cells[index(x, y, z)]; }
+	int index(int x, int y, int z = 0) const { return (z * height + y) * width + x; }
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getDepth() const { return depth; }
+	int getDimensions() const { return depth > 1 ? 3 : 2; }
+	int getCellCount() const { return width * height * depth; }
+	float getCellSize() const { return cellSize; }
+	std::vector<Cell>& getCells() { return cells; }
+	const std::vector<Cell>& getCells() const { return cells; }
+
+	// Solid occupancy layer: one bit per cell plus the open fraction of each cell's lower x/y/z faces.
+	// Empty until FluidGeometry::rasterize fills it, in which case every cell is fluid and every face open.
+	bool hasSolids() const { return !solidMask.empty(); }
+	bool isSolid(int i) const { return !solidMask.empty() && ((solidMask[i >> 6] >> (i & 63)) & 1u); }
+	float getFaceFraction(int i, int axis) const { return faceFractions.empty() ? 1.0f : faceFractions[3 * i + axis]; }
+	void clearSolids();
+	std::vector<uint64_t>& getSolidMask() { return solidMask; }
+	std::vector<float>& getFaceFractions() { return faceFractions; }
+
 private:
 	struct Node {
 		bool isLeaf;
@@ -34,5 +59,8 @@ private:
 	Cell* findInNode(std::shared_ptr<Node> node, const std::tuple<int, int, int>& key);
 
 	int width, height, depth;
+	float cellSize;
 	std::vector<Cell> cells;
+	std::vector<uint64_t> solidMask;
+	std::vector<float> faceFractions;
 };
\ No newline at end of file
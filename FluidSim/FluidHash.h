@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Incremental SHA-256, for content-addressing simulation inputs (see FluidRunner::getConfigHash).
+ *
+ * Feed the input with update() or field(), then call finishHex() once.
+ */
+class FluidHash {
+public:
+	FluidHash();
+
+	void update(const void* data, size_t size);
+	void update(const std::string& text) { update(text.data(), text.size()); }
+
+	// Adds a length-prefixed value, so neighbouring values cannot run together ("ab" "c" vs "a" "bc")
+	void field(const std::string& text);
+
+	/**
+	 * @brief Adds the contents of a file, read in chunks.
+	 * @return False if the file cannot be read.
+	 */
+	bool updateFile(const std::string& path);
+
+	// The digest as 64 lowercase hex digits; the hash takes no more input afterwards
+	std::string finishHex();
+
+private:
+	uint32_t state[8];
+	uint64_t length; // Bytes fed so far
+	uint8_t block[64];
+	size_t blockBytes;
+
+	void compress(const uint8_t* data);
+};
@@ -0,0 +1,238 @@
+#include "FluidJobs.h"
+#include <algorithm>
+
+// The pool the current thread works for and its deque, or null/-1 outside any pool
+static thread_local FluidJobs* currentPool = nullptr;
+static thread_local int currentIndex = -1;
+static thread_local FluidJobs* scopedPool = nullptr; // Set by FluidJobs::Scope
+
+static const int SpinRounds = 64; // Failed searches before an idle worker goes to sleep
+
+FluidJobs::WorkDeque::WorkDeque() : top(0), bottom(0) {
+	buffers.emplace_back(new Buffer(256));
+	buffer.store(buffers.back().get(), std::memory_order_relaxed);
+}
+
+void FluidJobs::WorkDeque::push(Job* job) {
+	const int64_t b = bottom.load(std::memory_order_relaxed);
+	const int64_t t = top.load(std::memory_order_acquire);
+	Buffer* a = buffer.load(std::memory_order_relaxed);
+	if (b - t > a->capacity() - 1) {
+		Buffer* grown = new Buffer(2 * a->capacity());
+		for (int64_t i = t; i < b; ++i)
+			grown->put(i, a->get(i));
+		buffers.emplace_back(grown);
+		buffer.store(grown, std::memory_order_release);
+		a = grown;
+	}
+	a->put(b, job);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+FluidJobs::Job* FluidJobs::WorkDeque::pop() {
+	const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	Buffer* a = buffer.load(std::memory_order_relaxed);
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+	if (t > b) {
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	Job* job = a->get(b);
+	if (t == b) {
+		// Last job: race thieves for it
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+FluidJobs::Job* FluidJobs::WorkDeque::steal() {
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return nullptr;
+	Buffer* a = buffer.load(std::memory_order_acquire);
+	Job* job = a->get(t);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr; // Lost to the owner or another thief
+	return job;
+}
+
+FluidJobs& FluidJobs::shared() {
+	if (currentPool)
+		return *currentPool;
+	if (scopedPool)
+		return *scopedPool;
+	static FluidJobs pool;
+	return pool;
+}
+
+FluidJobs::Scope::Scope(FluidJobs& pool) : previous(scopedPool) {
+	scopedPool = &pool;
+}
+
+FluidJobs::Scope::~Scope() {
+	scopedPool = previous;
+}
+
+FluidJobs::FluidJobs(int threads) : epoch(0), sleepers(0), stopping(false) {
+	start(threads);
+}
+
+FluidJobs::~FluidJobs() {
+	stop();
+}
+
+int FluidJobs::currentThread() {
+	return currentIndex + 1;
+}
+
+void FluidJobs::setThreadCount(int threads) {
+	stop();
+	start(threads);
+}
+
+void FluidJobs::start(int threads) {
+	if (threads <= 0)
+		threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	stopping.store(false);
+	deques.clear();
+	for (int i = 0; i < threads - 1; ++i)
+		deques.emplace_back(new WorkDeque());
+	for (int i = 0; i < threads - 1; ++i)
+		workers.emplace_back(&FluidJobs::workerLoop, this, i);
+}
+
+void FluidJobs::stop() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping.store(true);
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+void FluidJobs::workerLoop(int index) {
+	currentPool = this;
+	currentIndex = index;
+	unsigned seed = 2654435761u * (index + 1);
+	int idle = 0;
+	while (!stopping.load(std::memory_order_relaxed)) {
+		const unsigned seen = epoch.load();
+		if (Job* job = find(index, seed)) {
+			execute(job);
+			idle = 0;
+			continue;
+		}
+		if (++idle < SpinRounds) {
+			std::this_thread::yield();
+			continue;
+		}
+		// Sleep until a push bumps the epoch past what was seen before the last search
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepers.fetch_add(1);
+		wake.wait(lock, [&]() { return epoch.load() != seen || stopping.load(); });
+		sleepers.fetch_sub(1);
+		idle = 0;
+	}
+}
+
+void FluidJobs::push(Job* job) {
+	if (currentPool == this && currentIndex >= 0) {
+		deques[currentIndex]->push(job);
+	}
+	else {
+		std::lock_guard<std::mutex> lock(injectionMutex);
+		injection.push_back(job);
+	}
+	epoch.fetch_add(1);
+	if (sleepers.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+FluidJobs::Job* FluidJobs::find(int index, unsigned& seed) {
+	if (index >= 0) {
+		if (Job* job = deques[index]->pop())
+			return job;
+	}
+	{
+		std::unique_lock<std::mutex> lock(injectionMutex, std::try_to_lock);
+		if (lock.owns_lock() && !injection.empty()) {
+			Job* job = injection.front();
+			injection.pop_front();
+			return job;
+		}
+	}
+	// Steal from the other workers, starting at a random victim
+	const int count = static_cast<int>(deques.size());
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	const int first = count > 0 ? static_cast<int>(seed % count) : 0;
+	for (int k = 0; k < count; ++k) {
+		const int victim = (first + k) % count;
+		if (victim == index)
+			continue;
+		if (Job* job = deques[victim]->steal())
+			return job;
+	}
+	return nullptr;
+}
+
+void FluidJobs::execute(Job* job) {
+	if (job->body) {
+		// Split off upper halves for thieves until the rest is one grain, then run it
+		while (job->hi - job->lo > job->grain) {
+			const int mid = job->lo + (job->hi - job->lo) / 2;
+			Job* half = new Job{ std::function<void()>(), job->body, job->context, mid, job->hi, job->grain, job->counter };
+			job->counter->pending.fetch_add(1, std::memory_order_relaxed);
+			push(half);
+			job->hi = mid;
+		}
+		job->body(job->context, job->lo, job->hi);
+	}
+	else {
+		job->fn();
+	}
+	Counter* counter = job->counter;
+	delete job;
+	counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void FluidJobs::run(Counter& counter, std::function<void()> fn) {
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	if (workers.empty()) {
+		execute(new Job{ std::move(fn), nullptr, nullptr, 0, 0, 0, &counter });
+		return;
+	}
+	push(new Job{ std::move(fn), nullptr, nullptr, 0, 0, 0, &counter });
+}
+
+void FluidJobs::wait(Counter& counter) {
+	const int index = currentPool == this ? currentIndex : -1;
+	unsigned seed = 0x9e3779b9u ^ static_cast<unsigned>(reinterpret_cast<uintptr_t>(&counter));
+	while (!counter.done()) {
+		if (Job* job = find(index, seed))
+			execute(job);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void FluidJobs::forRange(int begin, int end, int grain, void (*body)(void*, int, int), void* context) {
+	if (end <= begin)
+		return;
+	Counter counter;
+	counter.pending.store(1, std::memory_order_relaxed);
+	execute(new Job{ std::function<void()>(), body, context, begin, end, std::max(1, grain), &counter });
+	wait(counter);
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing job system shared by every parallel loop and task graph in the simulator.
+ *
+ * Each worker thread owns a Chase-Lev deque: it pushes and pops jobs at the bottom, idle workers steal
+ * from the top, so a worker runs its own most recent (cache-warm, smallest) work while thieves take the
+ * oldest (largest) pieces. Threads outside the pool submit through a shared injection queue. Waiting on
+ * a Counter never blocks a thread: the waiter keeps running jobs until its counter drains, so nested
+ * parallelism (a parallel loop inside a job) cannot deadlock the pool.
+ *
+ * Idle workers spin briefly, then sleep until new work is pushed.
+ */
+class FluidJobs {
+public:
+	// Number of unfinished jobs of a batch; wait() on it
+	class Counter {
+	public:
+		Counter() : pending(0) {}
+		bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class FluidJobs;
+		std::atomic<int> pending;
+	};
+
+	// Routes shared() on the constructing thread to another pool while alive, so a caller can confine
+	// its parallel loops to a thread budget (e.g. one of several concurrent runs)
+	class Scope {
+	public:
+		explicit Scope(FluidJobs& pool);
+		~Scope();
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		FluidJobs* previous;
+	};
+
+	// The pool parallel work goes to: the pool of the current worker thread, else the one a Scope on
+	// this thread selected, else the process-wide pool, sized to the hardware on first use
+	static FluidJobs& shared();
+
+	explicit FluidJobs(int threads = 0); // 0 uses std::thread::hardware_concurrency()
+	~FluidJobs();
+	FluidJobs(const FluidJobs&) = delete;
+	FluidJobs& operator=(const FluidJobs&) = delete;
+
+	// Restarts the pool with a new thread count (the calling thread included). Only call it while idle.
+	void setThreadCount(int threads);
+	int getThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+	// 1 + the worker index on a pool thread, 0 on any other thread
+	static int currentThread();
+
+	// Queues fn on the pool as part of counter's batch
+	void run(Counter& counter, std::function<void()> fn);
+	// Runs queued jobs on the calling thread until every job of the counter's batch has finished
+	void wait(Counter& counter);
+
+	/**
+	 * @brief Calls body(context, lo, hi) over disjoint sub-ranges covering [begin, end) and returns when all are done.
+	 *
+	 * The range is split in halves down to the grain lazily, as it runs: the upper half of each split
+	 * goes to the current thread's deque where idle threads can steal it.
+	 * @param begin First index.
+	 * @param end One past the last index.
+	 * @param grain Sub-ranges at or below this length run without further splitting.
+	 * @param body Loop body over [lo, hi).
+	 * @param context Passed through to body.
+	 */
+	void forRange(int begin, int end, int grain, void (*body)(void*, int, int), void* context);
+
+private:
+	struct Job {
+		std::function<void()> fn; // A single task, or empty for a range
+		void (*body)(void*, int, int);
+		void* context;
+		int lo, hi, grain;
+		Counter* counter;
+	};
+
+	// Chase-Lev deque of job pointers (Le, Pop, Cohen and Zappa Nardelli, PPoPP 2013). Only the owning
+	// worker calls push() and pop(); any thread may steal().
+	class WorkDeque {
+	public:
+		WorkDeque();
+		void push(Job* job);
+		Job* pop();
+		Job* steal();
+
+	private:
+		struct Buffer {
+			explicit Buffer(int64_t capacity) : mask(capacity - 1), slots(new std::atomic<Job*>[capacity]) {}
+			int64_t capacity() const { return mask + 1; }
+			Job* get(int64_t i) const { return slots[i & mask].load(std::memory_order_acquire); }
+			void put(int64_t i, Job* job) { slots[i & mask].store(job, std::memory_order_release); }
+			int64_t mask;
+			std::unique_ptr<std::atomic<Job*>[]> slots;
+		};
+
+		std::atomic<int64_t> top, bottom;
+		std::atomic<Buffer*> buffer;
+		std::vector<std::unique_ptr<Buffer>> buffers; // Outgrown buffers stay alive for concurrent thieves
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkDeque>> deques; // One per worker thread
+	std::mutex injectionMutex;
+	std::deque<Job*> injection; // Jobs pushed from threads outside the pool
+
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<unsigned> epoch;    // Bumped on every push so sleepers notice new work
+	std::atomic<int> sleepers;
+	std::atomic<bool> stopping;
+
+	void start(int threads);
+	void stop();
+	void workerLoop(int index);
+	void push(Job* job);
+	Job* find(int index, unsigned& seed);
+	void execute(Job* job);
+};
@@ -0,0 +1,313 @@
+#include "FluidJson.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+class FluidJson::Parser {
+public:
+	Parser(const std::string& source) : s(source.c_str()), end(source.c_str() + source.size()), p(source.c_str()) {}
+
+	bool parseDocument(FluidJson& out, std::string* error) {
+		skipSpace();
+		if (p == end) {
+			out = FluidJson();
+			return true;
+		}
+		if (!parseValue(out, 0) || (skipSpace(), p != end)) {
+			if (error)
+				*error = (message ? message : "Unexpected trailing characters") + std::string(" at offset ") + std::to_string(p - s);
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static const int MaxDepth = 64;
+	const char* s;
+	const char* end;
+	const char* p;
+	const char* message = nullptr;
+
+	bool fail(const char* what) {
+		message = what;
+		return false;
+	}
+
+	void skipSpace() {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+			++p;
+	}
+
+	bool literal(const char* word) {
+		size_t len = std::strlen(word);
+		if (static_cast<size_t>(end - p) < len || std::strncmp(p, word, len) != 0)
+			return fail("Invalid literal");
+		p += len;
+		return true;
+	}
+
+	bool parseValue(FluidJson& out, int depth) {
+		if (depth > MaxDepth)
+			return fail("Nesting too deep");
+		skipSpace();
+		if (p == end)
+			return fail("Unexpected end of input");
+
+		out = FluidJson();
+		switch (*p) {
+		case '{': return parseObject(out, depth);
+		case '[': return parseArray(out, depth);
+		case '"': out.type = Type::String; return parseString(out.text);
+		case 't': out.type = Type::Bool; out.boolean = true; return literal("true");
+		case 'f': out.type = Type::Bool; out.boolean = false; return literal("false");
+		case 'n': return literal("null");
+		default: return parseNumber(out);
+		}
+	}
+
+	bool parseNumber(FluidJson& out) {
+		const char* start = p;
+		if (p < end && *p == '-') ++p;
+		if (p == end || !(*p >= '0' && *p <= '9'))
+			return fail("Invalid value");
+		while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-'))
+			++p;
+		std::string digits(start, p);
+		char* stop = nullptr;
+		out.number = std::strtod(digits.c_str(), &stop);
+		if (stop != digits.c_str() + digits.size())
+			return fail("Invalid number");
+		out.type = Type::Number;
+		return true;
+	}
+
+	static void appendUtf8(std::string& out, unsigned code) {
+		if (code < 0x80) out += static_cast<char>(code);
+		else if (code < 0x800) {
+			out += static_cast<char>(0xC0 | (code >> 6));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			out += static_cast<char>(0xE0 | (code >> 12));
+			out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else {
+			out += static_cast<char>(0xF0 | (code >> 18));
+			out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+
+	bool parseHex4(unsigned& code) {
+		if (end - p < 4)
+			return fail("Truncated escape");
+		code = 0;
+		for (int i = 0; i < 4; ++i, ++p) {
+			char c = *p;
+			code <<= 4;
+			if (c >= '0' && c <= '9') code |= c - '0';
+			else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+			else return fail("Invalid escape");
+		}
+		return true;
+	}
+
+	bool parseString(std::string& out) {
+		++p; // opening quote
+		out.clear();
+		while (p < end && *p != '"') {
+			char c = *p++;
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (p == end)
+				return fail("Truncated escape");
+			switch (*p++) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				unsigned code;
+				if (!parseHex4(code))
+					return false;
+				if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+					p += 2;
+					unsigned low;
+					if (!parseHex4(low))
+						return false;
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				appendUtf8(out, code);
+				break;
+			}
+			default: return fail("Invalid escape");
+			}
+		}
+		if (p == end)
+			return fail("Unterminated string");
+		++p; // closing quote
+		return true;
+	}
+
+	bool parseArray(FluidJson& out, int depth) {
+		out.type = Type::Array;
+		++p;
+		skipSpace();
+		if (p < end && *p == ']') {
+			++p;
+			return true;
+		}
+		while (true) {
+			out.items.emplace_back();
+			if (!parseValue(out.items.back(), depth + 1))
+				return false;
+			skipSpace();
+			if (p < end && *p == ',') { ++p; continue; }
+			if (p < end && *p == ']') { ++p; return true; }
+			return fail("Expected ',' or ']'");
+		}
+	}
+
+	bool parseObject(FluidJson& out, int depth) {
+		out.type = Type::Object;
+		++p;
+		skipSpace();
+		if (p < end && *p == '}') {
+			++p;
+			return true;
+		}
+		while (true) {
+			skipSpace();
+			if (p == end || *p != '"')
+				return fail("Expected member name");
+			out.members.emplace_back();
+			if (!parseString(out.members.back().first))
+				return false;
+			skipSpace();
+			if (p == end || *p != ':')
+				return fail("Expected ':'");
+			++p;
+			if (!parseValue(out.members.back().second, depth + 1))
+				return false;
+			skipSpace();
+			if (p < end && *p == ',') { ++p; continue; }
+			if (p < end && *p == '}') { ++p; return true; }
+			return fail("Expected ',' or '}'");
+		}
+	}
+};
+
+bool FluidJson::parse(const std::string& text, FluidJson& out, std::string* error) {
+	Parser parser(text);
+	return parser.parseDocument(out, error);
+}
+
+static const FluidJson& nullValue() {
+	static const FluidJson value;
+	return value;
+}
+
+const FluidJson& FluidJson::operator[](size_t index) const {
+	if (type == Type::Array && index < items.size())
+		return items[index];
+	return nullValue();
+}
+
+const FluidJson& FluidJson::get(const std::string& key) const {
+	if (type == Type::Object) {
+		for (const auto& member : members) {
+			if (member.first == key)
+				return member.second;
+		}
+	}
+	return nullValue();
+}
+
+bool FluidJson::has(const std::string& key) const {
+	return !get(key).isNull();
+}
+
+std::string FluidJson::getString(const std::string& key, const std::string& fallback) const {
+	const FluidJson& value = get(key);
+	return value.isString() ? value.text : fallback;
+}
+
+std::string FluidJson::toCanonical() const {
+	std::string out;
+	writeCanonical(out);
+	return out;
+}
+
+static void writeCanonicalString(const std::string& value, std::string& out) {
+	out += '"';
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20) {
+			char escape[8];
+			std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned>(static_cast<unsigned char>(c)));
+			out += escape;
+		}
+		else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+void FluidJson::writeCanonical(std::string& out) const {
+	switch (type) {
+	case Type::Null:
+		out += "null";
+		break;
+	case Type::Bool:
+		out += boolean ? "true" : "false";
+		break;
+	case Type::Number: {
+		char digits[32];
+		std::snprintf(digits, sizeof(digits), "%.17g", number == 0.0 ? 0.0 : number); // -0 prints as 0
+		out += digits;
+		break;
+	}
+	case Type::String:
+		writeCanonicalString(text, out);
+		break;
+	case Type::Array:
+		out += '[';
+		for (size_t i = 0; i < items.size(); ++i) {
+			if (i > 0) out += ',';
+			items[i].writeCanonical(out);
+		}
+		out += ']';
+		break;
+	case Type::Object: {
+		// Stable, so duplicate keys keep their document order (get() returns the first)
+		std::vector<const std::pair<std::string, FluidJson>*> sorted;
+		for (const auto& member : members)
+			sorted.push_back(&member);
+		std::stable_sort(sorted.begin(), sorted.end(),
+			[](const std::pair<std::string, FluidJson>* a, const std::pair<std::string, FluidJson>* b) { return a->first < b->first; });
+		out += '{';
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			if (i > 0) out += ',';
+			writeCanonicalString(sorted[i]->first, out);
+			out += ':';
+			sorted[i]->second.writeCanonical(out);
+		}
+		out += '}';
+		break;
+	}
+	}
+}
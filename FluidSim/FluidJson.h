@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+
+/**
+ * @brief Minimal JSON document model for the *JSON columns of the database.
+ *
+ * Parses RFC 8259 text into a tree of values. Objects keep their members in document order;
+ * lookups are linear, which is fine for the handful of keys in a config package. Parse once and
+ * keep the typed result; nothing here is meant to be called per particle or per cell.
+ */
+class FluidJson {
+public:
+	enum class Type { Null, Bool, Number, String, Array, Object };
+
+	FluidJson() : type(Type::Null), boolean(false), number(0.0) {}
+
+	/**
+	 * @brief Parses a JSON document.
+	 * @param text JSON text. Empty or whitespace-only text parses as null.
+	 * @param out Filled with the parsed value.
+	 * @param error Optional: receives a message with the byte offset on failure.
+	 * @return True if the text was valid JSON.
+	 */
+	static bool parse(const std::string& text, FluidJson& out, std::string* error = nullptr);
+
+	Type getType() const { return type; }
+	bool isNull() const { return type == Type::Null; }
+	bool isNumber() const { return type == Type::Number; }
+	bool isString() const { return type == Type::String; }
+	bool isArray() const { return type == Type::Array; }
+	bool isObject() const { return type == Type::Object; }
+
+	// Typed accessors return the fallback when the value has another type
+	double asNumber(double fallback = 0.0) const { return type == Type::Number ? number : fallback; }
+	bool asBool(bool fallback = false) const { return type == Type::Bool ? boolean : fallback; }
+	const std::string& asString() const { return text; }
+
+	// Array access
+	size_t size() const { return type == Type::Array ? items.size() : (type == Type::Object ? members.size() : 0); }
+	const FluidJson& operator[](size_t index) const;
+
+	// Object access; a missing key yields a shared null value
+	const FluidJson& get(const std::string& key) const;
+	bool has(const std::string& key) const;
+	double getNumber(const std::string& key, double fallback) const { return get(key).asNumber(fallback); }
+	std::string getString(const std::string& key, const std::string& fallback) const;
+	const std::vector<std::pair<std::string, FluidJson>>& getMembers() const { return members; }
+
+	/**
+	 * @brief Serializes the value in one canonical form: object members sorted by key, no whitespace,
+	 * numbers printed round-trip exact. Documents that differ only in layout, member order or number
+	 * spelling (1, 1.0, 1e0) give the same text, e.g. for hashing a config.
+	 */
+	std::string toCanonical() const;
+
+private:
+	Type type;
+	bool boolean;
+	double number;
+	std::string text;
+	std::vector<FluidJson> items;
+	std::vector<std::pair<std::string, FluidJson>> members;
+
+	class Parser;
+	void writeCanonical(std::string& out) const;
+};
@@ -0,0 +1,530 @@
+#include "FluidLBM.h"
+#include "FluidParallel.h"
+#include <algorithm>
+#include <cmath>
+
+// Velocity sets. Direction 0 is the rest population; the others come in (q, q + 1) opposite pairs.
+struct D2Q9 {
+	static constexpr int Q = 9;
+	static constexpr int c[Q][3] = {
+		{ 0, 0, 0 },
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 },
+		{ 1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { -1, 1, 0 } };
+	static constexpr float w[Q] = { 4.0f / 9.0f,
+		1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f,
+		1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f };
+};
+
+struct D3Q19 {
+	static constexpr int Q = 19;
+	static constexpr int c[Q][3] = {
+		{ 0, 0, 0 },
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+		{ 1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { -1, 1, 0 },
+		{ 1, 0, 1 }, { -1, 0, -1 }, { 1, 0, -1 }, { -1, 0, 1 },
+		{ 0, 1, 1 }, { 0, -1, -1 }, { 0, 1, -1 }, { 0, -1, 1 } };
+	static constexpr float w[Q] = { 1.0f / 3.0f,
+		1.0f / 18.0f, 1.0f / 18.0f, 1.0f / 18.0f, 1.0f / 18.0f, 1.0f / 18.0f, 1.0f / 18.0f,
+		1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f,
+		1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f };
+};
+
+constexpr int D2Q9::c[D2Q9::Q][3];
+constexpr float D2Q9::w[D2Q9::Q];
+constexpr int D3Q19::c[D3Q19::Q][3];
+constexpr float D3Q19::w[D3Q19::Q];
+
+static inline int opposite(int q) { return q == 0 ? 0 : ((q & 1) ? q + 1 : q - 1); }
+
+template <typename L>
+static inline float equilibrium(int q, float rho, const float u[3]) {
+	const float cu = 3.0f * (L::c[q][0] * u[0] + L::c[q][1] * u[1] + L::c[q][2] * u[2]);
+	const float usq = 1.5f * (u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+	return L::w[q] * rho * (1.0f + cu + 0.5f * cu * cu - usq);
+}
+
+// Nodes collided together. A block is copied into a small local array, collided there with every
+// loop running over the nodes with the direction fixed, and copied back. Trip counts are always
+// compile-time (a run's tail is split into power-of-two blocks), which the compiler turns into
+// straight vector code.
+static const int Block = 32;
+
+// TRT collision of up to Block nodes in place (f[q][node]). The body force enters through the
+// equilibrium velocity shift, scaled by the odd (momentum-carrying) relaxation time; the reported
+// velocity is the half-step average. Relaxation rates are per node, so lanes of an ensemble can
+// carry different viscosities.
+template <typename L, int Count>
+static void collideBlock(float (*f)[Block], const float force[3], const float* omegaPlus, const float* omegaMinus,
+	float* rhoOut, float* uxOut, float* uyOut, float* uzOut) {
+	const int count = Count;
+	float rho[Block], ueq[3][Block], usq[Block];
+	for (int i = 0; i < count; ++i) {
+		rho[i] = f[0][i];
+		ueq[0][i] = ueq[1][i] = ueq[2][i] = 0.0f;
+	}
+	for (int q = 1; q < L::Q; ++q) {
+		const float cx = static_cast<float>(L::c[q][0]);
+		const float cy = static_cast<float>(L::c[q][1]);
+		const float cz = static_cast<float>(L::c[q][2]);
+		for (int i = 0; i < count; ++i) {
+			rho[i] += f[q][i];
+			ueq[0][i] += cx * f[q][i];
+			ueq[1][i] += cy * f[q][i];
+			ueq[2][i] += cz * f[q][i];
+		}
+	}
+	for (int i = 0; i < count; ++i) {
+		const float inv = 1.0f / rho[i];
+		const float tauMinus = 1.0f / omegaMinus[i];
+		float u[3];
+		for (int d = 0; d < 3; ++d) {
+			u[d] = ueq[d][i] * inv;
+			ueq[d][i] = u[d] + tauMinus * force[d];
+		}
+		usq[i] = 1.5f * (ueq[0][i] * ueq[0][i] + ueq[1][i] * ueq[1][i] + ueq[2][i] * ueq[2][i]);
+		rhoOut[i] = rho[i];
+		uxOut[i] = u[0] + 0.5f * force[0];
+		uyOut[i] = u[1] + 0.5f * force[1];
+		uzOut[i] = u[2] + 0.5f * force[2];
+	}
+
+	for (int i = 0; i < count; ++i)
+		f[0][i] -= omegaPlus[i] * (f[0][i] - L::w[0] * rho[i] * (1.0f - usq[i]));
+	for (int q = 1; q < L::Q; q += 2) {
+		const float cx = 3.0f * L::c[q][0], cy = 3.0f * L::c[q][1], cz = 3.0f * L::c[q][2];
+		const float w = L::w[q];
+		float* fq = f[q];
+		float* fo = f[q + 1];
+		for (int i = 0; i < count; ++i) {
+			const float cu = cx * ueq[0][i] + cy * ueq[1][i] + cz * ueq[2][i];
+			const float eqPlus = w * rho[i] * (1.0f + 0.5f * cu * cu - usq[i]);
+			const float eqMinus = w * rho[i] * cu;
+			const float dPlus = omegaPlus[i] * (0.5f * (fq[i] + fo[i]) - eqPlus);
+			const float dMinus = omegaMinus[i] * (0.5f * (fq[i] - fo[i]) - eqMinus);
+			fq[i] -= dPlus + dMinus;
+			fo[i] -= dPlus - dMinus;
+		}
+	}
+}
+
+// Streams one block of a run: load from in[q], collide, store to out[q]
+template <typename L, int Count>
+static void streamBlock(const float* const* in, float* const* out, int first, const float force[3],
+	const float* omegaPlus, const float* omegaMinus, float* rhoOut, float* uxOut, float* uyOut, float* uzOut) {
+	const int count = Count;
+	float f[L::Q][Block];
+	for (int q = 0; q < L::Q; ++q) {
+		const float* src = in[q] + first;
+		for (int i = 0; i < count; ++i)
+			f[q][i] = src[i];
+	}
+	collideBlock<L, Count>(f, force, omegaPlus, omegaMinus, rhoOut, uxOut, uyOut, uzOut);
+	for (int q = 0; q < L::Q; ++q) {
+		float* dst = out[q] + first;
+		for (int i = 0; i < count; ++i)
+			dst[i] = f[q][i];
+	}
+}
+
+template <typename L>
+static void latticeOffsets(const int padded[3], int offsets[L::Q]) {
+	for (int q = 0; q < L::Q; ++q)
+		offsets[q] = L::c[q][0] + L::c[q][1] * padded[0] + L::c[q][2] * padded[0] * padded[1];
+}
+
+FluidLBM::FluidLBM()
+	: size{ 0, 0, 0 }, padded{ 0, 0, 0 }, dims(2), nodeCount(0), lanes(1), cellSize(0.0f), oddStep(false),
+	latticeDt(0.0f), pendingTime(0.0f), tau(1, 0.5f), referenceSpeed(0.0f), speedUsed(0.0f), fluidDensity(1, 1.0f), gravity{ 0.0f, 0.0f, 0.0f } {
+}
+
+void FluidLBM::setGravity(float gx, float gy, float gz) {
+	gravity[0] = gx;
+	gravity[1] = gy;
+	gravity[2] = gz;
+}
+
+bool FluidLBM::isPreparedFor(const FluidGrid& grid) const {
+	return nodeCount > 0 && size[0] == grid.getWidth() && size[1] == grid.getHeight()
+		&& size[2] == grid.getDepth() && cellSize == grid.getCellSize();
+}
+
+bool FluidLBM::restoreState(std::vector<float> values, bool odd, float pending) {
+	if (values.size() != populations.size())
+		return false;
+	populations.swap(values);
+	oddStep = odd;
+	pendingTime = pending;
+	return true;
+}
+
+std::vector<float> FluidLBM::getLanePopulations(int lane) const {
+	const size_t count = populations.size() / lanes;
+	std::vector<float> values(count);
+	for (size_t i = 0; i < count; ++i)
+		values[i] = populations[i * lanes + lane];
+	return values;
+}
+
+std::vector<float> FluidLBM::getLaneMacroscopic(int lane) const {
+	const size_t count = static_cast<size_t>(nodeCount);
+	std::vector<float> values(4 * count);
+	for (size_t i = 0; i < count; ++i) {
+		const size_t element = i * lanes + lane;
+		values[i] = density[element];
+		for (int d = 0; d < 3; ++d)
+			values[(d + 1) * count + i] = velocity[d][element];
+	}
+	return values;
+}
+
+bool FluidLBM::restoreMacroscopic(const std::vector<float>& values) {
+	const size_t count = static_cast<size_t>(nodeCount);
+	if (lanes != 1 || values.size() != 4 * count)
+		return false;
+	density.assign(values.begin(), values.begin() + count);
+	for (int d = 0; d < 3; ++d)
+		velocity[d].assign(values.begin() + (d + 1) * count, values.begin() + (d + 2) * count);
+	return true;
+}
+
+void FluidLBM::prepare(const FluidGrid& grid, const FluidBoundary& boundary, float density, float kinematicViscosity) {
+	prepareEnsemble(grid, { { &boundary, density, kinematicViscosity } });
+}
+
+bool FluidLBM::prepareEnsemble(const FluidGrid& grid, const std::vector<Member>& members) {
+	if (members.empty() || static_cast<int>(members.size()) > MaxLanes)
+		return false;
+
+	// Lanes share the lattice layout: every member's boundaries must close, open and drive the same cells
+	const FluidBoundary& layout = *members[0].boundary;
+	const std::vector<FluidBoundary::FaceVelocity>& faces = layout.getFaceVelocities();
+	for (const Member& member : members) {
+		const FluidBoundary& other = *member.boundary;
+		if (other.isPreparedFor(grid) != layout.isPreparedFor(grid) || other.getCellKinds() != layout.getCellKinds()
+			|| other.getFaceVelocities().size() != faces.size())
+			return false;
+		for (size_t i = 0; i < faces.size(); ++i) {
+			if (other.getFaceVelocities()[i].cell != faces[i].cell || other.getFaceVelocities()[i].axis != faces[i].axis)
+				return false;
+		}
+	}
+
+	size[0] = grid.getWidth();
+	size[1] = grid.getHeight();
+	size[2] = grid.getDepth();
+	dims = grid.getDimensions();
+	cellSize = grid.getCellSize();
+	lanes = static_cast<int>(members.size());
+	for (int d = 0; d < 3; ++d)
+		padded[d] = d < dims ? size[d] + 2 : 1;
+	nodeCount = padded[0] * padded[1] * padded[2];
+	fluidDensity.resize(lanes);
+	for (int lane = 0; lane < lanes; ++lane)
+		fluidDensity[lane] = members[lane].density;
+	const int stride[3] = { 1, padded[0], padded[0] * padded[1] };
+	const int ghost = dims == 3 ? 1 : 0; // z offset of the first interior node
+
+	// Lattice timestep, shared by all lanes: the fastest reference speed moves 0.1 cells per step
+	float speed = referenceSpeed;
+	for (const Member& member : members) {
+		const std::vector<FluidBoundary::FaceVelocity>& driven = member.boundary->getFaceVelocities();
+		for (size_t i = 0; i < driven.size() && referenceSpeed <= 0.0f; ++i)
+			speed = std::max(speed, std::fabs(driven[i].value));
+	}
+	if (referenceSpeed <= 0.0f) {
+		// Free-fall speed over the domain, so hydrostatic pressure stays a small density variation
+		float height = 0.0f, g = std::sqrt(gravity[0] * gravity[0] + gravity[1] * gravity[1] + gravity[2] * gravity[2]);
+		for (int d = 0; d < dims; ++d)
+			height = std::max(height, size[d] * cellSize);
+		speed = std::max(speed, std::sqrt(2.0f * g * height));
+	}
+	if (speed <= 0.0f)
+		speed = 1.0f;
+	latticeDt = 0.1f * cellSize / speed;
+	speedUsed = speed;
+	pendingTime = 0.0f;
+	oddStep = false;
+
+	// tau = 3 nu + 1/2 in lattice units; very thin fluids are clamped to keep TRT stable, which lowers
+	// the effective Reynolds number of the run
+	tau.resize(lanes);
+	for (int lane = 0; lane < lanes; ++lane)
+		tau[lane] = std::max(0.505f, 3.0f * members[lane].kinematicViscosity * latticeDt / (cellSize * cellSize) + 0.5f);
+
+	// Ghost layer and solid cells are walls; inlet cells of "+" inflows are moving walls
+	const size_t elements = static_cast<size_t>(nodeCount) * lanes;
+	nodeType.assign(nodeCount, Wall);
+	for (int d = 0; d < 3; ++d) {
+		wallVelocity[d].assign(elements, 0.0f);
+		velocity[d].assign(elements, 0.0f);
+	}
+	this->density.assign(elements, 1.0f);
+	const std::vector<uint8_t>& kinds = layout.getCellKinds();
+	const bool hasKinds = layout.isPreparedFor(grid) && kinds.size() == static_cast<size_t>(grid.getCellCount());
+	for (int z = 0; z < size[2]; ++z) {
+		for (int y = 0; y < size[1]; ++y) {
+			for (int x = 0; x < size[0]; ++x) {
+				const int cell = grid.index(x, y, z);
+				const bool closed = grid.isSolid(cell) || (hasKinds && kinds[cell] == FluidBoundary::Inlet);
+				nodeType[nodeIndex(x + 1, y + 1, z + ghost)] = closed ? Wall : Fluid;
+			}
+		}
+	}
+
+	if (hasKinds) {
+		for (const FluidBoundary::Outflow& outflow : layout.getOutflows()) {
+			const int axis = static_cast<int>(outflow.side) / 2;
+			if (outflow.type != FluidBoundary::OutflowType::Open || axis >= dims)
+				continue;
+			const int layer = static_cast<int>(outflow.side) % 2 ? padded[axis] - 1 : 0;
+			for (int z = 0; z < padded[2]; ++z) {
+				for (int y = 0; y < padded[1]; ++y) {
+					for (int x = 0; x < padded[0]; ++x) {
+						const int coord[3] = { x, y, z };
+						if (coord[axis] == layer)
+							nodeType[nodeIndex(x, y, z)] = Outlet;
+					}
+				}
+			}
+		}
+
+		// A driven face is the lower face of its cell: on an inlet cell the cell itself is the moving
+		// wall, otherwise the ghost node below it is. Each lane takes its own member's face speeds.
+		const float toLattice = latticeDt / cellSize;
+		for (size_t i = 0; i < faces.size(); ++i) {
+			const FluidBoundary::FaceVelocity& face = faces[i];
+			const int x = face.cell % size[0];
+			const int y = (face.cell / size[0]) % size[1];
+			const int z = face.cell / (size[0] * size[1]);
+			int node = nodeIndex(x + 1, y + 1, z + ghost);
+			if (kinds[face.cell] != FluidBoundary::Inlet) {
+				node -= stride[face.axis];
+				nodeType[node] = Wall;
+			}
+			for (int lane = 0; lane < lanes; ++lane)
+				wallVelocity[face.axis][static_cast<size_t>(node) * lanes + lane] = members[lane].boundary->getFaceVelocities()[i].value * toLattice;
+		}
+	}
+
+	// Split every interior row into runs of fluid nodes, marking runs whose whole neighbourhood is fluid
+	int offsets[D3Q19::Q];
+	const int directions = dims == 3 ? D3Q19::Q : D2Q9::Q;
+	if (dims == 3)
+		latticeOffsets<D3Q19>(padded, offsets);
+	else
+		latticeOffsets<D2Q9>(padded, offsets);
+
+	runs.clear();
+	rowRuns.clear();
+	for (int z = ghost; z < padded[2] - ghost; ++z) {
+		for (int y = 1; y <= size[1]; ++y) {
+			rowRuns.push_back(static_cast<int>(runs.size()));
+			bool open = false;
+			for (int x = 1; x <= size[0]; ++x) {
+				const int node = nodeIndex(x, y, z);
+				if (nodeType[node] != Fluid) {
+					open = false;
+					continue;
+				}
+				bool bulk = true;
+				for (int q = 1; q < directions && bulk; ++q)
+					bulk = nodeType[node + offsets[q]] == Fluid;
+				if (open && runs.back().bulk == bulk) {
+					++runs.back().length;
+				}
+				else {
+					runs.push_back({ node, 1, bulk });
+					open = true;
+				}
+			}
+		}
+	}
+	rowRuns.push_back(static_cast<int>(runs.size()));
+
+	// Start at rest
+	populations.resize(static_cast<size_t>(directions) * elements);
+	for (int q = 0; q < directions; ++q) {
+		const float weight = dims == 3 ? D3Q19::w[q] : D2Q9::w[q];
+		std::fill(populations.begin() + static_cast<size_t>(q) * elements,
+			populations.begin() + static_cast<size_t>(q + 1) * elements, weight);
+	}
+	return true;
+}
+
+template <typename L>
+void FluidLBM::streamCollide(const float force[3], const float* omegaPlus, const float* omegaMinus) {
+	// Addresses count elements (node * lanes + lane), so a run of nodes is a contiguous run of
+	// elements with every lane of a node next to each other
+	const int N = nodeCount * lanes;
+	float* A = populations.data();
+	int nodeOffsets[L::Q], offsets[L::Q];
+	latticeOffsets<L>(padded, nodeOffsets);
+	for (int q = 0; q < L::Q; ++q)
+		offsets[q] = nodeOffsets[q] * lanes;
+	const bool odd = oddStep;
+	float* rhoOut = density.data();
+	float* uOut[3] = { velocity[0].data(), velocity[1].data(), velocity[2].data() };
+	const uint8_t* type = nodeType.data();
+	const float* wall[3] = { wallVelocity[0].data(), wallVelocity[1].data(), wallVelocity[2].data() };
+
+	auto wallTerm = [&](int q, int element) {
+		return 6.0f * L::w[q] * (L::c[q][0] * wall[0][element] + L::c[q][1] * wall[1][element] + L::c[q][2] * wall[2][element]);
+	};
+
+	parallelFor(0, static_cast<int>(rowRuns.size()) - 1, [&](int row) {
+		float f[L::Q][Block];
+		for (int r = rowRuns[row]; r < rowRuns[row + 1]; ++r) {
+			const Run& run = runs[r];
+			const int start = run.start * lanes;
+			const int length = run.length * lanes;
+			if (!odd || run.bulk) {
+				// Even: read own slots, write reversed. Odd: gather from x - c_q, scatter to x + c_q.
+				// Each node reads and writes only its own slots, so a block is loaded whole before it is
+				// stored and blocks never overlap.
+				const float* in[L::Q];
+				float* out[L::Q];
+				for (int q = 0; q < L::Q; ++q) {
+					if (!odd) {
+						in[q] = A + static_cast<size_t>(q) * N + start;
+						out[q] = A + static_cast<size_t>(opposite(q)) * N + start;
+					}
+					else {
+						in[q] = A + static_cast<size_t>(opposite(q)) * N + start - offsets[q];
+						out[q] = A + static_cast<size_t>(q) * N + start + offsets[q];
+					}
+				}
+				int first = 0;
+				auto blocks = [&](auto stream, int size) {
+					for (; first + size <= length; first += size) {
+						const int element = start + first;
+						const int lane = first % lanes; // Rates repeat every lanes entries
+						stream(in, out, first, force, omegaPlus + lane, omegaMinus + lane,
+							rhoOut + element, uOut[0] + element, uOut[1] + element, uOut[2] + element);
+					}
+				};
+				blocks(streamBlock<L, Block>, Block);
+				blocks(streamBlock<L, 16>, 16);
+				blocks(streamBlock<L, 8>, 8);
+				blocks(streamBlock<L, 4>, 4);
+				blocks(streamBlock<L, 1>, 1);
+				continue;
+			}
+
+			// Odd step next to a boundary: links to walls bounce back (with the wall's momentum),
+			// links to outlets take the rho = 1 equilibrium at the node's velocity. Lanes share the
+			// node types, so all lanes of a node take the same branches and collide together.
+			for (int x = run.start; x < run.start + run.length; ++x) {
+				int lane = 0;
+				auto laneBlocks = [&](auto collide, int count) {
+					for (; lane + count <= lanes; lane += count) {
+						const int e = x * lanes + lane;
+						for (int q = 0; q < L::Q; ++q) {
+							const int src = x - nodeOffsets[q];
+							for (int i = 0; i < count; ++i) {
+								if (type[src] == Fluid) {
+									f[q][i] = A[static_cast<size_t>(opposite(q)) * N + e + i - offsets[q]];
+								}
+								else if (type[src] == Wall) {
+									f[q][i] = A[static_cast<size_t>(q) * N + e + i] + wallTerm(q, e + i - offsets[q]);
+								}
+								else {
+									const float u[3] = { uOut[0][e + i], uOut[1][e + i], uOut[2][e + i] };
+									f[q][i] = equilibrium<L>(q, 1.0f, u);
+								}
+							}
+						}
+						collide(f, force, omegaPlus + lane, omegaMinus + lane, rhoOut + e, uOut[0] + e, uOut[1] + e, uOut[2] + e);
+						for (int q = 0; q < L::Q; ++q) {
+							const int dst = x + nodeOffsets[q];
+							for (int i = 0; i < count; ++i) {
+								if (type[dst] == Fluid) {
+									A[static_cast<size_t>(q) * N + e + i + offsets[q]] = f[q][i];
+								}
+								else if (type[dst] == Wall) {
+									A[static_cast<size_t>(opposite(q)) * N + e + i] = f[q][i] - wallTerm(q, e + i + offsets[q]);
+								}
+								else {
+									const float u[3] = { uOut[0][e + i], uOut[1][e + i], uOut[2][e + i] };
+									A[static_cast<size_t>(opposite(q)) * N + e + i] = equilibrium<L>(opposite(q), 1.0f, u);
+								}
+							}
+						}
+					}
+				};
+				laneBlocks(collideBlock<L, 16>, 16);
+				laneBlocks(collideBlock<L, 8>, 8);
+				laneBlocks(collideBlock<L, 4>, 4);
+				laneBlocks(collideBlock<L, 2>, 2);
+				laneBlocks(collideBlock<L, 1>, 1);
+			}
+		}
+	}, 4);
+}
+
+int FluidLBM::step(FluidGrid& grid, float dt) {
+	FluidGrid* grids[1] = { &grid };
+	return lanes == 1 ? stepEnsemble(grids, dt) : 0;
+}
+
+int FluidLBM::stepEnsemble(FluidGrid* const* grids, float dt) {
+	for (int lane = 0; lane < lanes; ++lane) {
+		if (!isPreparedFor(*grids[lane]))
+			return 0;
+	}
+	pendingTime += dt;
+	const int steps = static_cast<int>(pendingTime / latticeDt + 1e-3f);
+	pendingTime = std::max(0.0f, pendingTime - steps * latticeDt);
+
+	const float toLattice = latticeDt * latticeDt / cellSize;
+	const float force[3] = { gravity[0] * toLattice, gravity[1] * toLattice, dims == 3 ? gravity[2] * toLattice : 0.0f };
+	// Relaxation rates of each lane, repeated so a block starting at any lane reads its rates in a row
+	float omegaPlus[Block + MaxLanes], omegaMinus[Block + MaxLanes];
+	for (int i = 0; i < Block + MaxLanes; ++i) {
+		const float t = tau[i % lanes];
+		omegaPlus[i] = 1.0f / t;
+		omegaMinus[i] = 1.0f / (0.1875f / (t - 0.5f) + 0.5f);
+	}
+	for (int s = 0; s < steps; ++s) {
+		if (dims == 3)
+			streamCollide<D3Q19>(force, omegaPlus, omegaMinus);
+		else
+			streamCollide<D2Q9>(force, omegaPlus, omegaMinus);
+		oddStep = !oddStep;
+	}
+	for (int lane = 0; lane < lanes; ++lane)
+		writeToGrid(*grids[lane], lane);
+	return steps;
+}
+
+void FluidLBM::writeToGrid(FluidGrid& grid, int lane) const {
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int stride[3] = { 1, padded[0], padded[0] * padded[1] };
+	const int ghost = dims == 3 ? 1 : 0;
+	const float toPhysical = cellSize / latticeDt;
+	const float pressureScale = fluidDensity[lane] * toPhysical * toPhysical / 3.0f;
+
+	// Face value between two nodes: the mean of two fluid nodes, the wall's velocity on a wall, or the
+	// fluid side's velocity at an outlet
+	auto faceValue = [&](int axis, int a, int b) {
+		const size_t ea = static_cast<size_t>(a) * lanes + lane, eb = static_cast<size_t>(b) * lanes + lane;
+		if (nodeType[a] == Fluid && nodeType[b] == Fluid)
+			return 0.5f * (velocity[axis][ea] + velocity[axis][eb]);
+		if (nodeType[a] == Wall)
+			return wallVelocity[axis][ea];
+		if (nodeType[b] == Wall)
+			return wallVelocity[axis][eb];
+		return nodeType[a] == Fluid ? velocity[axis][ea] : (nodeType[b] == Fluid ? velocity[axis][eb] : 0.0f);
+	};
+
+	parallelFor(0, size[2] * size[1], [&](int row) {
+		const int z = row / size[1];
+		const int y = row % size[1];
+		for (int x = 0; x < size[0]; ++x) {
+			const int node = nodeIndex(x + 1, y + 1, z + ghost);
+			FluidGrid::Cell& cell = cells[grid.index(x, y, z)];
+			cell.pressure = nodeType[node] == Fluid ? (density[static_cast<size_t>(node) * lanes + lane] - 1.0f) * pressureScale : 0.0f;
+			for (int d = 0; d < 3; ++d)
+				cell.velocity[d] = d < dims ? faceValue(d, node, node - stride[d]) * toPhysical : 0.0f;
+		}
+	}, 4);
+}
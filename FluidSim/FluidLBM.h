@@ -0,0 +1,141 @@
+#pragma once
+#include "FluidGrid.h"
+#include "FluidBoundary.h"
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Lattice Boltzmann engine (D2Q9 in 2D, D3Q19 in 3D) on the extents of a FluidGrid.
+ *
+ * Single-phase: the lattice is filled with one fluid (density and kinematic viscosity given to
+ * prepare()). Distributions are stored structure-of-arrays, one contiguous array per direction, and
+ * streamed in place with the AA pattern: even steps collide each node locally and write the result
+ * back reversed, odd steps gather from the neighbours, collide and scatter back to them. Both halves
+ * touch exactly the slots they read, so one copy of the distributions is enough and every step is a
+ * fused stream-and-collide. Collisions use TRT (two relaxation times, magic parameter 3/16).
+ *
+ * The lattice carries a one-node ghost layer. Domain walls and solid cells are half-way bounce-back
+ * nodes; inflow faces from FluidBoundary become moving bounce-back walls and open outflows become
+ * equilibrium (rho = 1) outlets. Runs of nodes whose whole neighbourhood is fluid are streamed by a
+ * branch-free loop over contiguous memory so the compiler can vectorize it; nodes next to a boundary
+ * take a scalar path. Rows are distributed over threads with parallelFor.
+ *
+ * The lattice timestep is fixed at prepare() so the reference speed maps to lattice speed 0.1
+ * (Mach ~0.17); step() runs as many lattice steps as fit in the caller's dt and carries the rest.
+ *
+ * Ensembles: prepareEnsemble() runs up to MaxLanes members of the same grid in one lattice, each
+ * member a lane. Distributions are interleaved per node (populations[(q * nodeCount + node) * lanes
+ * + lane]), so a run of nodes is lanes times longer and every stream-and-collide block is full-width
+ * across members. Members share geometry and the lattice timestep but keep their own viscosity and
+ * inflow speeds; small grids, whose rows are too short to fill the vector units alone, gain most.
+ */
+class FluidLBM {
+public:
+	FluidLBM();
+
+	/**
+	 * @brief Builds the lattice for a grid and its boundaries, starting at rest.
+	 * @param grid Grid whose extents, cell size and solid layer are used.
+	 * @param boundary Prepared inflow/outflow boundaries (may be empty).
+	 * @param density Fluid density (kg/m^3), used to report pressure.
+	 * @param kinematicViscosity Fluid kinematic viscosity (m^2/s).
+	 */
+	void prepare(const FluidGrid& grid, const FluidBoundary& boundary, float density, float kinematicViscosity);
+	bool isPreparedFor(const FluidGrid& grid) const;
+
+	static const int MaxLanes = 16;
+
+	// One member of an ensemble lattice
+	struct Member {
+		const FluidBoundary* boundary; // Prepared; must close, open and drive the same cells as the other members'
+		float density;                 // kg/m^3, used to report pressure
+		float kinematicViscosity;      // m^2/s
+	};
+
+	/**
+	 * @brief Builds one lattice for an ensemble of members on the same grid, one lane each, starting at rest.
+	 * @param grid Grid shared by the members (extents, cell size and solid layer).
+	 * @param members Boundaries and fluid of each lane; inflow speeds, density and viscosity may differ.
+	 * @return False if there are no members, more than MaxLanes, or their boundary layouts differ.
+	 */
+	bool prepareEnsemble(const FluidGrid& grid, const std::vector<Member>& members);
+	int getLanes() const { return lanes; }
+
+	// Reference speed used to pick the lattice timestep; 0 (default) uses the fastest inflow or the free-fall speed over the domain
+	void setReferenceSpeed(float speed) { referenceSpeed = speed; }
+	// The speed the last prepare() derived the lattice timestep from; set it as the reference speed to
+	// rebuild the same lattice (e.g. for one lane of an ensemble, whose timestep follows the fastest lane)
+	float getSpeedUsed() const { return speedUsed; }
+	void setGravity(float gx, float gy, float gz); // Set before prepare(), it feeds the default reference speed
+
+	/**
+	 * @brief Advances the lattice by dt and writes the macroscopic face velocities and cell
+	 * pressures back into the grid.
+	 * @param grid Grid the lattice was prepared for.
+	 * @param dt Timestep.
+	 * @return Number of lattice steps taken.
+	 */
+	int step(FluidGrid& grid, float dt);
+
+	/**
+	 * @brief Advances every lane by dt and writes each lane back into its member's grid.
+	 * @param grids One grid per lane, each of the prepared size.
+	 * @param dt Timestep.
+	 * @return Number of lattice steps taken.
+	 */
+	int stepEnsemble(FluidGrid* const* grids, float dt);
+
+	// Distributions and step phase, for checkpoints. Restore them after prepare() for the same grid and fluid.
+	const std::vector<float>& getPopulations() const { return populations; }
+	// The distributions of one lane, laid out as a single-member lattice's (restorable with restoreState())
+	std::vector<float> getLanePopulations(int lane) const;
+	bool isOddStep() const { return oddStep; }
+	float getPendingTime() const { return pendingTime; }
+	bool restoreState(std::vector<float> values, bool odd, float pending);
+	// Density and velocity from the last collision of one lane, four node-sized blocks: outlets build their
+	// incoming links from them, so a restored lattice needs them to continue exactly
+	std::vector<float> getLaneMacroscopic(int lane) const;
+	bool restoreMacroscopic(const std::vector<float>& values);
+
+	float getLatticeTimestep() const { return latticeDt; }
+	float getRelaxationTime(int lane = 0) const { return tau[lane]; }
+
+private:
+	enum NodeType : uint8_t { Fluid = 0, Wall = 1, Outlet = 2 };
+
+	// A contiguous run of fluid nodes within a lattice row
+	struct Run {
+		int start;
+		int length;
+		bool bulk; // Every node's full neighbourhood is fluid
+	};
+
+	int size[3];    // Grid extents
+	int padded[3];  // Lattice extents including the ghost layer
+	int dims;
+	int nodeCount;
+	int lanes;      // Ensemble members sharing the lattice
+	float cellSize;
+
+	// Per element (node * lanes + lane) except nodeType, which the lanes share
+	std::vector<float> populations;  // populations[q * nodeCount * lanes + element]
+	std::vector<uint8_t> nodeType;
+	std::vector<float> wallVelocity[3]; // Lattice units, for moving bounce-back walls
+	std::vector<float> density;
+	std::vector<float> velocity[3];     // Lattice units, from the last collision
+	std::vector<Run> runs;
+	std::vector<int> rowRuns;          // First run of each lattice row, plus one past the end
+
+	bool oddStep;
+	float latticeDt;
+	float pendingTime;
+	std::vector<float> tau; // Per lane
+	float referenceSpeed;
+	float speedUsed;
+	std::vector<float> fluidDensity; // Per lane
+	float gravity[3];
+
+	template <typename L> void streamCollide(const float force[3], const float* omegaPlus, const float* omegaMinus);
+	void writeToGrid(FluidGrid& grid, int lane) const;
+	int nodeIndex(int x, int y, int z) const { return (z * padded[1] + y) * padded[0] + x; }
+};
@@ -0,0 +1,623 @@
+#include "FluidNet.h"
+#include "FluidGrid.h"
+#include "FluidParallel.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FLUID_NET_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+const uint32_t FluidNet::FormatVersion;
+const int FluidNet::MaxKernel;
+
+static const char Magic[8] = { 'F', 'L', 'U', 'I', 'D', 'N', 'E', 'T' };
+static const int Group = 4;  // Output channels accumulated together
+static const int Span = 16;  // Cells of a row accumulated together
+static const uint32_t ChannelCount = 7;
+static const uint32_t ActivationCount = 3;
+static const uint32_t MaxChannels = 4096;
+
+static bool fail(std::string* error, const std::string& reason) {
+	if (error)
+		*error = reason;
+	return false;
+}
+
+// IEEE half precision, round to nearest even
+static uint16_t toHalf(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, 4);
+	const uint32_t sign = (bits >> 16) & 0x8000u;
+	const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffffu;
+	if (((bits >> 23) & 0xff) == 0xff)
+		return static_cast<uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+	if (exponent >= 31)
+		return static_cast<uint16_t>(sign | 0x7c00u);
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000u;
+		const int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		const uint32_t rest = mantissa & ((1u << shift) - 1), midpoint = 1u << (shift - 1);
+		if (rest > midpoint || (rest == midpoint && (half & 1u)))
+			++half;
+		return static_cast<uint16_t>(sign | half);
+	}
+	uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	const uint32_t rest = mantissa & 0x1fffu;
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+		++half; // May carry into the exponent, which rounds up to the next power of two or to infinity
+	return static_cast<uint16_t>(sign | half);
+}
+
+static float fromHalf(uint16_t half) {
+	const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+	uint32_t exponent = (half >> 10) & 0x1fu;
+	uint32_t mantissa = half & 0x3ffu;
+	uint32_t bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	}
+	else if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		}
+		else {
+			// Subnormal: normalize it
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400u)) {
+				mantissa <<= 1;
+				--exponent;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+		}
+	}
+	else {
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+	float value;
+	std::memcpy(&value, &bits, 4);
+	return value;
+}
+
+static float activate(FluidNet::Activation activation, float value) {
+	if (activation == FluidNet::Activation::ReLU)
+		return value > 0.0f ? value : 0.0f;
+	if (activation == FluidNet::Activation::Tanh)
+		return std::tanh(value);
+	return value;
+}
+
+// One layer's geometry over the padded activations
+struct ConvShape {
+	int inputs;
+	int taps;
+	size_t channelStride;
+	int tapOffset[FluidNet::MaxKernel * FluidNet::MaxKernel * FluidNet::MaxKernel];
+	FluidNet::Activation activation;
+};
+
+// Accumulates outputs [0, count) of one group over cells [first, last) of a row. in and out point at
+// the row's first cell in channel 0; weights holds (input, tap, Group) triples of the group.
+static void convolveSpan(const ConvShape& shape, const float* in, float* out, const float* weights, const float* bias,
+	int count, int first, int last) {
+	for (int x = first; x < last; x += Span) {
+		const int width = std::min(Span, last - x);
+		float acc[Group][Span];
+		for (int g = 0; g < Group; ++g) {
+			for (int i = 0; i < Span; ++i)
+				acc[g][i] = bias[g];
+		}
+		for (int c = 0; c < shape.inputs; ++c) {
+			const float* source = in + c * shape.channelStride + x;
+			const float* w = weights + static_cast<size_t>(c) * shape.taps * Group;
+			for (int t = 0; t < shape.taps; ++t, w += Group) {
+				const float* s = source + shape.tapOffset[t];
+				if (width == Span) {
+					for (int i = 0; i < Span; ++i) {
+						const float v = s[i];
+						acc[0][i] += w[0] * v;
+						acc[1][i] += w[1] * v;
+						acc[2][i] += w[2] * v;
+						acc[3][i] += w[3] * v;
+					}
+				}
+				else {
+					for (int i = 0; i < width; ++i) {
+						for (int g = 0; g < Group; ++g)
+							acc[g][i] += w[g] * s[i];
+					}
+				}
+			}
+		}
+		for (int g = 0; g < count; ++g) {
+			float* target = out + g * shape.channelStride + x;
+			for (int i = 0; i < width; ++i)
+				target[i] = activate(shape.activation, acc[g][i]);
+		}
+	}
+}
+
+#ifdef FLUID_NET_AVX2
+#ifndef _MSC_VER
+__attribute__((target("xsave")))
+#endif
+static bool detectVectorKernels() {
+	unsigned regs[4] = {};
+#ifdef _MSC_VER
+	__cpuid(reinterpret_cast<int*>(regs), 0);
+	if (regs[0] < 7)
+		return false;
+	__cpuid(reinterpret_cast<int*>(regs), 1);
+#else
+	if (__get_cpuid_max(0, nullptr) < 7)
+		return false;
+	__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+	// FMA, OSXSAVE and AVX, with the OS saving the ymm registers
+	const unsigned needed = (1u << 12) | (1u << 27) | (1u << 28);
+	if ((regs[2] & needed) != needed || (_xgetbv(0) & 6) != 6)
+		return false;
+#ifdef _MSC_VER
+	__cpuidex(reinterpret_cast<int*>(regs), 7, 0);
+#else
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	return (regs[1] & (1u << 5)) != 0;
+}
+
+#ifndef _MSC_VER
+__attribute__((target("avx2,fma")))
+#endif
+static void convolveSpanVector(const ConvShape& shape, const float* in, float* out, const float* weights, const float* bias,
+	int count, int first, int last) {
+	int x = first;
+	for (; x + Span <= last; x += Span) {
+		__m256 acc[Group][2];
+		for (int g = 0; g < Group; ++g)
+			acc[g][0] = acc[g][1] = _mm256_set1_ps(bias[g]);
+		for (int c = 0; c < shape.inputs; ++c) {
+			const float* source = in + c * shape.channelStride + x;
+			const float* w = weights + static_cast<size_t>(c) * shape.taps * Group;
+			for (int t = 0; t < shape.taps; ++t, w += Group) {
+				const float* s = source + shape.tapOffset[t];
+				const __m256 lo = _mm256_loadu_ps(s), hi = _mm256_loadu_ps(s + 8);
+				for (int g = 0; g < Group; ++g) {
+					const __m256 weight = _mm256_broadcast_ss(w + g);
+					acc[g][0] = _mm256_fmadd_ps(weight, lo, acc[g][0]);
+					acc[g][1] = _mm256_fmadd_ps(weight, hi, acc[g][1]);
+				}
+			}
+		}
+		const __m256 zero = _mm256_setzero_ps();
+		for (int g = 0; g < count; ++g) {
+			float* target = out + g * shape.channelStride + x;
+			if (shape.activation == FluidNet::Activation::ReLU) {
+				_mm256_storeu_ps(target, _mm256_max_ps(acc[g][0], zero));
+				_mm256_storeu_ps(target + 8, _mm256_max_ps(acc[g][1], zero));
+			}
+			else {
+				_mm256_storeu_ps(target, acc[g][0]);
+				_mm256_storeu_ps(target + 8, acc[g][1]);
+				if (shape.activation != FluidNet::Activation::None) {
+					for (int i = 0; i < Span; ++i)
+						target[i] = activate(shape.activation, target[i]);
+				}
+			}
+		}
+	}
+	if (x < last)
+		convolveSpan(shape, in, out, weights, bias, count, x, last);
+}
+#endif
+
+FluidNet::FluidNet() : dims(2), precision(Precision::Float32), layout{ 0, 0, 0, 0, 0 } {
+}
+
+bool FluidNet::hasVectorKernels() {
+#ifdef FLUID_NET_AVX2
+	static const bool available = detectVectorKernels();
+	return available;
+#else
+	return false;
+#endif
+}
+
+bool FluidNet::parsePrecision(const std::string& text, Precision& value) {
+	std::string name;
+	for (char c : text)
+		name += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	if (name == "fp32" || name == "float32" || name.empty())
+		value = Precision::Float32;
+	else if (name == "fp16" || name == "float16" || name == "half")
+		value = Precision::Float16;
+	else if (name == "int8")
+		value = Precision::Int8;
+	else
+		return false;
+	return true;
+}
+
+void FluidNet::reset(int dimensions, const std::vector<std::pair<Channel, float>>& inputChannels, Precision storage) {
+	dims = dimensions == 3 ? 3 : 2;
+	precision = storage;
+	inputs = inputChannels;
+	outputs.clear();
+	layers.clear();
+}
+
+bool FluidNet::addLayer(int kernel, int outputCount, Activation activation, const std::vector<float>& weights, const std::vector<float>& bias) {
+	const int inputCount = layers.empty() ? static_cast<int>(inputs.size()) : layers.back().outputs;
+	if (kernel < 1 || kernel > MaxKernel || kernel % 2 == 0 || outputCount < 1 || outputCount > static_cast<int>(MaxChannels) || inputCount < 1)
+		return false;
+	const size_t taps = dims == 3 ? kernel * kernel * kernel : kernel * kernel;
+	if (weights.size() != static_cast<size_t>(outputCount) * inputCount * taps || bias.size() != static_cast<size_t>(outputCount))
+		return false;
+
+	Layer layer;
+	layer.kernel = kernel;
+	layer.inputs = inputCount;
+	layer.outputs = outputCount;
+	layer.activation = activation;
+	layer.bias = bias;
+	if (precision == Precision::Float32) {
+		layer.weights = weights;
+	}
+	else if (precision == Precision::Float16) {
+		layer.halves.resize(weights.size());
+		for (size_t i = 0; i < weights.size(); ++i)
+			layer.halves[i] = toHalf(weights[i]);
+	}
+	else {
+		// Symmetric per output channel: the largest weight maps to +-127
+		const size_t perOutput = static_cast<size_t>(inputCount) * taps;
+		layer.quantized.resize(weights.size());
+		layer.scales.resize(outputCount);
+		for (int o = 0; o < outputCount; ++o) {
+			float largest = 0.0f;
+			for (size_t i = 0; i < perOutput; ++i)
+				largest = std::max(largest, std::fabs(weights[o * perOutput + i]));
+			const float scale = largest > 0.0f ? largest / 127.0f : 1.0f;
+			layer.scales[o] = scale;
+			for (size_t i = 0; i < perOutput; ++i) {
+				const float q = std::round(weights[o * perOutput + i] / scale);
+				layer.quantized[o * perOutput + i] = static_cast<int8_t>(std::min(127.0f, std::max(-127.0f, q)));
+			}
+		}
+	}
+	layers.push_back(std::move(layer));
+	return true;
+}
+
+bool FluidNet::setOutputs(const std::vector<std::pair<Channel, float>>& outputChannels) {
+	if (layers.empty() || static_cast<int>(outputChannels.size()) != layers.back().outputs)
+		return false;
+	outputs = outputChannels;
+	return true;
+}
+
+bool FluidNet::isReady() const {
+	return !inputs.empty() && !layers.empty() && static_cast<int>(outputs.size()) == layers.back().outputs;
+}
+
+size_t FluidNet::getWeightBytes() const {
+	size_t bytes = 0;
+	for (const Layer& layer : layers) {
+		bytes += layer.weights.size() * sizeof(float) + layer.halves.size() * sizeof(uint16_t)
+			+ layer.quantized.size() + (layer.scales.size() + layer.bias.size()) * sizeof(float);
+	}
+	return bytes;
+}
+
+int FluidNet::getPadding() const {
+	int radius = 0;
+	for (const Layer& layer : layers)
+		radius = std::max(radius, layer.kernel / 2);
+	return radius;
+}
+
+void FluidNet::expandWeights(const Layer& layer, float* out) const {
+	// (group, input, tap, Group) order, so a group's weights are read front to back; outputs past the
+	// last one in the final group get zero weights
+	const int taps = dims == 3 ? layer.kernel * layer.kernel * layer.kernel : layer.kernel * layer.kernel;
+	const int groups = (layer.outputs + Group - 1) / Group;
+	const size_t perOutput = static_cast<size_t>(layer.inputs) * taps;
+	for (int g = 0; g < groups; ++g) {
+		for (int j = 0; j < Group; ++j) {
+			const int o = g * Group + j;
+			for (size_t i = 0; i < perOutput; ++i) {
+				float w = 0.0f;
+				if (o < layer.outputs) {
+					const size_t at = o * perOutput + i;
+					if (precision == Precision::Float32)
+						w = layer.weights[at];
+					else if (precision == Precision::Float16)
+						w = fromHalf(layer.halves[at]);
+					else
+						w = layer.quantized[at] * layer.scales[o];
+				}
+				out[(g * perOutput + i) * Group + j] = w;
+			}
+		}
+	}
+}
+
+bool FluidNet::evaluate(const float* input, float* output, int count, int nx, int ny, int nz) const {
+	if (!isReady() || count < 1 || nx < 1 || ny < 1 || nz < 1 || (dims == 2 && nz != 1))
+		return false;
+
+	// Every layer reads and writes planes with a zero border of the widest kernel's radius, so taps
+	// never need bounds checks; the border is cleared only when the layout changes
+	const int radius = getPadding();
+	const int px = nx + 2 * radius, py = ny + 2 * radius, pz = dims == 3 ? nz + 2 * radius : 1;
+	const int zBorder = dims == 3 ? radius : 0;
+	int channels = static_cast<int>(inputs.size());
+	for (const Layer& layer : layers)
+		channels = std::max(channels, layer.outputs);
+	const size_t channelStride = static_cast<size_t>(px) * py * pz;
+	const size_t sampleStride = channelStride * channels;
+	const int key[5] = { count, px, py, pz, channels };
+	if (!std::equal(key, key + 5, layout)) {
+		for (std::vector<float>& buffer : activations)
+			buffer.assign(sampleStride * count, 0.0f);
+		std::copy(key, key + 5, layout);
+	}
+
+	const size_t cells = static_cast<size_t>(nx) * ny * nz;
+	auto interior = [&](int sample, int channel, int z, int y) {
+		return (sample * sampleStride) + channel * channelStride + (static_cast<size_t>(z + zBorder) * py + y + radius) * px + radius;
+	};
+	auto copyPlanes = [&](const float* from, float* to, int planeCount, bool toPadded) {
+		parallelFor(0, count * planeCount * nz, [&](int index) {
+			const int z = index % nz;
+			const int plane = index / nz;
+			const int sample = plane / planeCount, channel = plane % planeCount;
+			for (int y = 0; y < ny; ++y) {
+				const size_t dense = (static_cast<size_t>(sample) * planeCount + channel) * cells + (static_cast<size_t>(z) * ny + y) * nx;
+				const size_t padded = interior(sample, channel, z, y);
+				if (toPadded)
+					std::copy(from + dense, from + dense + nx, to + padded);
+				else
+					std::copy(from + padded, from + padded + nx, to + dense);
+			}
+		});
+	};
+	copyPlanes(input, activations[0].data(), static_cast<int>(inputs.size()), true);
+
+#ifdef FLUID_NET_AVX2
+	const auto span = hasVectorKernels() ? convolveSpanVector : convolveSpan;
+#else
+	const auto span = convolveSpan;
+#endif
+	int current = 0;
+	for (const Layer& layer : layers) {
+		ConvShape shape;
+		const int r = layer.kernel / 2;
+		const int reach = dims == 3 ? r : 0;
+		shape.inputs = layer.inputs;
+		shape.taps = 0;
+		shape.channelStride = channelStride;
+		shape.activation = layer.activation;
+		for (int dz = -reach; dz <= reach; ++dz) {
+			for (int dy = -r; dy <= r; ++dy) {
+				for (int dx = -r; dx <= r; ++dx)
+					shape.tapOffset[shape.taps++] = (dz * py + dy) * px + dx;
+			}
+		}
+
+		const int groups = (layer.outputs + Group - 1) / Group;
+		const size_t groupWeights = static_cast<size_t>(layer.inputs) * shape.taps * Group;
+		panel.resize(groupWeights * groups);
+		expandWeights(layer, panel.data());
+		staged.assign(static_cast<size_t>(groups) * Group, 0.0f);
+		std::copy(layer.bias.begin(), layer.bias.end(), staged.begin());
+
+		const float* in = activations[current].data();
+		float* out = activations[1 - current].data();
+		const int rows = count * nz * ny;
+		parallelFor(0, rows * groups, [&](int index) {
+			const int g = index % groups;
+			const int row = index / groups;
+			const int sample = row / (nz * ny);
+			const int z = (row / ny) % nz, y = row % ny;
+			const size_t at = interior(sample, 0, z, y) - static_cast<size_t>(sample) * sampleStride;
+			const float* source = in + sample * sampleStride + at;
+			float* target = out + sample * sampleStride + g * Group * channelStride + at;
+			span(shape, source, target, panel.data() + g * groupWeights, staged.data() + g * Group,
+				std::min(Group, layer.outputs - g * Group), 0, nx);
+		});
+		current = 1 - current;
+	}
+
+	copyPlanes(activations[current].data(), output, static_cast<int>(outputs.size()), false);
+	return true;
+}
+
+void FluidNet::readChannel(const FluidGrid& grid, Channel channel, float dt, float* out) {
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	const int dims = grid.getDimensions();
+	const int size[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int stride[3] = { 1, size[0], size[0] * size[1] };
+	const float rhsScale = dt > 0.0f ? -grid.getCellSize() / dt : 0.0f;
+	parallelFor(0, n, [&](int i) {
+		float value = 0.0f;
+		switch (channel) {
+		case Channel::VelocityX:
+		case Channel::VelocityY:
+		case Channel::VelocityZ:
+			value = cells[i].velocity[static_cast<int>(channel)];
+			break;
+		case Channel::Pressure:
+			value = cells[i].pressure;
+			break;
+		case Channel::Solid:
+			value = grid.isSolid(i) ? 1.0f : 0.0f;
+			break;
+		case Channel::Liquid:
+			value = cells[i].material_id >= 0 ? 1.0f : 0.0f;
+			break;
+		case Channel::PressureRhs: {
+			// Net flux out of the cell through its open faces
+			int coord[3] = { i % size[0], (i / size[0]) % size[1], i / (size[0] * size[1]) };
+			float divergence = 0.0f;
+			for (int d = 0; d < dims; ++d) {
+				const float lower = grid.getFaceFraction(i, d) * cells[i].velocity[d];
+				const float upper = coord[d] + 1 < size[d] ? grid.getFaceFraction(i + stride[d], d) * cells[i + stride[d]].velocity[d] : 0.0f;
+				divergence += upper - lower;
+			}
+			value = grid.isSolid(i) ? 0.0f : rhsScale * divergence;
+			break;
+		}
+		}
+		out[i] = value;
+	}, 4096);
+}
+
+bool FluidNet::infer(const std::vector<const FluidGrid*>& grids, float dt, std::vector<std::vector<float>>& results) const {
+	if (!isReady() || grids.empty())
+		return false;
+	const FluidGrid& first = *grids[0];
+	for (const FluidGrid* grid : grids) {
+		if (grid->getWidth() != first.getWidth() || grid->getHeight() != first.getHeight() || grid->getDepth() != first.getDepth())
+			return false;
+	}
+	const size_t cells = static_cast<size_t>(first.getCellCount());
+	const int count = static_cast<int>(grids.size());
+	std::vector<float> input(cells * inputs.size() * count);
+	for (int s = 0; s < count; ++s) {
+		for (size_t c = 0; c < inputs.size(); ++c) {
+			float* plane = input.data() + (s * inputs.size() + c) * cells;
+			readChannel(*grids[s], inputs[c].first, dt, plane);
+			const float scale = inputs[c].second;
+			if (scale != 1.0f) {
+				for (size_t i = 0; i < cells; ++i)
+					plane[i] *= scale;
+			}
+		}
+	}
+	std::vector<float> output(cells * outputs.size() * count);
+	if (!evaluate(input.data(), output.data(), count, first.getWidth(), first.getHeight(), first.getDepth()))
+		return false;
+
+	results.resize(count);
+	for (int s = 0; s < count; ++s) {
+		results[s].assign(output.begin() + s * outputs.size() * cells, output.begin() + (s + 1) * outputs.size() * cells);
+		for (size_t c = 0; c < outputs.size(); ++c) {
+			const float scale = outputs[c].second;
+			if (scale != 1.0f) {
+				for (size_t i = 0; i < cells; ++i)
+					results[s][c * cells + i] *= scale;
+			}
+		}
+	}
+	return true;
+}
+
+static bool readValues(FILE* file, void* out, size_t bytes) {
+	return std::fread(out, 1, bytes, file) == bytes;
+}
+
+bool FluidNet::load(const std::string& path, Precision storage, std::string* error) {
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file)
+		return fail(error, "Cannot open " + path);
+
+	char magic[8];
+	uint32_t head[5];
+	bool ok = readValues(file, magic, sizeof(magic)) && std::memcmp(magic, Magic, sizeof(Magic)) == 0
+		&& readValues(file, head, sizeof(head));
+	std::string reason = path + " is not a FluidSim model";
+	if (ok && (head[0] != FormatVersion || (head[1] != 2 && head[1] != 3) || head[2] == 0 || head[2] > MaxChannels
+		|| head[3] == 0 || head[3] > MaxChannels || head[4] == 0 || head[4] > 256)) {
+		ok = false;
+		reason = path + " has an unsupported model header";
+	}
+
+	auto readChannels = [&](uint32_t n, std::vector<std::pair<Channel, float>>& list) {
+		for (uint32_t i = 0; i < n && ok; ++i) {
+			uint32_t channel = 0;
+			float scale = 0.0f;
+			ok = readValues(file, &channel, 4) && readValues(file, &scale, 4) && channel < ChannelCount;
+			list.push_back({ static_cast<Channel>(channel), scale });
+		}
+	};
+	std::vector<std::pair<Channel, float>> inputList, outputList;
+	if (ok) {
+		readChannels(head[2], inputList);
+		readChannels(head[3], outputList);
+		reset(static_cast<int>(head[1]), inputList, storage);
+	}
+	for (uint32_t l = 0; l < head[4] && ok; ++l) {
+		uint32_t spec[3];
+		ok = readValues(file, spec, sizeof(spec)) && spec[0] >= 1 && spec[0] <= static_cast<uint32_t>(MaxKernel)
+			&& spec[1] >= 1 && spec[1] <= MaxChannels && spec[2] < ActivationCount;
+		if (!ok)
+			break;
+		const size_t inputCount = layers.empty() ? inputs.size() : layers.back().outputs;
+		const size_t taps = dims == 3 ? spec[0] * spec[0] * spec[0] : spec[0] * spec[0];
+		std::vector<float> weights(spec[1] * inputCount * taps), bias(spec[1]);
+		ok = readValues(file, weights.data(), weights.size() * sizeof(float)) && readValues(file, bias.data(), bias.size() * sizeof(float))
+			&& addLayer(static_cast<int>(spec[0]), static_cast<int>(spec[1]), static_cast<Activation>(spec[2]), weights, bias);
+	}
+	std::fclose(file);
+	if (ok && !setOutputs(outputList)) {
+		ok = false;
+		reason = path + ": the last layer does not match the output channels";
+	}
+	if (!ok) {
+		layers.clear();
+		outputs.clear();
+		return fail(error, reason);
+	}
+	return true;
+}
+
+bool FluidNet::save(const std::string& path, std::string* error) const {
+	if (!isReady())
+		return fail(error, "No model to save");
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file)
+		return fail(error, "Cannot create " + path);
+
+	const uint32_t head[5] = { FormatVersion, static_cast<uint32_t>(dims), static_cast<uint32_t>(inputs.size()),
+		static_cast<uint32_t>(outputs.size()), static_cast<uint32_t>(layers.size()) };
+	bool ok = std::fwrite(Magic, 1, sizeof(Magic), file) == sizeof(Magic) && std::fwrite(head, 1, sizeof(head), file) == sizeof(head);
+	for (const auto* list : { &inputs, &outputs }) {
+		for (const auto& entry : *list) {
+			const uint32_t channel = static_cast<uint32_t>(entry.first);
+			ok = ok && std::fwrite(&channel, 4, 1, file) == 1 && std::fwrite(&entry.second, 4, 1, file) == 1;
+		}
+	}
+	for (const Layer& layer : layers) {
+		// Stored weights go back out as fp32, dequantized if need be
+		const uint32_t spec[3] = { static_cast<uint32_t>(layer.kernel), static_cast<uint32_t>(layer.outputs), static_cast<uint32_t>(layer.activation) };
+		const size_t perOutput = static_cast<size_t>(layer.inputs) * (dims == 3 ? layer.kernel * layer.kernel * layer.kernel : layer.kernel * layer.kernel);
+		std::vector<float> weights(perOutput * layer.outputs);
+		for (size_t i = 0; i < weights.size(); ++i) {
+			if (precision == Precision::Float32)
+				weights[i] = layer.weights[i];
+			else if (precision == Precision::Float16)
+				weights[i] = fromHalf(layer.halves[i]);
+			else
+				weights[i] = layer.quantized[i] * layer.scales[i / perOutput];
+		}
+		ok = ok && std::fwrite(spec, 1, sizeof(spec), file) == sizeof(spec)
+			&& std::fwrite(weights.data(), sizeof(float), weights.size(), file) == weights.size()
+			&& std::fwrite(layer.bias.data(), sizeof(float), layer.bias.size(), file) == layer.bias.size();
+	}
+	ok = std::fclose(file) == 0 && ok;
+	return ok || fail(error, "Cannot write " + path);
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FluidGrid;
+
+/**
+ * @brief CPU inference for small convolutional surrogates over grid channels.
+ *
+ * A network is a chain of "same"-padded convolutions with odd kernels (1 for a per-cell MLP layer,
+ * 3 or 5 for stencils), each followed by an activation, over a 2D or 3D grid. Its inputs are grid
+ * channels (velocities, the pressure right-hand side, solid and liquid masks) scaled per channel;
+ * its outputs are grid channels again, typically the pressure.
+ *
+ * Convolutions are computed directly from zero-padded activations (no im2col): each output row is
+ * accumulated tap by tap, four output channels and sixteen cells at a time, with AVX2/FMA when the
+ * CPU has it and a portable loop otherwise. Weights are kept as fp32, fp16 or int8 (per output
+ * channel scale) and expanded to fp32 once per evaluation; the arithmetic is fp32 throughout.
+ *
+ * Model files are little-endian binary:
+ *
+ *   "FLUIDNET" | version u32 | dims u32 | inputCount u32 | outputCount u32 | layerCount u32
+ *   inputCount  x (channel u32, scale f32)      network input = scale * channel
+ *   outputCount x (channel u32, scale f32)      channel = scale * network output
+ *   layerCount  x (kernel u32, outputs u32, activation u32,
+ *                  weights f32[outputs][inputs][kernel^dims] (z, y, x order), bias f32[outputs])
+ *
+ * Weights are always stored as fp32; the precision is chosen when loading.
+ */
+class FluidNet {
+public:
+	enum class Precision { Float32, Float16, Int8 };
+	enum class Activation : uint32_t { None = 0, ReLU = 1, Tanh = 2 };
+
+	// Grid quantities a network reads or writes, one value per cell
+	enum class Channel : uint32_t {
+		VelocityX = 0,   // Lower x face velocity
+		VelocityY = 1,
+		VelocityZ = 2,
+		Pressure = 3,    // As stored in FluidGrid::Cell::pressure
+		PressureRhs = 4, // Right-hand side of the pressure solve, -(dx / dt) div(u)
+		Solid = 5,       // 1 in solid cells
+		Liquid = 6       // 1 in cells holding a material
+	};
+
+	static const uint32_t FormatVersion = 1;
+	static const int MaxKernel = 7;
+
+	FluidNet();
+
+	/**
+	 * @brief Loads a model file.
+	 * @param path Model file.
+	 * @param precision Storage of the weights once loaded.
+	 * @param error Optional: receives the reason on failure.
+	 * @return False if the file is missing, truncated or describes an invalid network.
+	 */
+	bool load(const std::string& path, Precision precision = Precision::Float32, std::string* error = nullptr);
+	bool save(const std::string& path, std::string* error = nullptr) const;
+
+	/**
+	 * @brief Starts a network in code, replacing the current one.
+	 * @param dims 2 or 3.
+	 * @param inputs Input channels with their scales.
+	 * @param precision Storage of the weights added next.
+	 */
+	void reset(int dims, const std::vector<std::pair<Channel, float>>& inputs, Precision precision = Precision::Float32);
+
+	/**
+	 * @brief Appends a layer.
+	 * @param kernel Odd kernel width, at most MaxKernel.
+	 * @param outputs Output channels.
+	 * @param activation Applied after the bias.
+	 * @param weights outputs x inputs x kernel^dims values, (z, y, x) order per pair.
+	 * @param bias One per output.
+	 * @return False if the sizes do not match.
+	 */
+	bool addLayer(int kernel, int outputs, Activation activation, const std::vector<float>& weights, const std::vector<float>& bias);
+
+	// Maps the last layer's outputs to grid channels; their count must match that layer's outputs
+	bool setOutputs(const std::vector<std::pair<Channel, float>>& outputs);
+
+	bool isReady() const;
+	int getDimensions() const { return dims; }
+	Precision getPrecision() const { return precision; }
+	const std::vector<std::pair<Channel, float>>& getInputs() const { return inputs; }
+	const std::vector<std::pair<Channel, float>>& getOutputs() const { return outputs; }
+	size_t getWeightBytes() const;
+
+	/**
+	 * @brief Runs the network on a batch of samples of the same size.
+	 *
+	 * Channels are planes of nx * ny * nz cells, x fastest: sample s, channel c starts at
+	 * (s * channels + c) * cells. Inputs are taken as they are (scales are applied by infer()).
+	 * Not reentrant: scratch buffers are kept between calls.
+	 * @param input Input planes of every sample.
+	 * @param output Receives the output planes of every sample.
+	 * @param count Samples in the batch.
+	 * @return False if the network is not ready or the size does not match its dimensions.
+	 */
+	bool evaluate(const float* input, float* output, int count, int nx, int ny, int nz) const;
+
+	/**
+	 * @brief Reads the input channels of each grid, evaluates them as one batch and returns the scaled
+	 * output channels of each grid.
+	 * @param grids Grids of the same size.
+	 * @param dt Timestep the PressureRhs channel is formed with.
+	 * @param results Receives, per grid, the output planes one after another.
+	 */
+	bool infer(const std::vector<const FluidGrid*>& grids, float dt, std::vector<std::vector<float>>& results) const;
+
+	// Writes one channel of a grid into out (one value per cell)
+	static void readChannel(const FluidGrid& grid, Channel channel, float dt, float* out);
+
+	// "fp32", "fp16" or "int8" (case-insensitive)
+	static bool parsePrecision(const std::string& text, Precision& precision);
+
+	// True if evaluate() runs the AVX2/FMA kernels on this CPU
+	static bool hasVectorKernels();
+
+private:
+	struct Layer {
+		int kernel;
+		int inputs;
+		int outputs;
+		Activation activation;
+		std::vector<float> weights;      // Float32
+		std::vector<uint16_t> halves;    // Float16
+		std::vector<int8_t> quantized;   // Int8, with one scale per output
+		std::vector<float> scales;
+		std::vector<float> bias;
+	};
+
+	int dims;
+	Precision precision;
+	std::vector<std::pair<Channel, float>> inputs;
+	std::vector<std::pair<Channel, float>> outputs;
+	std::vector<Layer> layers;
+
+	// Padded activations (ping-pong) and expanded weights, kept between evaluations
+	mutable std::vector<float> activations[2];
+	mutable std::vector<float> panel;
+	mutable std::vector<float> staged;
+	mutable int layout[5]; // Batch, padded extents and channel count the activations are laid out for
+
+	void expandWeights(const Layer& layer, float* out) const;
+	int getPadding() const;
+};
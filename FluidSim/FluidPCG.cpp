@@ -0,0 +1,230 @@
+#include "FluidPCG.h"
+#include "FluidParallel.h"
+#include <algorithm>
+#include <cmath>
+
+// Vector updates are spread over the job system in pieces of at least this many entries
+static const int MinChunk = 4096;
+// Widest piece of a 2D row that forms one unit of the MIC(0) wavefront, and the units a plane needs before it is split over threads
+static const int WavefrontTile = 32;
+static const int WavefrontMinUnits = 4;
+
+FluidPCG::FluidPCG(int maxIterations, float tolerance)
+	: maxIterations(maxIterations), tolerance(tolerance) {
+}
+
+double FluidPCG::dot(const std::vector<float>& a, const std::vector<float>& b) {
+	// Accumulate in double so long grids do not lose the small late-iteration residuals. The tiled
+	// reduction sums in the same order on any number of threads, so iteration counts and results
+	// do not depend on the machine.
+	return parallelReduce(0, static_cast<int>(a.size()), 0.0, [&](int lo, int hi) {
+		double sum = 0.0;
+		for (int i = lo; i < hi; ++i)
+			sum += static_cast<double>(a[i]) * b[i];
+		return sum;
+	}, [](double x, double y) { return x + y; });
+}
+
+FluidPCG::Result FluidPCG::solve(const Operator& A, const Operator& preconditioner, const std::vector<float>& b, std::vector<float>& x) {
+	const size_t n = b.size();
+	x.resize(n, 0.0f);
+	r.resize(n);
+	z.resize(n);
+	p.resize(n);
+	q.resize(n);
+
+	Result result = { 0, 0.0f, true };
+	double bNorm = std::sqrt(dot(b, b));
+	if (bNorm == 0.0) {
+		x.assign(n, 0.0f);
+		return result;
+	}
+
+	A(x, q);
+	const int count = static_cast<int>(n);
+	parallelFor(0, count, [&](int i) { r[i] = b[i] - q[i]; }, MinChunk);
+
+	double rNorm = std::sqrt(dot(r, r));
+	if (rNorm <= tolerance * bNorm) {
+		result.residual = static_cast<float>(rNorm / bNorm);
+		return result;
+	}
+
+	preconditioner(r, z);
+	p = z;
+	double rz = dot(r, z);
+
+	for (int it = 1; it <= maxIterations; ++it) {
+		A(p, q);
+		double pq = dot(p, q);
+		if (pq <= 0.0)
+			break; // Operator is not SPD along p; keep the best iterate so far
+
+		float alpha = static_cast<float>(rz / pq);
+		parallelFor(0, count, [&](int i) {
+			x[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+		}, MinChunk);
+
+		result.iterations = it;
+		rNorm = std::sqrt(dot(r, r));
+		if (rNorm <= tolerance * bNorm) {
+			result.residual = static_cast<float>(rNorm / bNorm);
+			return result;
+		}
+
+		preconditioner(r, z);
+		double rzNew = dot(r, z);
+		float beta = static_cast<float>(rzNew / rz);
+		rz = rzNew;
+		parallelFor(0, count, [&](int i) { p[i] = z[i] + beta * p[i]; }, MinChunk);
+	}
+
+	result.residual = static_cast<float>(rNorm / bNorm);
+	result.converged = false;
+	return result;
+}
+
+FluidPCG::Operator FluidPCG::jacobi(const std::vector<float>& diagonal) {
+	return [&diagonal](const std::vector<float>& in, std::vector<float>& out) {
+		out.resize(in.size());
+		parallelFor(0, static_cast<int>(in.size()), [&](int i) { out[i] = in[i] / diagonal[i]; }, MinChunk);
+	};
+}
+
+void FluidPCG::MIC0::schedule() {
+	// 3D planes already hold many whole rows; 2D rows are cut into tiles so a plane has more than one unit
+	tilesX = nz > 1 ? 1 : (nx + WavefrontTile - 1) / WavefrontTile;
+	tileWidth = (nx + tilesX - 1) / tilesX;
+	const int planes = tilesX + ny + nz - 2;
+	planeStart.assign(planes + 1, 0);
+	units.clear();
+	units.reserve(static_cast<size_t>(tilesX) * ny * nz);
+	for (int s = 0; s < planes; ++s) {
+		planeStart[s] = static_cast<int>(units.size());
+		for (int z = std::max(0, s - (tilesX - 1) - (ny - 1)); z <= std::min(nz - 1, s); ++z) {
+			for (int y = std::max(0, s - z - (tilesX - 1)); y <= std::min(ny - 1, s - z); ++y)
+				units.push_back((z * ny + y) * tilesX + (s - z - y));
+		}
+	}
+	planeStart[planes] = static_cast<int>(units.size());
+}
+
+template <typename Fn>
+void FluidPCG::MIC0::wavefront(bool backward, Fn cell) const {
+	// A single thread gains nothing from the planes; the plain sweep meets the same dependencies in cache order
+	if (FluidJobs::shared().getThreadCount() == 1) {
+		if (backward) {
+			for (int z = nz - 1, i = nx * ny * nz - 1; z >= 0; --z) {
+				for (int y = ny - 1; y >= 0; --y) {
+					for (int x = nx - 1; x >= 0; --x, --i)
+						cell(i, x, y, z);
+				}
+			}
+		}
+		else {
+			for (int z = 0, i = 0; z < nz; ++z) {
+				for (int y = 0; y < ny; ++y) {
+					for (int x = 0; x < nx; ++x, ++i)
+						cell(i, x, y, z);
+				}
+			}
+		}
+		return;
+	}
+
+	const int planes = static_cast<int>(planeStart.size()) - 1;
+	for (int p = 0; p < planes; ++p) {
+		const int s = backward ? planes - 1 - p : p;
+		parallelFor(planeStart[s], planeStart[s + 1], [&](int u) {
+			const int row = units[u] / tilesX;
+			const int lo = (units[u] % tilesX) * tileWidth;
+			const int hi = std::min(lo + tileWidth, nx);
+			const int y = row % ny;
+			const int z = row / ny;
+			if (backward) {
+				for (int x = hi - 1; x >= lo; --x)
+					cell(row * nx + x, x, y, z);
+			}
+			else {
+				for (int x = lo; x < hi; ++x)
+					cell(row * nx + x, x, y, z);
+			}
+		}, WavefrontMinUnits);
+	}
+}
+
+void FluidPCG::MIC0::factor(int sizeX, int sizeY, int sizeZ, const std::vector<float>& diagonal, const std::vector<float>* const couplings[3]) {
+	nx = sizeX;
+	ny = sizeY;
+	nz = sizeZ;
+	for (int d = 0; d < 3; ++d)
+		plus[d] = (d < 2 || nz > 1) ? couplings[d] : nullptr;
+	schedule();
+
+	const int stride[3] = { 1, nx, nx * ny };
+	precon.assign(diagonal.size(), 0.0f);
+
+	wavefront(false, [&](int i, int x, int y, int z) {
+		const float diag = diagonal[i];
+		if (diag == 0.0f)
+			return;
+		const int coord[3] = { x, y, z };
+		double e = diag;
+		for (int d = 0; d < 3; ++d) {
+			if (!plus[d] || coord[d] == 0)
+				continue;
+			const int j = i - stride[d];
+			const float a = (*plus[d])[j];
+			const float pj = precon[j];
+			e -= static_cast<double>(a * pj) * (a * pj);
+
+			// Modified part: fold the dropped fill-in back onto the diagonal
+			float other = 0.0f;
+			for (int o = 0; o < 3; ++o) {
+				if (o != d && plus[o])
+					other += (*plus[o])[j];
+			}
+			e -= tuning * static_cast<double>(a) * other * pj * pj;
+		}
+		if (e < safety * diag)
+			e = diag;
+		precon[i] = static_cast<float>(1.0 / std::sqrt(e));
+	});
+}
+
+void FluidPCG::MIC0::apply(const std::vector<float>& in, std::vector<float>& out) const {
+	const int stride[3] = { 1, nx, nx * ny };
+	const int size[3] = { nx, ny, nz };
+	const int n = nx * ny * nz;
+	forward.assign(n, 0.0f);
+	out.assign(n, 0.0f);
+
+	// Solve L q = in
+	wavefront(false, [&](int i, int x, int y, int z) {
+		if (precon[i] == 0.0f)
+			return;
+		const int coord[3] = { x, y, z };
+		float t = in[i];
+		for (int d = 0; d < 3; ++d) {
+			if (plus[d] && coord[d] > 0) {
+				const int j = i - stride[d];
+				t -= (*plus[d])[j] * precon[j] * forward[j];
+			}
+		}
+		forward[i] = t * precon[i];
+	});
+
+	// Solve L^T out = q
+	wavefront(true, [&](int i, int x, int y, int z) {
+		if (precon[i] == 0.0f)
+			return;
+		const int coord[3] = { x, y, z };
+		float t = forward[i];
+		for (int d = 0; d < 3; ++d) {
+			if (plus[d] && coord[d] + 1 < size[d])
+				t -= (*plus[d])[i] * precon[i] * out[i + stride[d]];
+		}
+		out[i] = t * precon[i];
+	});
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "FluidJobs.h"
+#include <algorithm>
+#include <vector>
+
+// Entries per partial result of parallelReduce. It is fixed, not derived from the thread count, so the
+// shape of every reduction depends on the range alone.
+static const int ReductionTile = 2048;
+
+/**
+ * @brief Runs fn(i) for every i in [begin, end) on the shared job system.
+ *
+ * Iterations must be independent. The range is split lazily into pieces of an adaptive grain (about
+ * eight per thread, never below minChunk) that idle threads steal, so uneven iterations still balance.
+ * Small ranges, and every range on a single-threaded pool, run inline on the calling thread.
+ * @param begin First index.
+ * @param end One past the last index.
+ * @param fn Callable taking an int index.
+ * @param minChunk Smallest range worth handing to another thread.
+ */
+template <typename Fn>
+void parallelFor(int begin, int end, Fn fn, int minChunk = 1) {
+	const int count = end - begin;
+	if (count <= 0)
+		return;
+	FluidJobs& jobs = FluidJobs::shared();
+	const int threads = jobs.getThreadCount();
+	const int grain = std::max(std::max(1, minChunk), count / (8 * threads));
+	if (threads == 1 || count <= grain) {
+		for (int i = begin; i < end; ++i)
+			fn(i);
+		return;
+	}
+
+	auto body = [](void* context, int lo, int hi) {
+		Fn& f = *static_cast<Fn*>(context);
+		for (int i = lo; i < hi; ++i)
+			f(i);
+	};
+	jobs.forRange(begin, end, grain, body, &fn);
+}
+
+/**
+ * @brief Deterministic parallel reduction over [begin, end).
+ *
+ * The range is cut into tiles of ReductionTile entries; tile(lo, hi) reduces one tile in index order and
+ * the per-tile partials are combined by a fixed pairwise tree. Floating-point results are therefore
+ * bitwise identical for any thread count and schedule, which keeps seeded runs reproducible, and the
+ * pairwise tree loses less precision than one long running sum.
+ * @param begin First index.
+ * @param end One past the last index.
+ * @param identity Result for an empty range.
+ * @param tile Callable taking (lo, hi) and returning the reduction of that sub-range.
+ * @param combine Callable merging two partials; it must be associative, but partials always meet in
+ * the same order.
+ */
+template <typename T, typename TileFn, typename CombineFn>
+T parallelReduce(int begin, int end, T identity, TileFn tile, CombineFn combine) {
+	const int count = end - begin;
+	if (count <= 0)
+		return identity;
+	const int tiles = (count + ReductionTile - 1) / ReductionTile;
+	if (tiles == 1)
+		return tile(begin, end);
+
+	std::vector<T> partials(tiles, identity);
+	parallelFor(0, tiles, [&](int t) {
+		const int lo = begin + t * ReductionTile;
+		partials[t] = tile(lo, std::min(lo + ReductionTile, end));
+	});
+	for (int width = 1; width < tiles; width *= 2) {
+		for (int t = 0; t + width < tiles; t += 2 * width)
+			partials[t] = combine(partials[t], partials[t + width]);
+	}
+	return partials[0];
+}
@@ -0,0 +1,36 @@
+#include "FluidParticle.h"
+#include <cassert>
+
+FluidParticle::FluidParticle(int nx, int ny, int nz)
+	: width(nx), height(ny), depth(nz) {
+	assert(nx >= 0 && ny >= 0 && nz >= 0);
+	Particle zero = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1, 0 };
+	Particles.assign(static_cast<size_t>(nx) * ny * nz, zero);
+}
+
+FluidParticle::Particle& FluidParticle::at(int x, int y, int z) {
+	assert(x >= 0 && x < width && y >= 0 && y < height && z >= 0 && z < depth);
+	return Particles[(static_cast<size_t>(z) * height + y) * width + x];
+}
+
+void FluidParticle::setPosition(int x, int y, int z, float posX, float posY, float posZ) {
+	Particle& p = at(x, y, z);
+	p.x = posX;
+	p.y = posY;
+	p.z = posZ;
+}
+
+void FluidParticle::setVelocity(int x, int y, int z, float velX, float velY, float velZ) {
+	Particle& p = at(x, y, z);
+	p.vx = velX;
+	p.vy = velY;
+	p.vz = velZ;
+}
+
+void FluidParticle::setMaterialID(int x, int y, int z, int material_id) {
+	at(x, y, z).material_id = material_id;
+}
+
+void FluidParticle::setPhaseID(int x, int y, int z, int phase_id) {
+	at(x, y, z).phase_id = phase_id;
+}
@@ -1,5 +1,7 @@
 #pragma once
+#include <algorithm>
 #include <vector>
+#include <cstddef>
 
 class FluidParticle {
 public:
@@ -7,7 +9,7 @@ public:
 		float x, y, z;      // Position (z=0 for 2D)
 		float vx, vy, vz;   // Velocity (vz=0 for 2D)
 		int material_id;    // Material type (e.g., water, oil), allows look up of liquid properties from database
-		int phase_id;       // For multiphase fluids
+		int phase_id;       // For multiphase fluids: selects the density in the pressure projection (FluidSolver::setPhaseMaterial)
 	};
 
 	FluidParticle(int nx, int ny, int nz = 1);
@@ -26,6 +28,37 @@ public:
 	void setMaterialID(int x, int y, int z, int material_id);
 	void setPhaseID(int x, int y, int z, int phase_id);
 
+	// Block extents given to the constructor (size() x 1 x 1 once particles have been removed)
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getDepth() const { return depth; }
+
+	// Flat access for the solver stages. Appended particles are only reachable this way, not through at().
+	void append(const Particle& particle) { Particles.push_back(particle); }
+	size_t size() const { return Particles.size(); }
+	std::vector<Particle>& getParticles() { return Particles; }
+	const std::vector<Particle>& getParticles() const { return Particles; }
+
+	/**
+	 * @brief Removes every particle matching pred, keeping the order of the rest.
+	 *
+	 * The survivors no longer form the width x height x depth block, so the extents become a flat
+	 * size() x 1 x 1 row and at(i, 0, 0) keeps addressing particle i.
+	 * @return Number of particles removed.
+	 */
+	template <typename Predicate>
+	size_t removeIf(Predicate pred) {
+		auto last = std::remove_if(Particles.begin(), Particles.end(), pred);
+		const size_t removed = static_cast<size_t>(Particles.end() - last);
+		if (removed > 0) {
+			Particles.erase(last, Particles.end());
+			width = static_cast<int>(Particles.size());
+			height = 1;
+			depth = 1;
+		}
+		return removed;
+	}
+
 private:
 	int width, height, depth;
 	std::vector<Particle> Particles;
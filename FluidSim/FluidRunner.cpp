@@ -0,0 +1,701 @@
+#include "FluidRunner.h"
+#include "FluidCheckpoint.h"
+#include "FluidGeometry.h"
+#include "FluidHash.h"
+#include "FluidJson.h"
+#include "FluidVersion.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <random>
+
+static const float DefaultEndTime = 1.0f;
+
+// Rough working set per cell or particle beyond the grid cells and particles themselves, for
+// estimateMemory(): FLIP keeps ~57 floats of transfer, viscosity and pressure arrays per cell, the
+// lattice 2 x Q populations plus macroscopic fields, SPH neighbour lists with kernel values
+static const uint64_t FlipCellBytes = 228;
+static const uint64_t Lattice2DCellBytes = 4 * (9 + 8);
+static const uint64_t Lattice3DCellBytes = 4 * (19 + 8);
+static const uint64_t SphParticleBytes = 900;
+
+// Current local time in strftime format
+static std::string localTime(const char* format) {
+	std::time_t now = std::time(nullptr);
+	std::tm parts;
+#ifdef _WIN32
+	localtime_s(&parts, &now);
+#else
+	localtime_r(&now, &parts);
+#endif
+	char text[64];
+	return std::strftime(text, sizeof(text), format, &parts) ? text : "";
+}
+
+// Reads up to count numbers from a JSON array; false if the value is not an array of that many numbers
+static bool readNumbers(const FluidJson& value, float* out, size_t count) {
+	if (!value.isArray() || value.size() < count)
+		return false;
+	for (size_t i = 0; i < count; ++i) {
+		if (!value[i].isNumber())
+			return false;
+		out[i] = static_cast<float>(value[i].asNumber());
+	}
+	return true;
+}
+
+FluidRunner::FluidRunner(FluidDatabase& database)
+	: database(database), configID(0), timestep(0.0f), totalSteps(0), simulated(false), simulationID(0), datasetSamples(0), duration(0.0),
+	firstStep(0), checkpointPending(false) {
+}
+
+bool FluidRunner::parseGridSize(const std::string& text, int size[3]) {
+	int values[3] = { 0, 0, 1 };
+	int found = 0;
+	for (size_t i = 0; i < text.size();) {
+		if (text[i] < '0' || text[i] > '9') {
+			++i;
+			continue;
+		}
+		long long value = 0;
+		for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i)
+			value = std::min(value * 10 + (text[i] - '0'), 1LL << 30);
+		if (found == 3 || value == 0)
+			return false;
+		values[found++] = static_cast<int>(value);
+	}
+	if (found == 0)
+		return false;
+	// A single size is a square grid, as written by the original editor ("100")
+	size[0] = values[0];
+	size[1] = found == 1 ? values[0] : values[1];
+	size[2] = values[2];
+	return true;
+}
+
+bool FluidRunner::loadMaterial(int liquidID, std::string* error) {
+	FluidDatabase::LiquidType liquid;
+	if (!database.loadLiquidType(liquidID, liquid)) {
+		if (error) *error = "No TypesOfLiquids row with LiquidID " + std::to_string(liquidID);
+		return false;
+	}
+	FluidSolver::Material material;
+	material.density = static_cast<float>(liquid.density);
+	material.viscosity = static_cast<float>(liquid.viscosity);
+	if (!(material.density > 0.0f) || material.viscosity < 0.0f) {
+		if (error) *error = "Liquid " + std::to_string(liquidID) + " needs a positive density and a non-negative viscosity";
+		return false;
+	}
+	solver->setMaterial(liquidID, material);
+	char key[96];
+	snprintf(key, sizeof(key), "%d:%.9g:%.9g;", liquidID, material.density, material.viscosity);
+	hashedMaterials += key;
+	return true;
+}
+
+void FluidRunner::seedParticles(int count, int materialID, const float fill[6]) {
+	particles.clear();
+	if (count <= 0)
+		return;
+
+	// Lattice spacing that puts count particles in the fill region, then per-axis counts from it
+	const int dims = grid.getDimensions();
+	float extent[3] = { 0.0f, 0.0f, 0.0f };
+	float volume = 1.0f;
+	for (int d = 0; d < dims; ++d) {
+		extent[d] = fill[2 * d + 1] - fill[2 * d];
+		volume *= extent[d];
+	}
+	const float spacing = std::pow(volume / count, 1.0f / dims);
+	int n[3] = { 1, 1, 1 };
+	for (int d = 0; d < dims; ++d)
+		n[d] = std::max(1, static_cast<int>(std::lround(extent[d] / spacing)));
+
+	particles.emplace_back(n[0], n[1], n[2]);
+	FluidParticle& block = particles.back();
+	for (int z = 0; z < n[2]; ++z) {
+		for (int y = 0; y < n[1]; ++y) {
+			for (int x = 0; x < n[0]; ++x) {
+				block.setPosition(x, y, z,
+					fill[0] + (x + 0.5f) * extent[0] / n[0],
+					fill[2] + (y + 0.5f) * extent[1] / n[1],
+					dims == 3 ? fill[4] + (z + 0.5f) * extent[2] / n[2] : 0.0f);
+				block.setMaterialID(x, y, z, materialID);
+			}
+		}
+	}
+
+	const float cellVolume = std::pow(grid.getCellSize(), static_cast<float>(dims));
+	solver->setParticlesPerCell(static_cast<float>(block.size()) * cellVolume / volume);
+}
+
+uint64_t FluidRunner::estimateMemory(const FluidDatabase::SimulationConfig& config) {
+	int size[3];
+	if (!parseGridSize(config.gridSize, size))
+		return 0;
+	const uint64_t particleCount = static_cast<uint64_t>(std::max(config.particleCount, 0));
+	FluidSolver::Method method = FluidSolver::Method::FlipPic;
+	FluidSolver::parseMethod(config.methodOfComputation, method);
+
+	const uint64_t cells = static_cast<uint64_t>(size[0]) * size[1] * size[2];
+	uint64_t cellBytes = sizeof(FluidGrid::Cell), particleBytes = sizeof(FluidParticle::Particle);
+	if (method == FluidSolver::Method::LatticeBoltzmann)
+		cellBytes += size[2] > 1 ? Lattice3DCellBytes : Lattice2DCellBytes;
+	else if (method == FluidSolver::Method::FlipPic || method == FluidSolver::Method::Surrogate)
+		cellBytes += FlipCellBytes;
+	else
+		particleBytes += SphParticleBytes;
+	// The result checkpoint snapshots the state once more while it is written
+	return 2 * (cells * cellBytes + particleCount * particleBytes);
+}
+
+bool FluidRunner::load(int id, const Options& runOptions, std::string* error) {
+	options = runOptions;
+	configID = id;
+	simulated = false;
+	configHash.clear();
+	hashedMaterials.clear();
+
+	FluidDatabase::SimulationConfig row;
+	if (!database.loadSimulationParameters(configID, row)) {
+		if (error) *error = "No SimulationConfigs row with ConfigID " + std::to_string(configID);
+		return false;
+	}
+	configName = row.name;
+
+	int size[3];
+	if (!parseGridSize(row.gridSize, size)) {
+		if (error) *error = "GridSize needs one to three positive cell counts, got \"" + row.gridSize + "\"";
+		return false;
+	}
+	timestep = static_cast<float>(row.timestep);
+	if (!(timestep > 0.0f)) {
+		if (error) *error = "Timestep must be positive";
+		return false;
+	}
+	FluidSolver::Method method;
+	if (!FluidSolver::parseMethod(row.methodOfComputation, method)) {
+		if (error) *error = "Unknown MethodOfComputation: " + row.methodOfComputation;
+		return false;
+	}
+	// Parsed once per config version, however many seeds load it
+	const std::shared_ptr<const FluidJson> otherDoc = database.parseJson("SimulationConfigs", "OtherParamsJSON", configID, row.otherParamsJSON, error);
+	if (!otherDoc)
+		return false;
+	const FluidJson& other = *otherDoc;
+
+	const int longest = std::max(size[0], std::max(size[1], size[2]));
+	const float cellSize = static_cast<float>(other.getNumber("cellSize", 1.0 / longest));
+	if (!(cellSize > 0.0f)) {
+		if (error) *error = "cellSize must be positive";
+		return false;
+	}
+	grid.resize(size[0], size[1], size[2], cellSize);
+	particles.clear();
+	solver = std::make_unique<FluidSolver>(grid, particles);
+	solver->setMethod(method);
+
+	float gravity[3];
+	if (readNumbers(other.get("gravity"), gravity, 3))
+		solver->setGravity(gravity[0], gravity[1], gravity[2]);
+	else if (readNumbers(other.get("gravity"), gravity, 2))
+		solver->setGravity(gravity[0], gravity[1]);
+	solver->setFlipRatio(static_cast<float>(other.getNumber("flipRatio", 0.95)));
+
+	// A learned pressure model warm-starts the FLIP pressure solve, or replaces it under Surrogate
+	const std::string modelPath = other.getString("model", "");
+	if (!modelPath.empty()) {
+		FluidNet::Precision precision;
+		if (!FluidNet::parsePrecision(other.getString("modelPrecision", ""), precision)) {
+			if (error) *error = "modelPrecision must be fp32, fp16 or int8";
+			return false;
+		}
+		std::shared_ptr<FluidNet> model = std::make_shared<FluidNet>();
+		if (!model->load(modelPath, precision, error))
+			return false;
+		if (model->getDimensions() != grid.getDimensions()) {
+			if (error) *error = "The model is " + std::to_string(model->getDimensions()) + "D but the grid is not";
+			return false;
+		}
+		solver->setPressureModel(model);
+	}
+	else if (method == FluidSolver::Method::Surrogate) {
+		if (error) *error = "MethodOfComputation Surrogate needs a \"model\" in OtherParamsJSON";
+		return false;
+	}
+
+	unsigned seed = options.seed;
+	if (!options.overrideSeed && other.has("seed"))
+		seed = static_cast<unsigned>(other.getNumber("seed", 0.0));
+	else if (!options.overrideSeed)
+		seed = std::random_device()() & 0x7fffffffu; // Kept positive for SavedSimulations.Seed
+
+	// A resumed run keeps its own seed; a given seed only resumes a run of that seed
+	resumeRow = FluidDatabase::SavedSimulation();
+	resumeCheckpoints.clear();
+	if (options.resume && !options.exportDataset) {
+		const long long wanted = options.overrideSeed || other.has("seed") ? static_cast<long long>(seed) : -1;
+		FluidDatabase::SavedSimulation unfinished;
+		if (database.findUnfinishedSimulation(configID, wanted, unfinished) && unfinished.version == FLUIDSIM_VERSION_STRING
+			&& database.loadCheckpoints(unfinished.simulationID, resumeCheckpoints) && !resumeCheckpoints.empty()) {
+			std::reverse(resumeCheckpoints.begin(), resumeCheckpoints.end());
+			resumeRow = unfinished;
+			seed = static_cast<unsigned>(unfinished.seed);
+		}
+		else {
+			resumeCheckpoints.clear();
+		}
+	}
+	solver->setSeed(seed);
+
+	const std::shared_ptr<const FluidJson> inflowDoc = database.parseJson("SimulationConfigs", "InflowParamsJSON", configID, row.inflowParamsJSON, error);
+	if (!inflowDoc)
+		return false;
+	const std::shared_ptr<const FluidJson> outflowDoc = database.parseJson("SimulationConfigs", "OutflowParamsJSON", configID, row.outflowParamsJSON, error);
+	if (!outflowDoc || !solver->getBoundary().load(*inflowDoc, *outflowDoc, error))
+		return false;
+
+	// Liquids: the config's own, plus any an inflow emits
+	const int fluidID = row.fluidID;
+	const int particleCount = row.particleCount;
+	if (particleCount > 0 && !loadMaterial(fluidID, error))
+		return false;
+	for (const FluidBoundary::Inflow& inflow : solver->getBoundary().getInflows()) {
+		if (inflow.emissionRate > 0.0f && inflow.material_id >= 0 && inflow.material_id != fluidID && !loadMaterial(inflow.material_id, error))
+			return false;
+	}
+	// Phases give particles of a phaseID the density of a liquid in the pressure projection,
+	// e.g. "phases": [{"phaseID": 1, "liquidID": 3}]
+	const FluidJson& phases = other.get("phases");
+	for (size_t i = 0; phases.isArray() && i < phases.size(); ++i) {
+		const int phaseID = static_cast<int>(phases[i].getNumber("phaseID", -1.0));
+		const int liquidID = static_cast<int>(phases[i].getNumber("liquidID", -1.0));
+		if (phaseID < 0 || liquidID < 0) {
+			if (error) *error = "Every entry of phases needs a non-negative phaseID and liquidID";
+			return false;
+		}
+		if (!loadMaterial(liquidID, error))
+			return false;
+		solver->setPhaseMaterial(phaseID, liquidID);
+	}
+
+	// Obstacle points may leave out z in 2D; they then span the single cell layer
+	auto readPoint = [](const FluidJson& value, float out[3], float z) {
+		out[2] = z;
+		return readNumbers(value, out, 3) || readNumbers(value, out, 2);
+	};
+	const FluidJson& obstacles = other.get("obstacles");
+	if (obstacles.size() > 0) {
+		FluidGeometry geometry;
+		for (size_t i = 0; i < obstacles.size() && obstacles.isArray(); ++i) {
+			const FluidJson& item = obstacles[i];
+			const std::string type = item.getString("type", "");
+			float a[3], b[3];
+			if (type == "sphere" && readPoint(item.get("center"), a, 0.5f * cellSize) && item.has("radius")) {
+				geometry.addSphere(a[0], a[1], a[2], static_cast<float>(item.getNumber("radius", 0.0)));
+			}
+			else if (type == "box" && readPoint(item.get("min"), a, 0.0f) && readPoint(item.get("max"), b, cellSize)) {
+				geometry.addBox(a[0], a[1], a[2], b[0], b[1], b[2]);
+			}
+			else {
+				if (error) *error = "Obstacle " + std::to_string(i) + " needs a \"type\" of sphere (center, radius) or box (min, max)";
+				return false;
+			}
+		}
+		geometry.rasterize(grid);
+	}
+
+	const float world[3] = { size[0] * cellSize, size[1] * cellSize, size[2] * cellSize };
+	float fill[6] = { 0.0f, world[0], 0.0f, 0.5f * world[1], 0.0f, world[2] };
+	if (other.has("fill") && !readNumbers(other.get("fill"), fill, grid.getDimensions() * 2)) {
+		if (error) *error = "fill needs [x0, x1, y0, y1] or [x0, x1, y0, y1, z0, z1]";
+		return false;
+	}
+	for (int d = 0; d < grid.getDimensions(); ++d) {
+		fill[2 * d] = std::max(fill[2 * d], 0.0f);
+		fill[2 * d + 1] = std::min(fill[2 * d + 1], world[d]);
+		if (particleCount > 0 && !(fill[2 * d + 1] > fill[2 * d])) {
+			if (error) *error = "fill region is empty or outside the domain";
+			return false;
+		}
+	}
+	seedParticles(particleCount, fluidID, fill);
+
+	if (other.has("steps"))
+		totalSteps = static_cast<uint64_t>(std::max(0.0, other.getNumber("steps", 0.0)));
+	else
+		totalSteps = static_cast<uint64_t>(std::ceil(other.getNumber("endTime", DefaultEndTime) / timestep - 1e-6));
+
+	// Inputs in normalized form: edits that cannot change the result keep the hash
+	FluidHash hash;
+	char number[32];
+	snprintf(number, sizeof(number), "%.17g", row.timestep);
+	hash.field("FluidSim result 1");
+	hash.field(FLUIDSIM_VERSION_STRING);
+	hash.field(std::to_string(size[0]) + "," + std::to_string(size[1]) + "," + std::to_string(size[2]));
+	hash.field(std::to_string(static_cast<int>(method)));
+	hash.field(number);
+	hash.field(std::to_string(particleCount) + "," + std::to_string(fluidID));
+	hash.field(other.toCanonical());
+	hash.field(inflowDoc->toCanonical());
+	hash.field(outflowDoc->toCanonical());
+	hash.field(hashedMaterials);
+	hash.field(std::to_string(seed));
+	if (!modelPath.empty())
+		hash.updateFile(modelPath);
+	configHash = hash.finishHex();
+	return true;
+}
+
+bool FluidRunner::reuse(Result& result) {
+	FluidDatabase::SavedSimulation row;
+	if (!solver || options.exportDataset || !database.findResult(configHash, row))
+		return false;
+	FluidJson metadata;
+	FluidJson::parse(row.otherMetadataJSON, metadata);
+	result.configID = configID;
+	result.simulationID = row.simulationID;
+	result.resultFilePath = row.resultFilePath;
+	result.steps = static_cast<uint64_t>(metadata.getNumber("steps", 0.0));
+	result.simulatedTime = metadata.getNumber("simulatedTime", 0.0);
+	result.duration = row.duration;
+	result.seed = static_cast<unsigned>(row.seed);
+	result.particleCount = static_cast<size_t>(metadata.getNumber("particles", 0.0));
+	result.datasetSamples = 0;
+	result.reused = true;
+	result.resumedStep = 0;
+	return true;
+}
+
+bool FluidRunner::run(Result& result, std::string* error) {
+	if (options.reuseResults && reuse(result))
+		return true;
+	return simulate(error) && record(result, error);
+}
+
+bool FluidRunner::simulate(std::string* error) {
+	if (!solver) {
+		if (error) *error = "No simulation loaded";
+		return false;
+	}
+	const auto start = std::chrono::steady_clock::now();
+	startTime = localTime("%Y-%m-%d %H:%M:%S");
+	if (!startRun(true, error))
+		return false;
+
+	for (uint64_t s = firstStep; s < totalSteps; ++s) {
+		const auto stepStart = std::chrono::steady_clock::now();
+		solver->step(timestep);
+		if (!afterStep(s + 1, std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count(), error))
+			return false;
+	}
+	return finish(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), error);
+}
+
+bool FluidRunner::simulateEnsemble(const std::vector<FluidRunner*>& runners, std::string* error) {
+	if (runners.empty())
+		return true;
+	std::vector<FluidSolver*> members;
+	for (FluidRunner* runner : runners) {
+		if (!runner->solver) {
+			if (error) *error = "No simulation loaded";
+			return false;
+		}
+		if (runner->totalSteps != runners[0]->totalSteps || runner->timestep != runners[0]->timestep) {
+			if (error) *error = "Ensemble members differ in step count or timestep";
+			return false;
+		}
+		members.push_back(runner->solver.get());
+	}
+	const auto start = std::chrono::steady_clock::now();
+	const std::string startTime = localTime("%Y-%m-%d %H:%M:%S");
+	for (FluidRunner* runner : runners) {
+		runner->startTime = startTime;
+		if (!runner->startRun(false, error)) // Members step in lockstep from the start
+			return false;
+	}
+
+	for (uint64_t s = 0; s < runners[0]->totalSteps; ++s) {
+		const auto stepStart = std::chrono::steady_clock::now();
+		if (!FluidSolver::stepEnsemble(members, runners[0]->timestep)) {
+			if (error) *error = "Simulations cannot run as an ensemble";
+			return false;
+		}
+		const double stepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count() / runners.size();
+		for (FluidRunner* runner : runners) {
+			if (!runner->afterStep(s + 1, stepSeconds, error))
+				return false;
+		}
+	}
+
+	// Members share the wall-clock time of the ensemble
+	const double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runners.size();
+	for (FluidRunner* runner : runners) {
+		if (!runner->finish(duration, error))
+			return false;
+	}
+	return true;
+}
+
+bool FluidRunner::startRun(bool mayResume, std::string* error) {
+	datasetSamples = 0;
+	dataset.reset();
+	simulated = false;
+	firstStep = 0;
+	checkpointPending = false;
+	runStamp = localTime("%Y%m%d-%H%M%S");
+
+	// The row exists from the first step, so whatever the run writes while stepping has a SimulationID;
+	// it gets its result file and hash in record(), and until then is never taken for a finished run
+	// A bounded queue that waits rather than drops: samples are only lost to a crash, and only the last batch
+	FluidDatabaseWriter::Options writerOptions;
+	writerOptions.maxPending = 1 << 16;
+	writerOptions.blockWhenFull = true;
+	writer = std::make_unique<FluidDatabaseWriter>();
+	if (!writer->start(database.getPath(), writerOptions, error))
+		return false;
+	if (mayResume && restoreLatestCheckpoint()) {
+		// Continues under the unfinished row, which record() completes like any other
+		simulationID = resumeRow.simulationID;
+		startTime = resumeRow.dateTime;
+		return true;
+	}
+	FluidDatabase::SavedSimulation row;
+	row.configID = configID;
+	row.dateTime = startTime;
+	row.notes = options.notes;
+	row.user = options.user;
+	row.seed = static_cast<int>(solver->getSeed());
+	row.version = FLUIDSIM_VERSION_STRING;
+	std::future<long long> reserved = writer->submit(row);
+	writer->flush(); // Rather than wait out the flush interval
+	simulationID = static_cast<int>(reserved.get());
+	if (simulationID == 0) {
+		if (error) *error = "Could not insert the SavedSimulations row";
+		return false;
+	}
+
+	if (!options.exportDataset)
+		return true;
+	FluidDataset::Options exportOptions = options.dataset;
+	exportOptions.prefix = "config" + std::to_string(configID) + "_seed" + std::to_string(solver->getSeed()) + "_" + runStamp;
+	exportOptions.seed = solver->getSeed();
+	exportOptions.dt = timestep;
+	dataset = std::make_unique<FluidDataset>();
+	if (!dataset->open(exportOptions, grid, error))
+		return false;
+	dataset->observe(grid, 0, 0.0);
+	return true;
+}
+
+bool FluidRunner::restoreLatestCheckpoint() {
+	// A file that is gone, damaged, or not the one its row describes falls back to the one before
+	for (const FluidDatabase::Checkpoint& checkpoint : resumeCheckpoints) {
+		if (checkpoint.step <= 0 || static_cast<uint64_t>(checkpoint.step) > totalSteps)
+			continue;
+		FluidCheckpoint file;
+		if (!file.load(checkpoint.filePath) || file.getChecksum() != static_cast<uint32_t>(checkpoint.checksum))
+			continue;
+		file.close();
+		if (!solver->restoreCheckpoint(checkpoint.filePath) || solver->getStepCount() != static_cast<uint64_t>(checkpoint.step))
+			continue;
+		firstStep = solver->getStepCount();
+		return true;
+	}
+	return false;
+}
+
+std::string FluidRunner::outputPath(const std::string& stamp) const {
+	std::string path = options.outputDirectory;
+	if (!path.empty() && path.back() != '/' && path.back() != '\\')
+		path += '/';
+	return path + "config" + std::to_string(configID) + "_seed" + std::to_string(solver->getSeed()) + "_" + stamp + ".ckp";
+}
+
+bool FluidRunner::landCheckpoint(std::string* error) {
+	if (!checkpointPending)
+		return true;
+	checkpointPending = false;
+	if (!solver->finishCheckpoint(error))
+		return false;
+	const FluidSolver::CheckpointInfo& written = solver->getLastCheckpoint();
+	FluidDatabase::Checkpoint checkpoint;
+	checkpoint.simulationID = simulationID;
+	checkpoint.step = static_cast<long long>(written.step);
+	checkpoint.simulatedTime = written.simulatedTime;
+	checkpoint.filePath = written.path;
+	checkpoint.fileSize = static_cast<long long>(written.fileSize);
+	checkpoint.checksum = written.checksum;
+	checkpoint.formatVersion = static_cast<int>(FluidCheckpoint::FormatVersion);
+	checkpoint.dateTime = localTime("%Y-%m-%d %H:%M:%S");
+	writer->post(checkpoint); // Only once the file is complete, so every row names an intact file
+	return true;
+}
+
+bool FluidRunner::afterStep(uint64_t step, double stepSeconds, std::string* error) {
+	if (dataset)
+		dataset->observe(grid, step, solver->getSimulatedTime());
+	if (options.metricsInterval > 0 && step % options.metricsInterval == 0) {
+		// Streamed under the reserved row: the writer commits them in batches while the run steps, so
+		// nothing piles up in memory and a crash keeps every sample written before it
+		const FluidSolver::Measurements measured = solver->measure();
+		FluidDatabase::MetricSample sample;
+		sample.simulationID = simulationID;
+		sample.step = static_cast<long long>(step);
+		sample.simulatedTime = solver->getSimulatedTime();
+		sample.kineticEnergy = measured.kineticEnergy;
+		sample.maxVelocity = measured.maxSpeed;
+		sample.pressureIterations = solver->getLastPressureIterations();
+		sample.viscosityIterations = solver->getLastViscosityIterations();
+		sample.drag = measured.force[0];
+		sample.lift = measured.force[1];
+		sample.stepSeconds = stepSeconds;
+		writer->post(sample); // One that never lands is counted in the writer's stats; finish() fails on it
+	}
+	if (options.checkpointInterval > 0 && step % options.checkpointInterval == 0 && step < totalSteps) {
+		// Written in the background while the run steps on; the previous one has long landed by now
+		if (!landCheckpoint(error))
+			return false;
+		solver->writeCheckpoint(outputPath(runStamp + "_step" + std::to_string(step)));
+		checkpointPending = true;
+	}
+	if (options.progressInterval > 0 && step % options.progressInterval == 0)
+		printf("config %d: step %llu/%llu, t = %.4f s\n", configID, static_cast<unsigned long long>(step),
+			static_cast<unsigned long long>(totalSteps), solver->getSimulatedTime());
+	return true;
+}
+
+bool FluidRunner::finish(double seconds, std::string* error) {
+	if (dataset) {
+		if (!dataset->finish(error))
+			return false;
+		datasetSamples = dataset->getStats().samples;
+		dataset.reset();
+	}
+	if (!landCheckpoint(error))
+		return false;
+	resultFilePath = outputPath(localTime("%Y%m%d-%H%M%S"));
+	solver->writeCheckpoint(resultFilePath);
+	if (!solver->finishCheckpoint(error))
+		return false;
+
+	// The result file is a checkpoint, so a finished run can be resumed like an interrupted one. Stopping
+	// the writer lands its rows before record() takes the shared connection.
+	const FluidSolver::CheckpointInfo& written = solver->getLastCheckpoint();
+	FluidDatabase::Checkpoint checkpoint;
+	checkpoint.simulationID = simulationID;
+	checkpoint.step = static_cast<long long>(written.step);
+	checkpoint.simulatedTime = written.simulatedTime;
+	checkpoint.filePath = resultFilePath;
+	checkpoint.fileSize = static_cast<long long>(written.fileSize);
+	checkpoint.checksum = written.checksum;
+	checkpoint.formatVersion = static_cast<int>(FluidCheckpoint::FormatVersion);
+	checkpoint.dateTime = startTime;
+	std::future<long long> checkpointRow = writer->submit(checkpoint);
+	writer->stop();
+	const FluidDatabaseWriter::Stats rows = writer->getStats();
+	writer.reset();
+	if (checkpointRow.get() == 0) {
+		if (error) *error = "Could not insert the SimulationCheckpoints row";
+		return false;
+	}
+	// Metric samples are posted without waiting on them: a batch the database kept refusing shows up here
+	if (rows.failed + rows.dropped > 0) {
+		if (error) *error = std::to_string(rows.failed + rows.dropped) + " metric samples could not be written";
+		return false;
+	}
+	duration = seconds;
+	simulated = true;
+	return true;
+}
+
+bool FluidRunner::storeResult(int simulationID, const FluidSolver::CheckpointInfo& written, std::string* error) {
+	FILE* file = std::fopen(written.path.c_str(), "rb");
+	if (!file) {
+		if (error) *error = "Cannot open " + written.path;
+		return false;
+	}
+	FluidDatabase::Frame frame;
+	frame.simulationID = simulationID;
+	frame.step = static_cast<long long>(written.step);
+	frame.simulatedTime = written.simulatedTime;
+	frame.format = "checkpoint";
+	frame.size = static_cast<long long>(written.fileSize);
+	std::string frameError;
+	bool ok = database.createFrame(frame, &frameError);
+	if (ok) {
+		// Copied a chunk at a time: the file is never held in memory whole
+		FluidDatabase::FrameStream stream = database.openFrame(frame.frameID, true);
+		std::vector<char> chunk(FluidDatabase::FrameChunkBytes);
+		long long offset = 0;
+		while (ok && offset < frame.size) {
+			const size_t count = std::fread(chunk.data(), 1, static_cast<size_t>(std::min<long long>(chunk.size(), frame.size - offset)), file);
+			ok = count > 0 && stream.write(offset, chunk.data(), count);
+			offset += count;
+		}
+		if (!ok)
+			frameError = "Cannot copy " + written.path;
+	}
+	std::fclose(file);
+	if (!ok && error)
+		*error = "Could not store the result in SimulationFrames: " + frameError;
+	return ok;
+}
+
+bool FluidRunner::record(Result& result, std::string* error) {
+	if (!simulated) {
+		if (error) *error = "Nothing simulated to record";
+		return false;
+	}
+	const FluidSolver::CheckpointInfo& written = solver->getLastCheckpoint();
+	size_t particleCount = 0;
+	for (const FluidParticle& block : particles)
+		particleCount += block.size();
+
+	char metadata[320];
+	snprintf(metadata, sizeof(metadata),
+		"{\"steps\": %llu, \"simulatedTime\": %.9g, \"particles\": %llu, \"resultFileSize\": %llu, \"resultChecksum\": %u, \"datasetSamples\": %llu}",
+		static_cast<unsigned long long>(written.step), written.simulatedTime, static_cast<unsigned long long>(particleCount),
+		static_cast<unsigned long long>(written.fileSize), written.checksum, static_cast<unsigned long long>(datasetSamples));
+
+	// Completes the row startRun() inserted; it and the run's other rows commit together
+	FluidDatabase::Transaction transaction(database);
+	FluidDatabase::SavedSimulation row;
+	row.simulationID = simulationID;
+	row.configID = configID;
+	row.dateTime = startTime;
+	row.resultFilePath = resultFilePath;
+	row.duration = duration;
+	row.notes = options.notes;
+	row.user = options.user;
+	row.seed = static_cast<int>(solver->getSeed());
+	row.version = FLUIDSIM_VERSION_STRING;
+	row.otherMetadataJSON = metadata;
+	row.configHash = configHash;
+	if (!database.updateSimulation(row)) {
+		if (error) *error = std::string("Could not update the SavedSimulations row: ") + database.lastError();
+		return false;
+	}
+	if (options.storeResult && !storeResult(simulationID, written, error))
+		return false;
+	if (!transaction.commit()) {
+		if (error) *error = std::string("Could not commit the SavedSimulations row: ") + database.lastError();
+		return false;
+	}
+
+	result.configID = configID;
+	result.simulationID = simulationID;
+	result.resultFilePath = resultFilePath;
+	result.steps = written.step;
+	result.simulatedTime = written.simulatedTime;
+	result.duration = duration;
+	result.seed = solver->getSeed();
+	result.particleCount = particleCount;
+	result.datasetSamples = datasetSamples;
+	result.reused = false;
+	result.resumedStep = firstStep;
+	return true;
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include "FluidDatabase.h"
+#include "FluidDatabaseWriter.h"
+#include "FluidDataset.h"
+#include "FluidGrid.h"
+#include "FluidParticle.h"
+#include "FluidSolver.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Runs a SimulationConfigs row without the GUI: builds the grid, particles and solver from the
+ * row, steps to the end and records the run as a SavedSimulations row.
+ *
+ * The row is inserted when stepping starts, through a FluidDatabaseWriter on a connection of the
+ * run's own, and completed by record(); metric samples and the result file's SimulationCheckpoints
+ * row go through the writer too, in batches while the run steps. A row with an empty ResultFilePath
+ * is a run that never finished; its samples up to the interruption are kept, and with checkpointInterval
+ * set it also has SimulationCheckpoints rows that a later load() with resume continues it from.
+ *
+ * The columns map as follows: GridSize is "nx x ny [x nz]" (any separators; a single size is square), ParticleCount particles
+ * are seeded on a regular lattice over the fill region, Timestep is the step size, FluidID selects the
+ * TypesOfLiquids row of the particles, InflowParamsJSON/OutflowParamsJSON/MethodOfComputation are
+ * handed to the solver. OtherParamsJSON holds the rest, every key optional:
+ *
+ *   { "cellSize": 0.05, "endTime": 1.0, "steps": 200, "seed": 7, "gravity": [0, -9.81, 0],
+ *     "flipRatio": 0.95, "fill": [x0, x1, y0, y1, z0, z1], "model": "pressure.fnet", "modelPrecision": "int8",
+ *     "obstacles": [ { "type": "sphere", "center": [x, y, z], "radius": r },
+ *                    { "type": "box", "min": [x, y, z], "max": [x, y, z] } ],
+ *     "phases": [ { "phaseID": 1, "liquidID": 3 } ] }
+ *
+ * "steps" takes precedence over "endTime"; "fill" is in world units and defaults to the lower half
+ * of the domain. "model" is a FluidNet pressure model (fp32, fp16 or int8 weights), required by the
+ * Surrogate method and used to warm-start the pressure solve under FLIP. "phases" makes particles of a
+ * phaseID (e.g. those an inflow emits) weigh in at a liquid's density in the pressure projection. The final state is written as a checkpoint (see FluidCheckpoint) to the result file,
+ * so a finished run can be inspected or continued.
+ */
+class FluidRunner {
+public:
+	struct Options {
+		std::string outputDirectory; // Where result files go; empty for the working directory
+		std::string user;
+		std::string notes;
+		bool overrideSeed;           // Use seed instead of the config's (or a random) one
+		unsigned seed;
+		int progressInterval;        // Print progress every this many steps, 0 for none
+		bool exportDataset;          // Write training pairs while running (see FluidDataset)
+		FluidDataset::Options dataset; // Its prefix, seed and dt are set per run
+		int metricsInterval;         // Log a SimulationMetrics row every this many steps, 0 for none (written while running)
+		bool storeResult;            // Also copy the result file into SimulationFrames
+		bool reuseResults;           // run() returns an earlier run with the same config hash instead of simulating (see reuse())
+		int checkpointInterval;      // Write a checkpoint file and its SimulationCheckpoints row every this many steps, 0 for none
+		bool resume;                 // Continue the config's newest unfinished run from its latest intact checkpoint, if it has one
+
+		Options() : overrideSeed(false), seed(0), progressInterval(0), exportDataset(false), metricsInterval(0), storeResult(false), reuseResults(true),
+			checkpointInterval(0), resume(false) {}
+	};
+
+	// What a finished run recorded
+	struct Result {
+		int configID;
+		int simulationID;
+		std::string resultFilePath;
+		uint64_t steps;
+		double simulatedTime;
+		double duration; // Wall-clock seconds, as stored in SavedSimulations.Duration
+		unsigned seed;
+		size_t particleCount;
+		uint64_t datasetSamples; // Training samples exported, 0 without an export
+		bool reused;             // An earlier identical run, returned instead of simulating
+		uint64_t resumedStep;    // Step an interrupted run was continued from, 0 if it ran from the start
+	};
+
+	explicit FluidRunner(FluidDatabase& database);
+
+	/**
+	 * @brief Loads a SimulationConfigs row and builds the simulation it describes.
+	 *
+	 * With options.resume, the config's newest unfinished run of the same version (and seed, if one is
+	 * given) is looked up and its seed adopted; simulate() then restores its latest checkpoint that is
+	 * intact and matches its row, and continues under its SimulationID. Runs that export a dataset
+	 * always start over.
+	 * @param configID Row to load.
+	 * @param options Output location, seed override and metadata.
+	 * @param error Optional: receives the reason on failure.
+	 * @return True if the row exists and all its columns are valid.
+	 */
+	bool load(int configID, const Options& options, std::string* error = nullptr);
+
+	/**
+	 * @brief Steps the loaded simulation to its end, writes the result file and inserts the
+	 * SavedSimulations row.
+	 * @param result Receives what was recorded.
+	 * @param error Optional: receives the reason on failure.
+	 * @return True if the run finished and was recorded.
+	 */
+	bool run(Result& result, std::string* error = nullptr);
+
+	/**
+	 * @brief Looks up an earlier run of the same inputs (see getConfigHash()) whose result still exists.
+	 *
+	 * The result is the earlier run's: its SimulationID, result file, timings and any metrics or frames
+	 * it recorded. Runs that export a dataset are never reused, since the export would not happen.
+	 * @param result Receives the earlier run, with reused set.
+	 * @return True on a hit; FluidDatabase::getResultCacheStats() counts hits and misses.
+	 */
+	bool reuse(Result& result);
+
+	// The two halves of run(): stepping and writing the result file, then the database rows. Callers
+	// sharing a connection between threads only need to serialize load(), reuse() and record().
+	bool simulate(std::string* error = nullptr);
+	bool record(Result& result, std::string* error = nullptr);
+
+	/**
+	 * @brief simulate() for several loaded lattice Boltzmann runs at once, stepped as one ensemble (see
+	 * FluidSolver::stepEnsemble). Each runner then writes its own result file and is recorded as usual.
+	 * @param runners Loaded runs with the same grid, step count and timestep, at most FluidLBM::MaxLanes.
+	 * @param error Optional: receives the reason on failure.
+	 * @return False if the runs cannot form an ensemble or a result file failed; the runs must be loaded
+	 * again before simulating them one by one.
+	 */
+	static bool simulateEnsemble(const std::vector<FluidRunner*>& runners, std::string* error = nullptr);
+
+	/**
+	 * @brief Rough peak memory of a run, for scheduling concurrent runs.
+	 * @param config A SimulationConfigs row as loaded by loadSimulationParameters.
+	 * @return Estimated bytes (0 if GridSize is invalid). Particles emitted by inflows are not counted.
+	 */
+	static uint64_t estimateMemory(const FluidDatabase::SimulationConfig& config);
+
+	/**
+	 * @brief Parses a GridSize value: one to three positive integers with any separators.
+	 * @param text Column value, e.g. "64x64" or "64, 32, 16". A single size ("100") is a square 2D grid.
+	 * @param size Receives the cell counts (depth 1 for 2D).
+	 * @return False if the value does not hold one to three positive sizes.
+	 */
+	static bool parseGridSize(const std::string& text, int size[3]);
+
+	const std::string& getConfigName() const { return configName; }
+
+	/**
+	 * @brief SHA-256 of everything the loaded run's result depends on, as stored in SavedSimulations.ConfigHash.
+	 *
+	 * Covers the config's parameters in normalized form (parsed grid size and method, canonical JSON
+	 * packages, so names, descriptions, JSON layout and member order do not count), the liquids it
+	 * uses, the pressure model file's contents, the seed and FLUIDSIM_VERSION_STRING.
+	 */
+	const std::string& getConfigHash() const { return configHash; }
+	uint64_t getTotalSteps() const { return totalSteps; }
+	FluidGrid& getGrid() { return grid; }
+	std::vector<FluidParticle>& getParticles() { return particles; }
+	FluidSolver& getSolver() { return *solver; }
+
+private:
+	FluidDatabase& database;
+	Options options;
+	int configID;
+	std::string configName;
+	std::string configHash;
+	std::string hashedMaterials; // Liquids loaded, for the hash
+
+	FluidGrid grid;
+	std::vector<FluidParticle> particles;
+	std::unique_ptr<FluidSolver> solver; // Holds references to grid and particles
+	float timestep;
+	uint64_t totalSteps;
+
+	// Set by simulate() for record()
+	bool simulated;
+	int simulationID;                            // Inserted by startRun(), completed by record()
+	std::unique_ptr<FluidDatabaseWriter> writer; // Writes the run's rows while it steps; stopped by finish()
+	std::string startTime;
+	std::unique_ptr<FluidDataset> dataset;
+	uint64_t datasetSamples;
+	std::string resultFilePath;
+	double duration;
+	std::string runStamp;    // Start time in file names
+	uint64_t firstStep;      // 0, or the step of the checkpoint a resumed run restored
+	bool checkpointPending;  // An interval checkpoint is being written; its row is queued once it lands
+
+	// Found by load() with options.resume: the unfinished run and its checkpoints, newest first
+	FluidDatabase::SavedSimulation resumeRow;
+	std::vector<FluidDatabase::Checkpoint> resumeCheckpoints;
+
+	bool startRun(bool mayResume, std::string* error);
+	bool restoreLatestCheckpoint();
+	bool afterStep(uint64_t step, double stepSeconds, std::string* error);
+	bool landCheckpoint(std::string* error);
+	std::string outputPath(const std::string& stamp) const;
+	bool finish(double seconds, std::string* error);
+	bool storeResult(int simulationID, const FluidSolver::CheckpointInfo& written, std::string* error);
+	bool loadMaterial(int liquidID, std::string* error);
+	void seedParticles(int count, int materialID, const float fill[6]);
+};
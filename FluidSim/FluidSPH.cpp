@@ -0,0 +1,661 @@
+#include "FluidSPH.h"
+#include "FluidParallel.h"
+#include <algorithm>
+#include <cmath>
+
+static const float Pi = 3.14159265f;
+static const float Skin = 0.2f;             // Neighbour list skin, as a fraction of the support
+static const float ArtificialViscosity = 0.02f;
+static const float DensityTolerance = 1e-3f; // Mean relative density error of the constant-density solve
+static const float DivergenceTolerance = 1e-3f;
+static const int MaxSolverIterations = 100;
+static const int MinChunk = 64;
+
+// Calls fn(first, last) for each row of hash cells in the 3x3 (3x3x3) block around a cell
+template <typename Fn>
+static void forEachNearbyCell(const int hashSize[3], int cell, int dims, Fn fn) {
+	const int cx = cell % hashSize[0];
+	const int cy = (cell / hashSize[0]) % hashSize[1];
+	const int cz = cell / (hashSize[0] * hashSize[1]);
+	const int zlo = dims == 3 ? std::max(cz - 1, 0) : 0;
+	const int zhi = dims == 3 ? std::min(cz + 1, hashSize[2] - 1) : 0;
+	for (int z = zlo; z <= zhi; ++z) {
+		for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, hashSize[1] - 1); ++y) {
+			// Cells along x are contiguous, so the block row is one range of cells
+			const int row = (z * hashSize[1] + y) * hashSize[0];
+			fn(row + std::max(cx - 1, 0), row + std::min(cx + 1, hashSize[0] - 1) + 1);
+		}
+	}
+}
+
+// Cubic spline kernel with support h, W = scale * (2 (1 - q)^3 - 8 (1/2 - q)^3) with both terms
+// clamped at zero, and its gradient, for every pair of a list. No branches and no aliasing between
+// the outputs and the positions, so the loop vectorizes (gathering the neighbour positions).
+static void evaluatePairs(const int* __restrict list, int begin, int end, const float xi[3], const float* const px[3],
+	float invH, float scale, float* __restrict w, float* __restrict gx, float* __restrict gy, float* __restrict gz) {
+	const float gradScale = scale * invH;
+	const float x = xi[0], y = xi[1], z = xi[2];
+	const float* __restrict ox = px[0];
+	const float* __restrict oy = px[1];
+	const float* __restrict oz = px[2];
+	for (int k = begin; k < end; ++k) {
+		const int j = list[k];
+		const float rx = x - ox[j];
+		const float ry = y - oy[j];
+		const float rz = z - oz[j];
+		const float r = std::sqrt(rx * rx + ry * ry + rz * rz);
+		const float q = r * invH;
+		const float a = std::max(1.0f - q, 0.0f);
+		const float b = std::max(0.5f - q, 0.0f);
+		w[k] = scale * (2.0f * a * a * a - 8.0f * b * b * b);
+		// dW/dr is zero at r = 0, so the clamp on r only avoids 0/0
+		const float g = gradScale * (24.0f * b * b - 6.0f * a * a) / std::max(r, 1e-12f);
+		gx[k] = g * rx;
+		gy[k] = g * ry;
+		gz[k] = g * rz;
+	}
+}
+
+FluidSPH::FluidSPH()
+	: scheme(Scheme::DivergenceFree), dims(2), size{ 0, 0, 0 }, cellSize(0.0f), spacing(0.0f), support(0.0f),
+	searchRadius(0.0f), kernelScale(0.0f), particleVolume(0.0f), extent{ 0.0f, 0.0f, 0.0f },
+	gravity{ 0.0f, -9.81f, 0.0f }, referenceSpeed(0.0f), lastSolverIterations(0), lastNeighbourBuilds(0),
+	hashSize{ 1, 1, 1 }, count(0) {
+}
+
+void FluidSPH::setGravity(float gx, float gy, float gz) {
+	gravity[0] = gx;
+	gravity[1] = gy;
+	gravity[2] = gz;
+}
+
+bool FluidSPH::isPreparedFor(const FluidGrid& grid, float particleSpacing) const {
+	return size[0] == grid.getWidth() && size[1] == grid.getHeight() && size[2] == grid.getDepth()
+		&& cellSize == grid.getCellSize() && spacing == particleSpacing;
+}
+
+float FluidSPH::kernelValue(float r) const {
+	const float q = r / support;
+	const float a = std::max(1.0f - q, 0.0f);
+	const float b = std::max(0.5f - q, 0.0f);
+	return kernelScale * (2.0f * a * a * a - 8.0f * b * b * b);
+}
+
+int FluidSPH::hashCell(float x, float y, float z) const {
+	const float inv = 1.0f / searchRadius;
+	const int cx = std::min(std::max(static_cast<int>((x + searchRadius) * inv), 0), hashSize[0] - 1);
+	const int cy = std::min(std::max(static_cast<int>((y + searchRadius) * inv), 0), hashSize[1] - 1);
+	const int cz = std::min(std::max(static_cast<int>((z + searchRadius) * inv), 0), hashSize[2] - 1);
+	return (cz * hashSize[1] + cy) * hashSize[0] + cx;
+}
+
+void FluidSPH::prepare(const FluidGrid& grid, float particleSpacing) {
+	dims = grid.getDimensions();
+	size[0] = grid.getWidth();
+	size[1] = grid.getHeight();
+	size[2] = grid.getDepth();
+	cellSize = grid.getCellSize();
+	spacing = particleSpacing;
+	support = 2.0f * spacing;
+	searchRadius = (1.0f + Skin) * support;
+	kernelScale = dims == 3 ? 8.0f / (Pi * support * support * support) : 40.0f / (7.0f * Pi * support * support);
+	for (int d = 0; d < 3; ++d) {
+		extent[d] = d < dims ? size[d] * cellSize : 0.0f;
+		hashSize[d] = d < dims ? static_cast<int>((extent[d] + 2.0f * searchRadius) / searchRadius) + 1 : 1;
+	}
+
+	// Particle rest volume, so that a particle inside a regular lattice at the rest spacing has exactly
+	// the rest density under this kernel
+	float lattice = 0.0f;
+	const int reach = static_cast<int>(std::ceil(support / spacing));
+	for (int k = dims == 3 ? -reach : 0; k <= (dims == 3 ? reach : 0); ++k) {
+		for (int j = -reach; j <= reach; ++j) {
+			for (int i = -reach; i <= reach; ++i)
+				lattice += kernelValue(spacing * std::sqrt(static_cast<float>(i * i + j * j + k * k)));
+		}
+	}
+	particleVolume = 1.0f / lattice;
+
+	solidCells.clear();
+	if (grid.hasSolids()) {
+		solidCells.resize(grid.getCellCount());
+		for (int i = 0; i < grid.getCellCount(); ++i)
+			solidCells[i] = grid.isSolid(i) ? 1 : 0;
+	}
+
+	// Sample the solid cells and the ghost ring around the domain on the fluid lattice, keeping the
+	// points within one kernel support of an open cell: two layers behind flat walls, corners included
+	const int perCell = std::max(1, static_cast<int>(std::lround(cellSize / spacing)));
+	std::vector<float> samples[3];
+	auto blocked = [&](const int c[3]) {
+		for (int d = 0; d < dims; ++d) {
+			if (c[d] < 0 || c[d] >= size[d])
+				return true;
+		}
+		return grid.isSolid(grid.index(c[0], c[1], c[2]));
+	};
+	const int reachCells = static_cast<int>(std::ceil(support / cellSize));
+	const int ring[3] = { reachCells, reachCells, dims == 3 ? reachCells : 0 };
+	std::vector<int> open;
+	for (int z = -ring[2]; z < size[2] + ring[2]; ++z) {
+		for (int y = -ring[1]; y < size[1] + ring[1]; ++y) {
+			for (int x = -ring[0]; x < size[0] + ring[0]; ++x) {
+				const int cell[3] = { x, y, z };
+				if (!blocked(cell))
+					continue;
+				open.clear();
+				for (int dz = -ring[2]; dz <= ring[2]; ++dz) {
+					for (int dy = -ring[1]; dy <= ring[1]; ++dy) {
+						for (int dx = -ring[0]; dx <= ring[0]; ++dx) {
+							const int next[3] = { x + dx, y + dy, z + dz };
+							if (!blocked(next))
+								open.insert(open.end(), next, next + 3);
+						}
+					}
+				}
+				for (int k = 0; k < (dims == 3 ? perCell : 1); ++k) {
+					for (int j = 0; j < perCell; ++j) {
+						for (int i = 0; i < perCell; ++i) {
+							const float p[3] = { (x + (i + 0.5f) / perCell) * cellSize, (y + (j + 0.5f) / perCell) * cellSize,
+								dims == 3 ? (z + (k + 0.5f) / perCell) * cellSize : 0.0f };
+							bool near = false;
+							for (size_t n = 0; n < open.size() && !near; n += 3) {
+								float d2 = 0.0f;
+								for (int d = 0; d < dims; ++d) {
+									const float lo = open[n + d] * cellSize;
+									const float gap = std::max(std::max(lo - p[d], p[d] - lo - cellSize), 0.0f);
+									d2 += gap * gap;
+								}
+								near = d2 < support * support;
+							}
+							for (int d = 0; d < 3 && near; ++d)
+								samples[d].push_back(p[d]);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Sort the boundary particles by hash cell
+	const int cells = hashSize[0] * hashSize[1] * hashSize[2];
+	const int boundaryCount = static_cast<int>(samples[0].size());
+	std::vector<int> cellOf(boundaryCount);
+	boundaryCellStart.assign(cells + 1, 0);
+	for (int b = 0; b < boundaryCount; ++b) {
+		cellOf[b] = hashCell(samples[0][b], samples[1][b], samples[2][b]);
+		++boundaryCellStart[cellOf[b] + 1];
+	}
+	for (int c = 0; c < cells; ++c)
+		boundaryCellStart[c + 1] += boundaryCellStart[c];
+	std::vector<int> fill(boundaryCellStart.begin(), boundaryCellStart.end() - 1);
+	for (int d = 0; d < 3; ++d)
+		boundaryPosition[d].resize(boundaryCount);
+	for (int b = 0; b < boundaryCount; ++b) {
+		const int slot = fill[cellOf[b]]++;
+		for (int d = 0; d < 3; ++d)
+			boundaryPosition[d][slot] = samples[d][b];
+	}
+
+	// Each boundary particle stands for the volume its own sampling leaves it (Akinci et al. 2012), but
+	// never more than a fluid particle, so a flat wall reads exactly like mirrored fluid rows
+	boundaryVolume.resize(boundaryCount);
+	parallelFor(0, boundaryCount, [&](int b) {
+		const float bx = boundaryPosition[0][b], by = boundaryPosition[1][b], bz = boundaryPosition[2][b];
+		float sum = 0.0f;
+		forEachNearbyCell(hashSize, hashCell(bx, by, bz), dims, [&](int first, int last) {
+			for (int k = boundaryCellStart[first]; k < boundaryCellStart[last]; ++k) {
+				const float rx = bx - boundaryPosition[0][k], ry = by - boundaryPosition[1][k], rz = bz - boundaryPosition[2][k];
+				sum += kernelValue(std::sqrt(rx * rx + ry * ry + rz * rz));
+			}
+		});
+		boundaryVolume[b] = std::min(1.0f / sum, particleVolume);
+	}, MinChunk);
+}
+
+void FluidSPH::gather(const std::vector<FluidParticle>& particles, const std::vector<Properties>& properties) {
+	count = 0;
+	for (const FluidParticle& block : particles)
+		count += static_cast<int>(block.size());
+	for (int d = 0; d < 3; ++d) {
+		position[d].resize(count);
+		velocity[d].resize(count);
+		acceleration[d].resize(count);
+	}
+	mass.resize(count);
+	restDensity.resize(count);
+	viscosity.resize(count);
+	origin.resize(count);
+
+	int i = 0;
+	for (const FluidParticle& block : particles) {
+		for (const FluidParticle::Particle& p : block.getParticles()) {
+			position[0][i] = p.x;
+			position[1][i] = p.y;
+			position[2][i] = dims == 3 ? p.z : 0.0f;
+			velocity[0][i] = p.vx;
+			velocity[1][i] = p.vy;
+			velocity[2][i] = dims == 3 ? p.vz : 0.0f;
+			restDensity[i] = properties[i].restDensity;
+			mass[i] = properties[i].restDensity * particleVolume;
+			viscosity[i] = properties[i].kinematicViscosity;
+			origin[i] = i;
+			++i;
+		}
+	}
+}
+
+void FluidSPH::scatter(std::vector<FluidParticle>& particles) {
+	order.resize(count);
+	for (int i = 0; i < count; ++i)
+		order[origin[i]] = i;
+	int flat = 0;
+	for (FluidParticle& block : particles) {
+		for (FluidParticle::Particle& p : block.getParticles()) {
+			const int i = order[flat++];
+			p.x = position[0][i];
+			p.y = position[1][i];
+			p.vx = velocity[0][i];
+			p.vy = velocity[1][i];
+			if (dims == 3) {
+				p.z = position[2][i];
+				p.vz = velocity[2][i];
+			}
+		}
+	}
+}
+
+void FluidSPH::sortParticles() {
+	// Counting sort by hash cell; neighbours then sit close together in every per-particle array
+	const int cells = hashSize[0] * hashSize[1] * hashSize[2];
+	std::vector<int> cellOf(count);
+	cellStart.assign(cells + 1, 0);
+	for (int i = 0; i < count; ++i) {
+		cellOf[i] = hashCell(position[0][i], position[1][i], position[2][i]);
+		++cellStart[cellOf[i] + 1];
+	}
+	for (int c = 0; c < cells; ++c)
+		cellStart[c + 1] += cellStart[c];
+	order.resize(count);
+	std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+	for (int i = 0; i < count; ++i)
+		order[fill[cellOf[i]]++] = i;
+
+	auto permute = [&](std::vector<float>& values) {
+		scratch.resize(count);
+		for (int i = 0; i < count; ++i)
+			scratch[i] = values[order[i]];
+		values.swap(scratch);
+	};
+	for (int d = 0; d < 3; ++d) {
+		permute(position[d]);
+		permute(velocity[d]);
+	}
+	permute(mass);
+	permute(restDensity);
+	permute(viscosity);
+	std::vector<int> sortedOrigin(count);
+	for (int i = 0; i < count; ++i)
+		sortedOrigin[i] = origin[order[i]];
+	origin.swap(sortedOrigin);
+}
+
+void FluidSPH::buildNeighbours() {
+	const float r2 = searchRadius * searchRadius;
+	neighbourStart.assign(count + 1, 0);
+	boundaryStart.assign(count + 1, 0);
+
+	// Two passes over the same search: count, then fill at the prefix-summed offsets
+	auto search = [&](int i, bool fill) {
+		const float xi = position[0][i], yi = position[1][i], zi = position[2][i];
+		int fluid = fill ? neighbourStart[i] : 0;
+		int wall = fill ? boundaryStart[i] : 0;
+		forEachNearbyCell(hashSize, hashCell(xi, yi, zi), dims, [&](int first, int last) {
+			for (int j = cellStart[first]; j < cellStart[last]; ++j) {
+				const float rx = xi - position[0][j], ry = yi - position[1][j], rz = zi - position[2][j];
+				if (j != i && rx * rx + ry * ry + rz * rz < r2) {
+					if (fill)
+						neighbours[fluid] = j;
+					++fluid;
+				}
+			}
+			for (int b = boundaryCellStart[first]; b < boundaryCellStart[last]; ++b) {
+				const float rx = xi - boundaryPosition[0][b], ry = yi - boundaryPosition[1][b], rz = zi - boundaryPosition[2][b];
+				if (rx * rx + ry * ry + rz * rz < r2) {
+					if (fill)
+						boundaryNeighbours[wall] = b;
+					++wall;
+				}
+			}
+		});
+		if (!fill) {
+			neighbourStart[i + 1] = fluid;
+			boundaryStart[i + 1] = wall;
+		}
+	};
+
+	parallelFor(0, count, [&](int i) { search(i, false); }, MinChunk);
+	for (int i = 0; i < count; ++i) {
+		neighbourStart[i + 1] += neighbourStart[i];
+		boundaryStart[i + 1] += boundaryStart[i];
+	}
+	neighbours.resize(neighbourStart[count]);
+	boundaryNeighbours.resize(boundaryStart[count]);
+	parallelFor(0, count, [&](int i) { search(i, true); }, MinChunk);
+
+	kernel.resize(neighbours.size());
+	boundaryKernel.resize(boundaryNeighbours.size());
+	for (int d = 0; d < 3; ++d) {
+		gradient[d].resize(neighbours.size());
+		boundaryGradient[d].resize(boundaryNeighbours.size());
+		listPosition[d] = position[d];
+	}
+	++lastNeighbourBuilds;
+}
+
+void FluidSPH::evaluateKernels() {
+	const float invH = 1.0f / support;
+	const float* const fluid[3] = { position[0].data(), position[1].data(), position[2].data() };
+	const float* const wall[3] = { boundaryPosition[0].data(), boundaryPosition[1].data(), boundaryPosition[2].data() };
+	parallelFor(0, count, [&](int i) {
+		const float xi[3] = { position[0][i], position[1][i], position[2][i] };
+		evaluatePairs(neighbours.data(), neighbourStart[i], neighbourStart[i + 1], xi, fluid, invH, kernelScale,
+			kernel.data(), gradient[0].data(), gradient[1].data(), gradient[2].data());
+		evaluatePairs(boundaryNeighbours.data(), boundaryStart[i], boundaryStart[i + 1], xi, wall, invH, kernelScale,
+			boundaryKernel.data(), boundaryGradient[0].data(), boundaryGradient[1].data(), boundaryGradient[2].data());
+	}, MinChunk);
+}
+
+void FluidSPH::computeDensities() {
+	density.resize(count);
+	parallelFor(0, count, [&](int i) {
+		float fluid = mass[i] * kernelScale;
+		for (int k = neighbourStart[i]; k < neighbourStart[i + 1]; ++k)
+			fluid += mass[neighbours[k]] * kernel[k];
+		float wall = 0.0f;
+		for (int k = boundaryStart[i]; k < boundaryStart[i + 1]; ++k)
+			wall += boundaryVolume[boundaryNeighbours[k]] * boundaryKernel[k];
+		density[i] = fluid + restDensity[i] * wall;
+	}, MinChunk);
+}
+
+void FluidSPH::computeFactors() {
+	// DFSPH factor alpha_i = rho_i / (|sum_j m_j grad W_ij|^2 + sum_j |m_j grad W_ij|^2); boundary
+	// particles add to the first sum only since they never move
+	factor.resize(count);
+	parallelFor(0, count, [&](int i) {
+		float sum[3] = { 0.0f, 0.0f, 0.0f };
+		float squares = 0.0f;
+		for (int k = neighbourStart[i]; k < neighbourStart[i + 1]; ++k) {
+			const float m = mass[neighbours[k]];
+			const float g[3] = { m * gradient[0][k], m * gradient[1][k], m * gradient[2][k] };
+			sum[0] += g[0];
+			sum[1] += g[1];
+			sum[2] += g[2];
+			squares += g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+		}
+		for (int k = boundaryStart[i]; k < boundaryStart[i + 1]; ++k) {
+			const float psi = restDensity[i] * boundaryVolume[boundaryNeighbours[k]];
+			sum[0] += psi * boundaryGradient[0][k];
+			sum[1] += psi * boundaryGradient[1][k];
+			sum[2] += psi * boundaryGradient[2][k];
+		}
+		const float denominator = sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2] + squares;
+		// Nearly isolated particles would get an unbounded factor; they have nothing to push against anyway
+		const float floor = 1e-6f * restDensity[i] * restDensity[i] / (support * support);
+		factor[i] = denominator > floor ? density[i] / denominator : 0.0f;
+	}, MinChunk);
+}
+
+float FluidSPH::flowSpeed() const {
+	float speed = referenceSpeed;
+	if (speed <= 0.0f) {
+		const float g = std::sqrt(gravity[0] * gravity[0] + gravity[1] * gravity[1] + gravity[2] * gravity[2]);
+		speed = std::sqrt(2.0f * g * std::max(extent[0], std::max(extent[1], extent[2])));
+	}
+	return speed > 0.0f ? speed : 1.0f;
+}
+
+void FluidSPH::computeAccelerations(bool withPressure, float sound) {
+	// Laminar viscosity (Morris et al. 1997); the weakly compressible scheme adds the artificial
+	// viscosity alpha * h * c / (2 (d + 2)) it needs to damp acoustic noise
+	const float artificial = withPressure ? ArtificialViscosity * support * sound / (2.0f * (dims + 2)) : 0.0f;
+	const float viscousScale = 2.0f * (dims + 2);
+	const float eps = 0.01f * support * support;
+
+	// Tait equation of state, clamped at zero so free surfaces do not pull particles together
+	stiffness.resize(count);
+	if (withPressure) {
+		parallelFor(0, count, [&](int i) {
+			const float stiff = restDensity[i] * sound * sound / 7.0f;
+			const float ratio = std::max(density[i] / restDensity[i], 1.0f);
+			const float r2 = ratio * ratio;
+			stiffness[i] = stiff * (r2 * r2 * r2 * ratio - 1.0f) / (density[i] * density[i]);
+		}, MinChunk);
+	}
+
+	parallelFor(0, count, [&](int i) {
+		float a[3] = { gravity[0], gravity[1], gravity[2] };
+		const float xi[3] = { position[0][i], position[1][i], position[2][i] };
+		const float vi[3] = { velocity[0][i], velocity[1][i], velocity[2][i] };
+		const float pi = withPressure ? stiffness[i] : 0.0f;
+		for (int k = neighbourStart[i]; k < neighbourStart[i + 1]; ++k) {
+			const int j = neighbours[k];
+			const float r[3] = { xi[0] - position[0][j], xi[1] - position[1][j], xi[2] - position[2][j] };
+			const float vr = (vi[0] - velocity[0][j]) * r[0] + (vi[1] - velocity[1][j]) * r[1] + (vi[2] - velocity[2][j]) * r[2];
+			const float nu = 0.5f * (viscosity[i] + viscosity[j]) + artificial;
+			const float visc = viscousScale * nu * (mass[j] / density[j]) * vr / (r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + eps);
+			const float pressure = withPressure ? mass[j] * (pi + stiffness[j]) : 0.0f;
+			for (int d = 0; d < 3; ++d)
+				a[d] += (visc - pressure) * gradient[d][k];
+		}
+		if (withPressure) {
+			// Boundary particles mirror the fluid particle's pressure at the rest density
+			const float mirrored = pi + pi * density[i] * density[i] / (restDensity[i] * restDensity[i]);
+			for (int k = boundaryStart[i]; k < boundaryStart[i + 1]; ++k) {
+				const float psi = restDensity[i] * boundaryVolume[boundaryNeighbours[k]];
+				for (int d = 0; d < 3; ++d)
+					a[d] -= psi * mirrored * boundaryGradient[d][k];
+			}
+		}
+		for (int d = 0; d < 3; ++d)
+			acceleration[d][i] = d < dims ? a[d] : 0.0f;
+	}, MinChunk);
+}
+
+int FluidSPH::correctVelocities(float dt, bool divergenceOnly) {
+	// Jacobi iterations of the DFSPH velocity correction. Both solves predict a density change from
+	// the velocity divergence and push particles apart with stiffness kappa_i = error_i * alpha_i;
+	// only compression is corrected, so free surfaces stay free.
+	const int minNeighbours = dims == 3 ? 20 : 7;
+	const float tolerance = divergenceOnly ? DivergenceTolerance : DensityTolerance;
+	scratch.resize(count);
+	int iteration = 0;
+	for (; iteration < MaxSolverIterations; ++iteration) {
+		parallelFor(0, count, [&](int i) {
+			float change = 0.0f;
+			for (int k = neighbourStart[i]; k < neighbourStart[i + 1]; ++k) {
+				const int j = neighbours[k];
+				change += mass[j] * ((velocity[0][i] - velocity[0][j]) * gradient[0][k]
+					+ (velocity[1][i] - velocity[1][j]) * gradient[1][k]
+					+ (velocity[2][i] - velocity[2][j]) * gradient[2][k]);
+			}
+			float wall = 0.0f;
+			for (int k = boundaryStart[i]; k < boundaryStart[i + 1]; ++k) {
+				wall += boundaryVolume[boundaryNeighbours[k]] * (velocity[0][i] * boundaryGradient[0][k]
+					+ velocity[1][i] * boundaryGradient[1][k] + velocity[2][i] * boundaryGradient[2][k]);
+			}
+			change += restDensity[i] * wall;
+
+			float error;
+			if (divergenceOnly) {
+				const bool surrounded = neighbourStart[i + 1] - neighbourStart[i] >= minNeighbours;
+				error = surrounded ? std::max(change, 0.0f) : 0.0f;
+				stiffness[i] = error / dt * factor[i];
+				scratch[i] = error * dt / restDensity[i];
+			}
+			else {
+				error = std::max(density[i] + dt * change - restDensity[i], 0.0f);
+				stiffness[i] = error / (dt * dt) * factor[i];
+				scratch[i] = error / restDensity[i];
+			}
+		}, MinChunk);
+
+		const float total = parallelReduce(0, count, 0.0f, [&](int lo, int hi) {
+			float sum = 0.0f;
+			for (int i = lo; i < hi; ++i)
+				sum += scratch[i];
+			return sum;
+		}, [](float a, float b) { return a + b; });
+		if (total <= tolerance * count && iteration >= (divergenceOnly ? 0 : 1))
+			break;
+
+		parallelFor(0, count, [&](int i) {
+			const float ki = stiffness[i] / density[i];
+			float dv[3] = { 0.0f, 0.0f, 0.0f };
+			for (int k = neighbourStart[i]; k < neighbourStart[i + 1]; ++k) {
+				const int j = neighbours[k];
+				const float s = mass[j] * (ki + stiffness[j] / density[j]);
+				dv[0] += s * gradient[0][k];
+				dv[1] += s * gradient[1][k];
+				dv[2] += s * gradient[2][k];
+			}
+			for (int k = boundaryStart[i]; k < boundaryStart[i + 1]; ++k) {
+				const float s = restDensity[i] * boundaryVolume[boundaryNeighbours[k]] * ki;
+				dv[0] += s * boundaryGradient[0][k];
+				dv[1] += s * boundaryGradient[1][k];
+				dv[2] += s * boundaryGradient[2][k];
+			}
+			for (int d = 0; d < dims; ++d)
+				velocity[d][i] -= dt * dv[d];
+		}, MinChunk);
+	}
+	return iteration;
+}
+
+float FluidSPH::advanceParticles(float dt) {
+	const float margin = 1e-3f * cellSize;
+	parallelFor(0, count, [&](int i) {
+		float pos[3] = { position[0][i], position[1][i], position[2][i] };
+		// Particles pushed through the boundary layer stop at the domain wall or stay where they were
+		// next to an obstacle, and lose the velocity that took them there
+		for (int d = 0; d < dims; ++d) {
+			pos[d] += dt * velocity[d][i];
+			if (pos[d] < margin || pos[d] > extent[d] - margin) {
+				pos[d] = std::min(std::max(pos[d], margin), extent[d] - margin);
+				velocity[d][i] = 0.0f;
+			}
+		}
+		if (!solidCells.empty()) {
+			const int ci = static_cast<int>(pos[0] / cellSize);
+			const int cj = static_cast<int>(pos[1] / cellSize);
+			const int ck = dims == 3 ? static_cast<int>(pos[2] / cellSize) : 0;
+			if (solidCells[(ck * size[1] + cj) * size[0] + ci]) {
+				for (int d = 0; d < 3; ++d)
+					velocity[d][i] = 0.0f;
+				return;
+			}
+		}
+		for (int d = 0; d < 3; ++d)
+			position[d][i] = pos[d];
+	}, MinChunk);
+
+	// Largest squared distance moved since the neighbour lists were built
+	return parallelReduce(0, count, 0.0f, [&](int lo, int hi) {
+		float moved = 0.0f;
+		for (int i = lo; i < hi; ++i) {
+			const float dx = position[0][i] - listPosition[0][i];
+			const float dy = position[1][i] - listPosition[1][i];
+			const float dz = position[2][i] - listPosition[2][i];
+			moved = std::max(moved, dx * dx + dy * dy + dz * dz);
+		}
+		return moved;
+	}, [](float a, float b) { return std::max(a, b); });
+}
+
+float FluidSPH::chooseTimestep(float remaining, float sound) const {
+	// Largest squared speed, squared acceleration and viscosity
+	struct Peaks { float speed, accel, nu; };
+	const Peaks peaks = parallelReduce(0, count, Peaks{ 0.0f, 0.0f, 0.0f }, [&](int lo, int hi) {
+		Peaks local = { 0.0f, 0.0f, 0.0f };
+		for (int i = lo; i < hi; ++i) {
+			local.speed = std::max(local.speed, velocity[0][i] * velocity[0][i] + velocity[1][i] * velocity[1][i] + velocity[2][i] * velocity[2][i]);
+			local.accel = std::max(local.accel, acceleration[0][i] * acceleration[0][i] + acceleration[1][i] * acceleration[1][i] + acceleration[2][i] * acceleration[2][i]);
+			local.nu = std::max(local.nu, viscosity[i]);
+		}
+		return local;
+	}, [](const Peaks& a, const Peaks& b) {
+		return Peaks{ std::max(a.speed, b.speed), std::max(a.accel, b.accel), std::max(a.nu, b.nu) };
+	});
+	const float speed = std::sqrt(peaks.speed);
+	const float accel = std::sqrt(peaks.accel);
+	float nu = peaks.nu;
+
+	// CFL on the signal speed (sound for the weakly compressible scheme, the flow for DFSPH, never
+	// below the reference speed the flow is expected to reach), the force criterion and the explicit
+	// viscosity limit
+	float dt = remaining;
+	if (scheme == Scheme::WeaklyCompressible) {
+		dt = std::min(dt, 0.2f * support / (sound + speed));
+		nu += ArtificialViscosity * support * sound / (2.0f * (dims + 2));
+	}
+	else {
+		dt = std::min(dt, 0.2f * support / std::max(speed, flowSpeed()));
+	}
+	if (accel > 0.0f)
+		dt = std::min(dt, 0.25f * std::sqrt(support / accel));
+	if (nu > 0.0f)
+		dt = std::min(dt, 0.125f * support * support / nu);
+	return dt;
+}
+
+int FluidSPH::step(std::vector<FluidParticle>& particles, const std::vector<Properties>& properties, float dt) {
+	lastSolverIterations = 0;
+	lastNeighbourBuilds = 0;
+	gather(particles, properties);
+	if (count == 0 || dt <= 0.0f)
+		return 0;
+
+	const float sound = 10.0f * flowSpeed();
+	const bool divergenceFree = scheme == Scheme::DivergenceFree;
+	const float rebuild = 0.25f * (searchRadius - support) * (searchRadius - support); // Half the skin, squared
+
+	sortParticles();
+	buildNeighbours();
+	evaluateKernels();
+	computeDensities();
+	if (divergenceFree)
+		computeFactors();
+
+	int substeps = 0;
+	float elapsed = 0.0f;
+	while (elapsed < dt) {
+		computeAccelerations(!divergenceFree, sound);
+		// Never more than 10000 substeps per call; the last one takes whatever is left
+		float h = std::max(chooseTimestep(dt - elapsed, sound), 1e-4f * dt);
+		if (elapsed + 1.05f * h >= dt)
+			h = dt - elapsed;
+		for (int d = 0; d < dims; ++d) {
+			for (int i = 0; i < count; ++i)
+				velocity[d][i] += h * acceleration[d][i];
+		}
+		if (divergenceFree)
+			lastSolverIterations += correctVelocities(h, false);
+
+		if (advanceParticles(h) > rebuild) {
+			sortParticles();
+			buildNeighbours();
+		}
+		evaluateKernels();
+		computeDensities();
+		if (divergenceFree) {
+			computeFactors();
+			lastSolverIterations += correctVelocities(h, true);
+		}
+		elapsed += h;
+		++substeps;
+	}
+
+	scatter(particles);
+	return substeps;
+}
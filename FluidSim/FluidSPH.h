@@ -0,0 +1,119 @@
+#pragma once
+#include "FluidGrid.h"
+#include "FluidParticle.h"
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Smoothed-particle hydrodynamics engine working directly on FluidParticle positions and velocities.
+ *
+ * Two schemes share the same machinery: weakly compressible SPH (Tait equation of state, explicit
+ * pressure forces, CFL-limited by the artificial speed of sound) and divergence-free SPH (DFSPH: a
+ * constant-density solve before the position update and a divergence-free solve after it, so the
+ * timestep is limited by the flow speed only). Neither touches the grid's pressure system.
+ *
+ * Each step() copies the particles into structure-of-arrays buffers sorted by cell of a uniform hash
+ * grid whose cells are one search radius wide. Neighbour lists are compact (one contiguous index array
+ * with per-particle offsets) and built with a skin around the kernel support, so they are reused over
+ * substeps until some particle has moved half the skin. Kernel values and gradients are evaluated once
+ * per substep for every listed pair in branch-free loops the compiler vectorizes, and the pressure
+ * iterations only read them back.
+ *
+ * Domain walls and solid cells are sampled once at prepare() into static boundary particles whose
+ * volumes are corrected for their own sampling density (Akinci et al. 2012), giving free-slip walls.
+ * Particles are lost only through outflow boundaries (handled by the caller).
+ */
+class FluidSPH {
+public:
+	enum class Scheme { WeaklyCompressible, DivergenceFree };
+
+	// Per-particle material properties, in the flat order of the particle blocks
+	struct Properties {
+		float restDensity;        // kg/m^3
+		float kinematicViscosity; // m^2/s
+	};
+
+	FluidSPH();
+
+	/**
+	 * @brief Samples the boundary particles for a grid and fixes the kernel support.
+	 * @param grid Grid whose extents, cell size and solid layer bound the particles.
+	 * @param particleSpacing Rest distance between fluid particles; the kernel support is twice this.
+	 */
+	void prepare(const FluidGrid& grid, float particleSpacing);
+	bool isPreparedFor(const FluidGrid& grid, float particleSpacing) const;
+
+	void setScheme(Scheme value) { scheme = value; }
+	Scheme getScheme() const { return scheme; }
+	void setGravity(float gx, float gy, float gz);
+	// Expected top flow speed, a floor for the CFL limit; the weakly compressible speed of sound is ten times this. 0 (default) uses the free-fall speed over the domain
+	void setReferenceSpeed(float speed) { referenceSpeed = speed; }
+
+	/**
+	 * @brief Advances the particles by dt in as many CFL-limited substeps as needed.
+	 * @param particles Particle blocks; positions and velocities are updated in place.
+	 * @param properties Material properties of every particle, in flat block order.
+	 * @param dt Timestep.
+	 * @return Number of substeps taken.
+	 */
+	int step(std::vector<FluidParticle>& particles, const std::vector<Properties>& properties, float dt);
+
+	int getLastSolverIterations() const { return lastSolverIterations; }
+	int getLastNeighbourBuilds() const { return lastNeighbourBuilds; }
+	float getSupportRadius() const { return support; }
+
+private:
+	Scheme scheme;
+	int dims;
+	int size[3];
+	float cellSize;
+	float spacing;
+	float support;        // Kernel support radius h
+	float searchRadius;   // h plus the neighbour list skin
+	float kernelScale;    // Normalisation of the cubic spline for h and dims
+	float particleVolume; // Rest volume per particle, from the kernel sum over a regular lattice
+	float extent[3];
+	float gravity[3];
+	float referenceSpeed;
+	int lastSolverIterations;
+	int lastNeighbourBuilds;
+
+	// Uniform hash grid over the domain plus one search radius on each side
+	int hashSize[3];
+	std::vector<int> cellStart, boundaryCellStart; // First particle of each hash cell, plus one past the end
+
+	// Fluid particles, sorted by hash cell
+	int count;
+	std::vector<float> position[3], velocity[3], acceleration[3], listPosition[3];
+	std::vector<float> mass, restDensity, viscosity;
+	std::vector<float> density, factor, stiffness;
+	std::vector<int> origin; // Flat index of each sorted particle in the caller's blocks
+	std::vector<int> order;
+	std::vector<float> scratch;
+
+	// Compact neighbour lists (fluid and boundary) with the kernel terms of each listed pair
+	std::vector<int> neighbourStart, neighbours;
+	std::vector<int> boundaryStart, boundaryNeighbours;
+	std::vector<float> kernel, gradient[3];
+	std::vector<float> boundaryKernel, boundaryGradient[3];
+
+	// Static boundary particles, sorted by hash cell
+	std::vector<float> boundaryPosition[3];
+	std::vector<float> boundaryVolume;
+	std::vector<uint8_t> solidCells; // Copy of the grid's solid layer, empty without obstacles
+
+	void gather(const std::vector<FluidParticle>& particles, const std::vector<Properties>& properties);
+	void scatter(std::vector<FluidParticle>& particles);
+	int hashCell(float x, float y, float z) const;
+	void sortParticles();
+	void buildNeighbours();
+	void evaluateKernels();
+	void computeDensities();
+	void computeFactors();
+	void computeAccelerations(bool withPressure, float speedOfSound);
+	int correctVelocities(float dt, bool divergenceOnly);
+	float advanceParticles(float dt);
+	float flowSpeed() const;
+	float chooseTimestep(float remaining, float sound) const;
+	float kernelValue(float r) const;
+};
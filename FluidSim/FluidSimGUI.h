@@ -3,7 +3,9 @@
 #include "resource.h"  
 #include "sqlite3.h"
 
-#define FLUIDSIM_VERSION L"0.1.000"
+#include "FluidVersion.h"
+
+#define FLUIDSIM_VERSION FLUIDSIM_WIDEN(FLUIDSIM_VERSION_STRING)
 
 #include <fstream>
 #include <string>
@@ -0,0 +1,1488 @@
+#include "FluidSolver.h"
+#include "FluidParallel.h"
+#include "FluidCheckpoint.h"
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <type_traits>
+
+// Smallest pieces of work worth handing to another thread
+static const int CellChunk = 4096;
+static const int RowChunk = 16;
+static const int ParticleChunk = 1024;
+static const long long MaxPhaseTable = 1 << 16; // Widest phase_id range looked up through a table
+
+// Axis pairs of the shear stresses, (x, y) first so 2D uses only that one
+static const int PlaneAxes[3][2] = { { 0, 1 }, { 0, 2 }, { 1, 2 } };
+
+static int planeOf(int a, int b) {
+	return a + b - 1;
+}
+
+// Position in face-sample units along one axis: faces of that axis sit on cell boundaries, the rest
+// on cell centres. splatVelocity() bins particles with it too, so both agree on the stencil.
+static inline float faceCoordinate(float pos, float inv, bool faceAxis) {
+	return pos * inv - (faceAxis ? 0.0f : 0.5f);
+}
+
+// Calls fn(cellIndex, weight) for every face sample of the given axis that contributes to a point,
+// using (bi/tri)linear weights. Tangential indices are clamped to the domain; the unstored face
+// on the upper wall is skipped, which makes it read as zero velocity.
+template <typename Fn>
+static void forEachFaceWeight(const FluidGrid& grid, int axis, const float pos[3], Fn fn) {
+	const int n[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int dims = grid.getDimensions();
+	const float inv = 1.0f / grid.getCellSize();
+
+	int base[3] = { 0, 0, 0 };
+	float frac[3] = { 0.0f, 0.0f, 0.0f };
+	for (int d = 0; d < dims; ++d) {
+		float g = faceCoordinate(pos[d], inv, d == axis);
+		base[d] = static_cast<int>(std::floor(g));
+		frac[d] = g - base[d];
+	}
+
+	const int corners = 1 << dims;
+	for (int c = 0; c < corners; ++c) {
+		int idx[3] = { 0, 0, 0 };
+		float w = 1.0f;
+		bool valid = true;
+		for (int d = 0; d < dims; ++d) {
+			int o = (c >> d) & 1;
+			w *= o ? frac[d] : 1.0f - frac[d];
+			idx[d] = base[d] + o;
+			if (d == axis) {
+				if (idx[d] < 0 || idx[d] >= n[d])
+					valid = false;
+			}
+			else {
+				idx[d] = std::min(std::max(idx[d], 0), n[d] - 1);
+			}
+		}
+		if (valid && w > 0.0f)
+			fn(grid.index(idx[0], idx[1], idx[2]), w);
+	}
+}
+
+FluidSolver::FluidSolver(FluidGrid& grid, std::vector<FluidParticle>& particles)
+	: grid(grid), particles(particles), method(Method::FlipPic), ensembleLattice(nullptr), ensembleLane(0), ambient{ 1.2f, 1.8e-5f }, flipRatio(0.95f), seed(0),
+	particlesPerCell(static_cast<float>(1 << grid.getDimensions())), lastViscosityIterations(0), lastPressureIterations(0),
+	stepCount(0), simulatedTime(0.0), pendingCheckpoint(), lastCheckpoint(), phaseBase(0), viscous(false), pressureSolver(500, 1e-5f), pressureUnknowns(0),
+	stepDt(0.0f) {
+	gravity[0] = 0.0f;
+	gravity[1] = -9.81f;
+	gravity[2] = 0.0f;
+}
+
+void FluidSolver::setMaterial(int material_id, const Material& material) {
+	materials[material_id] = material;
+}
+
+void FluidSolver::setPhaseMaterial(int phase_id, int material_id) {
+	auto it = std::lower_bound(phaseMaterials.begin(), phaseMaterials.end(), std::make_pair(phase_id, INT_MIN));
+	if (it != phaseMaterials.end() && it->first == phase_id)
+		it->second = material_id;
+	else
+		phaseMaterials.insert(it, { phase_id, material_id });
+}
+
+void FluidSolver::setGravity(float gx, float gy, float gz) {
+	gravity[0] = gx;
+	gravity[1] = gy;
+	gravity[2] = gz;
+}
+
+const FluidSolver::Material& FluidSolver::materialFor(int material_id) const {
+	if (material_id < 0)
+		return ambient;
+	auto it = materials.find(material_id);
+	return it != materials.end() ? it->second : ambient;
+}
+
+bool FluidSolver::parseMethod(const std::string& text, Method& method) {
+	std::string name;
+	for (char c : text) {
+		if (!std::isspace(static_cast<unsigned char>(c)))
+			name += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	}
+	// "Standard" is what the original editor stored for its only solver, which was FLIP
+	if (name.empty() || name == "STANDARD" || name == "FLIP" || name == "PIC" || name == "PIC/FLIP" || name == "FLIP/PIC") {
+		method = Method::FlipPic;
+		return true;
+	}
+	if (name == "LBM" || name == "LATTICEBOLTZMANN") {
+		method = Method::LatticeBoltzmann;
+		return true;
+	}
+	if (name == "WCSPH") {
+		method = Method::SphWeaklyCompressible;
+		return true;
+	}
+	if (name == "SPH" || name == "DFSPH") {
+		method = Method::SphDivergenceFree;
+		return true;
+	}
+	if (name == "SURROGATE" || name == "NN") {
+		method = Method::Surrogate;
+		return true;
+	}
+	return false;
+}
+
+void FluidSolver::step(float dt) {
+	if (method == Method::LatticeBoltzmann) {
+		stepLattice(dt);
+	}
+	else if (method == Method::SphWeaklyCompressible || method == Method::SphDivergenceFree) {
+		stepParticles(dt);
+	}
+	else {
+		if (stepGraph.size() == 0)
+			buildStepGraph();
+		stepDt = dt;
+		stepGraph.run();
+	}
+	++stepCount;
+	simulatedTime += dt;
+}
+
+void FluidSolver::buildStepGraph() {
+	// Per-axis stages only touch their own velocity component, so the axes run side by side, and the
+	// pressure matrix only needs the face densities, so it is assembled and factored while forces and
+	// viscosity are applied. Adding the tasks in sequential order keeps that order a valid schedule.
+	const int dims = grid.getDimensions();
+	const FluidTaskGraph::Resources particleState = ParticleList | ParticlePositions | ParticleVelocities;
+	FluidTaskGraph::Resources allVelocity = 0, allDensity = 0, allSaved = 0;
+	for (int axis = 0; axis < dims; ++axis) {
+		allVelocity |= GridVelocity << axis;
+		allDensity |= FaceDensities << axis;
+		allSaved |= SavedVelocity << axis;
+	}
+	static const char* const axisNames[3] = { " x", " y", " z" };
+
+	stepGraph.clear();
+	stepGraph.add("boundary stage", 0, particleState | Boundaries, [this]() { applyBoundaryStage(stepDt); });
+	stepGraph.add("phase table", 0, PhaseTable, [this]() { preparePhaseTable(); });
+	for (int axis = 0; axis < dims; ++axis) {
+		stepGraph.add(std::string("splat") + axisNames[axis], particleState | PhaseTable, (GridVelocity | FaceDensities) << axis,
+			[this, axis]() { splatVelocity(axis); });
+	}
+	stepGraph.add("cell materials", ParticleList | ParticlePositions, CellMaterials, [this]() { assignMaterials(); });
+	for (int axis = 0; axis < dims; ++axis) {
+		stepGraph.add(std::string("save velocity") + axisNames[axis], Boundaries, (GridVelocity | SavedVelocity) << axis,
+			[this, axis]() { saveVelocity(axis); });
+		stepGraph.add(std::string("forces") + axisNames[axis], Boundaries, GridVelocity << axis,
+			[this, axis]() { applyForce(axis, stepDt); });
+	}
+	stepGraph.add("cell viscosity", CellMaterials, CellViscosity, [this]() { prepareViscosity(); });
+	stepGraph.add("viscosity", CellViscosity | allDensity | Boundaries, allVelocity,
+		[this]() { lastViscosityIterations = solveViscosity(stepDt); });
+	stepGraph.add("pressure matrix", allDensity | Boundaries, PressureMatrix, [this]() { assemblePressure(); });
+	stepGraph.add("pressure solve", PressureMatrix | allDensity | Boundaries | CellMaterials, allVelocity | CellPressure,
+		[this]() { lastPressureIterations = solvePressure(stepDt); });
+	for (int axis = 0; axis < dims; ++axis) {
+		stepGraph.add(std::string("grid delta") + axisNames[axis], GridVelocity << axis, SavedVelocity << axis,
+			[this, axis]() { storeGridDelta(axis); });
+	}
+	stepGraph.add("particle velocities", allVelocity | allSaved | ParticleList | ParticlePositions, ParticleVelocities,
+		[this]() { transferToParticles(); });
+	stepGraph.add("advect", allVelocity | ParticleList, ParticlePositions, [this]() { advectParticles(stepDt); });
+}
+
+void FluidSolver::stepLattice(float dt) {
+	applyBoundaryStage(dt);
+	ensembleLattice = nullptr;
+	lattice.setGravity(gravity[0], gravity[1], gravity[2]);
+	if (!lattice.isPreparedFor(grid) || lattice.getLanes() != 1)
+		lattice.prepare(grid, boundary, ambient.density, ambient.viscosity / ambient.density);
+	lattice.step(grid, dt);
+	moveTracers(dt);
+}
+
+bool FluidSolver::stepEnsemble(const std::vector<FluidSolver*>& members, float dt) {
+	if (members.empty() || static_cast<int>(members.size()) > FluidLBM::MaxLanes)
+		return false;
+	FluidSolver& leader = *members[0];
+	const FluidGrid& shape = leader.grid;
+	for (const FluidSolver* member : members) {
+		const FluidGrid& g = member->grid;
+		if (member->method != Method::LatticeBoltzmann || g.getWidth() != shape.getWidth() || g.getHeight() != shape.getHeight()
+			|| g.getDepth() != shape.getDepth() || g.getCellSize() != shape.getCellSize()
+			|| !std::equal(member->gravity, member->gravity + 3, leader.gravity) || member->grid.getSolidMask() != leader.grid.getSolidMask())
+			return false;
+	}
+
+	for (FluidSolver* member : members)
+		member->applyBoundaryStage(dt);
+
+	// Rebuild the shared lattice whenever the ensemble changes
+	FluidLBM& lattice = leader.lattice;
+	bool prepared = lattice.isPreparedFor(shape) && lattice.getLanes() == static_cast<int>(members.size());
+	for (size_t k = 0; k < members.size() && prepared; ++k)
+		prepared = members[k]->ensembleLattice == &lattice && members[k]->ensembleLane == static_cast<int>(k);
+	if (!prepared) {
+		std::vector<FluidLBM::Member> lanes;
+		for (const FluidSolver* member : members)
+			lanes.push_back({ &member->boundary, member->ambient.density, member->ambient.viscosity / member->ambient.density });
+		lattice.setGravity(leader.gravity[0], leader.gravity[1], leader.gravity[2]);
+		if (!lattice.prepareEnsemble(shape, lanes))
+			return false;
+		for (size_t k = 0; k < members.size(); ++k) {
+			members[k]->ensembleLattice = &lattice;
+			members[k]->ensembleLane = static_cast<int>(k);
+		}
+	}
+
+	std::vector<FluidGrid*> grids;
+	for (FluidSolver* member : members)
+		grids.push_back(&member->grid);
+	lattice.stepEnsemble(grids.data(), dt);
+	for (FluidSolver* member : members) {
+		member->moveTracers(dt);
+		++member->stepCount;
+		member->simulatedTime += dt;
+	}
+	return true;
+}
+
+void FluidSolver::moveTracers(float dt) {
+	enforceBoundaries();
+	lastViscosityIterations = 0;
+	lastPressureIterations = 0;
+
+	// Particles are passive tracers: they take the lattice velocity and move with it
+	const int dims = grid.getDimensions();
+	for (FluidParticle& block : particles) {
+		std::vector<FluidParticle::Particle>& list = block.getParticles();
+		parallelFor(0, static_cast<int>(list.size()), [&](int k) {
+			FluidParticle::Particle& p = list[k];
+			const float pos[3] = { p.x, p.y, p.z };
+			float* vel[3] = { &p.vx, &p.vy, &p.vz };
+			for (int axis = 0; axis < dims; ++axis)
+				*vel[axis] = sampleVelocity(axis, pos);
+		}, ParticleChunk);
+	}
+	advectParticles(dt);
+}
+
+FluidSolver::Measurements FluidSolver::measure() const {
+	Measurements result = { 0.0, 0.0f, { 0.0f, 0.0f, 0.0f } };
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int dims = grid.getDimensions();
+	const int size[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int stride[3] = { 1, size[0], size[0] * size[1] };
+	const float dx = grid.getCellSize();
+	const double cellVolume = std::pow(static_cast<double>(dx), dims);
+	const float faceArea = dims == 3 ? dx * dx : dx;
+	double force[3] = { 0.0, 0.0, 0.0 };
+	float maxSpeedSquared = 0.0f;
+
+	for (int z = 0, i = 0; z < size[2]; ++z) {
+		for (int y = 0; y < size[1]; ++y) {
+			for (int x = 0; x < size[0]; ++x, ++i) {
+				if (grid.isSolid(i))
+					continue;
+				const int coord[3] = { x, y, z };
+				float speedSquared = 0.0f;
+				for (int d = 0; d < dims; ++d) {
+					const bool hasUpper = coord[d] + 1 < size[d];
+					const float upper = hasUpper ? cells[i + stride[d]].velocity[d] : cells[i].velocity[d];
+					const float centre = 0.5f * (cells[i].velocity[d] + upper);
+					speedSquared += centre * centre;
+
+					// Pressure on the faces this cell shares with solids, pushing them away from it
+					if (coord[d] > 0 && grid.isSolid(i - stride[d]))
+						force[d] -= cells[i].pressure * faceArea;
+					if (hasUpper && grid.isSolid(i + stride[d]))
+						force[d] += cells[i].pressure * faceArea;
+				}
+				result.kineticEnergy += 0.5 * materialFor(cells[i].material_id).density * speedSquared * cellVolume;
+				maxSpeedSquared = std::max(maxSpeedSquared, speedSquared);
+			}
+		}
+	}
+	result.maxSpeed = std::sqrt(maxSpeedSquared);
+	for (int d = 0; d < 3; ++d)
+		result.force[d] = static_cast<float>(force[d]);
+	return result;
+}
+
+void FluidSolver::stepParticles(float dt) {
+	const int dims = grid.getDimensions();
+	const float spacing = grid.getCellSize() / std::pow(particlesPerCell, 1.0f / dims);
+	applyBoundaryStage(dt, spacing);
+	sph.setScheme(method == Method::SphWeaklyCompressible ? FluidSPH::Scheme::WeaklyCompressible : FluidSPH::Scheme::DivergenceFree);
+	sph.setGravity(gravity[0], gravity[1], gravity[2]);
+	if (!sph.isPreparedFor(grid, spacing))
+		sph.prepare(grid, spacing);
+
+	sphProperties.clear();
+	for (const FluidParticle& block : particles) {
+		for (const FluidParticle::Particle& p : block.getParticles()) {
+			const Material& material = materialFor(p.material_id);
+			sphProperties.push_back({ material.density, material.viscosity / material.density });
+		}
+	}
+	sph.step(particles, sphProperties, dt);
+	lastViscosityIterations = 0;
+	lastPressureIterations = sph.getLastSolverIterations();
+
+	// The grid only mirrors the particles (velocity, material) for output; nothing is solved on it
+	transferToGrid();
+	enforceBoundaries();
+}
+
+void FluidSolver::applyBoundaryStage(float dt, float emissionSpacing) {
+	if (boundary.empty())
+		return;
+	if (!boundary.isPreparedFor(grid))
+		boundary.prepare(grid, seed);
+	boundary.removeParticles(grid, particles);
+	if (particles.empty())
+		particles.emplace_back(0, 0, 0);
+	boundary.emitParticles(dt, particles, emissionSpacing);
+}
+
+void FluidSolver::transferToGrid() {
+	const int dims = grid.getDimensions();
+	preparePhaseTable();
+	for (int axis = 0; axis < dims; ++axis)
+		splatVelocity(axis);
+	assignMaterials();
+	for (int axis = 0; axis < dims; ++axis)
+		saveVelocity(axis);
+}
+
+void FluidSolver::preparePhaseTable() {
+	// Materials and phases may change between steps; the splat looks both up per particle
+	const int phaseCount = static_cast<int>(phaseMaterials.size());
+	phaseDensity.resize(phaseCount);
+	for (int k = 0; k < phaseCount; ++k)
+		phaseDensity[k] = materialFor(phaseMaterials[k].second).density;
+
+	// Phase ids are small in practice; a sparse set too wide for a table falls back to a binary search
+	phaseSlots.clear();
+	phaseBase = 0;
+	if (phaseCount == 0)
+		return;
+	const long long span = static_cast<long long>(phaseMaterials.back().first) - phaseMaterials.front().first + 1;
+	if (span > MaxPhaseTable)
+		return;
+	phaseBase = phaseMaterials.front().first;
+	phaseSlots.assign(static_cast<size_t>(span), -1);
+	for (int k = 0; k < phaseCount; ++k)
+		phaseSlots[phaseMaterials[k].first - phaseBase] = k;
+}
+
+int FluidSolver::phaseSlot(int phase_id) const {
+	if (!phaseSlots.empty()) {
+		const long long offset = static_cast<long long>(phase_id) - phaseBase;
+		return offset >= 0 && offset < static_cast<long long>(phaseSlots.size()) ? phaseSlots[static_cast<size_t>(offset)] : -1;
+	}
+	auto it = std::lower_bound(phaseMaterials.begin(), phaseMaterials.end(), std::make_pair(phase_id, INT_MIN));
+	return it != phaseMaterials.end() && it->first == phase_id ? static_cast<int>(it - phaseMaterials.begin()) : -1;
+}
+
+void FluidSolver::splatVelocity(int axis) {
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	const int phaseCount = static_cast<int>(phaseMaterials.size());
+	std::vector<float>& weight = splatWeight[axis];
+	std::vector<float>& density = splatDensity[axis];
+	std::vector<float>& phaseWeight = splatPhaseWeight[axis];
+
+	weight.assign(n, 0.0f);
+	density.assign(n, 0.0f);
+	phaseWeight.assign(static_cast<size_t>(phaseCount) * n, 0.0f);
+	parallelFor(0, n, [&](int i) {
+		cells[i].velocity[axis] = 0.0f;
+	}, CellChunk);
+
+	// Particles are grouped by the layer of the outermost axis (z, or y in 2D) their stencil starts in,
+	// keeping their order within a group. Group s writes layers s - 1 and s only, so the even groups
+	// run in parallel and then the odd ones; every face sums its contributions in the same order for
+	// any thread count, which keeps seeded runs reproducible.
+	const int outer = grid.getDimensions() - 1;
+	const int layers = outer == 2 ? grid.getDepth() : grid.getHeight();
+	const float inv = 1.0f / grid.getCellSize();
+	std::vector<const FluidParticle::Particle*>& order = splatOrder[axis];
+	std::vector<int>& slabStart = splatSlabStart[axis];
+	auto slabOf = [&](const FluidParticle::Particle& p) {
+		const float g = faceCoordinate(outer == 2 ? p.z : p.y, inv, axis == outer);
+		return std::min(std::max(static_cast<int>(std::floor(g)), -1), layers - 1) + 1;
+	};
+	slabStart.assign(layers + 2, 0);
+	size_t count = 0;
+	for (const FluidParticle& block : particles) {
+		for (const FluidParticle::Particle& p : block.getParticles())
+			++slabStart[slabOf(p) + 1];
+		count += block.getParticles().size();
+	}
+	for (int s = 0; s <= layers; ++s)
+		slabStart[s + 1] += slabStart[s];
+	order.resize(count);
+	{
+		std::vector<int> next(slabStart.begin(), slabStart.end() - 1);
+		for (const FluidParticle& block : particles) {
+			for (const FluidParticle::Particle& p : block.getParticles())
+				order[next[slabOf(p)]++] = &p;
+		}
+	}
+
+	auto splatSlab = [&](int s) {
+		for (int k = slabStart[s]; k < slabStart[s + 1]; ++k) {
+			const FluidParticle::Particle& p = *order[k];
+			const float pos[3] = { p.x, p.y, p.z };
+			const float vel = axis == 0 ? p.vx : (axis == 1 ? p.vy : p.vz);
+			const int phase = phaseSlot(p.phase_id);
+			if (phase >= 0) {
+				float* slot = phaseWeight.data() + static_cast<size_t>(phase) * n;
+				forEachFaceWeight(grid, axis, pos, [&](int idx, float w) {
+					cells[idx].velocity[axis] += w * vel;
+					weight[idx] += w;
+					slot[idx] += w;
+				});
+			}
+			else {
+				const float rho = materialFor(p.material_id).density;
+				forEachFaceWeight(grid, axis, pos, [&](int idx, float w) {
+					cells[idx].velocity[axis] += w * vel;
+					weight[idx] += w;
+					density[idx] += w * rho;
+				});
+			}
+		}
+	};
+	for (int parity = 0; parity < 2; ++parity) {
+		parallelFor(0, (layers + 2 - parity) / 2, [&](int g) {
+			splatSlab(2 * g + parity);
+		});
+	}
+
+	// Each phase holds weight / particlesPerCell of the face (scaled so an overfull face sums to one) at its
+	// own density; the remainder of the face belongs to the ambient phase
+	faceDensity[axis].resize(n);
+	parallelFor(0, n, [&](int i) {
+		if (weight[i] > 0.0f) {
+			cells[i].velocity[axis] /= weight[i];
+			const float scale = 1.0f / std::max(weight[i], particlesPerCell);
+			float rho = density[i] * scale;
+			for (int k = 0; k < phaseCount; ++k)
+				rho += phaseWeight[static_cast<size_t>(k) * n + i] * scale * phaseDensity[k];
+			faceDensity[axis][i] = rho + (1.0f - weight[i] * scale) * ambient.density;
+		}
+		else {
+			faceDensity[axis][i] = ambient.density;
+		}
+	}, CellChunk);
+}
+
+void FluidSolver::assignMaterials() {
+	// Each cell takes the material of the particle closest to its centre
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int dims = grid.getDimensions();
+	const float dx = grid.getCellSize();
+	nearestDistance.assign(grid.getCellCount(), 0.25f * dx * dx * dims);
+	for (FluidGrid::Cell& cell : cells)
+		cell.material_id = -1;
+	for (FluidParticle& block : particles) {
+		for (const FluidParticle::Particle& p : block.getParticles()) {
+			int ci = std::min(std::max(static_cast<int>(p.x / dx), 0), grid.getWidth() - 1);
+			int cj = std::min(std::max(static_cast<int>(p.y / dx), 0), grid.getHeight() - 1);
+			int ck = dims == 3 ? std::min(std::max(static_cast<int>(p.z / dx), 0), grid.getDepth() - 1) : 0;
+			float ox = p.x - (ci + 0.5f) * dx;
+			float oy = p.y - (cj + 0.5f) * dx;
+			float oz = dims == 3 ? p.z - (ck + 0.5f) * dx : 0.0f;
+			float d2 = ox * ox + oy * oy + oz * oz;
+			int idx = grid.index(ci, cj, ck);
+			if (d2 <= nearestDistance[idx] && !grid.isSolid(idx)) {
+				nearestDistance[idx] = d2;
+				cells[idx].material_id = p.material_id;
+			}
+		}
+	}
+}
+
+void FluidSolver::saveVelocity(int axis) {
+	enforceBoundaries(axis);
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	savedVelocity[axis].resize(n);
+	for (int i = 0; i < n; ++i)
+		savedVelocity[axis][i] = cells[i].velocity[axis];
+}
+
+void FluidSolver::applyForce(int axis, float dt) {
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const float dv = dt * gravity[axis];
+	parallelFor(0, grid.getCellCount(), [&](int i) {
+		cells[i].velocity[axis] += dv;
+	}, CellChunk);
+	enforceBoundaries(axis);
+}
+
+void FluidSolver::enforceBoundaries(int axis) {
+	// Domain walls are closed: the lower face of the first cell along each axis carries no flow.
+	// The upper wall face is not stored and reads as zero. Closed solid faces get the (static)
+	// obstacle velocity, so nothing flows through them.
+	const int nx = grid.getWidth(), ny = grid.getHeight(), nz = grid.getDepth();
+	const bool solids = grid.hasSolids();
+	const int first = axis < 0 ? 0 : axis;
+	const int last = axis < 0 ? 2 : axis;
+	for (int z = 0; z < nz; ++z) {
+		for (int y = 0; y < ny; ++y) {
+			for (int x = 0; x < nx; ++x) {
+				const int i = grid.index(x, y, z);
+				FluidGrid::Cell& cell = grid.getCells()[i];
+				const bool wall[3] = { x == 0, y == 0, z == 0 || nz == 1 };
+				for (int d = first; d <= last; ++d) {
+					if (wall[d] || (solids && grid.getFaceFraction(i, d) == 0.0f))
+						cell.velocity[d] = 0.0f;
+				}
+			}
+		}
+	}
+	if (boundary.isPreparedFor(grid))
+		boundary.applyFaceVelocities(grid, axis);
+}
+
+int FluidSolver::applyViscosity(float dt) {
+	prepareViscosity();
+	return solveViscosity(dt);
+}
+
+void FluidSolver::prepareViscosity() {
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	cellViscosity.resize(n);
+	float maxViscosity = 0.0f;
+	for (int i = 0; i < n; ++i) {
+		cellViscosity[i] = materialFor(cells[i].material_id).viscosity;
+		maxViscosity = std::max(maxViscosity, cellViscosity[i]);
+	}
+	viscous = maxViscosity > 0.0f;
+}
+
+int FluidSolver::solveViscosity(float dt) {
+	if (!viscous)
+		return 0;
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	const int dims = grid.getDimensions();
+	const int size[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int stride[3] = { 1, size[0], size[0] * size[1] };
+	// Edges run through cell corners, so their lattice is one wider along each axis (one layer in 2D)
+	const int edgeSize[3] = { size[0] + 1, size[1] + 1, dims == 3 ? size[2] + 1 : 1 };
+	const int edgeStride[3] = { 1, edgeSize[0], edgeSize[0] * edgeSize[1] };
+	const int edgeCount = edgeSize[0] * edgeSize[1] * edgeSize[2];
+	const int planes = dims == 3 ? 3 : 1;
+	const float scale = dt / (grid.getCellSize() * grid.getCellSize());
+
+	auto inside = [&](const int c[3]) {
+		return c[0] >= 0 && c[1] >= 0 && c[2] >= 0 && c[0] < size[0] && c[1] < size[1] && c[2] < size[2];
+	};
+	// The first face along each axis is the wall; it and closed faces hold zero, like faces outside the grid
+	auto fixedFace = [&](int i, const int coord[3], int axis) {
+		return coord[axis] == 0 || grid.getFaceFraction(i, axis) == 0.0f;
+	};
+	auto edgeIndex = [&](const int c[3]) { return c[0] + c[1] * edgeStride[1] + c[2] * edgeStride[2]; };
+
+	// Shear viscosity on each edge is the mean of the cells around it that lie in the grid
+	for (int p = 0; p < planes; ++p)
+		edgeViscosity[p].resize(edgeCount);
+	parallelFor(0, edgeSize[1] * edgeSize[2], [&](int row) {
+		const int y = row % edgeSize[1], z = row / edgeSize[1];
+		for (int x = 0; x < edgeSize[0]; ++x) {
+			const int corner[3] = { x, y, z };
+			const int e = edgeIndex(corner);
+			for (int p = 0; p < planes; ++p) {
+				const int a = PlaneAxes[p][0], b = PlaneAxes[p][1];
+				float sum = 0.0f;
+				int count = 0;
+				for (int k = 0; k < 4; ++k) {
+					int c[3] = { x, y, z };
+					c[a] -= k & 1;
+					c[b] -= k >> 1;
+					if (inside(c)) {
+						sum += cellViscosity[c[0] + c[1] * stride[1] + c[2] * stride[2]];
+						++count;
+					}
+				}
+				edgeViscosity[p][e] = count > 0 ? sum / count : 0.0f;
+			}
+		}
+	}, RowChunk);
+
+	// One system for every component, component-major: the stress couples them where mu varies
+	const size_t unknowns = static_cast<size_t>(dims) * n;
+	viscosityDiagonal.resize(unknowns);
+	viscosityRhs.resize(unknowns);
+	viscositySolution.resize(unknowns);
+	for (int axis = 0; axis < dims; ++axis) {
+		normalStress[axis].resize(n);
+		if (axis < planes)
+			shearStress[axis].resize(edgeCount);
+	}
+	parallelFor(0, size[1] * size[2], [&](int row) {
+		const int y = row % size[1], z = row / size[1];
+		for (int x = 0, i = row * size[0]; x < size[0]; ++x, ++i) {
+			const int coord[3] = { x, y, z };
+			const int e = edgeIndex(coord);
+			for (int a = 0; a < dims; ++a) {
+				const size_t f = static_cast<size_t>(a) * n + i;
+				if (fixedFace(i, coord, a)) {
+					viscosityDiagonal[f] = 1.0f;
+					viscosityRhs[f] = 0.0f;
+					viscositySolution[f] = 0.0f;
+					continue;
+				}
+				// Each strain rate the face enters contributes its viscosity: the normal strain of both
+				// cells it separates (weighted 2 mu) and the shear strain of the edges on either side
+				float coupling = 2.0f * (cellViscosity[i] + cellViscosity[i - stride[a]]);
+				for (int b = 0; b < dims; ++b) {
+					if (b != a) {
+						const int p = planeOf(a, b);
+						coupling += edgeViscosity[p][e] + edgeViscosity[p][e + edgeStride[b]];
+					}
+				}
+				viscosityDiagonal[f] = faceDensity[a][i] + scale * coupling;
+				viscosityRhs[f] = faceDensity[a][i] * cells[i].velocity[a];
+				viscositySolution[f] = cells[i].velocity[a];
+			}
+		}
+	}, RowChunk);
+
+	// A = rho + dt D^T W D, where D takes face velocities to strain rates and W weighs them by
+	// viscosity: symmetric positive definite, applied as two stress passes and a gather
+	FluidPCG::Operator A = [&](const std::vector<float>& in, std::vector<float>& out) {
+		out.resize(in.size());
+		auto velocity = [&](const int c[3], int axis) {
+			if (!inside(c))
+				return 0.0f;
+			const int i = c[0] + c[1] * stride[1] + c[2] * stride[2];
+			return fixedFace(i, c, axis) ? 0.0f : in[static_cast<size_t>(axis) * n + i];
+		};
+		parallelFor(0, size[1] * size[2], [&](int row) {
+			const int y = row % size[1], z = row / size[1];
+			for (int x = 0, i = row * size[0]; x < size[0]; ++x, ++i) {
+				const int coord[3] = { x, y, z };
+				for (int a = 0; a < dims; ++a) {
+					int upper[3] = { x, y, z };
+					++upper[a];
+					normalStress[a][i] = 2.0f * cellViscosity[i] * (velocity(upper, a) - velocity(coord, a));
+				}
+			}
+		}, RowChunk);
+		parallelFor(0, edgeSize[1] * edgeSize[2], [&](int row) {
+			const int y = row % edgeSize[1], z = row / edgeSize[1];
+			for (int x = 0; x < edgeSize[0]; ++x) {
+				const int corner[3] = { x, y, z };
+				const int e = edgeIndex(corner);
+				for (int p = 0; p < planes; ++p) {
+					const int a = PlaneAxes[p][0], b = PlaneAxes[p][1];
+					int belowA[3] = { x, y, z }, belowB[3] = { x, y, z };
+					--belowA[a];
+					--belowB[b];
+					shearStress[p][e] = edgeViscosity[p][e]
+						* (velocity(corner, a) - velocity(belowB, a) + velocity(corner, b) - velocity(belowA, b));
+				}
+			}
+		}, RowChunk);
+		parallelFor(0, size[1] * size[2], [&](int row) {
+			const int y = row % size[1], z = row / size[1];
+			for (int x = 0, i = row * size[0]; x < size[0]; ++x, ++i) {
+				const int coord[3] = { x, y, z };
+				const int e = edgeIndex(coord);
+				for (int a = 0; a < dims; ++a) {
+					const size_t f = static_cast<size_t>(a) * n + i;
+					if (fixedFace(i, coord, a)) {
+						out[f] = in[f];
+						continue;
+					}
+					float force = normalStress[a][i - stride[a]] - normalStress[a][i];
+					for (int b = 0; b < dims; ++b) {
+						if (b != a) {
+							const int p = planeOf(a, b);
+							force += shearStress[p][e] - shearStress[p][e + edgeStride[b]];
+						}
+					}
+					out[f] = faceDensity[a][i] * in[f] + scale * force;
+				}
+			}
+		}, RowChunk);
+	};
+
+	FluidPCG::Result result = viscositySolver.solve(A, FluidPCG::jacobi(viscosityDiagonal), viscosityRhs, viscositySolution);
+
+	for (int a = 0; a < dims; ++a) {
+		const float* solved = viscositySolution.data() + static_cast<size_t>(a) * n;
+		for (int i = 0; i < n; ++i)
+			cells[i].velocity[a] = solved[i];
+	}
+	enforceBoundaries();
+	return result.iterations;
+}
+
+int FluidSolver::project(float dt) {
+	assemblePressure();
+	return solvePressure(dt);
+}
+
+void FluidSolver::assemblePressure() {
+	const int n = grid.getCellCount();
+	const int dims = grid.getDimensions();
+	const int size[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int stride[3] = { 1, size[0], size[0] * size[1] };
+
+	// Unknown cells are solved for; outlet cells hold p = 0; solid and inlet cells are closed
+	const std::vector<uint8_t>& kinds = boundary.getCellKinds();
+	const bool hasKinds = kinds.size() == static_cast<size_t>(n);
+	pressureRoles.resize(n);
+	for (int i = 0; i < n; ++i) {
+		uint8_t role = Unknown;
+		if (grid.isSolid(i))
+			role = Closed;
+		else if (hasKinds && kinds[i] == FluidBoundary::Outlet)
+			role = Dirichlet;
+		else if (hasKinds && kinds[i] == FluidBoundary::Inlet)
+			role = Closed;
+		pressureRoles[i] = role;
+	}
+
+	pressureDiagonal.assign(n, 0.0f);
+	for (int d = 0; d < 3; ++d)
+		pressurePlus[d].assign(d < dims ? n : 0, 0.0f);
+
+	// Face coefficients are F/rho_f where F is the open fraction of the face. Wall, solid and inlet
+	// faces carry their prescribed flux only (Neumann); faces to an outlet add to the diagonal
+	// against the p = 0 ghost.
+	pressureUnknowns = 0;
+	for (int z = 0, i = 0; z < size[2]; ++z) {
+		for (int y = 0; y < size[1]; ++y) {
+			for (int x = 0; x < size[0]; ++x, ++i) {
+				if (pressureRoles[i] != Unknown)
+					continue;
+				const int coord[3] = { x, y, z };
+				for (int d = 0; d < dims; ++d) {
+					if (coord[d] > 0 && pressureRoles[i - stride[d]] != Closed)
+						pressureDiagonal[i] += grid.getFaceFraction(i, d) / faceDensity[d][i];
+					if (coord[d] + 1 < size[d]) {
+						const int j = i + stride[d];
+						if (pressureRoles[j] != Closed) {
+							float coefficient = grid.getFaceFraction(j, d) / faceDensity[d][j];
+							pressureDiagonal[i] += coefficient;
+							if (pressureRoles[j] == Unknown)
+								pressurePlus[d][i] = -coefficient;
+						}
+					}
+				}
+				++pressureUnknowns;
+			}
+		}
+	}
+	if (pressureUnknowns == 0)
+		return;
+
+	// Unknown cells joined by open faces form the regions of the system. One that no open face links to
+	// an outlet is only determined up to a constant (an enclosed pocket, or a closed box).
+	pressureComponent.assign(n, -1);
+	pressureAnchored.clear();
+	std::vector<int> pending;
+	for (int seedCell = 0; seedCell < n; ++seedCell) {
+		if (pressureRoles[seedCell] != Unknown || pressureComponent[seedCell] >= 0)
+			continue;
+		const int region = static_cast<int>(pressureAnchored.size());
+		uint8_t anchored = 0;
+		pressureComponent[seedCell] = region;
+		pending.push_back(seedCell);
+		while (!pending.empty()) {
+			const int i = pending.back();
+			pending.pop_back();
+			const int x = i % size[0], y = (i / size[0]) % size[1], z = i / stride[2];
+			const int coord[3] = { x, y, z };
+			for (int d = 0; d < dims; ++d) {
+				for (int side = 0; side < 2; ++side) {
+					if (side == 0 ? coord[d] == 0 : coord[d] + 1 == size[d])
+						continue;
+					const int j = side == 0 ? i - stride[d] : i + stride[d];
+					if (grid.getFaceFraction(side == 0 ? i : j, d) == 0.0f)
+						continue;
+					if (pressureRoles[j] == Dirichlet)
+						anchored = 1;
+					else if (pressureRoles[j] == Unknown && pressureComponent[j] < 0) {
+						pressureComponent[j] = region;
+						pending.push_back(j);
+					}
+				}
+			}
+		}
+		pressureAnchored.push_back(anchored);
+	}
+
+	const std::vector<float>* plus[3] = { &pressurePlus[0], &pressurePlus[1], dims == 3 ? &pressurePlus[2] : nullptr };
+	pressurePreconditioner.factor(size[0], size[1], size[2], pressureDiagonal, plus);
+}
+
+int FluidSolver::solvePressure(float dt) {
+	std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	const int dims = grid.getDimensions();
+	const int size[3] = { grid.getWidth(), grid.getHeight(), grid.getDepth() };
+	const int stride[3] = { 1, size[0], size[0] * size[1] };
+	const float dx = grid.getCellSize();
+
+	// A p = -(dx/dt) div(F u*) over the matrix from assemblePressure()
+	const float rhsScale = -dx / dt;
+	pressureRhs.assign(n, 0.0f);
+	pressureSolution.resize(n);
+	for (int z = 0, i = 0; z < size[2]; ++z) {
+		for (int y = 0; y < size[1]; ++y) {
+			for (int x = 0; x < size[0]; ++x, ++i) {
+				pressureSolution[i] = 0.0f;
+				if (pressureRoles[i] != Unknown) {
+					cells[i].pressure = 0.0f;
+					continue;
+				}
+				const int coord[3] = { x, y, z };
+				float divergence = 0.0f;
+				for (int d = 0; d < dims; ++d) {
+					float lower = grid.getFaceFraction(i, d) * cells[i].velocity[d];
+					float upper = 0.0f;
+					if (coord[d] + 1 < size[d]) {
+						const int j = i + stride[d];
+						upper = grid.getFaceFraction(j, d) * cells[j].velocity[d];
+					}
+					divergence += upper - lower;
+				}
+				pressureRhs[i] = rhsScale * divergence;
+				pressureSolution[i] = cells[i].pressure;
+			}
+		}
+	}
+	if (pressureUnknowns == 0)
+		return 0;
+
+	// Each region without an outlet leaves a constant in the null space; keep its right-hand side consistent
+	const int regions = static_cast<int>(pressureAnchored.size());
+	if (std::find(pressureAnchored.begin(), pressureAnchored.end(), 0) != pressureAnchored.end()) {
+		std::vector<double> regionSum(regions, 0.0);
+		std::vector<int> regionCells(regions, 0);
+		for (int i = 0; i < n; ++i) {
+			const int region = pressureComponent[i];
+			if (region >= 0 && !pressureAnchored[region]) {
+				regionSum[region] += pressureRhs[i];
+				++regionCells[region];
+			}
+		}
+		for (int region = 0; region < regions; ++region) {
+			if (regionCells[region] > 0)
+				regionSum[region] /= regionCells[region];
+		}
+		for (int i = 0; i < n; ++i) {
+			const int region = pressureComponent[i];
+			if (region >= 0 && !pressureAnchored[region])
+				pressureRhs[i] -= static_cast<float>(regionSum[region]);
+		}
+	}
+
+	FluidPCG::Operator A = [&](const std::vector<float>& in, std::vector<float>& out) {
+		out.resize(in.size());
+		parallelFor(0, size[1] * size[2], [&](int row) {
+			const int y = row % size[1], z = row / size[1];
+			for (int x = 0, i = row * size[0]; x < size[0]; ++x, ++i) {
+				if (pressureDiagonal[i] == 0.0f) {
+					out[i] = 0.0f;
+					continue;
+				}
+				const int coord[3] = { x, y, z };
+				float sum = pressureDiagonal[i] * in[i];
+				for (int d = 0; d < dims; ++d) {
+					if (coord[d] > 0)
+						sum += pressurePlus[d][i - stride[d]] * in[i - stride[d]];
+					if (coord[d] + 1 < size[d])
+						sum += pressurePlus[d][i] * in[i + stride[d]];
+				}
+				out[i] = sum;
+			}
+		}, RowChunk);
+	};
+
+	// The model's prediction replaces the previous pressure as the initial guess, or the solve itself
+	const bool predicted = pressureModel && predictPressure(dt);
+	FluidPCG::Result result = { 0, 0.0f, true };
+	if (!predicted || method != Method::Surrogate)
+		result = pressureSolver.solve(A, pressurePreconditioner.op(), pressureRhs, pressureSolution);
+
+	// u = u* - dt / (rho_f dx) grad p on every open face between an unknown cell and an
+	// unknown or outlet neighbour
+	const float gradScale = dt / dx;
+	for (int z = 0, i = 0; z < size[2]; ++z) {
+		for (int y = 0; y < size[1]; ++y) {
+			for (int x = 0; x < size[0]; ++x, ++i) {
+				const int coord[3] = { x, y, z };
+				const uint8_t self = pressureRoles[i];
+				if (self == Unknown)
+					cells[i].pressure = pressureSolution[i];
+				if (self == Closed)
+					continue;
+				for (int d = 0; d < dims; ++d) {
+					if (coord[d] == 0 || grid.getFaceFraction(i, d) == 0.0f)
+						continue;
+					const uint8_t neighbour = pressureRoles[i - stride[d]];
+					if (neighbour == Closed || (self == Dirichlet && neighbour == Dirichlet))
+						continue;
+					float gradient = pressureSolution[i] - pressureSolution[i - stride[d]];
+					cells[i].velocity[d] -= gradScale * gradient / faceDensity[d][i];
+				}
+			}
+		}
+	}
+	return result.iterations;
+}
+
+bool FluidSolver::predictPressure(float dt) {
+	const FluidNet& model = *pressureModel;
+	const std::vector<std::pair<FluidNet::Channel, float>>& inputs = model.getInputs();
+	const std::vector<std::pair<FluidNet::Channel, float>>& outputs = model.getOutputs();
+	int pressureOutput = -1;
+	for (size_t c = 0; c < outputs.size() && pressureOutput < 0; ++c) {
+		if (outputs[c].first == FluidNet::Channel::Pressure)
+			pressureOutput = static_cast<int>(c);
+	}
+	if (pressureOutput < 0 || model.getDimensions() != grid.getDimensions())
+		return false;
+
+	// The right-hand side comes from the system being solved (mean removed in closed domains); every
+	// other channel is read from the grid
+	const size_t n = static_cast<size_t>(grid.getCellCount());
+	modelInput.resize(n * inputs.size());
+	for (size_t c = 0; c < inputs.size(); ++c) {
+		float* plane = modelInput.data() + c * n;
+		if (inputs[c].first == FluidNet::Channel::PressureRhs)
+			std::copy(pressureRhs.begin(), pressureRhs.end(), plane);
+		else
+			FluidNet::readChannel(grid, inputs[c].first, dt, plane);
+		const float scale = inputs[c].second;
+		for (size_t i = 0; i < n; ++i)
+			plane[i] *= scale;
+	}
+	modelOutput.resize(n * outputs.size());
+	if (!model.evaluate(modelInput.data(), modelOutput.data(), 1, grid.getWidth(), grid.getHeight(), grid.getDepth()))
+		return false;
+
+	const float* predicted = modelOutput.data() + pressureOutput * n;
+	const float scale = outputs[pressureOutput].second;
+	for (size_t i = 0; i < n; ++i)
+		pressureSolution[i] = pressureRoles[i] == Unknown ? scale * predicted[i] : 0.0f;
+	return true;
+}
+
+float FluidSolver::sampleVelocity(int axis, const float pos[3]) const {
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	float sum = 0.0f;
+	forEachFaceWeight(grid, axis, pos, [&](int idx, float w) {
+		sum += w * cells[idx].velocity[axis];
+	});
+	return sum;
+}
+
+void FluidSolver::storeGridDelta(int axis) {
+	// savedVelocity becomes the grid delta so FLIP can sample it with the same weights
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int n = grid.getCellCount();
+	for (int i = 0; i < n; ++i)
+		savedVelocity[axis][i] = cells[i].velocity[axis] - savedVelocity[axis][i];
+}
+
+void FluidSolver::transferToParticles() {
+	const std::vector<FluidGrid::Cell>& cells = grid.getCells();
+	const int dims = grid.getDimensions();
+
+	for (FluidParticle& block : particles) {
+		std::vector<FluidParticle::Particle>& list = block.getParticles();
+		parallelFor(0, static_cast<int>(list.size()), [&](int k) {
+			FluidParticle::Particle& p = list[k];
+			const float pos[3] = { p.x, p.y, p.z };
+			float* vel[3] = { &p.vx, &p.vy, &p.vz };
+			for (int axis = 0; axis < dims; ++axis) {
+				float pic = 0.0f, delta = 0.0f;
+				forEachFaceWeight(grid, axis, pos, [&](int idx, float w) {
+					pic += w * cells[idx].velocity[axis];
+					delta += w * savedVelocity[axis][idx];
+				});
+				*vel[axis] = flipRatio * (*vel[axis] + delta) + (1.0f - flipRatio) * pic;
+			}
+		}, ParticleChunk);
+	}
+}
+
+void FluidSolver::advectParticles(float dt) {
+	const int dims = grid.getDimensions();
+	const float dx = grid.getCellSize();
+	const float extent[3] = { grid.getWidth() * dx, grid.getHeight() * dx, grid.getDepth() * dx };
+	const float margin = 1e-3f * dx;
+
+	for (FluidParticle& block : particles) {
+		std::vector<FluidParticle::Particle>& list = block.getParticles();
+		parallelFor(0, static_cast<int>(list.size()), [&](int k) {
+			FluidParticle::Particle& p = list[k];
+			// Midpoint (RK2) through the grid velocity field
+			float pos[3] = { p.x, p.y, p.z };
+			float mid[3] = { p.x, p.y, p.z };
+			for (int axis = 0; axis < dims; ++axis)
+				mid[axis] += 0.5f * dt * sampleVelocity(axis, pos);
+			for (int axis = 0; axis < dims; ++axis) {
+				pos[axis] += dt * sampleVelocity(axis, mid);
+				pos[axis] = std::min(std::max(pos[axis], margin), extent[axis] - margin);
+			}
+			if (grid.hasSolids()) {
+				// Particles that would end inside an obstacle stay where they were
+				int ci = static_cast<int>(pos[0] / dx);
+				int cj = static_cast<int>(pos[1] / dx);
+				int ck = dims == 3 ? static_cast<int>(pos[2] / dx) : 0;
+				if (grid.isSolid(grid.index(ci, cj, ck)))
+					return;
+			}
+			p.x = pos[0];
+			p.y = pos[1];
+			p.z = dims == 3 ? pos[2] : p.z;
+		}, ParticleChunk);
+	}
+}
+
+// Scalar solver state, the STAT section of a checkpoint
+struct CheckpointState {
+	int32_t size[3];
+	float cellSize;
+	int32_t method;
+	uint32_t seed;
+	uint64_t stepCount;
+	double simulatedTime;
+	float gravity[3];
+	float flipRatio;
+	float particlesPerCell;
+	float ambientDensity, ambientViscosity;
+	bool boundaryPrepared;
+	bool latticeOddStep;
+	float latticePendingTime;
+};
+
+// Material table entry, the MATL section
+struct CheckpointMaterial {
+	int32_t id;
+	float density, viscosity;
+};
+
+// Builds a section one field at a time, each at a fixed width, so the bytes depend on neither struct
+// padding nor the size of bool and enum types
+class SectionWriter {
+public:
+	template <typename T>
+	void put(T value) {
+		static_assert(std::is_arithmetic<T>::value, "fields are fixed-width scalars");
+		const size_t at = bytes.size();
+		bytes.resize(at + sizeof(T));
+		std::memcpy(bytes.data() + at, &value, sizeof(T));
+	}
+	const std::vector<uint8_t>& data() const { return bytes; }
+
+private:
+	std::vector<uint8_t> bytes;
+};
+
+// Reads the fields back; reading past the end clears ok()
+class SectionReader {
+public:
+	SectionReader(const void* data, size_t bytes) : at(static_cast<const uint8_t*>(data)), left(data ? bytes : 0), valid(data != nullptr) {}
+	template <typename T>
+	T get() {
+		T value = T();
+		if (left < sizeof(T)) {
+			valid = false;
+			return value;
+		}
+		std::memcpy(&value, at, sizeof(T));
+		at += sizeof(T);
+		left -= sizeof(T);
+		return value;
+	}
+	bool ok() const { return valid; }
+	bool atEnd() const { return left == 0; }
+
+private:
+	const uint8_t* at;
+	size_t left;
+	bool valid;
+};
+
+// STAT: the fields in declaration order, flags as int32 (80 bytes)
+static void writeState(SectionWriter& out, const CheckpointState& state) {
+	for (int d = 0; d < 3; ++d)
+		out.put<int32_t>(state.size[d]);
+	out.put<float>(state.cellSize);
+	out.put<int32_t>(state.method);
+	out.put<uint32_t>(state.seed);
+	out.put<uint64_t>(state.stepCount);
+	out.put<double>(state.simulatedTime);
+	for (int d = 0; d < 3; ++d)
+		out.put<float>(state.gravity[d]);
+	out.put<float>(state.flipRatio);
+	out.put<float>(state.particlesPerCell);
+	out.put<float>(state.ambientDensity);
+	out.put<float>(state.ambientViscosity);
+	out.put<int32_t>(state.boundaryPrepared ? 1 : 0);
+	out.put<int32_t>(state.latticeOddStep ? 1 : 0);
+	out.put<float>(state.latticePendingTime);
+}
+
+static bool readState(SectionReader& in, CheckpointState& state) {
+	for (int d = 0; d < 3; ++d)
+		state.size[d] = in.get<int32_t>();
+	state.cellSize = in.get<float>();
+	state.method = in.get<int32_t>();
+	state.seed = in.get<uint32_t>();
+	state.stepCount = in.get<uint64_t>();
+	state.simulatedTime = in.get<double>();
+	for (int d = 0; d < 3; ++d)
+		state.gravity[d] = in.get<float>();
+	state.flipRatio = in.get<float>();
+	state.particlesPerCell = in.get<float>();
+	state.ambientDensity = in.get<float>();
+	state.ambientViscosity = in.get<float>();
+	state.boundaryPrepared = in.get<int32_t>() != 0;
+	state.latticeOddStep = in.get<int32_t>() != 0;
+	state.latticePendingTime = in.get<float>();
+	return in.ok() && in.atEnd();
+}
+
+// INFL: one 52-byte record per inflow; the region flag is a byte followed by three reserved zero bytes
+static void writeInflows(SectionWriter& out, const std::vector<FluidBoundary::Inflow>& inflows) {
+	for (const FluidBoundary::Inflow& inflow : inflows) {
+		out.put<int32_t>(static_cast<int32_t>(inflow.side));
+		out.put<int32_t>(static_cast<int32_t>(inflow.profile));
+		for (int d = 0; d < 3; ++d)
+			out.put<float>(inflow.velocity[d]);
+		out.put<float>(inflow.emissionRate);
+		out.put<int32_t>(inflow.material_id);
+		out.put<int32_t>(inflow.phase_id);
+		out.put<uint8_t>(inflow.hasRegion ? 1 : 0);
+		for (int pad = 0; pad < 3; ++pad)
+			out.put<uint8_t>(0);
+		for (int k = 0; k < 4; ++k)
+			out.put<float>(inflow.region[k]);
+	}
+}
+
+static bool readInflows(SectionReader& in, std::vector<FluidBoundary::Inflow>& inflows) {
+	while (in.ok() && !in.atEnd()) {
+		FluidBoundary::Inflow inflow;
+		const int32_t side = in.get<int32_t>();
+		const int32_t profile = in.get<int32_t>();
+		if (side < 0 || side > static_cast<int32_t>(FluidBoundary::Side::ZPlus)
+			|| profile < 0 || profile > static_cast<int32_t>(FluidBoundary::Profile::Parabolic))
+			return false;
+		inflow.side = static_cast<FluidBoundary::Side>(side);
+		inflow.profile = static_cast<FluidBoundary::Profile>(profile);
+		for (int d = 0; d < 3; ++d)
+			inflow.velocity[d] = in.get<float>();
+		inflow.emissionRate = in.get<float>();
+		inflow.material_id = in.get<int32_t>();
+		inflow.phase_id = in.get<int32_t>();
+		inflow.hasRegion = in.get<uint8_t>() != 0;
+		for (int pad = 0; pad < 3; ++pad)
+			in.get<uint8_t>(); // Older files hold struct padding here
+		for (int k = 0; k < 4; ++k)
+			inflow.region[k] = in.get<float>();
+		if (in.ok())
+			inflows.push_back(inflow);
+	}
+	return in.ok();
+}
+
+// OUTF: side and type as int32 per outflow
+static void writeOutflows(SectionWriter& out, const std::vector<FluidBoundary::Outflow>& outflows) {
+	for (const FluidBoundary::Outflow& outflow : outflows) {
+		out.put<int32_t>(static_cast<int32_t>(outflow.side));
+		out.put<int32_t>(static_cast<int32_t>(outflow.type));
+	}
+}
+
+static bool readOutflows(SectionReader& in, std::vector<FluidBoundary::Outflow>& outflows) {
+	while (in.ok() && !in.atEnd()) {
+		const int32_t side = in.get<int32_t>();
+		const int32_t type = in.get<int32_t>();
+		if (!in.ok() || side < 0 || side > static_cast<int32_t>(FluidBoundary::Side::ZPlus)
+			|| type < 0 || type > static_cast<int32_t>(FluidBoundary::OutflowType::Sink))
+			return false;
+		outflows.push_back({ static_cast<FluidBoundary::Side>(side), static_cast<FluidBoundary::OutflowType>(type) });
+	}
+	return in.ok();
+}
+
+static const uint32_t StateSection = FluidCheckpoint::tag('S', 'T', 'A', 'T');
+static const uint32_t CellSection = FluidCheckpoint::tag('C', 'E', 'L', 'L');
+static const uint32_t SolidSection = FluidCheckpoint::tag('S', 'O', 'L', 'D');
+static const uint32_t FaceSection = FluidCheckpoint::tag('F', 'A', 'C', 'E');
+static const uint32_t BlockSection = FluidCheckpoint::tag('B', 'L', 'K', 'S'); // Width, height, depth, count per block
+static const uint32_t ParticleSection = FluidCheckpoint::tag('P', 'A', 'R', 'T');
+static const uint32_t MaterialSection = FluidCheckpoint::tag('M', 'A', 'T', 'L');
+static const uint32_t PhaseSection = FluidCheckpoint::tag('P', 'H', 'A', 'S'); // Phase id, material id pairs
+static const uint32_t InflowSection = FluidCheckpoint::tag('I', 'N', 'F', 'L');
+static const uint32_t OutflowSection = FluidCheckpoint::tag('O', 'U', 'T', 'F');
+static const uint32_t EmissionSection = FluidCheckpoint::tag('E', 'M', 'I', 'T');
+static const uint32_t LatticeSection = FluidCheckpoint::tag('L', 'B', 'M', 'P');
+static const uint32_t LatticeSpeedSection = FluidCheckpoint::tag('L', 'B', 'M', 'S'); // Speed the lattice timestep came from
+static const uint32_t LatticeMacroSection = FluidCheckpoint::tag('L', 'B', 'M', 'M'); // Density and velocity of the last collision
+
+void FluidSolver::writeCheckpoint(const std::string& path) {
+	finishCheckpoint();
+
+	// Everything is copied into the snapshot here; the solver may step on as soon as this returns
+	std::shared_ptr<FluidCheckpoint> snapshot = std::make_shared<FluidCheckpoint>();
+	// A member of an ensemble saves its own lane, which restores as a single-lane lattice
+	const FluidLBM& source = ensembleLattice ? *ensembleLattice : lattice;
+	const bool latticeState = method == Method::LatticeBoltzmann && source.isPreparedFor(grid);
+	CheckpointState state = {};
+	state.size[0] = grid.getWidth();
+	state.size[1] = grid.getHeight();
+	state.size[2] = grid.getDepth();
+	state.cellSize = grid.getCellSize();
+	state.method = static_cast<int32_t>(method);
+	state.seed = seed;
+	state.stepCount = stepCount;
+	state.simulatedTime = simulatedTime;
+	std::copy(gravity, gravity + 3, state.gravity);
+	state.flipRatio = flipRatio;
+	state.particlesPerCell = particlesPerCell;
+	state.ambientDensity = ambient.density;
+	state.ambientViscosity = ambient.viscosity;
+	state.boundaryPrepared = boundary.isPreparedFor(grid);
+	state.latticeOddStep = latticeState && source.isOddStep();
+	state.latticePendingTime = latticeState ? source.getPendingTime() : 0.0f;
+	SectionWriter stateFields;
+	writeState(stateFields, state);
+	snapshot->addSection(StateSection, stateFields.data());
+
+	snapshot->addSection(CellSection, grid.getCells());
+	snapshot->addSection(SolidSection, grid.getSolidMask());
+	snapshot->addSection(FaceSection, grid.getFaceFractions());
+
+	std::vector<int32_t> blocks;
+	size_t particleCount = 0;
+	for (const FluidParticle& block : particles) {
+		blocks.insert(blocks.end(), { block.getWidth(), block.getHeight(), block.getDepth(), static_cast<int32_t>(block.size()) });
+		particleCount += block.size();
+	}
+	snapshot->addSection(BlockSection, blocks);
+	uint8_t* all = snapshot->beginSection(ParticleSection, particleCount * sizeof(FluidParticle::Particle));
+	for (const FluidParticle& block : particles) {
+		if (block.size() > 0)
+			std::memcpy(all, block.getParticles().data(), block.size() * sizeof(FluidParticle::Particle));
+		all += block.size() * sizeof(FluidParticle::Particle);
+	}
+
+	std::vector<CheckpointMaterial> table;
+	for (const auto& entry : materials)
+		table.push_back({ entry.first, entry.second.density, entry.second.viscosity });
+	std::sort(table.begin(), table.end(), [](const CheckpointMaterial& a, const CheckpointMaterial& b) { return a.id < b.id; });
+	SectionWriter materialFields;
+	for (const CheckpointMaterial& entry : table) {
+		materialFields.put<int32_t>(entry.id);
+		materialFields.put<float>(entry.density);
+		materialFields.put<float>(entry.viscosity);
+	}
+	snapshot->addSection(MaterialSection, materialFields.data());
+	std::vector<int32_t> phases;
+	for (const auto& entry : phaseMaterials)
+		phases.insert(phases.end(), { entry.first, entry.second });
+	snapshot->addSection(PhaseSection, phases);
+
+	SectionWriter inflowFields, outflowFields;
+	writeInflows(inflowFields, boundary.getInflows());
+	writeOutflows(outflowFields, boundary.getOutflows());
+	snapshot->addSection(InflowSection, inflowFields.data());
+	snapshot->addSection(OutflowSection, outflowFields.data());
+	if (state.boundaryPrepared) {
+		const std::string emission = boundary.saveEmissionState();
+		snapshot->addSection(EmissionSection, emission.data(), emission.size());
+	}
+	if (latticeState) {
+		snapshot->addSection(LatticeSection, source.getLanes() == 1 ? source.getPopulations() : source.getLanePopulations(ensembleLane));
+		const float speed = source.getSpeedUsed();
+		snapshot->addSection(LatticeSpeedSection, &speed, sizeof(speed));
+		snapshot->addSection(LatticeMacroSection, source.getLaneMacroscopic(source.getLanes() == 1 ? 0 : ensembleLane));
+	}
+
+	pendingCheckpoint.path = path;
+	pendingCheckpoint.step = stepCount;
+	pendingCheckpoint.simulatedTime = simulatedTime;
+	pendingWrite = std::async(std::launch::async, [snapshot, path]() {
+		std::string error;
+		snapshot->save(path, &error);
+		return error;
+	});
+	pendingSnapshot = snapshot;
+}
+
+bool FluidSolver::finishCheckpoint(std::string* error) {
+	if (!pendingWrite.valid())
+		return true;
+	const std::string result = pendingWrite.get();
+	if (result.empty()) {
+		lastCheckpoint = pendingCheckpoint;
+		lastCheckpoint.fileSize = pendingSnapshot->getFileSize();
+		lastCheckpoint.checksum = pendingSnapshot->getChecksum();
+	}
+	else if (error) {
+		*error = result;
+	}
+	pendingSnapshot.reset();
+	return result.empty();
+}
+
+bool FluidSolver::restoreCheckpoint(const std::string& path, std::string* error) {
+	finishCheckpoint();
+	FluidCheckpoint file;
+	if (!file.load(path, error))
+		return false;
+	auto fail = [&](const char* reason) {
+		if (error)
+			*error = path + ": " + reason;
+		return false;
+	};
+
+	size_t bytes = 0;
+	const void* stateData = file.getSection(StateSection, bytes);
+	if (!stateData)
+		return fail("missing solver state");
+	CheckpointState state;
+	SectionReader stateFields(stateData, bytes);
+	if (!readState(stateFields, state) || state.size[0] <= 0 || state.size[1] <= 0 || state.size[2] <= 0 || !(state.cellSize > 0.0f)
+		|| state.method < 0 || state.method > static_cast<int32_t>(Method::Surrogate))
+		return fail("invalid solver state");
+
+	// Every section is decoded into temporaries and checked first; the solver is only touched once all
+	// of them are valid, so a damaged or mismatched file leaves the current state as it was
+	std::vector<int32_t> blocks;
+	const size_t cellCount = static_cast<size_t>(state.size[0]) * state.size[1] * state.size[2];
+	const FluidParticle::Particle* stored = static_cast<const FluidParticle::Particle*>(file.getSection(ParticleSection, bytes));
+	const size_t storedCount = bytes / sizeof(FluidParticle::Particle);
+	size_t blockTotal = 0;
+	if (!file.readSection(BlockSection, blocks) || blocks.size() % 4 != 0)
+		return fail("missing particle blocks");
+	for (size_t b = 0; b < blocks.size(); b += 4) {
+		if (blocks[b] < 0 || blocks[b + 1] < 0 || blocks[b + 2] < 0 || blocks[b + 3] < 0)
+			return fail("invalid particle blocks");
+		blockTotal += static_cast<size_t>(blocks[b + 3]);
+	}
+	if (blockTotal != storedCount || bytes % sizeof(FluidParticle::Particle) != 0)
+		return fail("particle count does not match its blocks");
+
+	FluidGrid restoredGrid;
+	restoredGrid.resize(state.size[0], state.size[1], state.size[2], state.cellSize);
+	if (!file.readSection(CellSection, restoredGrid.getCells()) || restoredGrid.getCells().size() != cellCount)
+		return fail("grid cells do not match the grid size");
+	if (file.hasSection(SolidSection) && (!file.readSection(SolidSection, restoredGrid.getSolidMask())
+			|| (!restoredGrid.getSolidMask().empty() && restoredGrid.getSolidMask().size() != (cellCount + 63) / 64)))
+		return fail("solid mask does not match the grid size");
+	if (file.hasSection(FaceSection) && (!file.readSection(FaceSection, restoredGrid.getFaceFractions())
+			|| (!restoredGrid.getFaceFractions().empty() && restoredGrid.getFaceFractions().size() != 3 * cellCount)))
+		return fail("face fractions do not match the grid size");
+
+	std::vector<FluidParticle> restoredParticles;
+	size_t offset = 0;
+	for (size_t b = 0; b < blocks.size(); b += 4) {
+		restoredParticles.emplace_back(blocks[b], blocks[b + 1], blocks[b + 2]);
+		restoredParticles.back().getParticles().assign(stored + offset, stored + offset + blocks[b + 3]);
+		offset += static_cast<size_t>(blocks[b + 3]);
+	}
+
+	std::unordered_map<int, Material> restoredMaterials;
+	const void* materialData = file.getSection(MaterialSection, bytes);
+	SectionReader materialFields(materialData, bytes);
+	while (materialFields.ok() && !materialFields.atEnd()) {
+		CheckpointMaterial entry;
+		entry.id = materialFields.get<int32_t>();
+		entry.density = materialFields.get<float>();
+		entry.viscosity = materialFields.get<float>();
+		if (!materialFields.ok())
+			return fail("invalid material table");
+		restoredMaterials[entry.id] = { entry.density, entry.viscosity };
+	}
+	// Checkpoints written before phases were registered have no phase table
+	std::vector<int32_t> phases;
+	if (file.hasSection(PhaseSection) && (!file.readSection(PhaseSection, phases) || phases.size() % 2 != 0))
+		return fail("invalid phase table");
+	std::vector<std::pair<int, int>> restoredPhases;
+	for (size_t i = 0; i < phases.size(); i += 2)
+		restoredPhases.emplace_back(phases[i], phases[i + 1]);
+	std::sort(restoredPhases.begin(), restoredPhases.end());
+	const float restoredGravity[3] = { state.gravity[0], state.gravity[1], state.gravity[2] };
+	const Material restoredAmbient = { state.ambientDensity, state.ambientViscosity };
+
+	// Boundaries are re-baked for the grid, then their emission picks up where it stopped
+	std::vector<FluidBoundary::Inflow> inflows;
+	std::vector<FluidBoundary::Outflow> outflows;
+	const void* inflowData = file.getSection(InflowSection, bytes);
+	SectionReader inflowFields(inflowData, bytes);
+	const void* outflowData = file.getSection(OutflowSection, bytes);
+	SectionReader outflowFields(outflowData, bytes);
+	if ((inflowData && !readInflows(inflowFields, inflows)) || (outflowData && !readOutflows(outflowFields, outflows)))
+		return fail("invalid boundary tables");
+	FluidBoundary restoredBoundary;
+	for (const FluidBoundary::Inflow& inflow : inflows)
+		restoredBoundary.addInflow(inflow);
+	for (const FluidBoundary::Outflow& outflow : outflows)
+		restoredBoundary.addOutflow(outflow);
+	if (state.boundaryPrepared) {
+		restoredBoundary.prepare(restoredGrid, state.seed);
+		const char* emission = static_cast<const char*>(file.getSection(EmissionSection, bytes));
+		if (!emission || !restoredBoundary.restoreEmissionState(std::string(emission, bytes)))
+			return fail("invalid boundary emission state");
+	}
+
+	const bool latticeState = file.hasSection(LatticeSection);
+	FluidLBM restoredLattice;
+	if (latticeState) {
+		std::vector<float> speed;
+		if (file.readSection(LatticeSpeedSection, speed) && speed.size() == 1)
+			restoredLattice.setReferenceSpeed(speed[0]);
+		restoredLattice.setGravity(restoredGravity[0], restoredGravity[1], restoredGravity[2]);
+		restoredLattice.prepare(restoredGrid, restoredBoundary, restoredAmbient.density, restoredAmbient.viscosity / restoredAmbient.density);
+		std::vector<float> populations;
+		if (!file.readSection(LatticeSection, populations)
+			|| !restoredLattice.restoreState(std::move(populations), state.latticeOddStep, state.latticePendingTime))
+			return fail("lattice does not match the grid");
+		// Older checkpoints lack the macroscopic fields; their outlets restart from rest as before
+		std::vector<float> macroscopic;
+		if (file.readSection(LatticeMacroSection, macroscopic) && !restoredLattice.restoreMacroscopic(macroscopic))
+			return fail("lattice does not match the grid");
+	}
+
+	// Everything checked out: swap the decoded state in
+	grid.resize(state.size[0], state.size[1], state.size[2], state.cellSize);
+	grid.getCells().swap(restoredGrid.getCells());
+	grid.getSolidMask().swap(restoredGrid.getSolidMask());
+	grid.getFaceFractions().swap(restoredGrid.getFaceFractions());
+	particles.swap(restoredParticles);
+	materials.swap(restoredMaterials);
+	phaseMaterials.swap(restoredPhases);
+	boundary = std::move(restoredBoundary);
+	if (latticeState)
+		lattice = std::move(restoredLattice);
+	ensembleLattice = nullptr;
+	method = static_cast<Method>(state.method);
+	seed = state.seed;
+	stepCount = state.stepCount;
+	simulatedTime = state.simulatedTime;
+	std::copy(restoredGravity, restoredGravity + 3, gravity);
+	flipRatio = state.flipRatio;
+	particlesPerCell = state.particlesPerCell;
+	ambient = restoredAmbient;
+
+	// Derived state (task graph, SPH boundary samples, solver scratch) is rebuilt on the next step
+	stepGraph.clear();
+	return true;
+}
@@ -1,14 +1,291 @@
 #pragma once
 #include "FluidGrid.h"
 #include "FluidParticle.h"
+#include "FluidPCG.h"
+#include "FluidBoundary.h"
+#include "FluidLBM.h"
+#include "FluidNet.h"
+#include "FluidSPH.h"
+#include "FluidTaskGraph.h"
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class FluidCheckpoint;
 
 class FluidSolver {
 public:
+	// Physical properties of a liquid, as stored in TypesOfLiquids
+	struct Material {
+		float density;   // kg/m^3
+		float viscosity; // Dynamic viscosity, Pa*s
+	};
+
+	// Solver selected by SimulationConfigs.MethodOfComputation
+	enum class Method {
+		FlipPic,               // "FLIP" (default): particle/grid with pressure projection
+		LatticeBoltzmann,      // "LBM": single-phase lattice Boltzmann filled with the ambient material; particles are tracers
+		SphWeaklyCompressible, // "WCSPH": particle-only SPH with a stiff equation of state, no grid solves
+		SphDivergenceFree,     // "DFSPH" or "SPH": particle-only incompressible SPH, no grid solves
+		Surrogate              // "Surrogate" or "NN": FLIP with the pressure predicted by the pressure model instead of solved
+	};
+
 	FluidSolver(FluidGrid& grid, std::vector<FluidParticle>& particles);
 	void step(float dt);
 
+	/**
+	 * @brief Steps several lattice Boltzmann solvers as one ensemble: their lattices are advanced together,
+	 * one SIMD lane per member (see FluidLBM::prepareEnsemble), then each member moves its own tracers.
+	 *
+	 * Members need the same grid extents, cell size, solids and gravity, and boundaries on the same
+	 * cells; seeds, inflow speeds and ambient material may differ. The lattice lives in the first
+	 * member; keep the same members in the same order from step to step. Checkpoints of a member hold
+	 * its own lane and restore as a single run.
+	 * @param members Solvers to advance, at most FluidLBM::MaxLanes.
+	 * @param dt Timestep.
+	 * @return False if a member is not LatticeBoltzmann or the members do not match. Boundaries that differ
+	 * in which cells they drive are only found after the boundary stage, which has then run for this step.
+	 */
+	static bool stepEnsemble(const std::vector<FluidSolver*>& members, float dt);
+
+	/**
+	 * @brief Parses a MethodOfComputation value (case-insensitive; empty or "Standard" selects FLIP).
+	 * @param text Column value.
+	 * @param method Receives the method on success.
+	 * @return False if the name is unknown.
+	 */
+	static bool parseMethod(const std::string& text, Method& method);
+	void setMethod(Method value) { method = value; }
+	Method getMethod() const { return method; }
+
+	// Registers the properties looked up for a material_id. Empty cells and unknown ids use the ambient material.
+	void setMaterial(int material_id, const Material& material);
+	// Makes particles of phase_id carry material_id's density into the projection's face densities (see
+	// project()). Particles of an unregistered phase use their own material's; viscosity follows the cell's material.
+	void setPhaseMaterial(int phase_id, int material_id);
+	void setAmbientMaterial(const Material& material) { ambient = material; }
+	void setGravity(float gx, float gy, float gz = 0.0f);
+	void setFlipRatio(float ratio) { flipRatio = ratio; }
+	// Expected particle count per cell at rest, used to turn splatted weights into phase fractions
+	void setParticlesPerCell(float count) { particlesPerCell = count; }
+	// Seeds every random choice the solver makes (e.g. inflow emission). Reductions are tiled in a fixed
+	// order, so runs with the same seed are bitwise identical on any number of threads.
+	void setSeed(unsigned value) { seed = value; }
+	unsigned getSeed() const { return seed; }
+
+	// Inflow/outflow boundaries; load them from the config's JSON columns before stepping
+	FluidBoundary& getBoundary() { return boundary; }
+
+	/**
+	 * @brief Implicit viscosity step on the grid face velocities.
+	 *
+	 * Solves (rho - dt * div(mu (grad u + grad u^T))) u = rho * u* for all components together, with
+	 * per-cell mu looked up from each cell's material. Normal stresses sit at cell centres and shear
+	 * stresses on cell edges, with mu averaged over the cells around the edge, so shear couples the
+	 * components where mu varies. Stable for any viscosity at the caller's dt.
+	 * @param dt Timestep.
+	 * @return PCG iterations (0 if every cell is inviscid).
+	 */
+	int applyViscosity(float dt);
+
+	/**
+	 * @brief Variable-density pressure projection.
+	 *
+	 * Each face uses the ghost-fluid density rho_f = sum_k theta_k * rho_k + (1 - sum_k theta_k) * rho_ambient,
+	 * where theta_k is the fraction of the face held by phase k (its splatted particle weight over the rest
+	 * count, scaled down if the face is overfull) and rho_k the density of that phase's material, so the
+	 * pressure gradient stays sharp across density jumps (water/air at 1000:1). Particles of unregistered
+	 * phases form one more phase with their weighted material density. Solved with MIC(0)-preconditioned CG.
+	 * A region of fluid cells that no outlet reaches only fixes pressure up to a constant, so the mean of
+	 * its right-hand side is removed to keep its system solvable; every region is treated on its own.
+	 * @param dt Timestep.
+	 * @return PCG iterations taken.
+	 */
+	int project(float dt);
+
+	/**
+	 * @brief Sets the learned pressure model (see FluidNet), or clears it with null.
+	 *
+	 * Its outputs must include Channel::Pressure. Under FLIP the prediction is the initial guess of the
+	 * pressure solve, so CG starts close to the answer; under Surrogate it replaces the solve and the
+	 * projection takes no CG iterations. A model that does not fit the grid (or none) falls back to the
+	 * solve from the previous pressure. The model keeps scratch buffers, so solvers stepping on
+	 * different threads need their own.
+	 */
+	void setPressureModel(std::shared_ptr<const FluidNet> model) { pressureModel = model; }
+	const FluidNet* getPressureModel() const { return pressureModel.get(); }
+
+	int getLastViscosityIterations() const { return lastViscosityIterations; }
+	int getLastPressureIterations() const { return lastPressureIterations; }
+
+	// Whole-domain quantities of the current state, for per-step metrics
+	struct Measurements {
+		double kineticEnergy; // Sum of 0.5 rho |u|^2 over cells (per unit depth in 2D), u at cell centres
+		float maxSpeed;       // Largest cell-centre speed
+		float force[3];       // Pressure force the fluid exerts on solid cells; x is drag, y is lift for flow along x
+	};
+
+	/**
+	 * @brief Measures the grid state (for SPH, the grid mirror of the particles). Viscous shear on solids is
+	 * not included in the force.
+	 */
+	Measurements measure() const;
+
+	/**
+	 * @brief Records when and on which thread each task of a FLIP step runs.
+	 *
+	 * A FLIP step is a graph of tasks with declared read/write sets over grid channels and particle
+	 * attributes, so independent stages (the velocity components, the pressure matrix next to forces
+	 * and viscosity) run concurrently. After step(), the graph's writeTimeline() and
+	 * getLastParallelism() show how much overlap was achieved.
+	 */
+	void setTimelineEnabled(bool enabled) { stepGraph.setTimelineEnabled(enabled); }
+	const FluidTaskGraph& getStepGraph() const { return stepGraph; }
+
+	// Steps taken and time simulated since construction (or as restored from a checkpoint)
+	uint64_t getStepCount() const { return stepCount; }
+	double getSimulatedTime() const { return simulatedTime; }
+
+	// A checkpoint file written by writeCheckpoint(), for recording it against its simulation
+	struct CheckpointInfo {
+		std::string path;
+		uint64_t step;
+		double simulatedTime;
+		uint64_t fileSize;
+		uint32_t checksum; // Of the file's section tables
+	};
+
+	/**
+	 * @brief Checkpoints the full solver state: grid, solids, particles, materials, boundaries (with
+	 * their emission progress), lattice distributions and step counters.
+	 *
+	 * The state is copied into a snapshot before this returns; checksumming and writing the file happen
+	 * on a background thread while stepping continues. At most one write is in flight: a new checkpoint
+	 * first waits for the previous one. See FluidCheckpoint for the file layout.
+	 * @param path Destination file.
+	 */
+	void writeCheckpoint(const std::string& path);
+
+	/**
+	 * @brief Waits for the background checkpoint write, if any.
+	 * @param error Optional: receives the reason on failure.
+	 * @return True if nothing was pending or the write succeeded (then getLastCheckpoint() describes it).
+	 */
+	bool finishCheckpoint(std::string* error = nullptr);
+	const CheckpointInfo& getLastCheckpoint() const { return lastCheckpoint; }
+
+	/**
+	 * @brief Resumes from a checkpoint: maps the file, verifies its checksums and replaces the grid,
+	 * the particles and the solver state with the saved ones. Stepping on continues the saved run
+	 * exactly.
+	 * @param path Checkpoint file.
+	 * @param error Optional: receives the reason on failure.
+	 * @return True on success; on failure the solver and its grid and particles are left unchanged.
+	 */
+	bool restoreCheckpoint(const std::string& path, std::string* error = nullptr);
+
 	// Add more methods for boundary conditions, etc.
 private:
 	FluidGrid& grid;
 	std::vector<FluidParticle>& particles;
-};
\ No newline at end of file
+	Method method;
+	FluidLBM lattice;
+	FluidLBM* ensembleLattice; // Lattice this solver is a lane of while stepped in an ensemble, else null
+	int ensembleLane;
+	FluidSPH sph;
+	std::vector<FluidSPH::Properties> sphProperties;
+
+	std::unordered_map<int, Material> materials;
+	std::vector<std::pair<int, int>> phaseMaterials; // (phase_id, material_id), sorted by phase_id
+	Material ambient;
+	float gravity[3];
+	float flipRatio; // 0 = PIC, 1 = FLIP
+	unsigned seed;
+	FluidBoundary boundary;
+	float particlesPerCell;
+	int lastViscosityIterations;
+	int lastPressureIterations;
+	uint64_t stepCount;
+	double simulatedTime;
+
+	// Checkpoint being written in the background
+	std::shared_ptr<FluidCheckpoint> pendingSnapshot;
+	std::future<std::string> pendingWrite; // Error message, empty on success
+	CheckpointInfo pendingCheckpoint, lastCheckpoint;
+
+	std::vector<float> savedVelocity[3]; // Face velocities right after transferToGrid, for FLIP deltas
+	std::vector<float> faceDensity[3];   // Ghost-fluid density per face, from particle phase fractions
+	std::vector<float> splatWeight[3], splatDensity[3]; // All particles; density from unregistered phases only
+	std::vector<float> splatPhaseWeight[3];             // Registered phases, phaseMaterials.size() blocks of one per face
+	std::vector<const FluidParticle::Particle*> splatOrder[3]; // Particles grouped by the layer their stencil starts in
+	std::vector<int> splatSlabStart[3];                        // Start of each layer's group in splatOrder, plus the end
+	std::vector<float> phaseDensity;                    // Per registered phase, in phaseMaterials order
+	std::vector<int> phaseSlots;                        // phase_id - phaseBase -> index into phaseMaterials, -1 if unregistered
+	int phaseBase;
+	std::vector<float> nearestDistance;
+
+	// Viscosity system: every face velocity component in one vector, component-major
+	FluidPCG viscositySolver;
+	std::vector<float> cellViscosity;
+	std::vector<float> edgeViscosity[3];                // Per cell edge, for the axis pairs (x, y), (x, z), (y, z)
+	std::vector<float> normalStress[3], shearStress[3]; // Operator scratch
+	std::vector<float> viscosityDiagonal, viscosityRhs, viscositySolution;
+	bool viscous;
+
+	// Pressure system: diagonal plus couplings to the +x/+y/+z neighbour
+	enum PressureRole : uint8_t { Unknown, Dirichlet, Closed }; // Solved for, p = 0 (outlet), no flow (solid, inlet)
+	FluidPCG pressureSolver;
+	FluidPCG::MIC0 pressurePreconditioner;
+	std::vector<uint8_t> pressureRoles;
+	std::vector<float> pressureDiagonal, pressurePlus[3];
+	std::vector<float> pressureRhs, pressureSolution;
+	int pressureUnknowns;
+	std::vector<int> pressureComponent;      // Connected region of each unknown cell, -1 elsewhere
+	std::vector<uint8_t> pressureAnchored;   // Per region: it touches an outlet, which fixes its constant
+	std::shared_ptr<const FluidNet> pressureModel;
+	std::vector<float> modelInput, modelOutput;
+
+	// What the tasks of a FLIP step read and write. Per-axis channels take three bits: Channel << axis.
+	enum StepResource : FluidTaskGraph::Resources {
+		ParticleList = 1 << 0, // Which particles exist
+		ParticlePositions = 1 << 1,
+		ParticleVelocities = 1 << 2,
+		GridVelocity = 1 << 3,
+		FaceDensities = 1 << 6,
+		SavedVelocity = 1 << 9,
+		CellMaterials = 1 << 12,
+		CellViscosity = 1 << 13,
+		CellPressure = 1 << 14,
+		PressureMatrix = 1 << 15,
+		Boundaries = 1 << 16, // Prepared inflow/outflow state
+		PhaseTable = 1 << 17
+	};
+	FluidTaskGraph stepGraph;
+	float stepDt;
+
+	const Material& materialFor(int material_id) const;
+	void stepLattice(float dt);
+	void moveTracers(float dt);
+	void stepParticles(float dt);
+	void applyBoundaryStage(float dt, float emissionSpacing = 0.0f); // Emits on a lattice when the spacing is positive
+	void buildStepGraph();
+	void transferToGrid();
+	void preparePhaseTable();
+	int phaseSlot(int phase_id) const;
+	void splatVelocity(int axis);
+	void assignMaterials();
+	void saveVelocity(int axis);
+	void applyForce(int axis, float dt);
+	void enforceBoundaries(int axis = -1); // One velocity component, or all of them
+	void prepareViscosity();
+	int solveViscosity(float dt);
+	void assemblePressure();
+	int solvePressure(float dt);
+	bool predictPressure(float dt);
+	void storeGridDelta(int axis);
+	void transferToParticles();
+	void advectParticles(float dt);
+	float sampleVelocity(int axis, const float pos[3]) const;
+};
@@ -0,0 +1,219 @@
+#include "FluidSweep.h"
+#include "FluidJobs.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static const int DefaultThreadsPerRun = 8;
+static const double DefaultMemoryFraction = 0.8;
+static const uint64_t FallbackMemoryBudget = 4ull << 30; // When physical memory cannot be queried
+
+FluidSweep::FluidSweep(FluidDatabase& database) : database(database) {
+}
+
+void FluidSweep::add(int configID) {
+	jobs.push_back({ configID, false, 0 });
+}
+
+void FluidSweep::add(int configID, unsigned seed) {
+	jobs.push_back({ configID, true, seed });
+}
+
+uint64_t FluidSweep::getPhysicalMemory() {
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	return GlobalMemoryStatusEx(&status) ? static_cast<uint64_t>(status.ullTotalPhys) : 0;
+#else
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long pageSize = sysconf(_SC_PAGE_SIZE);
+	return pages > 0 && pageSize > 0 ? static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize) : 0;
+#endif
+}
+
+bool FluidSweep::run(const Options& options, std::vector<Outcome>& outcomes, std::function<void(const Outcome&)> onFinished) {
+	const int threads = options.threads > 0 ? options.threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	const int threadsPerRun = std::min(threads, options.threadsPerRun > 0 ? options.threadsPerRun : DefaultThreadsPerRun);
+	const int slots = std::max(1, threads / threadsPerRun);
+	uint64_t budget = options.memoryBudget;
+	if (budget == 0) {
+		const uint64_t physical = getPhysicalMemory();
+		budget = physical > 0 ? static_cast<uint64_t>(physical * DefaultMemoryFraction) : FallbackMemoryBudget;
+	}
+
+	outcomes.assign(jobs.size(), Outcome());
+	for (size_t j = 0; j < jobs.size(); ++j) {
+		outcomes[j].job = jobs[j];
+		outcomes[j].skipped = false;
+		outcomes[j].succeeded = false;
+		outcomes[j].result = FluidRunner::Result();
+	}
+
+	// Pairs finished by an earlier sweep; rows without a result file are runs that never finished
+	std::set<std::pair<int, unsigned>> recorded;
+	if (options.skipRecorded) {
+		database.forEachRow("SavedSimulations", { "ConfigID", "Seed", "ResultFilePath" }, {}, FluidDatabase::QueryOptions(),
+			[&recorded](const FluidDatabase::Cursor& row) {
+				if (!row.isNull(0) && !row.isNull(1) && row.text(2)[0] != '\0')
+					recorded.insert({ static_cast<int>(row.integer(0)), static_cast<unsigned>(row.integer(1)) });
+				return true;
+			});
+	}
+
+	// Lattice Boltzmann jobs of one config differ only by seed, so up to ensembleSize of them share a
+	// run as one ensemble; every other job is a run of its own
+	const int ensembleSize = std::min(std::max(options.ensembleSize, 1), static_cast<int>(FluidLBM::MaxLanes));
+	std::vector<std::vector<size_t>> runs;
+	std::vector<uint64_t> estimate;
+	std::map<int, size_t> openEnsemble; // ConfigID -> run still taking members
+	for (size_t j = 0; j < jobs.size(); ++j) {
+		if (jobs[j].hasSeed && recorded.count({ jobs[j].configID, jobs[j].seed })) {
+			outcomes[j].skipped = true;
+			outcomes[j].succeeded = true;
+			if (onFinished)
+				onFinished(outcomes[j]);
+			continue;
+		}
+		FluidDatabase::SimulationConfig config;
+		uint64_t bytes = 0;
+		FluidSolver::Method method = FluidSolver::Method::FlipPic;
+		if (database.loadSimulationParameters(jobs[j].configID, config)) {
+			bytes = FluidRunner::estimateMemory(config);
+			FluidSolver::parseMethod(config.methodOfComputation, method);
+		}
+		if (ensembleSize > 1 && method == FluidSolver::Method::LatticeBoltzmann) {
+			auto open = openEnsemble.find(jobs[j].configID);
+			if (open != openEnsemble.end()) {
+				runs[open->second].push_back(j);
+				estimate[open->second] += bytes;
+				if (static_cast<int>(runs[open->second].size()) == ensembleSize)
+					openEnsemble.erase(open);
+				continue;
+			}
+			openEnsemble[jobs[j].configID] = runs.size();
+		}
+		runs.push_back({ j });
+		estimate.push_back(bytes);
+	}
+	std::vector<size_t> pending(runs.size());
+	for (size_t r = 0; r < runs.size(); ++r)
+		pending[r] = r;
+
+	std::mutex databaseMutex; // Serializes the shared connection
+	std::mutex mutex;         // Guards the scheduling state below
+	std::condition_variable ended;
+	std::deque<size_t> finished;
+	std::vector<std::thread> workers(runs.size());
+
+	auto execute = [&](size_t r) {
+		FluidJobs pool(threadsPerRun);
+		FluidJobs::Scope scope(pool);
+		const std::vector<size_t>& members = runs[r];
+		std::vector<std::unique_ptr<FluidRunner>> runners;
+		std::vector<bool> reused(members.size(), false);
+		auto load = [&]() {
+			std::lock_guard<std::mutex> lock(databaseMutex);
+			runners.clear();
+			for (size_t k = 0; k < members.size(); ++k) {
+				const size_t j = members[k];
+				FluidRunner::Options runOptions = options.run;
+				runOptions.overrideSeed = jobs[j].hasSeed;
+				runOptions.seed = jobs[j].seed;
+				runners.push_back(std::unique_ptr<FluidRunner>(new FluidRunner(database)));
+				outcomes[j].succeeded = runners.back()->load(jobs[j].configID, runOptions, &outcomes[j].error);
+				// An earlier run of identical inputs is returned instead of simulated again
+				reused[k] = outcomes[j].succeeded && options.run.reuseResults && runners.back()->reuse(outcomes[j].result);
+			}
+		};
+		load();
+
+		// An ensemble needs every member loaded and none reused; otherwise (or if the members do not
+		// match after all) they run one by one
+		bool together = members.size() > 1;
+		for (size_t k = 0; k < members.size() && together; ++k)
+			together = outcomes[members[k]].succeeded && !reused[k];
+		if (together) {
+			std::vector<FluidRunner*> ensemble;
+			for (const auto& runner : runners)
+				ensemble.push_back(runner.get());
+			std::string reason;
+			together = FluidRunner::simulateEnsemble(ensemble, &reason);
+			if (!together)
+				load();
+		}
+		for (size_t k = 0; k < members.size(); ++k) {
+			if (reused[k])
+				continue;
+			Outcome& outcome = outcomes[members[k]];
+			bool ok = outcome.succeeded && (together || runners[k]->simulate(&outcome.error));
+			if (ok) {
+				std::lock_guard<std::mutex> lock(databaseMutex);
+				ok = runners[k]->record(outcome.result, &outcome.error);
+			}
+			outcome.succeeded = ok;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.push_back(r);
+		ended.notify_one();
+	};
+
+	std::unique_lock<std::mutex> lock(mutex);
+	uint64_t inUse = 0;
+	int running = 0;
+	int headBypassed = 0; // Runs started ahead of pending.front() since it first failed to fit
+	bool allSucceeded = true;
+	while (!pending.empty() || running > 0) {
+		while (running < slots && !pending.empty()) {
+			size_t pick = pending.size();
+			for (size_t k = 0; k < pending.size(); ++k) {
+				if (k > 0 && headBypassed >= slots)
+					break; // Hold the slots until the head fits
+				if (inUse + estimate[pending[k]] <= budget || running == 0) {
+					pick = k;
+					break;
+				}
+			}
+			if (pick == pending.size())
+				break;
+			headBypassed = pick > 0 ? headBypassed + 1 : 0;
+			const size_t r = pending[pick];
+			pending.erase(pending.begin() + pick);
+			inUse += estimate[r];
+			++running;
+			workers[r] = std::thread(execute, r);
+		}
+
+		ended.wait(lock, [&]() { return !finished.empty(); });
+		while (!finished.empty()) {
+			const size_t r = finished.front();
+			finished.pop_front();
+			lock.unlock();
+			workers[r].join();
+			for (size_t j : runs[r]) {
+				if (!outcomes[j].succeeded)
+					allSucceeded = false;
+				if (onFinished)
+					onFinished(outcomes[j]);
+			}
+			lock.lock();
+			inUse -= estimate[r];
+			--running;
+		}
+	}
+	return allSucceeded;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "FluidDatabase.h"
+#include "FluidRunner.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Parameter sweep over SimulationConfigs: runs many (ConfigID, Seed) jobs concurrently.
+ *
+ * Runs scale poorly past a handful of threads, so instead of one wide run at a time the sweep packs
+ * several narrow ones onto the cores. Each run gets its own job pool of threadsPerRun threads (routed
+ * through FluidJobs::Scope), and at most threads / threadsPerRun runs are in flight.
+ *
+ * Admission is memory-aware: a job starts only if its FluidRunner::estimateMemory() fits in what the
+ * running jobs leave of the budget. Later, smaller jobs may start ahead of a job that does not fit,
+ * but only a bounded number of times before the sweep holds the slots for it; a job larger than the
+ * whole budget runs alone.
+ *
+ * Every finished run is recorded as a SavedSimulations row as soon as it ends, so an interrupted
+ * sweep loses only the runs in flight. Run again with the same jobs, it skips (ConfigID, Seed) pairs
+ * already recorded. Database access is serialized; the connection is shared by all runs.
+ *
+ * With run.reuseResults, a job whose inputs hash the same as an earlier run (see
+ * FluidRunner::getConfigHash) returns that run instead of simulating, so re-running unchanged configs
+ * (e.g. with skipRecorded off) only computes the ones that changed.
+ *
+ * With ensembleSize above 1, lattice Boltzmann jobs of the same config (which differ only by seed)
+ * are grouped and stepped together as one ensemble run (see FluidSolver::stepEnsemble), which raises
+ * throughput on small grids. Each job is still recorded as its own SavedSimulations row.
+ */
+class FluidSweep {
+public:
+	struct Options {
+		int threads;              // Cores to fill, 0 for all
+		int threadsPerRun;        // Thread budget of each run, 0 for min(8, threads)
+		uint64_t memoryBudget;    // Bytes all running jobs may use together, 0 for 80% of physical memory
+		bool skipRecorded;        // Skip jobs whose (ConfigID, Seed) already has a finished SavedSimulations row
+		int ensembleSize;         // Lattice Boltzmann jobs of one config stepped together, up to FluidLBM::MaxLanes; 1 for none
+		FluidRunner::Options run; // Per-run output and metadata; its seed override is set per job
+
+		Options() : threads(0), threadsPerRun(0), memoryBudget(0), skipRecorded(true), ensembleSize(1) {}
+	};
+
+	struct Job {
+		int configID;
+		bool hasSeed; // False runs with the config's own (or a random) seed and is never skipped
+		unsigned seed;
+	};
+
+	struct Outcome {
+		Job job;
+		bool skipped; // Already recorded
+		bool succeeded;
+		std::string error;
+		FluidRunner::Result result;
+	};
+
+	explicit FluidSweep(FluidDatabase& database);
+
+	void add(int configID);
+	void add(int configID, unsigned seed);
+	const std::vector<Job>& getJobs() const { return jobs; }
+
+	/**
+	 * @brief Runs every job and waits for all of them.
+	 * @param options Thread and memory budgets.
+	 * @param outcomes Receives one entry per job, in the order they were added.
+	 * @param onFinished Optional: called (one at a time, on the calling thread) as each job ends or is skipped.
+	 * @return True if no job failed.
+	 */
+	bool run(const Options& options, std::vector<Outcome>& outcomes, std::function<void(const Outcome&)> onFinished = nullptr);
+
+	// Installed physical memory in bytes, 0 if unknown
+	static uint64_t getPhysicalMemory();
+
+private:
+	FluidDatabase& database;
+	std::vector<Job> jobs;
+};
@@ -0,0 +1,130 @@
+#include "FluidTaskGraph.h"
+#include <algorithm>
+#include <chrono>
+
+FluidTaskGraph::FluidTaskGraph() : timelineEnabled(false), timed(false), wallTime(0.0), runStart(0) {
+	std::fill(lastWriter, lastWriter + 64, -1);
+}
+
+void FluidTaskGraph::clear() {
+	tasks.clear();
+	std::fill(lastWriter, lastWriter + 64, -1);
+	for (std::vector<int>& list : readers)
+		list.clear();
+	timed = false;
+}
+
+void FluidTaskGraph::depend(Task& task, int id, int dependency) {
+	if (dependency < 0 || dependency >= id)
+		return; // Only earlier tasks, which keeps the graph acyclic
+	std::vector<int>& successors = tasks[dependency].successors;
+	if (std::find(successors.begin(), successors.end(), id) != successors.end())
+		return;
+	successors.push_back(id);
+	++task.predecessors;
+}
+
+int FluidTaskGraph::add(std::function<void()> fn, const std::vector<int>& dependencies) {
+	const int id = size();
+	Task task = { "task " + std::to_string(id), std::move(fn), std::vector<int>(), 0, 0.0, 0.0, 0 };
+	for (int dependency : dependencies)
+		depend(task, id, dependency);
+	tasks.push_back(std::move(task));
+	return id;
+}
+
+int FluidTaskGraph::add(const std::string& name, Resources reads, Resources writes, std::function<void()> fn) {
+	const int id = size();
+	Task task = { name, std::move(fn), std::vector<int>(), 0, 0.0, 0.0, 0 };
+	for (int bit = 0; bit < 64; ++bit) {
+		const Resources mask = Resources(1) << bit;
+		if (!((reads | writes) & mask))
+			continue;
+		// Read after write, write after write, and write after read
+		depend(task, id, lastWriter[bit]);
+		if (writes & mask) {
+			for (int reader : readers[bit])
+				depend(task, id, reader);
+		}
+	}
+	for (int bit = 0; bit < 64; ++bit) {
+		const Resources mask = Resources(1) << bit;
+		if (writes & mask) {
+			lastWriter[bit] = id;
+			readers[bit].clear();
+		}
+		else if (reads & mask) {
+			readers[bit].push_back(id);
+		}
+	}
+	tasks.push_back(std::move(task));
+	return id;
+}
+
+double FluidTaskGraph::elapsed() const {
+	const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+	return static_cast<double>(now - runStart) * std::chrono::steady_clock::period::num / std::chrono::steady_clock::period::den;
+}
+
+void FluidTaskGraph::launch(FluidJobs& jobs, FluidJobs::Counter& counter, int task) {
+	jobs.run(counter, [this, &jobs, &counter, task]() {
+		Task& self = tasks[task];
+		if (timelineEnabled) {
+			self.thread = FluidJobs::currentThread();
+			self.start = elapsed();
+			self.fn();
+			self.end = elapsed();
+		}
+		else {
+			self.fn();
+		}
+		for (int next : self.successors) {
+			if (remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+				launch(jobs, counter, next);
+		}
+	});
+}
+
+void FluidTaskGraph::run(FluidJobs& jobs) {
+	remaining.reset(new std::atomic<int>[tasks.size()]);
+	for (size_t i = 0; i < tasks.size(); ++i)
+		remaining[i].store(tasks[i].predecessors, std::memory_order_relaxed);
+
+	runStart = std::chrono::steady_clock::now().time_since_epoch().count();
+	FluidJobs::Counter counter;
+	for (int i = 0; i < size(); ++i) {
+		if (tasks[i].predecessors == 0)
+			launch(jobs, counter, i);
+	}
+	jobs.wait(counter);
+	timed = timelineEnabled;
+	if (timed)
+		wallTime = elapsed();
+}
+
+double FluidTaskGraph::getLastParallelism() const {
+	if (!timed || wallTime <= 0.0)
+		return 0.0;
+	double busy = 0.0;
+	for (const Task& task : tasks)
+		busy += task.end - task.start;
+	return busy / wallTime;
+}
+
+void FluidTaskGraph::writeTimeline(std::ostream& out) const {
+	out << "{\"traceEvents\":[";
+	if (timed) {
+		for (size_t i = 0; i < tasks.size(); ++i) {
+			const Task& task = tasks[i];
+			out << (i ? ",\n" : "\n") << "{\"name\":\"";
+			for (char c : task.name) {
+				if (c == '"' || c == '\\')
+					out << '\\';
+				out << c;
+			}
+			out << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << task.thread
+				<< ",\"ts\":" << task.start * 1e6 << ",\"dur\":" << (task.end - task.start) * 1e6 << "}";
+		}
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
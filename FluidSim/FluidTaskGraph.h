@@ -0,0 +1,97 @@
+#pragma once
+#include "FluidJobs.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A set of tasks with dependencies, run on the job system as soon as each task's predecessors finish.
+ *
+ * Dependencies can only point at tasks added earlier, so every graph is acyclic by construction. They are
+ * either listed explicitly or inferred from declared read/write sets: a task waits for the last earlier
+ * writer of everything it touches and, for what it writes, for every earlier reader since that writer.
+ * Running the tasks in the order they were added is therefore always a valid schedule, and tasks with no
+ * conflicting accesses may run concurrently.
+ *
+ * A graph can be run any number of times. With the timeline enabled, each run records when and on which
+ * thread every task ran.
+ */
+class FluidTaskGraph {
+public:
+	// Set of resources a task accesses, one bit per resource; the bits are chosen by the caller
+	using Resources = uint64_t;
+
+	FluidTaskGraph();
+
+	/**
+	 * @brief Adds a task.
+	 * @param fn Work to run.
+	 * @param dependencies Ids of earlier tasks that must finish first.
+	 * @return Id of the new task.
+	 */
+	int add(std::function<void()> fn, const std::vector<int>& dependencies = std::vector<int>());
+
+	/**
+	 * @brief Adds a named task whose dependencies follow from what it reads and writes.
+	 * @param name Label used in the timeline.
+	 * @param reads Resources the task only reads.
+	 * @param writes Resources the task modifies (they may also be read).
+	 * @param fn Work to run.
+	 * @return Id of the new task.
+	 */
+	int add(const std::string& name, Resources reads, Resources writes, std::function<void()> fn);
+
+	void clear();
+	int size() const { return static_cast<int>(tasks.size()); }
+
+	// Runs every task once and returns when all have finished
+	void run(FluidJobs& jobs = FluidJobs::shared());
+
+	void setTimelineEnabled(bool enabled) { timelineEnabled = enabled; }
+	bool isTimelineEnabled() const { return timelineEnabled; }
+
+	/**
+	 * @brief Sum of the task durations of the last timed run over its wall time.
+	 *
+	 * 1 means the tasks ran one after the other; higher values are the average number of tasks in flight.
+	 */
+	double getLastParallelism() const;
+
+	/**
+	 * @brief Writes the last timed run in the Chrome trace event format (chrome://tracing, Perfetto).
+	 *
+	 * Every task becomes one complete event on the row of the thread that ran it, in microseconds from
+	 * the start of the run.
+	 */
+	void writeTimeline(std::ostream& out) const;
+
+private:
+	struct Task {
+		std::string name;
+		std::function<void()> fn;
+		std::vector<int> successors;
+		int predecessors;
+		// Timeline of the last run, written only by the thread running the task
+		double start, end;
+		int thread;
+	};
+
+	std::vector<Task> tasks;
+	std::unique_ptr<std::atomic<int>[]> remaining; // Unfinished predecessors per task, during run()
+
+	// Access history per resource bit, for inferring dependencies
+	int lastWriter[64];
+	std::vector<int> readers[64];
+
+	bool timelineEnabled;
+	bool timed;       // The last run recorded a timeline
+	double wallTime;  // Of the last timed run, in seconds
+	int64_t runStart; // Clock ticks at the start of the current run
+
+	void depend(Task& task, int id, int dependency);
+	void launch(FluidJobs& jobs, FluidJobs::Counter& counter, int task);
+	double elapsed() const;
+};
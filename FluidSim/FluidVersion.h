@@ -0,0 +1,7 @@
+#pragma once
+
+// Application version, shown by the GUI and recorded in SavedSimulations.Version
+#define FLUIDSIM_VERSION_STRING "0.1.000"
+
+#define FLUIDSIM_WIDEN_(text) L##text
+#define FLUIDSIM_WIDEN(text) FLUIDSIM_WIDEN_(text)
@@ -38,5 +38,50 @@ CREATE TABLE IF NOT EXISTS SavedSimulations (
     Seed INTEGER,
     Version TEXT,
     OtherMetadataJSON TEXT,  -- JSON package
+    ConfigHash TEXT,         -- SHA-256 of the normalized inputs, seed and version; equal hashes give equal results
     FOREIGN KEY (ConfigID) REFERENCES StandardSimulationConfigs(ConfigID)
-);
\ No newline at end of file
+);
+CREATE INDEX IF NOT EXISTS idx_SavedSimulations_ConfigHash ON SavedSimulations (ConfigHash);
+
+-- Checkpoints written while a simulation runs; resume from the one with the highest Step
+CREATE TABLE IF NOT EXISTS SimulationCheckpoints (
+    CheckpointID INTEGER PRIMARY KEY,
+    SimulationID INTEGER NOT NULL,
+    Step INTEGER,
+    SimulatedTime REAL,
+    FilePath TEXT NOT NULL,
+    FileSize INTEGER,
+    Checksum INTEGER,        -- CRC-32C of the file's section tables
+    FormatVersion INTEGER,
+    DateTime TEXT,
+    FOREIGN KEY (SimulationID) REFERENCES SavedSimulations(SimulationID)
+);
+
+-- Whole-domain quantities logged after solver steps, clustered by run and step for range reads
+CREATE TABLE IF NOT EXISTS SimulationMetrics (
+    SimulationID INTEGER NOT NULL,
+    Step INTEGER NOT NULL,
+    SimulatedTime REAL,
+    KineticEnergy REAL,      -- J (J/m in 2D)
+    MaxVelocity REAL,        -- m/s
+    PressureIterations INTEGER,
+    ViscosityIterations INTEGER,
+    Drag REAL,               -- Pressure force on solids along x, N (N/m in 2D)
+    Lift REAL,               -- Pressure force on solids along y
+    StepSeconds REAL,        -- Wall-clock time of the step
+    PRIMARY KEY (SimulationID, Step),
+    FOREIGN KEY (SimulationID) REFERENCES SavedSimulations(SimulationID)
+) WITHOUT ROWID;
+
+-- Result payloads stored with their run; Data is written and read in chunks through SQLite's BLOB API
+CREATE TABLE IF NOT EXISTS SimulationFrames (
+    FrameID INTEGER PRIMARY KEY,
+    SimulationID INTEGER NOT NULL,
+    Step INTEGER,
+    SimulatedTime REAL,
+    Format TEXT,             -- What Data holds, e.g. 'checkpoint' (a FluidCheckpoint file)
+    Size INTEGER,            -- Bytes in Data
+    Data BLOB,               -- Last, so reading the other columns skips the payload
+    FOREIGN KEY (SimulationID) REFERENCES SavedSimulations(SimulationID)
+);
+CREATE INDEX IF NOT EXISTS idx_SimulationFrames_SimulationID ON SimulationFrames (SimulationID, Step);